@@ -0,0 +1,742 @@
+/*
+    Headless benchmarks for MECS.
+
+    Runs a set of sample programs, and micro-benchmarks of the containers and
+    systems they sit on, and writes the results as JSON so runs can be compared
+    between releases.
+
+    Each benchmark is run a number of times to warm up (results thrown away),
+    then a number of timed repetitions. Times are reported as minimum, median and mean.
+    Allocation counts are the number of arena allocations made by one repetition.
+    The exit code is 1 if any sample program fails to load or does not run to completion.
+
+    Build with the Makefile in this folder (uses the `HEADLESS` platform).
+
+    Usage: mecsbench [--quick] [--warmup <n>] [--repeat <n>] [--samples <dir>] [--out <file>] [--trace <file>]
+           mecsbench --bridge-check [--samples <dir>]
+
+    `--bridge-check` runs no benchmarks. Instead it tests the cross-process IPC bridge (see BridgeSys.h):
+    this process runs `bridge_talker.ecs` as the bridge hub, and a forked child runs `bridge_listener.ecs`
+    in its own scheduler. The exit code is zero if the talker gets the right answer back.
+
+    `--trace` records scheduler, scope, IPC and arena events while the benchmarks run, and writes them
+    as Chrome trace JSON (see Trace.h). Only the most recent events of each thread are kept.
+    Tracing slows the run, so don't compare traced timings with untraced ones.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "Vector.h"
+#include "HashMap.h"
+#include "String.h"
+#include "ArenaAllocator.h"
+#include "MemoryManager.h"
+
+#include "TagData.h"
+#include "Serialisation.h"
+
+#include "FileSys.h"
+#include "TimingSys.h"
+#include "DisplaySys.h"
+#include "Trace.h"
+
+#include "SourceCodeTokeniser.h"
+#include "CompilerCore.h"
+#include "TagCodeInterpreter.h"
+#include "RuntimeScheduler.h"
+#include "BridgeSys.h"
+
+RegisterVectorStatics(Vec)
+RegisterVectorFor(int, Vec)
+RegisterVectorFor(char, Vec)
+RegisterVectorFor(DataTag, Vec)
+
+RegisterHashMapStatics(Map)
+RegisterHashMapFor(int, int, HashMapIntKeyHash, HashMapIntKeyCompare, Map)
+
+// Most timed repetitions of any one benchmark
+#define MAX_REPETITIONS 100
+
+// Sample programs, run from the samples folder.
+// The `bench_` programs loop over the same features as the short demos (`hashmaps`, `stringSearch`, `lists`),
+// so they run long enough to time.
+const char* SampleScripts[] = { "stressTest", "fib_rec", "bench_hashmaps", "bench_stringSearch", "bench_lists" };
+#define SAMPLE_SCRIPT_COUNT (int)(sizeof(SampleScripts) / sizeof(SampleScripts[0]))
+
+// Interpreter memory for each sample run. Values made in a loop are not freed until the program ends.
+#define SAMPLE_MEMORY (64 MEGABYTES)
+
+// Summary of repeated timings
+typedef struct TimingSummary {
+    uint64_t min;
+    uint64_t median;
+    uint64_t mean;
+} TimingSummary;
+
+// Settings from the command line
+typedef struct BenchSettings {
+    int warmup;
+    int repetitions;
+    const char* samplesPath;
+    const char* outputPath;
+    const char* tracePath;
+    bool bridgeCheck;
+} BenchSettings;
+
+//######################### Reporting #########################
+
+TimingSummary Summarise(uint64_t* samples, int count) {
+    TimingSummary result = {};
+    if (count < 1) return result;
+
+    // insertion sort: there are never many samples
+    for (int i = 1; i < count; i++) {
+        auto value = samples[i];
+        int j = i - 1;
+        while (j >= 0 && samples[j] > value) { samples[j + 1] = samples[j]; j--; }
+        samples[j + 1] = value;
+    }
+
+    uint64_t total = 0;
+    for (int i = 0; i < count; i++) total += samples[i];
+
+    result.min = samples[0];
+    result.median = (count % 2 == 1) ? samples[count / 2] : (samples[count / 2 - 1] + samples[count / 2]) / 2;
+    result.mean = total / count;
+    return result;
+}
+
+// Append an unsigned 64 bit integer as decimal
+void AppendUInt64(String* str, uint64_t value) {
+    char digits[21];
+    int i = 20;
+    digits[i] = 0;
+    do {
+        digits[--i] = '0' + (char)(value % 10);
+        value /= 10;
+    } while (value > 0);
+    StringAppend(str, digits + i);
+}
+
+void AppendJsonField(String* json, const char* name, uint64_t value) {
+    StringAppendFormat(json, "\"\x05\": ", name);
+    AppendUInt64(json, value);
+}
+
+void AppendJsonField(String* json, const char* name, double value) {
+    StringAppendFormat(json, "\"\x05\": ", name);
+    StringAppendDouble(json, value);
+}
+
+void AppendJsonField(String* json, const char* name, const char* value) {
+    StringAppendFormat(json, "\"\x05\": \"\x05\"", name, value);
+}
+
+void AppendJsonSummary(String* json, const char* name, TimingSummary summary) {
+    StringAppendFormat(json, "\"\x05\": {", name);
+    AppendJsonField(json, "min", summary.min); StringAppend(json, ", ");
+    AppendJsonField(json, "median", summary.median); StringAppend(json, ", ");
+    AppendJsonField(json, "mean", summary.mean);
+    StringAppend(json, "}");
+}
+
+// As `AppendJsonSummary`, but divided down to a per-operation figure
+void AppendJsonPerOp(String* json, const char* name, TimingSummary summary, int ops) {
+    StringAppendFormat(json, "\"\x05\": {", name);
+    AppendJsonField(json, "min", (double)summary.min / ops); StringAppend(json, ", ");
+    AppendJsonField(json, "median", (double)summary.median / ops); StringAppend(json, ", ");
+    AppendJsonField(json, "mean", (double)summary.mean / ops);
+    StringAppend(json, "}");
+}
+
+const char* StateName(ExecutionState state) {
+    switch (state) {
+    case ExecutionState::Complete: return "complete";
+    case ExecutionState::ErrorState: return "error";
+    case ExecutionState::Waiting: return "waiting-for-input";
+    case ExecutionState::IPC_Wait:
+    case ExecutionState::IPC_Ready: return "waiting-for-ipc";
+    case ExecutionState::IPC_Send: return "sending-ipc";
+    case ExecutionState::IPC_Spawn: return "spawning";
+    default: return "unknown";
+    }
+}
+
+// Write the whole of a string to an open file
+void WriteString(String* str, FILE* file) {
+    int start = 0, length = 0;
+    int index = 0;
+    const char* block;
+    while ((block = StringBlockAt(str, index, &start, &length)) != NULL) {
+        fwrite(block + (index - start), 1, length - (index - start), file);
+        index = start + length;
+    }
+}
+
+//######################### Sample programs #########################
+
+// Read and compile a program file into a new tag code vector.
+// Everything, including the working memory of the compiler, goes in the current arena.
+// Returns NULL if the file could not be read
+Vector* CompileSample(const char* fileName) {
+    auto code = StringEmpty();
+    auto path = StringNew(fileName);
+    uint64_t read = 0;
+    if (!FileLoadChunk(path, StringGetByteVector(code), 0, FILE_LOAD_ALL, &read) || read < 1) return NULL;
+
+    auto program = VecAllocate_DataTag();
+    auto syntaxTree = ParseSourceCode(MMCurrent(), code, false);
+    auto tagCode = CompileRoot(DTreeRootNode(syntaxTree), false, false);
+    TCW_AppendToVector(tagCode, program);
+    return program;
+}
+
+// Compile and run one sample program a number of times, and append its results.
+// Returns false if the program could not be read, or did not run to completion.
+bool BenchSample(BenchSettings* settings, const char* name, String* json) {
+    uint64_t compileTimes[MAX_REPETITIONS];
+    uint64_t runTimes[MAX_REPETITIONS];
+    uint64_t opcodes = 0, compileAllocations = 0, runAllocations = 0;
+    auto endState = ExecutionState::Complete;
+    bool loaded = true;
+
+    MMPush(1 MEGABYTE);
+    auto fileName = StringNew(name);
+    StringAppend(fileName, ".ecs");
+    auto cFileName = StringToCStr(fileName, MMCurrent());
+
+    int total = settings->warmup + settings->repetitions;
+    for (int rep = 0; rep < total && loaded; rep++) {
+        int slot = rep - settings->warmup;
+
+        // Compile
+        MMPush(16 MEGABYTES);
+        auto compileAllocsBefore = ArenaAllocationCount(MMCurrent());
+        auto compileStart = MonotonicNanoseconds();
+        auto program = CompileSample(cFileName);
+        auto compileEnd = MonotonicNanoseconds();
+        auto compileAllocs = ArenaAllocationCount(MMCurrent()) - compileAllocsBefore;
+        if (program == NULL) { loaded = false; MMPop(); break; }
+
+        // Run. Output is thrown away as it comes, so it does not build up in the interpreter
+        auto is = InterpAllocate(program, SAMPLE_MEMORY, NULL);
+        VecDeallocate(program);
+        auto runAllocsBefore = ArenaAllocationCount(InterpInternalMemory(is));
+        uint64_t steps = 0;
+
+        auto runStart = MonotonicNanoseconds();
+        auto result = InterpRun(is, 100000);
+        steps += result.Cycles;
+        while (result.State == ExecutionState::Paused) {
+            ReadOutput(is, NULL);
+            result = InterpRun(is, 100000);
+            steps += result.Cycles;
+        }
+        auto runEnd = MonotonicNanoseconds();
+
+        endState = result.State;
+        auto runAllocs = ArenaAllocationCount(InterpInternalMemory(is)) - runAllocsBefore;
+        InterpDeallocate(is);
+        MMPop();
+
+        if (slot < 0) continue; // warm-up
+        compileTimes[slot] = compileEnd - compileStart;
+        runTimes[slot] = runEnd - runStart;
+        opcodes = steps;
+        compileAllocations = compileAllocs;
+        runAllocations = runAllocs;
+    }
+
+    StringAppendFormat(json, "    { \"name\": \"\x05\", ", name);
+    if (!loaded) {
+        StringAppend(json, "\"ok\": false, \"state\": \"not-found\" }");
+        fprintf(stderr, "  %s: could not be read\n", name);
+        MMPop();
+        return false;
+    }
+
+    auto compile = Summarise(compileTimes, settings->repetitions);
+    auto run = Summarise(runTimes, settings->repetitions);
+    uint64_t opsPerSecond = (run.median > 0) ? (uint64_t)((double)opcodes * 1e9 / (double)run.median) : 0;
+
+    StringAppendFormat(json, "\"ok\": \x05, ", (endState == ExecutionState::Complete) ? "true" : "false");
+    AppendJsonField(json, "state", StateName(endState)); StringAppend(json, ",\n      ");
+    AppendJsonSummary(json, "compile_ns", compile); StringAppend(json, ",\n      ");
+    AppendJsonSummary(json, "run_ns", run); StringAppend(json, ",\n      ");
+    AppendJsonField(json, "opcodes", opcodes); StringAppend(json, ", ");
+    AppendJsonField(json, "opcodes_per_sec", opsPerSecond); StringAppend(json, ", ");
+    AppendJsonField(json, "ns_per_opcode", (opcodes > 0) ? (double)run.median / opcodes : 0.0); StringAppend(json, ",\n      ");
+    AppendJsonField(json, "compile_allocations", compileAllocations); StringAppend(json, ", ");
+    AppendJsonField(json, "run_allocations", runAllocations);
+    StringAppend(json, " }");
+
+    fprintf(stderr, "  %-18s %-9s run %8.2f ms, %12llu opcodes/sec\n", name, StateName(endState), run.median / 1e6, (unsigned long long)opsPerSecond);
+    MMPop();
+    return endState == ExecutionState::Complete;
+}
+
+//######################### Micro-benchmarks #########################
+
+// A micro-benchmark. `setUp` is called before each timed repetition, in a fresh arena, and its result is passed to `run`.
+// `run` does `ops` operations. Allocations made by `setUp` are not counted.
+typedef struct MicroBenchmark {
+    const char* name;
+    int ops;
+    void* (*setUp)();
+    void (*run)(void* state, int ops);
+} MicroBenchmark;
+
+// Results are fed back into here, so the compiler can't remove the work
+volatile uint64_t BenchSink;
+
+void* NoSetUp() { return NULL; }
+
+void RunVectorPushPop(void* state, int ops) {
+    auto vec = VecAllocate_int();
+    for (int i = 0; i < ops; i++) { VecPush_int(vec, i); }
+    int value = 0;
+    uint64_t sum = 0;
+    for (int i = 0; i < ops; i++) { VecPop_int(vec, &value); sum += value; }
+    VecDeallocate(vec);
+    BenchSink = sum;
+}
+
+void* SetUpVectorGet() {
+    auto vec = VecAllocate_int();
+    for (int i = 0; i < 4096; i++) { VecPush_int(vec, i); }
+    return vec;
+}
+
+void RunVectorGet(void* state, int ops) {
+    auto vec = (Vector*)state;
+    uint64_t sum = 0;
+    uint32_t index = 1;
+    for (int i = 0; i < ops; i++) {
+        index = (index * 1103515245 + 12345) & 4095; // jump around, so the index cache does not hide the lookup
+        sum += *VecGet_int(vec, index);
+    }
+    BenchSink = sum;
+}
+
+void RunHashMapPutGet(void* state, int ops) {
+    auto map = MapAllocate_int_int(64); // small, so it grows while filling
+    for (int i = 0; i < ops; i++) { MapPut_int_int(map, i * 7, i, true); }
+    uint64_t sum = 0;
+    int* value = NULL;
+    for (int i = 0; i < ops; i++) { if (MapGet_int_int(map, i * 7, &value)) sum += *value; }
+    MapDeallocate(map);
+    BenchSink = sum;
+}
+
+void RunStringAppend(void* state, int ops) {
+    auto str = StringEmpty();
+    for (int i = 0; i < ops; i++) {
+        StringAppend(str, "item ");
+        StringAppendInt32(str, i);
+        StringAppendChar(str, ';');
+    }
+    BenchSink = StringLength(str);
+    StringDeallocate(str);
+}
+
+void* SetUpStringSearch() {
+    auto str = StringEmpty();
+    for (int i = 0; i < 2000; i++) { StringAppend(str, "abcde"); }
+    StringAppend(str, "needle");
+    return str;
+}
+
+void RunStringSearch(void* state, int ops) {
+    auto str = (String*)state;
+    unsigned int position = 0;
+    uint64_t sum = 0;
+    for (int i = 0; i < ops; i++) {
+        if (StringFind(str, "needle", 0, &position)) sum += position;
+    }
+    BenchSink = sum;
+}
+
+void RunStringHash(void* state, int ops) {
+    auto str = StringNew("A string long enough to need a vector of its own for storage, so hashing walks the chunks");
+    uint64_t sum = 0;
+    for (int i = 0; i < ops; i++) {
+        StringAppendChar(str, 'x'); // changing the string drops its cached hash
+        sum += StringHash(str);
+        StringPop(str);
+    }
+    StringDeallocate(str);
+    BenchSink = sum;
+}
+
+void RunArenaAllocate(void* state, int ops) {
+    auto arena = MMCurrent();
+    void* recent[16] = {};
+    for (int i = 0; i < ops; i++) {
+        // keep a few allocations alive at once, so zones don't simply reset
+        auto slot = i & 15;
+        if (recent[slot] != NULL) ArenaDereference(arena, recent[slot]);
+        recent[slot] = ArenaAllocate(arena, 16 + (i & 127));
+    }
+    for (int i = 0; i < 16; i++) { if (recent[i] != NULL) ArenaDereference(arena, recent[i]); }
+    BenchSink = ops;
+}
+
+// A few lines of typical source, repeated to make a script for the parser benchmark
+const char* ParseSnippet =
+    "// work out a total\n"
+    "def(square x (x * x))\n"
+    "total = 0\n"
+    "i = 0\n"
+    "while ( (i < 100) (total = (total + square(i))) (set(i (i + 1))) )\n"
+    "print(\"total is \" total ', with \\'quotes\\'' 12.5 -3)\n"
+    "/* a block comment */ names = new-list('alpha' 'beta' \"gamma\")\n";
+
+void* SetUpParse() {
+    auto source = StringEmpty();
+    while (StringLength(source) < 32 KILOBYTES) { StringAppend(source, ParseSnippet); }
+    return source;
+}
+
+// Each op is one byte of source, so ns/op is the time per byte. Trees are kept, as the compiler's scratch arena keeps them.
+void RunParse(void* state, int ops) {
+    auto source = (String*)state;
+    int length = StringLength(source);
+    uint64_t nodes = 0;
+    for (int parsed = 0; parsed < ops; parsed += length) {
+        auto tree = ParseSourceCode(MMCurrent(), source, false);
+        nodes += DTreeCountChildren(tree, DTreeRootId(tree));
+    }
+    BenchSink = nodes;
+}
+
+// An interpreter holding a structure to serialise
+typedef struct SerialisationState {
+    InterpreterState* interp;
+    DataTag source;
+} SerialisationState;
+
+void* SetUpSerialisation() {
+    auto state = (SerialisationState*)ArenaAllocateAndClear(MMCurrent(), sizeof(SerialisationState));
+    auto program = VecAllocate_DataTag();
+
+    MMPush(1 MEGABYTE);
+    auto code = StringNew("return(new-map('a' 1, 'b' new-list(1 2 'x'), 'c' 'Hello, world!', 'd' 2))");
+    auto syntaxTree = ParseSourceCode(MMCurrent(), code, false);
+    auto tagCode = CompileRoot(DTreeRootNode(syntaxTree), false, false);
+    TCW_AppendToVector(tagCode, program);
+    MMPop();
+
+    state->interp = InterpAllocate(program, 1 MEGABYTE, NULL);
+    VecDeallocate(program);
+    auto result = InterpRun(state->interp, 10000);
+    state->source = result.Result;
+    return state;
+}
+
+void RunSerialisation(void* state, int ops) {
+    auto ser = (SerialisationState*)state;
+    auto arena = MMCurrent();
+    auto bytes = VecAllocate_char();
+    uint64_t sum = 0;
+    for (int i = 0; i < ops; i++) {
+        // freeze from the interpreter, then thaw into the benchmark arena
+        DataTag copy = {};
+        if (!FreezeToVector(ser->source, ser->interp, bytes)) break;
+        sum += VecLength(bytes);
+        if (!DefrostFromVector(&copy, arena, bytes)) break;
+    }
+    VecDeallocate(bytes);
+    InterpDeallocate(ser->interp); // last use of the interpreter
+    BenchSink = sum;
+}
+
+// Size of the render benchmark frame
+#define RENDER_WIDTH 640
+#define RENDER_HEIGHT 480
+
+typedef struct RenderState {
+    ScreenPtr screen;
+    ScanBuffer* buffer;
+} RenderState;
+
+void* SetUpRender() {
+    auto arena = MMCurrent();
+    auto state = (RenderState*)ArenaAllocateAndClear(arena, sizeof(RenderState));
+    state->screen = DisplaySystem_Start(arena, RENDER_WIDTH, RENDER_HEIGHT, 0, 0, 0);
+    state->buffer = DS_InitScanBuffer(state->screen, RENDER_WIDTH, RENDER_HEIGHT);
+    return state;
+}
+
+void RunRender(void* state, int ops) {
+    auto render = (RenderState*)state;
+    auto buf = render->buffer;
+    for (int frame = 0; frame < ops; frame++) {
+        // A mix of overlapping shapes, moving a little each frame
+        DS_SetBackground(buf, 1000, 20, 20, 40);
+        for (int i = 0; i < 40; i++) {
+            int x = (i * 97 + frame * 3) % RENDER_WIDTH;
+            int y = (i * 53 + frame * 2) % RENDER_HEIGHT;
+            DS_FillRect(buf, x, y, x + 60, y + 40, i, i * 6, 100, 200 - i * 4);
+            DS_FillCircle(buf, RENDER_WIDTH - x, y, 25, i + 1, 200, i * 5, 80);
+            DS_DrawLine(buf, x, y, RENDER_WIDTH - x, RENDER_HEIGHT - y, i + 2, 3, 255, 255, 255);
+        }
+        DS_RenderBuffer(buf, render->screen);
+        DS_ClearScanBuffer(buf);
+    }
+    BenchSink = (uint8_t)DisplaySystem_GetFrameBuffer(render->screen)[0];
+    DisplaySystem_Shutdown(render->screen);
+    render->screen = NULL;
+}
+
+const MicroBenchmark MicroBenchmarks[] = {
+    { "vector-push-pop",       100000, NoSetUp,            RunVectorPushPop },
+    { "vector-get",            100000, SetUpVectorGet,     RunVectorGet },
+    { "hashmap-put-get",        20000, NoSetUp,            RunHashMapPutGet },
+    { "string-append",          20000, NoSetUp,            RunStringAppend },
+    { "string-find",              500, SetUpStringSearch,  RunStringSearch },
+    { "string-hash",            20000, NoSetUp,            RunStringHash },
+    { "arena-allocate",        100000, NoSetUp,            RunArenaAllocate },
+    { "serialisation",           1000, SetUpSerialisation, RunSerialisation },
+    { "parse-source",          262144, SetUpParse,         RunParse },
+    { "ds-render-buffer",          20, SetUpRender,        RunRender },
+};
+#define MICRO_BENCHMARK_COUNT (int)(sizeof(MicroBenchmarks) / sizeof(MicroBenchmarks[0]))
+
+void BenchMicro(BenchSettings* settings, const MicroBenchmark* bench, String* json) {
+    uint64_t times[MAX_REPETITIONS];
+    uint64_t allocations = 0;
+
+    int total = settings->warmup + settings->repetitions;
+    for (int rep = 0; rep < total; rep++) {
+        MMPush(64 MEGABYTES); // a fresh arena for each repetition, so they don't interfere
+        auto state = bench->setUp();
+        auto allocsBefore = ArenaAllocationCount(MMCurrent());
+
+        auto start = MonotonicNanoseconds();
+        bench->run(state, bench->ops);
+        auto end = MonotonicNanoseconds();
+
+        auto allocs = ArenaAllocationCount(MMCurrent()) - allocsBefore;
+        MMPop();
+
+        int slot = rep - settings->warmup;
+        if (slot < 0) continue; // warm-up
+        times[slot] = end - start;
+        allocations = allocs;
+    }
+
+    auto summary = Summarise(times, settings->repetitions);
+
+    StringAppendFormat(json, "    { \"name\": \"\x05\", ", bench->name);
+    AppendJsonField(json, "ops", (uint64_t)bench->ops); StringAppend(json, ", ");
+    AppendJsonPerOp(json, "ns_per_op", summary, bench->ops); StringAppend(json, ",\n      ");
+    AppendJsonField(json, "allocations", allocations); StringAppend(json, ", ");
+    AppendJsonField(json, "allocations_per_op", (double)allocations / bench->ops);
+    StringAppend(json, " }");
+
+    fprintf(stderr, "  %-18s %10.1f ns/op, %8.3f allocations/op\n", bench->name, (double)summary.median / bench->ops, (double)allocations / bench->ops);
+}
+
+//######################### Bridge check #########################
+
+// Longest time either side of the bridge check may take
+#define BRIDGE_CHECK_MS 20000
+
+// Start a scheduler with one program
+RuntimeScheduler* StartProgram(const char* program) {
+    auto sched = RTSchedulerAllocate();
+    if (sched != NULL && !RTSchedulerAddProgram(sched, StringNew(program), NULL)) {
+        RTSchedulerDeallocate(&sched);
+        return NULL;
+    }
+    return sched;
+}
+
+// Run a scheduler joined to a bridge, until its programs end. Returns false on a fault or timeout.
+bool RunBridged(RuntimeScheduler* sched, IPCBridge* bridge, String* console) {
+    if (sched == NULL || bridge == NULL) return false;
+    RTSchedulerAttachBridge(sched, bridge);
+
+    bool ok = true;
+    uint64_t deadline = MonotonicNanoseconds() + BRIDGE_CHECK_MS * 1000000ULL;
+    while (ok && RTSchedulerRunUntilIdle(sched, 10000, console, 10) == 0) {
+        ok = MonotonicNanoseconds() < deadline;
+    }
+    return ok && RTSchedulerState(sched) == SchedulerState::Complete;
+}
+
+// The forked side: join the hub, wait for its answer so we know what it listens for, then run the listener
+int BridgeListenerProcess(const char* socketPath) {
+    StartManagedMemory();
+    MMPush(16 MEGABYTES);
+
+    IPCBridge* bridge = NULL;
+    uint64_t deadline = MonotonicNanoseconds() + BRIDGE_CHECK_MS * 1000000ULL;
+    while (bridge == NULL && MonotonicNanoseconds() < deadline) {
+        bridge = BridgeConnect(StringNew(socketPath), 0);
+        if (bridge == NULL) usleep(10000); // hub not started yet
+    }
+
+    auto target = StringEmpty();
+    const uint8_t* bytes;
+    int length;
+    while (bridge != NULL && !BridgeConnected(bridge) && MonotonicNanoseconds() < deadline) {
+        BridgeWait(bridge, 10);
+        if (BridgeReceive(bridge, target, &bytes, &length)) BridgeRelease(bridge);
+    }
+
+    auto sched = StartProgram("bridge_listener.ecs");
+    bool ok = BridgeConnected(bridge) && RunBridged(sched, bridge, NULL);
+    RTSchedulerDeallocate(&sched);
+    BridgeClose(&bridge);
+
+    MMPop();
+    ShutdownManagedMemory();
+    return ok ? 0 : 1;
+}
+
+int BridgeCheck() {
+    char socketPath[64];
+    snprintf(socketPath, sizeof(socketPath), "/tmp/mecs-bridge-check-%d.sock", (int)getpid());
+
+    auto child = fork();
+    if (child < 0) { fprintf(stderr, "Could not start the listener process\n"); return 1; }
+    if (child == 0) _exit(BridgeListenerProcess(socketPath));
+
+    StartManagedMemory();
+    MMPush(16 MEGABYTES);
+
+    // Listening only reaches other processes once they are joined, so the talker listens before the hub opens.
+    // The listener keeps trying to connect until then.
+    uint64_t start = MonotonicNanoseconds();
+    auto console = StringEmpty();
+    auto sched = StartProgram("bridge_talker.ecs");
+    if (sched != NULL) RTSchedulerRunUntilIdle(sched, 10000, console, 0);
+    auto bridge = BridgeListen(StringNew(socketPath), 0);
+    bool talked = RunBridged(sched, bridge, console);
+    RTSchedulerDeallocate(&sched);
+
+    int status = 1;
+    bool listened = (waitpid(child, &status, 0) == child) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    BridgeClose(&bridge);
+    uint64_t elapsed = (MonotonicNanoseconds() - start) / 1000000;
+
+    unsigned int position;
+    bool answered = StringFind(console, "Listener total: 1048631", 0, &position);
+    WriteString(console, stderr);
+    fprintf(stderr, "Bridge check %s in %d ms (talker %s, listener %s)\n", (talked && listened && answered) ? "passed" : "FAILED",
+        (int)elapsed, talked ? (answered ? "ok" : "wrong answer") : "failed", listened ? "ok" : "failed");
+
+    MMPop();
+    ShutdownManagedMemory();
+    return (talked && listened && answered) ? 0 : 1;
+}
+
+//######################### Driver #########################
+
+bool ReadSettings(int argc, char** argv, BenchSettings* settings) {
+    settings->warmup = 1;
+    settings->repetitions = 5;
+    settings->samplesPath = "../Samples";
+    settings->outputPath = NULL;
+    settings->tracePath = NULL;
+    settings->bridgeCheck = false;
+
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = (i + 1 < argc);
+        if (strcmp(argv[i], "--quick") == 0) { settings->warmup = 1; settings->repetitions = 2; }
+        else if (strcmp(argv[i], "--warmup") == 0 && hasValue) { settings->warmup = atoi(argv[++i]); }
+        else if (strcmp(argv[i], "--repeat") == 0 && hasValue) { settings->repetitions = atoi(argv[++i]); }
+        else if (strcmp(argv[i], "--samples") == 0 && hasValue) { settings->samplesPath = argv[++i]; }
+        else if (strcmp(argv[i], "--out") == 0 && hasValue) { settings->outputPath = argv[++i]; }
+        else if (strcmp(argv[i], "--trace") == 0 && hasValue) { settings->tracePath = argv[++i]; }
+        else if (strcmp(argv[i], "--bridge-check") == 0) { settings->bridgeCheck = true; }
+        else return false;
+    }
+
+    if (settings->warmup < 0) settings->warmup = 0;
+    if (settings->repetitions < 1) settings->repetitions = 1;
+    if (settings->repetitions > MAX_REPETITIONS) settings->repetitions = MAX_REPETITIONS;
+    return true;
+}
+
+int main(int argc, char** argv) {
+    BenchSettings settings;
+    if (!ReadSettings(argc, argv, &settings)) {
+        fprintf(stderr, "Usage: mecsbench [--quick] [--warmup <n>] [--repeat <n>] [--samples <dir>] [--out <file>] [--trace <file>]\n");
+        fprintf(stderr, "       mecsbench --bridge-check [--samples <dir>]\n");
+        return 2;
+    }
+
+    // Open the output before moving to the samples folder, so relative paths are from where we were started
+    auto output = stdout;
+    if (settings.outputPath != NULL) {
+        output = fopen(settings.outputPath, "wb");
+        if (output == NULL) { fprintf(stderr, "Could not open %s for writing\n", settings.outputPath); return 2; }
+    }
+    FILE* traceOutput = NULL;
+    if (settings.tracePath != NULL) {
+        traceOutput = fopen(settings.tracePath, "wb");
+        if (traceOutput == NULL) { fprintf(stderr, "Could not open %s for writing\n", settings.tracePath); return 2; }
+    }
+    if (chdir(settings.samplesPath) != 0) {
+        fprintf(stderr, "Could not find the samples folder at %s\n", settings.samplesPath);
+        return 2;
+    }
+    if (settings.bridgeCheck) return BridgeCheck();
+
+    StartManagedMemory();
+    MMPush(16 MEGABYTES);
+    auto json = StringEmpty();
+    if (traceOutput != NULL) TraceEnable(TRACE_ALL);
+
+    StringAppend(json, "{\n  ");
+    AppendJsonField(json, "format", (uint64_t)1); StringAppend(json, ", ");
+    AppendJsonField(json, "platform", "headless"); StringAppend(json, ", ");
+    AppendJsonField(json, "timestamp", SystemTime()); StringAppend(json, ",\n  ");
+    AppendJsonField(json, "warmup", (uint64_t)settings.warmup); StringAppend(json, ", ");
+    AppendJsonField(json, "repetitions", (uint64_t)settings.repetitions); StringAppend(json, ",\n");
+
+    fprintf(stderr, "Sample programs (%d warm-up, %d timed):\n", settings.warmup, settings.repetitions);
+    StringAppend(json, "  \"scripts\": [\n");
+    int failures = 0;
+    for (int i = 0; i < SAMPLE_SCRIPT_COUNT; i++) {
+        if (!BenchSample(&settings, SampleScripts[i], json)) failures++;
+        StringAppend(json, (i < SAMPLE_SCRIPT_COUNT - 1) ? ",\n" : "\n");
+    }
+    StringAppend(json, "  ],\n");
+
+    fprintf(stderr, "Micro-benchmarks:\n");
+    StringAppend(json, "  \"micro\": [\n");
+    for (int i = 0; i < MICRO_BENCHMARK_COUNT; i++) {
+        BenchMicro(&settings, &MicroBenchmarks[i], json);
+        StringAppend(json, (i < MICRO_BENCHMARK_COUNT - 1) ? ",\n" : "\n");
+    }
+    StringAppend(json, "  ]\n}\n");
+
+    WriteString(json, output);
+    if (output != stdout) fclose(output);
+
+    if (traceOutput != NULL) {
+        TraceEnable(0);
+        MMPush(64 MEGABYTES);
+        auto trace = StringEmpty();
+        TraceWriteChromeJson(trace);
+        WriteString(trace, traceOutput);
+        fclose(traceOutput);
+        MMPop();
+    }
+
+    MMPop();
+    ShutdownManagedMemory();
+
+    if (failures > 0) {
+        fprintf(stderr, "%d of %d sample programs did not complete\n", failures, SAMPLE_SCRIPT_COUNT);
+        return 1;
+    }
+    return 0;
+}
@@ -2,21 +2,21 @@
 #include "Vector.h"
 
 #include "RawData.h"
+#include "Trace.h"
 
 #include <stdlib.h>
 #include <stdint.h>
 
-#ifdef ARENA_DEBUG
-#include <iostream>
-#endif
+// Arenas keep a trace flag only if allocation or free tracing is built in
+#define ARENA_TRACING (TRACE_COMPILED & (TRACE_ALLOC | TRACE_FREE))
 
 // maximum number of references in a zone before we give up.
 #define ZONE_MAX_REFS 65000
 
 typedef struct Arena {
-#ifdef ARENA_DEBUG
-    // Diagnostic marker
-    bool _marked;
+#if ARENA_TRACING
+    // Set by `TraceArena`
+    bool _traced;
 #endif
 
     // Bottom of free memory (after arena management is taken up)
@@ -39,6 +39,9 @@ typedef struct Arena {
 
     // Count of available arenas. This is the limit of memory
     int _zoneCount;
+
+    // Number of successful allocations over the life of the arena
+    uint64_t _allocationCount;
 } Arena;
 
 // Create a new arena for memory management. Size is the maximum size for the whole
@@ -59,8 +62,8 @@ Arena* NewArena(size_t size) {
     result->_start = realMemory;
     result->_limit = byteOffset(realMemory, size - 1);
     
-#ifdef ARENA_DEBUG
-    result->_marked = false;
+#if ARENA_TRACING
+    result->_traced = false;
 #endif
 
     // with 64KB arenas (ushort) and 1GB of RAM, we get 16384 arenas.
@@ -96,6 +99,8 @@ void DropArena(Arena** a) {
 	*a = NULL; // kill the arena reference
     if (ptr == NULL) return;
 
+    TRACE_EVENT(TRACE_GC, "arena-drop", (int32_t)ptr->_allocationCount, (uint32_t)(uintptr_t)ptr);
+
     if (ptr->_headsPtr != NULL) { // delete contained memory
         free(ptr->_headsPtr);
         ptr->_headsPtr = NULL;
@@ -107,8 +112,8 @@ void DropArena(Arena** a) {
 }
 
 void TraceArena(Arena* a, bool traceOn) {
-#ifdef ARENA_DEBUG
-    a->_marked = traceOn;
+#if ARENA_TRACING
+    if (a != NULL) a->_traced = traceOn;
 #endif
 }
 
@@ -158,12 +163,6 @@ void* ArenaAllocate(Arena* a, size_t byteCount) {
     if (byteCount > ARENA_ZONE_SIZE) return NULL; // Invalid allocation -- beyond max size.
     if (a == NULL) return NULL;
 
-#ifdef ARENA_DEBUG
-    if (a->_marked == true) {
-        std::cout << "A@" << a->_headsPtr << ";S" << byteCount << "\n";
-    }
-#endif
-
     auto maxOff = ARENA_ZONE_SIZE - byteCount;
     auto zoneCount = a->_zoneCount;
 
@@ -181,6 +180,10 @@ void* ArenaAllocate(Arena* a, size_t byteCount) {
 
         auto oldRefs = GetRefCount(a, i);
         SetRefCount(a, i, oldRefs + 1); // increase arena ref count
+        a->_allocationCount++;
+#if TRACE_COMPILED & TRACE_ALLOC
+        if (a->_traced) TRACE_EVENT(TRACE_ALLOC, "alloc", (int32_t)byteCount, (uint32_t)(uintptr_t)a);
+#endif
 
         return byteOffset(a->_start, result + (i * ARENA_ZONE_SIZE)); // turn the offset into an absolute position
     }
@@ -220,18 +223,16 @@ bool ArenaDereference(Arena* a, void* ptr) {
     if (a == NULL) return false;
     if (ptr == NULL) return false;
 
-#ifdef ARENA_DEBUG
-    if (a->_marked == true) {
-        std::cout << "D@" << a->_headsPtr << "\n";
-    }
-#endif
-
     auto zone = ZoneForPtr(a, ptr);
     if (zone < 0) return false;
 
     auto refCount = GetRefCount(a, zone);
     if (refCount == 0) return false; // Overfree. Fix your code.
 
+#if TRACE_COMPILED & TRACE_FREE
+    if (a->_traced) TRACE_EVENT(TRACE_FREE, "free", refCount - 1, (uint32_t)(uintptr_t)a);
+#endif
+
     refCount--;
     SetRefCount(a, zone, refCount);
 
@@ -248,12 +249,6 @@ bool ArenaReference(Arena* a, void* ptr) {
     if (a == NULL) return false;
     if (ptr == NULL) return false;
 
-#ifdef ARENA_DEBUG
-    if (a->_marked == true) {
-        std::cout << "R@" << a->_headsPtr << "\n";
-    }
-#endif
-
     auto zone = ZoneForPtr(a, ptr);
     if (zone < 0) return false;
 
@@ -301,15 +296,20 @@ void ArenaGetState(Arena* a, size_t* allocatedBytes, size_t* unallocatedBytes,
 }
 
 // Get an offset into the arena for a pointer to memory
+uint64_t ArenaAllocationCount(Arena* a) {
+    if (a == NULL) return 0;
+    return a->_allocationCount;
+}
+
 uint32_t ArenaPtrToOffset(Arena* a, void* ptr) {
     if (!ArenaContainsPointer(a, ptr)) return 0;
 
     size_t base = (size_t)(a->_start);
     size_t actual = (size_t)ptr;
 
-    if (base >= actual) return 0;
+    if (base > actual) return 0;
 
-    return (actual - base) + 1; // zero is a failure case
+    return (actual - base) + 1; // zero is a failure case, so the first byte is offset 1
 }
 
 // Get a raw memory pointer from an offset into an arena
@@ -4,6 +4,7 @@
 #define arenaallocator_h
 
 #include <stdint.h>
+#include <stddef.h>
 
 // Maximum size of a single allocation
 #define ARENA_ZONE_SIZE 65535
@@ -16,9 +17,6 @@
 #define MEGABYTE * 1048576
 #define GIGABYTE * 1073741824UL
 
-// Enable diagnostics
-#define ARENA_DEBUG 1
-
 typedef struct Arena Arena;
 typedef Arena* ArenaPtr;
 
@@ -59,8 +57,11 @@ void* ArenaOffsetToPtr(Arena* a, uint32_t offset);
 // Read statistics for this Arena. Pass `NULL` for anything you're not interested in.
 void ArenaGetState(Arena* a, size_t* allocatedBytes, size_t* unallocatedBytes, int* occupiedZones, int* emptyZones, int* totalReferenceCount, size_t* largestContiguous);
 
-// Set a flag on this arena instance to help with debugging
-// The ARENA_DEBUG flag must also be defined
+// Number of successful allocations made in this arena since it was created. Includes allocations that have since been freed.
+uint64_t ArenaAllocationCount(Arena* a);
+
+// Mark this arena so its allocations and frees are traced (see Trace.h).
+// Does nothing unless `TRACE_ALLOC` or `TRACE_FREE` is built in.
 void TraceArena(Arena* a, bool traceOn);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,715 @@
+#include "BridgeSys.h"
+
+#ifdef WIN32
+
+// Not yet supported: Windows would need named pipes and file mappings in place of the socket and shared memory
+
+IPCBridge* BridgeListen(StringPtr socketPath, int ringSize) { return NULL; }
+IPCBridge* BridgeConnect(StringPtr socketPath, int ringSize) { return NULL; }
+void BridgeClose(IPCBridge** bridge) { }
+bool BridgeConnected(IPCBridge* bridge) { return false; }
+bool BridgeSubscribe(IPCBridge* bridge, StringPtr target) { return false; }
+bool BridgeWanted(IPCBridge* bridge, StringPtr target) { return false; }
+bool BridgePublish(IPCBridge* bridge, StringPtr target, VectorPtr data) { return true; }
+bool BridgeReceive(IPCBridge* bridge, StringPtr target, const uint8_t** bytes, int* length) { return false; }
+void BridgeRelease(IPCBridge* bridge) { }
+bool BridgeWait(IPCBridge* bridge, int timeoutMs) { return false; }
+
+#endif
+
+#if defined(HEADLESS) || defined(RASPI)
+
+#include "MemoryManager.h"
+#include "HashMap.h"
+#include "Trace.h"
+
+#include <atomic>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+// How long to wait for a peer to take a control packet before dropping it. Messages never wait.
+#define BRIDGE_BLOCK_MS 5000
+
+// Most processes that can connect to one hub. With the hub, each has one bit in a slot's `readers`.
+#define BRIDGE_MAX_PEERS 63
+
+// Room for a shared memory name
+#define BRIDGE_RING_NAME 48
+
+// Kinds of packet sent over the socket
+enum class PacketKind : uint8_t {
+	// Sent by the hub to a new process, after telling it what the others listen for
+	Hello = 1,
+	// "Send me messages for `target`"
+	Listen = 2,
+	// A message for `target` is in the ring called `ring`, at `offset`. Release it by clearing `reader` from its slot.
+	Message = 3,
+	// Sent by the hub: the process with the bit `reader` has gone, so it will never release what it holds
+	Gone = 4
+};
+
+// Every packet is the same size. The socket keeps packets whole, so there is no framing.
+typedef struct BridgePacket {
+	PacketKind kind;
+	uint32_t offset;
+	uint64_t reader;
+	char ring[BRIDGE_RING_NAME];
+	char target[BRIDGE_TARGET_LIMIT + 1];
+} BridgePacket;
+
+// Header of each message in a ring. The serialised data follows, padded to 8 bytes.
+typedef struct RingSlot {
+	// One bit for each process that has not released the message yet. The writer reuses the space when this is zero.
+	// The hub is bit 0, and the process at the hub's peer index `i` is bit `i + 1`. Indexes are never reused.
+	std::atomic<uint64_t> readers;
+	// Bytes of data, or `SLOT_WRAP` where the writer went back to the start of the ring
+	uint32_t length;
+} RingSlot;
+
+#define SLOT_WRAP 0xFFFFFFFFu
+
+// Slots start on multiples of this, so a wrap marker always fits at the end of the ring
+#define SLOT_ALIGN ((uint32_t)sizeof(RingSlot))
+
+// Ring space taken by a message of `length` bytes
+inline uint32_t SlotSpace(uint32_t length) {
+	return SLOT_ALIGN + ((length + SLOT_ALIGN - 1) & ~(SLOT_ALIGN - 1));
+}
+
+// Another process on the bridge. The hub has one peer per connected process. A connected process has one peer, the hub.
+typedef struct BridgePeer {
+	// -1 once the peer has gone
+	int socket;
+	// Map<StringPtr -> bool>, targets to send on to this peer
+	HashMap* listens;
+	// Map<StringPtr -> bool>, targets we have asked this peer to send to us
+	HashMap* told;
+} BridgePeer;
+
+// The ring of another process, mapped into ours
+typedef struct MappedRing {
+	char name[BRIDGE_RING_NAME];
+	uint8_t* base;
+	uint32_t size;
+} MappedRing;
+
+RegisterVectorStatics(Vec)
+RegisterVectorFor(BridgePeer, Vec)
+RegisterVectorFor(MappedRing, Vec)
+RegisterVectorFor(HashMap_KVP, Vec)
+RegisterHashMapStatics(Map)
+RegisterHashMapFor(StringPtr, bool, HashMapStringKeyHash, HashMapStringKeyCompare, Map)
+
+typedef struct IPCBridge {
+	// Holds the bridge, its peers and target names
+	Arena* memory;
+
+	bool hub;
+	bool connected;
+
+	// The hub's listening socket and its path, or -1 and NULL
+	int listener;
+	char* socketPath;
+
+	// Our own ring. Only this process writes to it. `head` is where the next message goes, `tail` is the oldest message
+	// not yet released, and `used` is the bytes between them, so a full ring can be told from an empty one.
+	char ringName[BRIDGE_RING_NAME];
+	uint8_t* ring;
+	uint32_t ringSize;
+	uint32_t head;
+	uint32_t tail;
+	uint32_t used;
+
+	// Vector<BridgePeer>, and the peer to read from first on the next receive, so no peer is starved
+	Vector* peers;
+	int nextPeer;
+
+	// Vector<MappedRing>, rings of other processes that messages have come from
+	Vector* mapped;
+
+	// Map<StringPtr -> bool>, targets our programs listen for
+	HashMap* listens;
+
+	// Message given out by the last receive, until it is released, and the bit to clear when it is
+	RingSlot* current;
+	uint64_t currentReader;
+
+	// Hub only: bits of peers that have gone, which the other processes have not been told about yet
+	uint64_t goneNews;
+} IPCBridge;
+
+// Make our ring, with a name no other bridge uses
+bool CreateRing(IPCBridge* bridge, int ringSize) {
+	static std::atomic<int> ringCount(0);
+	if (ringSize <= 0) ringSize = BRIDGE_DEFAULT_RING;
+	ringSize &= ~(int)(SLOT_ALIGN - 1);
+	if (ringSize < 4096) return false;
+
+	snprintf(bridge->ringName, BRIDGE_RING_NAME, "/mecs-bridge-%d-%d", (int)getpid(), ringCount.fetch_add(1));
+	int fd = shm_open(bridge->ringName, O_CREAT | O_EXCL | O_RDWR, 0600);
+	if (fd < 0) return false;
+
+	void* base = MAP_FAILED;
+	if (ftruncate(fd, ringSize) == 0) base = mmap(NULL, ringSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		shm_unlink(bridge->ringName);
+		return false;
+	}
+
+	bridge->ring = (uint8_t*)base;
+	bridge->ringSize = (uint32_t)ringSize;
+	return true;
+}
+
+IPCBridge* AllocateBridge(int ringSize) {
+	auto memory = NewArena(1 MEGABYTE);
+	if (memory == NULL) return NULL;
+
+	auto bridge = (IPCBridge*)ArenaAllocateAndClear(memory, sizeof(IPCBridge));
+	if (bridge == NULL) {
+		DropArena(&memory);
+		return NULL;
+	}
+
+	bridge->memory = memory;
+	bridge->listener = -1;
+	bridge->peers = VecAllocateArena_BridgePeer(memory);
+	bridge->mapped = VecAllocateArena_MappedRing(memory);
+	bridge->listens = MapAllocateArena_StringPtr_bool(16, memory);
+	if (bridge->peers == NULL || bridge->mapped == NULL || bridge->listens == NULL || !CreateRing(bridge, ringSize)) {
+		DropArena(&memory);
+		return NULL;
+	}
+	return bridge;
+}
+
+// Add a connected socket as a peer. Returns its index, or -1.
+int AddPeer(IPCBridge* bridge, int socket) {
+	auto peer = BridgePeer{ socket, NULL, NULL };
+	peer.listens = MapAllocateArena_StringPtr_bool(16, bridge->memory);
+	peer.told = MapAllocateArena_StringPtr_bool(16, bridge->memory);
+	if (peer.listens == NULL || peer.told == NULL || !VecPush_BridgePeer(bridge->peers, peer)) return -1;
+	return VecLength(bridge->peers) - 1;
+}
+
+// The bit in a slot's `readers` for one of our peers
+uint64_t PeerBit(IPCBridge* bridge, int index) {
+	return bridge->hub ? (1ull << (index + 1)) : 1ull; // a connected process's only peer is the hub
+}
+
+// Release everything a process holds in our ring, when it can no longer release them itself
+void ReleaseReader(IPCBridge* bridge, uint64_t reader) {
+	uint32_t offset = bridge->tail;
+	uint32_t remaining = bridge->used;
+	while (remaining > 0) {
+		auto slot = (RingSlot*)(bridge->ring + offset);
+		uint32_t space = (slot->length == SLOT_WRAP) ? bridge->ringSize - offset : SlotSpace(slot->length);
+		if (slot->length != SLOT_WRAP) slot->readers.fetch_and(~reader, std::memory_order_acq_rel);
+		remaining -= space;
+		offset += space;
+		if (offset >= bridge->ringSize) offset = 0;
+	}
+}
+
+// Close a peer's socket, and release what it had not. The hub also tells the other processes, on its next send or receive.
+void DropPeer(IPCBridge* bridge, int index) {
+	auto peer = VecGet_BridgePeer(bridge->peers, index);
+	if (peer == NULL || peer->socket < 0) return;
+	close(peer->socket);
+	peer->socket = -1;
+	if (!bridge->hub) bridge->connected = false;
+
+	ReleaseReader(bridge, PeerBit(bridge, index));
+	if (bridge->hub) bridge->goneNews |= PeerBit(bridge, index);
+	TRACE_EVENT(TRACE_IPC, "bridge-drop-peer", index, 0);
+}
+
+// Copy a target name into a packet. Returns false if it is too long.
+bool CopyTargetName(StringPtr target, char* dest) {
+	unsigned int length = StringLength(target);
+	if (length > BRIDGE_TARGET_LIMIT) return false;
+	for (unsigned int i = 0; i < length; i++) dest[i] = StringCharAtIndex(target, i);
+	dest[length] = 0;
+	return true;
+}
+
+// Add a name to a set of targets, if it is not already there
+bool AddTarget(IPCBridge* bridge, HashMap* set, StringPtr target) {
+	if (MapGet_StringPtr_bool(set, target, NULL)) return true;
+	return MapPut_StringPtr_bool(set, StringClone(target, bridge->memory), true, false);
+}
+
+// Send a packet to a peer. If its socket is full, either wait a while or give up at once, as `wait` says.
+// The peer is dropped if it has gone, or if it can't take the packet after waiting.
+bool SendPacket(IPCBridge* bridge, int index, BridgePacket* packet, bool wait) {
+	auto peer = VecGet_BridgePeer(bridge->peers, index);
+	if (peer == NULL || peer->socket < 0) return false;
+
+	while (true) {
+		auto sent = send(peer->socket, packet, sizeof(BridgePacket), MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (sent == (ssize_t)sizeof(BridgePacket)) return true;
+		if (sent < 0 && errno == EINTR) continue;
+		if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			if (!wait) return false; // busy, but not gone
+			struct pollfd ready = { peer->socket, POLLOUT, 0 };
+			if (poll(&ready, 1, BRIDGE_BLOCK_MS) > 0) continue;
+		}
+		DropPeer(bridge, index);
+		return false;
+	}
+}
+
+// Take one packet from a peer, if one is waiting. The peer is dropped if its socket has closed.
+bool ReadPacket(IPCBridge* bridge, int index, BridgePacket* packet) {
+	auto peer = VecGet_BridgePeer(bridge->peers, index);
+	if (peer == NULL || peer->socket < 0) return false;
+
+	while (true) {
+		auto got = recv(peer->socket, packet, sizeof(BridgePacket), MSG_DONTWAIT);
+		if (got == (ssize_t)sizeof(BridgePacket)) {
+			packet->ring[BRIDGE_RING_NAME - 1] = 0;
+			packet->target[BRIDGE_TARGET_LIMIT] = 0;
+			return true;
+		}
+		if (got < 0 && errno == EINTR) continue;
+		if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return false;
+		DropPeer(bridge, index); // closed, failed, or sent something that isn't a packet
+		return false;
+	}
+}
+
+// Ask a peer to send us messages for a target, unless we already have
+bool TellListening(IPCBridge* bridge, int index, StringPtr target) {
+	auto peer = VecGet_BridgePeer(bridge->peers, index);
+	if (peer == NULL || peer->socket < 0) return true;
+	if (MapGet_StringPtr_bool(peer->told, target, NULL)) return true;
+
+	BridgePacket packet = {};
+	packet.kind = PacketKind::Listen;
+	if (!CopyTargetName(target, packet.target)) return false;
+	if (!SendPacket(bridge, index, &packet, true)) return false;
+
+	peer = VecGet_BridgePeer(bridge->peers, index);
+	return AddTarget(bridge, peer->told, target);
+}
+
+// Ask a peer for every target in a set
+void TellAllListening(IPCBridge* bridge, int index, HashMap* set) {
+	auto entries = MapAllEntries(set); // Vector<HashMap_KVP>
+	HashMap_KVP entry;
+	while (VecPop_HashMap_KVP(entries, &entry)) {
+		TellListening(bridge, index, *((StringPtr*)entry.Key));
+	}
+	VecDeallocate(entries);
+}
+
+// True if a live peer wants messages for a target
+bool PeerWants(IPCBridge* bridge, int index, StringPtr target) {
+	auto peer = VecGet_BridgePeer(bridge->peers, index);
+	return peer != NULL && peer->socket >= 0 && MapGet_StringPtr_bool(peer->listens, target, NULL);
+}
+
+// Take in any processes waiting to connect to the hub. Each is told what everyone else listens for, then sent `Hello`.
+void AcceptPeers(IPCBridge* bridge) {
+	while (true) {
+		int socket = accept4(bridge->listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (socket < 0) return;
+
+		int index = (VecLength(bridge->peers) < BRIDGE_MAX_PEERS) ? AddPeer(bridge, socket) : -1;
+		if (index < 0) {
+			close(socket);
+			continue;
+		}
+
+		TellAllListening(bridge, index, bridge->listens);
+		for (int i = 0; i < index; i++) {
+			auto other = VecGet_BridgePeer(bridge->peers, i);
+			if (other->socket >= 0) TellAllListening(bridge, index, other->listens);
+		}
+
+		BridgePacket hello = {};
+		hello.kind = PacketKind::Hello;
+		SendPacket(bridge, index, &hello, true);
+	}
+}
+
+// Tell every process about peers that have gone since last time, so they release what those peers held in their rings
+void AnnounceGone(IPCBridge* bridge) {
+	while (bridge->goneNews != 0) {
+		BridgePacket gone = {};
+		gone.kind = PacketKind::Gone;
+		gone.reader = bridge->goneNews & (~bridge->goneNews + 1); // lowest bit
+		bridge->goneNews &= ~gone.reader;
+
+		int count = VecLength(bridge->peers);
+		for (int i = 0; i < count; i++) SendPacket(bridge, i, &gone, true); // a peer that fails is dropped, and added to the news
+	}
+}
+
+// Find a ring another process has named, mapping it in the first time
+MappedRing* MapRing(IPCBridge* bridge, const char* name) {
+	int count = VecLength(bridge->mapped);
+	for (int i = 0; i < count; i++) {
+		auto found = VecGet_MappedRing(bridge->mapped, i);
+		if (strcmp(found->name, name) == 0) return found;
+	}
+
+	int fd = shm_open(name, O_RDWR, 0);
+	if (fd < 0) return NULL;
+	struct stat info;
+	void* base = MAP_FAILED;
+	if (fstat(fd, &info) == 0 && info.st_size > 0) base = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) return NULL;
+
+	MappedRing ring = {};
+	strncpy(ring.name, name, BRIDGE_RING_NAME - 1);
+	ring.base = (uint8_t*)base;
+	ring.size = (uint32_t)info.st_size;
+	if (!VecPush_MappedRing(bridge->mapped, ring)) {
+		munmap(base, info.st_size);
+		return NULL;
+	}
+	return VecGet_MappedRing(bridge->mapped, count);
+}
+
+// Free the space of messages every reader has released, oldest first
+void ReclaimRing(IPCBridge* bridge) {
+	while (bridge->used > 0) {
+		uint32_t toEnd = bridge->ringSize - bridge->tail;
+		auto slot = (RingSlot*)(bridge->ring + bridge->tail);
+		if (slot->length == SLOT_WRAP) { // the rest of the ring was skipped
+			bridge->used -= toEnd;
+			bridge->tail = 0;
+			continue;
+		}
+		if (slot->readers.load(std::memory_order_acquire) > 0) break;
+
+		uint32_t space = SlotSpace(slot->length);
+		bridge->used -= space;
+		bridge->tail += space;
+		if (bridge->tail >= bridge->ringSize) bridge->tail = 0;
+	}
+	if (bridge->used == 0) bridge->head = bridge->tail = 0;
+}
+
+// Find space for a message at the head of our ring. Returns NULL if the ring is too full.
+RingSlot* ReserveSlot(IPCBridge* bridge, uint32_t length) {
+	ReclaimRing(bridge);
+	uint32_t space = SlotSpace(length);
+
+	if (bridge->used > 0 && bridge->head <= bridge->tail) {
+		// free space is only between head and tail
+		if (bridge->tail - bridge->head < space) return NULL;
+	} else {
+		// free space runs from head to the end, then from the start up to tail
+		uint32_t toEnd = bridge->ringSize - bridge->head;
+		if (toEnd < space) {
+			if (bridge->tail < space) return NULL;
+			auto wrap = (RingSlot*)(bridge->ring + bridge->head); // slots are aligned, so there is always room for this
+			wrap->readers.store(0);
+			wrap->length = SLOT_WRAP;
+			bridge->used += toEnd;
+			bridge->head = 0;
+		}
+	}
+
+	auto slot = (RingSlot*)(bridge->ring + bridge->head);
+	bridge->head += space;
+	bridge->used += space;
+	if (bridge->head >= bridge->ringSize) bridge->head = 0;
+	return slot;
+}
+
+// Open a Unix domain socket that keeps packets whole
+int PacketSocket(const char* path, struct sockaddr_un* address) {
+	if (strlen(path) >= sizeof(address->sun_path)) return -1;
+	memset(address, 0, sizeof(struct sockaddr_un));
+	address->sun_family = AF_UNIX;
+	strcpy(address->sun_path, path);
+	return socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+}
+
+IPCBridge* BridgeListen(StringPtr socketPath, int ringSize) {
+	if (socketPath == NULL) return NULL;
+	auto bridge = AllocateBridge(ringSize);
+	if (bridge == NULL) return NULL;
+
+	bridge->hub = true;
+	bridge->connected = true;
+	bridge->socketPath = StringToCStr(socketPath, bridge->memory);
+
+	struct sockaddr_un address;
+	bridge->listener = PacketSocket(bridge->socketPath, &address);
+	if (bridge->listener >= 0) unlink(bridge->socketPath);
+	if (bridge->listener < 0
+		|| bind(bridge->listener, (struct sockaddr*)&address, sizeof(address)) != 0
+		|| listen(bridge->listener, 16) != 0
+		|| fcntl(bridge->listener, F_SETFL, O_NONBLOCK) != 0) {
+		BridgeClose(&bridge);
+		return NULL;
+	}
+	return bridge;
+}
+
+IPCBridge* BridgeConnect(StringPtr socketPath, int ringSize) {
+	if (socketPath == NULL) return NULL;
+	auto bridge = AllocateBridge(ringSize);
+	if (bridge == NULL) return NULL;
+
+	struct sockaddr_un address;
+	int socket = PacketSocket(StringToCStr(socketPath, bridge->memory), &address);
+	if (socket >= 0 && (connect(socket, (struct sockaddr*)&address, sizeof(address)) != 0 || fcntl(socket, F_SETFL, O_NONBLOCK) != 0)) {
+		close(socket);
+		socket = -1;
+	}
+	if (socket < 0 || AddPeer(bridge, socket) < 0) {
+		if (socket >= 0) close(socket);
+		BridgeClose(&bridge);
+		return NULL;
+	}
+	return bridge;
+}
+
+void BridgeClose(IPCBridge** bridgeHandle) {
+	if (bridgeHandle == NULL || *bridgeHandle == NULL) return;
+	auto bridge = *bridgeHandle;
+
+	BridgeRelease(bridge);
+
+	int count = VecLength(bridge->peers);
+	for (int i = 0; i < count; i++) DropPeer(bridge, i);
+	if (bridge->listener >= 0) {
+		close(bridge->listener);
+		unlink(bridge->socketPath);
+	}
+
+	// Other processes keep their own mapping of our ring until they close it
+	count = VecLength(bridge->mapped);
+	for (int i = 0; i < count; i++) {
+		auto ring = VecGet_MappedRing(bridge->mapped, i);
+		munmap(ring->base, ring->size);
+	}
+	if (bridge->ring != NULL) {
+		munmap(bridge->ring, bridge->ringSize);
+		shm_unlink(bridge->ringName);
+	}
+
+	DropArena(&bridge->memory);
+	*bridgeHandle = NULL;
+}
+
+bool BridgeConnected(IPCBridge* bridge) {
+	return bridge != NULL && bridge->connected;
+}
+
+bool BridgeSubscribe(IPCBridge* bridge, StringPtr target) {
+	if (bridge == NULL || target == NULL || StringLength(target) > BRIDGE_TARGET_LIMIT) return false;
+	if (MapGet_StringPtr_bool(bridge->listens, target, NULL)) return true;
+	if (!AddTarget(bridge, bridge->listens, target)) return false;
+
+	int count = VecLength(bridge->peers);
+	for (int i = 0; i < count; i++) TellListening(bridge, i, target);
+	return true;
+}
+
+bool BridgeWanted(IPCBridge* bridge, StringPtr target) {
+	if (bridge == NULL || target == NULL) return false;
+	int count = VecLength(bridge->peers);
+	for (int i = 0; i < count; i++) {
+		if (PeerWants(bridge, i, target)) return true;
+	}
+	return false;
+}
+
+// Send a message in a ring to every peer that wants it, except the one it came from (or -1).
+// The slot must already have a reader bit for each of these peers. Peers whose sockets are full miss the message.
+void SendMessage(IPCBridge* bridge, RingSlot* slot, const char* ring, uint32_t offset, StringPtr target, int from) {
+	BridgePacket packet = {};
+	packet.kind = PacketKind::Message;
+	packet.offset = offset;
+	strncpy(packet.ring, ring, BRIDGE_RING_NAME - 1);
+	CopyTargetName(target, packet.target);
+
+	int count = VecLength(bridge->peers);
+	for (int i = 0; i < count; i++) {
+		if (i == from || !PeerWants(bridge, i, target)) continue;
+		packet.reader = PeerBit(bridge, i);
+		if (!SendPacket(bridge, i, &packet, false)) {
+			slot->readers.fetch_and(~packet.reader, std::memory_order_release); // it will never read it
+			TRACE_EVENT(TRACE_IPC, "bridge-peer-busy", i, 0);
+		}
+	}
+}
+
+// Reader bits of the peers that want messages for a target, other than `from`
+uint64_t WantingBits(IPCBridge* bridge, StringPtr target, int from) {
+	uint64_t wanting = 0;
+	int count = VecLength(bridge->peers);
+	for (int i = 0; i < count; i++) {
+		if (i != from && PeerWants(bridge, i, target)) wanting |= PeerBit(bridge, i);
+	}
+	return wanting;
+}
+
+bool BridgePublish(IPCBridge* bridge, StringPtr target, VectorPtr data) {
+	if (bridge == NULL || target == NULL || data == NULL) return false;
+
+	if (bridge->hub) AnnounceGone(bridge);
+
+	uint64_t wanting = WantingBits(bridge, target, -1);
+	if (wanting == 0) return true;
+
+	int length = VectorLength(data);
+	if (SlotSpace(length) > bridge->ringSize) {
+		TRACE_EVENT(TRACE_IPC, "bridge-too-big", length, 0);
+		return false;
+	}
+
+	// Never wait for readers in other processes to make space: a slow or stuck process must not hold up this one
+	auto slot = ReserveSlot(bridge, length);
+	if (slot == NULL) {
+		TRACE_EVENT(TRACE_IPC, "bridge-ring-full", length, bridge->used);
+		return false;
+	}
+
+	// The only copy of the data: from the sender's vector into shared memory
+	auto dest = (uint8_t*)(slot + 1);
+	int index = 0;
+	while (index < length) {
+		int first, count;
+		auto block = (uint8_t*)VectorBlockAt(data, index, &first, &count);
+		if (block == NULL) return false;
+		int skip = index - first;
+		memcpy(dest + index, block + skip, count - skip);
+		index = first + count;
+	}
+	slot->length = (uint32_t)length;
+	slot->readers.store(wanting, std::memory_order_release);
+	TRACE_EVENT(TRACE_IPC, "bridge-send", length, 0);
+
+	SendMessage(bridge, slot, bridge->ringName, (uint32_t)((uint8_t*)slot - bridge->ring), target, -1);
+	return true;
+}
+
+// Act on a packet from a peer. Returns true if it was a message for our programs.
+bool HandlePacket(IPCBridge* bridge, int index, BridgePacket* packet, StringPtr target, const uint8_t** bytes, int* length) {
+	switch (packet->kind) {
+		case PacketKind::Hello:
+			bridge->connected = true;
+			return false;
+
+		case PacketKind::Listen:
+		{
+			auto name = StringNewInArena(packet->target, bridge->memory);
+			auto peer = VecGet_BridgePeer(bridge->peers, index);
+			AddTarget(bridge, peer->listens, name);
+
+			// The hub passes messages along, so it asks everyone else for the target too
+			if (bridge->hub) {
+				int count = VecLength(bridge->peers);
+				for (int i = 0; i < count; i++) {
+					if (i != index) TellListening(bridge, i, name);
+				}
+			}
+			StringDeallocate(name);
+			return false;
+		}
+
+		case PacketKind::Message:
+		{
+			auto ring = MapRing(bridge, packet->ring);
+			if (ring == NULL || packet->offset % SLOT_ALIGN != 0 || packet->offset + sizeof(RingSlot) > ring->size) return false;
+			auto slot = (RingSlot*)(ring->base + packet->offset);
+			uint32_t size = slot->length;
+			if (size == SLOT_WRAP || packet->offset + SlotSpace(size) > ring->size) return false;
+
+			StringClear(target);
+			StringAppend(target, packet->target);
+
+			// The hub adds a reader bit for each process it passes the message to, before clearing its own
+			if (bridge->hub) {
+				uint64_t wanting = WantingBits(bridge, target, index);
+				if (wanting != 0) {
+					slot->readers.fetch_or(wanting, std::memory_order_acq_rel);
+					SendMessage(bridge, slot, packet->ring, packet->offset, target, index);
+				}
+			}
+
+			bridge->current = slot;
+			bridge->currentReader = packet->reader;
+			*bytes = (const uint8_t*)(slot + 1);
+			*length = (int)size;
+			return true;
+		}
+
+		case PacketKind::Gone:
+			if (!bridge->hub) ReleaseReader(bridge, packet->reader);
+			return false;
+
+		default:
+			return false;
+	}
+}
+
+bool BridgeReceive(IPCBridge* bridge, StringPtr target, const uint8_t** bytes, int* length) {
+	if (bridge == NULL || target == NULL || bytes == NULL || length == NULL) return false;
+	BridgeRelease(bridge);
+	if (bridge->hub) {
+		AcceptPeers(bridge);
+		AnnounceGone(bridge);
+	}
+
+	int count = VecLength(bridge->peers);
+	for (int i = 0; i < count; i++) {
+		int index = (bridge->nextPeer + i) % count;
+		BridgePacket packet;
+		while (ReadPacket(bridge, index, &packet)) {
+			if (HandlePacket(bridge, index, &packet, target, bytes, length)) {
+				bridge->nextPeer = index + 1;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+void BridgeRelease(IPCBridge* bridge) {
+	if (bridge == NULL || bridge->current == NULL) return;
+	bridge->current->readers.fetch_and(~bridge->currentReader, std::memory_order_release);
+	bridge->current = NULL;
+}
+
+bool BridgeWait(IPCBridge* bridge, int timeoutMs) {
+	if (bridge == NULL) return false;
+
+	struct pollfd sockets[BRIDGE_MAX_PEERS + 1];
+	int used = 0;
+	if (bridge->listener >= 0) sockets[used++] = { bridge->listener, POLLIN, 0 };
+	int count = VecLength(bridge->peers);
+	for (int i = 0; i < count && used <= BRIDGE_MAX_PEERS; i++) {
+		auto peer = VecGet_BridgePeer(bridge->peers, i);
+		if (peer->socket >= 0) sockets[used++] = { peer->socket, POLLIN, 0 };
+	}
+
+	if (used == 0) {
+		if (timeoutMs > 0) {
+			timespec delay = { timeoutMs / 1000, (timeoutMs % 1000) * 1000000L };
+			nanosleep(&delay, NULL);
+		}
+		return false;
+	}
+	return poll(sockets, used, (timeoutMs < 0) ? 0 : timeoutMs) > 0;
+}
+
+#endif
@@ -0,0 +1,77 @@
+#pragma once
+
+#ifndef bridgesys_h
+#define bridgesys_h
+
+#include <stdint.h>
+#include "String.h"
+#include "Vector.h"
+#include "ArenaAllocator.h"
+
+/*
+    Shares IPC targets between schedulers in different processes on the same machine.
+
+    One process is the hub, and listens on a Unix domain socket. Other processes connect to it.
+    The socket carries small packets: which targets each process has programs listening for,
+    and where to find each message. The hub passes these on, so every process hears about the others.
+
+    Message data is never sent over the socket. Each process has its own shared memory ring,
+    and a message is copied into the sender's ring once, in the serialised IPC format.
+    Receiving processes read it straight from the ring into their programs' queues,
+    then release it so the sender can reuse the space.
+
+    A process only sends a message to processes that listen for its target. Listening is learned
+    asynchronously: messages sent before another process's `listen` has reached this one are not
+    passed to it, just as a message sent before a local `listen` is not kept.
+
+    Only supported on Linux (`HEADLESS` and `RASPI`). Elsewhere, `BridgeListen` and `BridgeConnect` return NULL.
+*/
+
+typedef struct IPCBridge IPCBridge;
+
+// Ring size used if zero is given. Messages bigger than the ring stay in their own process.
+#define BRIDGE_DEFAULT_RING (16 MEGABYTES)
+
+// Longest target name that can cross the bridge. Messages for longer names stay in their own process.
+#define BRIDGE_TARGET_LIMIT 255
+
+// Start a bridge as the hub, listening for other processes on a Unix domain socket at `socketPath`.
+// Any old socket file at the path is replaced. Returns NULL if the socket or ring could not be made.
+IPCBridge* BridgeListen(StringPtr socketPath, int ringSize);
+
+// Join the bridge of a hub process listening at `socketPath`. Returns NULL if the hub could not be reached.
+// The hub's answer arrives later: see `BridgeConnected`.
+IPCBridge* BridgeConnect(StringPtr socketPath, int ringSize);
+
+// Leave the bridge. Messages this process sent that have not been read yet are lost.
+void BridgeClose(IPCBridge** bridge);
+
+// True once the hub has told a connecting process which targets others already listen for.
+// Always true for the hub. False if the hub has gone away.
+bool BridgeConnected(IPCBridge* bridge);
+
+// Tell other processes that programs in this process listen for `target`. Repeats are ignored.
+// Returns false if the name is too long to bridge, or the other processes could not be told.
+bool BridgeSubscribe(IPCBridge* bridge, StringPtr target);
+
+// True if any other process listens for `target`
+bool BridgeWanted(IPCBridge* bridge, StringPtr target);
+
+// Send a serialised message to every other process that listens for `target`.
+// Returns true without doing anything if no other process listens. Never waits: returns false, and sends nothing,
+// if the ring is full or the message is bigger than the whole ring.
+bool BridgePublish(IPCBridge* bridge, StringPtr target, VectorPtr data);
+
+// Non-blocking check for messages from other processes. Also takes in new connections and `listen` news.
+// Returns true if a message is available: `target` is filled with its name, and `bytes` and `length` give
+// the serialised data in shared memory. Call `BridgeRelease` when done with the data, before the next receive.
+bool BridgeReceive(IPCBridge* bridge, StringPtr target, const uint8_t** bytes, int* length);
+
+// Give back the message from the last `BridgeReceive`
+void BridgeRelease(IPCBridge* bridge);
+
+// Wait up to `timeoutMs` milliseconds for something to arrive from other processes.
+// Returns true if there is something to receive.
+bool BridgeWait(IPCBridge* bridge, int timeoutMs);
+
+#endif
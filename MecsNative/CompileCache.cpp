@@ -0,0 +1,516 @@
+#include "CompileCache.h"
+
+#include "MemoryManager.h"
+#include "FileSys.h"
+#include "SourceCodeTokeniser.h"
+#include "CompilerCore.h"
+#include "TagCodeReader.h"
+#include "TagCodeWriter.h"
+
+// Largest program source file we will read. Imports have the same limit in the compiler.
+#define MAX_PROGRAM_SIZE 0xFFFFF
+
+// Cache files are kept together in this directory, relative to the working directory
+#define CACHE_DIRECTORY "mecs_cache"
+
+typedef uint32_t Name;
+
+// A file that was imported when compiling a program, and a hash of its contents at the time.
+// The contents are only hashed again if the length is the same but the modified time is not.
+typedef struct ImportRecord {
+    StringPtr path;
+    uint64_t hash;
+    uint64_t modified;
+    uint32_t length;
+} ImportRecord;
+
+// One compiled program
+typedef struct CacheEntry {
+    int users;              // number of loads not yet released
+    bool outOfDate;         // true once replaced by a newer compile. Deallocated when there are no users.
+    StringPtr source;       // the whole source. Entries are found by a 32-bit hash, so a hit is only trusted if this matches.
+    Vector* code;           // Vector<DataTag>, already in machine byte order
+    HashMap* symbols;       // Map<Name -> StringPtr> of debug symbols
+    Vector* imports;        // Vector<ImportRecord>
+} CacheEntry;
+typedef CacheEntry* CacheEntryPtr;
+
+RegisterHashMapStatics(Map)
+RegisterHashMapFor(Name, CacheEntryPtr, HashMapIntKeyHash, HashMapIntKeyCompare, Map)
+RegisterHashMapFor(Name, StringPtr, HashMapIntKeyHash, HashMapIntKeyCompare, Map)
+RegisterHashMapFor(StringPtr, bool, HashMapStringKeyHash, HashMapStringKeyCompare, Map)
+
+RegisterVectorStatics(Vec)
+RegisterVectorFor(ImportRecord, Vec)
+RegisterVectorFor(CacheEntryPtr, Vec)
+RegisterVectorFor(DataTag, Vec)
+RegisterVectorFor(char, Vec)
+RegisterVectorFor(HashMap_KVP, Vec)
+
+typedef struct CompileCache {
+    // Holds the cache structure, and all entries' code and symbols
+    Arena* memory;
+
+    // Map<Name -> CacheEntryPtr>, keyed by `StringHash` of the source
+    HashMap* entries;
+
+    // Vector<CacheEntryPtr> of every entry, including out of date ones still in use
+    Vector* allEntries;
+
+    // If true, entries are also stored in files
+    bool persist;
+
+    // Load counters
+    int hits;
+    int misses;
+} CompileCache;
+
+
+CompileCache* CompileCacheAllocate(size_t memorySize, bool persist) {
+    auto memory = NewArena(memorySize);
+    if (memory == NULL) return NULL;
+
+    auto result = (CompileCache*)ArenaAllocateAndClear(memory, sizeof(CompileCache));
+    if (result == NULL) {
+        DropArena(&memory);
+        return NULL;
+    }
+
+    result->memory = memory;
+    result->entries = MapAllocateArena_Name_CacheEntryPtr(16, memory);
+    result->allEntries = VecAllocateArena_CacheEntryPtr(memory);
+    result->persist = persist;
+    result->hits = 0;
+    result->misses = 0;
+
+    if (result->entries == NULL || result->allEntries == NULL) {
+        DropArena(&memory);
+        return NULL;
+    }
+    return result;
+}
+
+void CompileCacheDeallocate(CompileCache* cache) {
+    if (cache == NULL) return;
+    auto memory = cache->memory;
+    DropArena(&memory);
+}
+
+void CompileCacheStatistics(CompileCache* cache, int* outHits, int* outMisses) {
+    if (outHits != NULL) *outHits = (cache == NULL) ? 0 : cache->hits;
+    if (outMisses != NULL) *outMisses = (cache == NULL) ? 0 : cache->misses;
+}
+
+
+// Read a whole file into a new string in the current arena. Returns NULL if it can't be read, or is too big
+String* ReadWholeFile(String* path, uint64_t limit) {
+    auto str = StringEmpty();
+    auto vec = StringGetByteVector(str);
+    uint64_t read = 0;
+    if (!FileLoadChunk(path, vec, 0, limit, &read) || read >= limit) {
+        StringDeallocate(str);
+        return NULL;
+    }
+    return str;
+}
+
+// 64-bit FNV-1a hash of a string's bytes. Only used to notice changed imports, so it need not be fast.
+uint64_t ContentHash(String* str) {
+    uint64_t hash = 14695981039346656037ull;
+    uint32_t length = StringLength(str);
+    for (uint32_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)StringCharAtIndex(str, i);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Read the hash and length of a file's contents
+bool HashFile(String* path, uint64_t limit, uint64_t* outHash, uint32_t* outLength) {
+    auto contents = ReadWholeFile(path, limit);
+    if (contents == NULL) return false;
+    *outHash = ContentHash(contents);
+    *outLength = StringLength(contents);
+    StringDeallocate(contents);
+    return true;
+}
+
+// Fill in an import record for a file as it is now
+bool RecordImport(String* path, ImportRecord* record) {
+    uint64_t length = 0;
+    if (!FileStatus(path, &length, &record->modified)) record->modified = 0;
+    if (!HashFile(path, MAX_PROGRAM_SIZE, &record->hash, &record->length)) return false;
+    if (length != record->length) record->modified = 0; // changed while we read it, so read it again next time
+    return true;
+}
+
+// Check that every import still has the contents it was compiled with.
+// Files are only read if their length is unchanged but their modified time is not.
+bool ImportsUnchanged(Vector* imports) {
+    int count = VecLength(imports);
+    for (int i = 0; i < count; i++) {
+        auto record = VecGet_ImportRecord(imports, i);
+        uint64_t length, modified;
+        if (!FileStatus(record->path, &length, &modified)) return false;
+        if (length != record->length) return false;
+        if (modified == record->modified) continue;
+
+        uint64_t hash;
+        uint32_t readLength;
+        if (!HashFile(record->path, MAX_PROGRAM_SIZE, &hash, &readLength)) return false;
+        if (hash != record->hash || readLength != record->length) return false;
+        record->modified = modified; // touched, but the same contents
+    }
+    return true;
+}
+
+// Name of a cache file: "mecs_cache/<prefix><source hash>.dat"
+String* CacheFileName(const char* prefix, uint32_t hash) {
+    auto name = StringNew(CACHE_DIRECTORY "/");
+    StringAppend(name, prefix);
+    StringAppendInt32Hex(name, hash);
+    StringAppend(name, ".dat");
+    return name;
+}
+
+// Read a whole cache file into a new byte vector in the current arena. Returns NULL if it can't be read
+Vector* ReadCacheFile(const char* prefix, uint32_t hash) {
+    auto name = CacheFileName(prefix, hash);
+    auto bytes = VecAllocate_char();
+    uint64_t read = 0;
+    bool ok = FileLoadChunk(name, bytes, 0, FILE_LOAD_ALL, &read);
+    StringDeallocate(name);
+    if (!ok) {
+        VecDeallocate(bytes);
+        return NULL;
+    }
+    return bytes;
+}
+
+// Write a byte vector to a cache file, creating the cache directory if needed.
+// This empties the vector, but does not deallocate it.
+bool WriteCacheFile(const char* prefix, uint32_t hash, Vector* bytes) {
+    auto dir = StringNew(CACHE_DIRECTORY);
+    bool made = FileMakeDirectory(dir);
+    StringDeallocate(dir);
+    if (!made) return false;
+
+    auto name = CacheFileName(prefix, hash);
+    bool ok = FileWriteAll(name, bytes);
+    StringDeallocate(name);
+    return ok;
+}
+
+// Network byte order, to match the tag code writer
+void PushUint32(Vector* v, uint32_t value) {
+    VecPush_char(v, (value >> 24) & 0xFF);
+    VecPush_char(v, (value >> 16) & 0xFF);
+    VecPush_char(v, (value >> 8) & 0xFF);
+    VecPush_char(v, (value >> 0) & 0xFF);
+}
+bool PopUint32(Vector* v, uint32_t* outValue) {
+    uint32_t result = 0;
+    char c;
+    for (int i = 0; i < 4; i++) {
+        if (!VecDequeue_char(v, &c)) return false;
+        result = (result << 8) | (uint8_t)c;
+    }
+    *outValue = result;
+    return true;
+}
+void PushUint64(Vector* v, uint64_t value) {
+    PushUint32(v, (uint32_t)(value >> 32));
+    PushUint32(v, (uint32_t)value);
+}
+bool PopUint64(Vector* v, uint64_t* outValue) {
+    uint32_t high, low;
+    if (!PopUint32(v, &high) || !PopUint32(v, &low)) return false;
+    *outValue = ((uint64_t)high << 32) | low;
+    return true;
+}
+
+// Copy a tag code byte stream into a DataTag vector, and correct the byte order
+bool ReadTagStream(Vector* stream, Vector* tags) {
+    int length = VecLength(stream);
+    if (length < 8 || length % 8 != 0) return false;
+
+    DataTag tag = {};
+    auto raw = (char*)&tag;
+    for (int i = 0; i < length; i += 8) {
+        for (int j = 0; j < 8; j++) { raw[j] = *VecGet_char(stream, i + j); }
+        if (!VecPush_DataTag(tags, tag)) return false;
+    }
+
+    uint32_t startOfCode, startOfMemory;
+    return TCR_Read(tags, &startOfCode, &startOfMemory);
+}
+
+// Copy symbols into the cache's memory
+void CopySymbols(HashMap* source, HashMap* target, Arena* strMem) {
+    auto content = MapAllEntries(source);
+
+    HashMap_KVP entry;
+    while (VecPop_HashMap_KVP(content, &entry)) {
+        auto newStr = StringClone(*(StringPtr*)entry.Value, strMem);
+        MapPut_Name_StringPtr(target, *(Name*)entry.Key, newStr, true);
+    }
+    VecDeallocate(content);
+}
+
+// Deallocate a map of symbols, and its strings
+void FreeSymbols(HashMap* symbols) {
+    if (symbols == NULL) return;
+    auto content = MapAllEntries(symbols);
+    HashMap_KVP kvp;
+    while (VecPop_HashMap_KVP(content, &kvp)) { StringDeallocate(*(StringPtr*)kvp.Value); }
+    VecDeallocate(content);
+    MapDeallocate(symbols);
+}
+
+// Deallocate an entry and everything it holds
+void FreeEntry(CompileCache* cache, CacheEntry* entry) {
+    if (entry == NULL) return;
+
+    StringDeallocate(entry->source);
+    VecDeallocate(entry->code);
+    FreeSymbols(entry->symbols);
+
+    if (entry->imports != NULL) {
+        ImportRecord record;
+        while (VecPop_ImportRecord(entry->imports, &record)) { StringDeallocate(record.path); }
+        VecDeallocate(entry->imports);
+    }
+
+    ArenaDereference(cache->memory, entry);
+}
+
+CacheEntry* NewEntry(CompileCache* cache, String* source) {
+    auto entry = (CacheEntry*)ArenaAllocateAndClear(cache->memory, sizeof(CacheEntry));
+    if (entry == NULL) return NULL;
+
+    entry->source = StringClone(source, cache->memory);
+    entry->code = VecAllocateArenaContiguous_DataTag(cache->memory);
+    entry->symbols = MapAllocateArena_Name_StringPtr(16, cache->memory);
+    entry->imports = VecAllocateArena_ImportRecord(cache->memory);
+
+    if (entry->source == NULL || entry->code == NULL || entry->symbols == NULL || entry->imports == NULL) { // cache memory is full
+        FreeEntry(cache, entry);
+        return NULL;
+    }
+    return entry;
+}
+
+// Check the source saved in a dependencies file is the same as the entry's, taking it out of the file's bytes
+bool SourceMatches(Vector* deps, String* source) {
+    uint32_t storedLength;
+    if (!PopUint32(deps, &storedLength) || storedLength != StringLength(source)) return false;
+
+    char c;
+    for (uint32_t i = 0; i < storedLength; i++) {
+        if (!VecDequeue_char(deps, &c) || c != StringCharAtIndex(source, i)) return false;
+    }
+    return true;
+}
+
+// Read the dependencies part of the cache files into an empty entry. Returns false if they are for other source,
+// or an import has changed. Format: [source length][source bytes...][import count]
+// then for each import [hash (8 bytes)][modified (8 bytes)][length][path length][path bytes...]
+bool ReadEntryDependencies(CompileCache* cache, CacheEntry* entry, Vector* deps) {
+    uint32_t importCount;
+    if (!SourceMatches(deps, entry->source)) return false; // a different program with the same hash
+    if (!PopUint32(deps, &importCount)) return false;
+
+    for (uint32_t i = 0; i < importCount; i++) {
+        ImportRecord record = {};
+        uint32_t pathLength;
+        if (!PopUint64(deps, &record.hash) || !PopUint64(deps, &record.modified)
+            || !PopUint32(deps, &record.length) || !PopUint32(deps, &pathLength)) return false;
+
+        record.path = StringEmptyInArena(cache->memory);
+        VecPush_ImportRecord(entry->imports, record);
+        char c;
+        while (pathLength-- > 0) {
+            if (!VecDequeue_char(deps, &c)) return false;
+            StringAppendChar(record.path, c);
+        }
+    }
+    return ImportsUnchanged(entry->imports);
+}
+
+// Read the files written by an earlier run into an empty entry. Returns false if they are missing or out of date.
+bool ReadEntryFiles(CompileCache* cache, CacheEntry* entry, uint32_t hash) {
+    // Dependencies file is written last, so check it first
+    auto deps = ReadCacheFile("cache_deps_", hash);
+    if (deps == NULL) return false;
+    bool current = ReadEntryDependencies(cache, entry, deps);
+    VecDeallocate(deps);
+    if (!current) return false;
+
+    auto code = ReadCacheFile("cache_code_", hash);
+    if (code == NULL) return false;
+    bool read = ReadTagStream(code, entry->code);
+    VecDeallocate(code);
+    if (!read) return false;
+
+    auto symbolBytes = ReadCacheFile("cache_symb_", hash);
+    if (symbolBytes != NULL) { // not needed to run, so carry on without
+        auto symbols = TCR_ReadSymbols(symbolBytes);
+        CopySymbols(symbols, entry->symbols, cache->memory);
+        FreeSymbols(symbols);
+        VecDeallocate(symbolBytes);
+    }
+    return true;
+}
+
+// Try to load an entry written by an earlier run. Returns NULL if there isn't one, or it is out of date.
+CacheEntry* LoadEntry(CompileCache* cache, uint32_t hash, String* source) {
+    auto entry = NewEntry(cache, source);
+    if (entry == NULL) return NULL;
+
+    if (!ReadEntryFiles(cache, entry, hash)) {
+        FreeEntry(cache, entry);
+        return NULL;
+    }
+    return entry;
+}
+
+// Write an entry to files, so later runs can skip compiling. This empties the byte vectors.
+void SaveEntry(CacheEntry* entry, uint32_t hash, Vector* codeBytes, Vector* symbolBytes) {
+    if (!WriteCacheFile("cache_code_", hash, codeBytes)) return;
+    if (!WriteCacheFile("cache_symb_", hash, symbolBytes)) return;
+
+    auto deps = VecAllocate_char();
+    uint32_t sourceLength = StringLength(entry->source);
+    PushUint32(deps, sourceLength);
+    for (uint32_t i = 0; i < sourceLength; i++) { VecPush_char(deps, StringCharAtIndex(entry->source, i)); }
+
+    int count = VecLength(entry->imports);
+    PushUint32(deps, count);
+    for (int i = 0; i < count; i++) {
+        auto record = VecGet_ImportRecord(entry->imports, i);
+        uint32_t pathLength = StringLength(record->path);
+        PushUint64(deps, record->hash);
+        PushUint64(deps, record->modified);
+        PushUint32(deps, record->length);
+        PushUint32(deps, pathLength);
+        for (uint32_t j = 0; j < pathLength; j++) { VecPush_char(deps, StringCharAtIndex(record->path, j)); }
+    }
+    WriteCacheFile("cache_deps_", hash, deps);
+    VecDeallocate(deps);
+}
+
+// Compile source code into a new cache entry. Returns NULL if it has errors, so failed compiles are never kept.
+CacheEntry* CompileEntry(CompileCache* cache, String* source, uint32_t hash) {
+    auto syntaxTree = ParseSourceCode(MMCurrent(), source, false);
+    auto parseResult = (SourceNode*)DTreeReadBody(syntaxTree, DTreeRootId(syntaxTree));
+    if (!parseResult->IsValid) return NULL;
+
+    auto includedFiles = MapAllocate_StringPtr_bool(32);
+    auto tagCode = CompileRootWithImports(DTreeRootNode(syntaxTree), false, false, includedFiles);
+    if (tagCode == NULL || TCW_HasErrors(tagCode)) return NULL;
+
+    auto entry = NewEntry(cache, source);
+    if (entry == NULL) return NULL;
+
+    // The byte stream is the on-disk format. We read it back the same way as a cached file.
+    auto symbolBytes = VecAllocate_char();
+    TCW_GetSymbolsTo(tagCode, entry->symbols, cache->memory);
+    TCW_WriteSymbolsToStream(tagCode, symbolBytes);
+
+    auto codeBytes = VecAllocate_char();
+    bool written = TCW_AppendToStream(tagCode, codeBytes) >= 0;
+    if (!written || !ReadTagStream(codeBytes, entry->code)) {
+        VecDeallocate(codeBytes);
+        VecDeallocate(symbolBytes);
+        FreeEntry(cache, entry);
+        return NULL;
+    }
+
+    // Record imports, copying the paths out of the compiler's memory
+    auto imports = MapAllEntries(includedFiles);
+    HashMap_KVP kvp;
+    while (VecPop_HashMap_KVP(imports, &kvp)) {
+        ImportRecord record = {};
+        auto path = *(StringPtr*)kvp.Key;
+        if (!RecordImport(path, &record)) continue;
+        record.path = StringClone(path, cache->memory);
+        VecPush_ImportRecord(entry->imports, record);
+    }
+    VecDeallocate(imports);
+
+    if (cache->persist) SaveEntry(entry, hash, codeBytes, symbolBytes);
+    VecDeallocate(codeBytes);
+    VecDeallocate(symbolBytes);
+    return entry;
+}
+
+void CompileCacheRelease(CompileCache* cache, Vector* code) {
+    if (cache == NULL || code == NULL) return;
+
+    int count = VecLength(cache->allEntries);
+    for (int i = 0; i < count; i++) {
+        auto entry = *VecGet_CacheEntryPtr(cache->allEntries, i);
+        if (entry->code != code) continue;
+
+        if (entry->users > 0) entry->users--;
+        if (entry->users < 1 && entry->outOfDate) {
+            // swap the last entry into this slot
+            CacheEntryPtr last = NULL;
+            VecPop_CacheEntryPtr(cache->allEntries, &last);
+            if (last != entry) VecSet_CacheEntryPtr(cache->allEntries, i, last, NULL);
+            FreeEntry(cache, entry);
+        }
+        return;
+    }
+}
+
+bool CompileCacheLoad(CompileCache* cache, String* filePath, Vector** outCode, HashMap** outSymbols) {
+    if (cache == NULL || filePath == NULL || outCode == NULL) return false;
+
+    // Everything except the entry itself is scratch data, and is dropped at the end
+    MMPush(10 MEGABYTES);
+
+    auto source = ReadWholeFile(filePath, MAX_PROGRAM_SIZE);
+    if (source == NULL) {
+        MMPop();
+        return false;
+    }
+    uint32_t hash = StringHash(source);
+
+    // Look for a compile in memory, then in files
+    CacheEntryPtr* found = NULL;
+    CacheEntry* entry = NULL;
+    if (MapGet_Name_CacheEntryPtr(cache->entries, hash, &found)
+        && StringAreEqual((*found)->source, source)
+        && ImportsUnchanged((*found)->imports)) {
+        entry = *found;
+    } else if (cache->persist) {
+        entry = LoadEntry(cache, hash, source);
+    }
+
+    if (entry != NULL) {
+        cache->hits++;
+    } else {
+        cache->misses++;
+        entry = CompileEntry(cache, source, hash);
+    }
+
+    if (entry != NULL && (found == NULL || *found != entry)) {
+        // New entry. Any old one for this source is out of date, and is deallocated when the last user releases it.
+        if (found != NULL) {
+            CacheEntry* old = *found;
+            old->outOfDate = true;
+            if (old->users < 1) CompileCacheRelease(cache, old->code);
+        }
+        MapPut_Name_CacheEntryPtr(cache->entries, hash, entry, true);
+        VecPush_CacheEntryPtr(cache->allEntries, entry);
+    }
+
+    MMPop();
+
+    if (entry == NULL) return false;
+    entry->users++;
+    *outCode = entry->code;
+    if (outSymbols != NULL) *outSymbols = entry->symbols;
+    return true;
+}
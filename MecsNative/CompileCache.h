@@ -0,0 +1,45 @@
+#pragma once
+
+#ifndef compilecache_h
+#define compilecache_h
+
+/*
+    Keeps compiled tag code, so a program that is loaded many times (like a pool of `run:` workers)
+    is only compiled once. The code is held as a read-only segment that any number of interpreters can
+    run directly (see `InterpAllocateShared`), so it is not copied for each one either.
+
+    Entries are found by a hash of the program's source, and only used if the whole source matches.
+    Each records the length, modified time and a hash of every file it imports. If any import has changed,
+    the entry is compiled again. Programs that fail to compile are not kept.
+    When persisting, entries are also written to files in the tag code and symbol formats,
+    and later runs load them with `TCR_Read` instead of compiling.
+*/
+
+#include "ArenaAllocator.h"
+#include "String.h"
+#include "Vector.h"
+#include "HashMap.h"
+
+typedef struct CompileCache CompileCache;
+typedef CompileCache* CompileCachePtr;
+
+// Allocate a new cache, with its own memory arena of `memorySize` bytes for compiled code and symbols.
+// If `persist` is true, compiled programs are written to and read from files.
+CompileCache* CompileCacheAllocate(size_t memorySize, bool persist);
+
+// Deallocate a cache, and all the code and symbols it holds
+void CompileCacheDeallocate(CompileCache* cache);
+
+// Get compiled tag code for a source file, compiling it only if there is no up-to-date cached copy.
+// `outCode` gets a Vector<DataTag> ready for `InterpAllocateShared`, and `outSymbols` (optional) gets the debug symbols.
+// Both belong to the cache, and must not be changed. Each successful load must be matched by a `CompileCacheRelease`.
+// Returns false if the file could not be read or compiled.
+bool CompileCacheLoad(CompileCache* cache, String* filePath, Vector** outCode, HashMap** outSymbols);
+
+// Release code returned by `CompileCacheLoad`. Code that is out of date is deallocated once it has no users.
+void CompileCacheRelease(CompileCache* cache, Vector* code);
+
+// Read the number of loads that were served from the cache, and the number that had to compile
+void CompileCacheStatistics(CompileCache* cache, int* outHits, int* outMisses);
+
+#endif
@@ -7,22 +7,71 @@
 #include "Vector.h"
 #include "FileSys.h"
 #include "TimingSys.h"
+#include "ThreadSys.h"
 
 // Up this if you have files over 1MB. Or write better code.
 #define MAX_IMPORT_SIZE 0xFFFFF
 
+// Memory for each imported file's syntax tree and code is sized from the file's length.
+// Compiling dense code peaks at about 128 bytes per byte of source, so this allows double.
+#define IMPORT_ARENA_BASE (1 MEGABYTE)
+#define IMPORT_ARENA_PER_BYTE 256
+
+// Most threads used to read and compile imports
+#define MAX_IMPORT_THREADS 8
+
 RegisterHashMapStatics(Map)
 RegisterHashMapFor(StringPtr, bool, HashMapStringKeyHash, HashMapStringKeyCompare, Map)
 
 RegisterDTreeStatics(DT)
 RegisterDTreeFor(SourceNode, DT)
 
+RegisterVectorStatics(Vec)
 RegisterVectorFor(char, Vec)
 RegisterVectorFor(StringPtr, Vec)
 
+// Code of part of an imported file, up to where it imports another
+typedef struct ImportPiece {
+    TagCodeCache* code;     // code of the statements before the import
+    String* importTarget;   // file imported after `code`, or NULL for the last piece
+} ImportPiece;
+
+// An imported file, read and compiled, ready to be merged into a program
+typedef struct ImportedFile {
+    String* path;           // path of the file, in the arena of the program importing it
+    Arena* memory;          // holds the syntax tree and code
+    bool ownsMemory;        // if true, `memory` is the file's own arena, dropped with the import set.
+                            // Otherwise it is the arena of the program importing it.
+    bool debug;             // compile with debug symbols
+    bool readFailed;        // true if the file could not be read
+    Vector* pieces;         // Vector<ImportPiece>, in file order
+} ImportedFile;
+typedef ImportedFile* ImportedFilePtr;
+
+RegisterVectorFor(ImportPiece, Vec)
+RegisterVectorFor(ImportedFilePtr, Vec)
+RegisterHashMapFor(StringPtr, ImportedFilePtr, HashMapStringKeyHash, HashMapStringKeyCompare, Map)
+
+typedef struct ImportSet {
+    HashMap* includedFiles; // Map<StringPtr -> bool> of files merged into the program so far (supplied by the caller)
+    HashMap* files;         // Map<StringPtr -> ImportedFilePtr> of every file read so far
+    Vector* order;          // Vector<ImportedFilePtr>, in the order the files were found
+    int threads;            // threads used to compile imports. With only one, files are compiled in the caller's arena.
+    bool debug;
+} ImportSet;
+
+ImportSet* ImportSetAllocate(HashMap* includedFiles, bool debug);
+void ImportSetDeallocate(ImportSet* imports);
+void ImportSetPrepare(ImportSet* imports, DTreeNode root);
+
 // Compile source code from a syntax tree into a tag code cache
 TagCodeCache* CompileRoot(DTreeNode root, bool debug, bool isSubprogram) {
-    if (!DTValidNode(root)) return NULL;
+    auto includedFiles = MapAllocate_StringPtr_bool(32); // used to prevent multiple includes
+    return CompileRootWithImports(root, debug, isSubprogram, includedFiles);
+}
+
+TagCodeCache* CompileRootWithImports(DTreeNode root, bool debug, bool isSubprogram, HashMap* includedFiles) {
+    if (!DTValidNode(root) || includedFiles == NULL) return NULL;
     auto wr = TCW_Allocate(MMCurrent());
 
     if (debug) {
@@ -34,11 +83,20 @@ TagCodeCache* CompileRoot(DTreeNode root, bool debug, bool isSubprogram) {
         TCW_Comment(wr, header);
     }
 
+    // Sub-programs (`eval`) can see and change the variables of the program around them, so only fold
+    CO_FoldConstants(root, !isSubprogram);
+    CO_MarkInlineCalls(root);
+
     auto parameterNames = ScopeAllocate(MMCurrent()); // renaming for local parameters
-    auto includedFiles = MapAllocate_StringPtr_bool(32); // used to prevent multiple includes
 
-    // The implementation of `Compile` is way down at the bottom
-    TCW_Merge(wr, Compile(root, 0, debug, parameterNames, includedFiles, Context::Default));
+    // Read and compile all the imports up-front, in parallel
+    auto imports = ImportSetAllocate(includedFiles, debug);
+    ImportSetPrepare(imports, root);
+
+    // The implementation of `CompileInto` is way down at the bottom
+    CompileInto(wr, root, 0, debug, parameterNames, imports, Context::Default);
+    ImportSetDeallocate(imports);
+    TCW_Optimise(wr); // peephole pass, now that all jumps are known
 
     if (isSubprogram) {
         TCW_RawToken(wr, MarkEndOfSubProgram()); // Interpreter uses this to clean up eval opcodes
@@ -48,6 +106,21 @@ TagCodeCache* CompileRoot(DTreeNode root, bool debug, bool isSubprogram) {
     return wr;
 }
 
+TagCodeCache* CompileFragment(DTreeNode root, bool debug, HashMap* includedFiles) {
+    if (!DTValidNode(root) || includedFiles == NULL) return NULL;
+    auto wr = TCW_Allocate(MMCurrent());
+    if (DTIsLeaf(root)) return wr; // nothing but whitespace and comments
+
+    CO_FoldConstants(root, false);
+
+    auto parameterNames = ScopeAllocate(MMCurrent());
+    auto imports = ImportSetAllocate(includedFiles, debug);
+    ImportSetPrepare(imports, root);
+    CompileInto(wr, root, 0, debug, parameterNames, imports, Context::Default);
+    ImportSetDeallocate(imports);
+    ScopeDeallocate(parameterNames);
+    return wr;
+}
 
 bool IsUnwrappedIdentifier(String* valueName, DTreeNode rootNode, Context compileContext) {
     //auto root = TreeReadBody_SourceNode(rootNode);
@@ -199,11 +272,8 @@ void EmitLeafNode(DTreeNode rootNode, bool debug, Scope* parameterNames, Context
     }
 }
 
-int CountRealFunctionParameters(DTreeNode node) {
-	int nodeCount = DTCountChildren(node);
-
-	if (nodeCount == 0) return 0;
-
+// Count parameters in a chain of sibling nodes, skipping chain-call extensions
+int CountRealParameters(DTreePtr tree, int childChain) {
 	// any node that is function-like, has a text of "()" [that is, it has no function name] and is NOT a scope delimiter [thus is not a leaf node]
 	// this is a chain call, and should not be counted as a function parameter.
 	// Examples:
@@ -211,9 +281,6 @@ int CountRealFunctionParameters(DTreeNode node) {
 	//     print("hello" ())           <-- 2 params
 	//     print( mymap("key") )       <-- 1 param
 	//     print( mymap("k")("sub") )  <-- 1 param
-    auto tree = node.Tree;
-	auto childChain = DTGetChildId(node);
-	
 	int filteredCount = 0;
 	while (childChain >= 0) {
 		auto nodeData = DTReadBody_SourceNode(tree, childChain);
@@ -223,6 +290,17 @@ int CountRealFunctionParameters(DTreeNode node) {
 	return filteredCount;
 }
 
+int CountRealFunctionParameters(DTreeNode node) {
+	int nodeCount = DTCountChildren(node);
+
+	if (nodeCount == 0) return 0;
+	return CountRealParameters(node.Tree, DTGetChildId(node));
+}
+
+bool CompileStatement(TagCodeCache* wr, DTreeNode node, int indent, bool debug, Scope* parameterNames, ImportSet* imports, Context compileContext);
+bool CompileStatements(TagCodeCache* wr, DTreePtr tree, int chain, int indent, bool debug, Scope* parameterNames, ImportSet* imports, Context compileContext);
+bool IsLeafNode(DTreeNode node);
+
 
 void CompileMemoryFunction(int level, bool debug, DTreeNode node, TagCodeCache* wr, Scope* parameterNames) {
     auto nodeData = DTReadBody_SourceNode(node);
@@ -251,19 +329,23 @@ void CompileMemoryFunction(int level, bool debug, DTreeNode node, TagCodeCache*
         // complex set/get, using var-as-func
         // compile out the indexes
         auto childNode = DTNode(tree, DTGetChildId(node));
-        TCW_Merge(wr, Compile(childNode, level, debug, parameterNames, NULL, Context::MemoryAccess));
+        CompileInto(wr, childNode, level, debug, parameterNames, NULL, Context::MemoryAccess);
         paramCount += targetChildCount;
     }
 
     // build a sub-tree to compile in memory-access context
     auto child = DTPivot(node);
 
-    paramCount += CountRealFunctionParameters(DTNode(tree, child));
+    // The pivot puts the values after the target's own children, so skip the indexes written above
+    auto firstValue = DTGetNthChildId(tree, child, targetChildCount);
+    if (targetChildCount > 0) paramCount += CountRealParameters(tree, firstValue);
+    else paramCount += CountRealFunctionParameters(DTNode(tree, child));
     auto childData = DTReadBody_SourceNode(tree, child);
 
     // this special case around `get` is probably an artefact of `TreePivot`
     if (!isAccessRequest || paramCount > 0) {
-        TCW_Merge(wr, Compile(DTNode(tree, child), level + 1, debug, parameterNames, NULL, context));
+        if (targetChildCount > 0) CompileStatements(wr, tree, firstValue, level + 1, debug, parameterNames, NULL, context);
+        else CompileInto(wr, DTNode(tree, child), level + 1, debug, parameterNames, NULL, context);
     }
 
     if (debug) { TCW_Comment(wr, StringNewFormat("// Memory function : '\x01'", nodeData->Text)); }
@@ -272,57 +354,219 @@ void CompileMemoryFunction(int level, bool debug, DTreeNode node, TagCodeCache*
     TCW_Memory(wr, act, childData->Text, paramCount);
 }
 
-void CompileExternalFile(int level, bool debug, DTreeNode node, TagCodeCache* wr, Scope* parameterNames, HashMap* includedFiles) {
-    //     1) Check against import list. If already done, warn and skip.
-    //     2) Read file. Fail = terminate with error
-    //     3) Compile to opcodes
-    //     4) Inject opcodes in `wr`
-    auto root = DTReadBody_SourceNode(node);
+// File named by an `import` statement, or NULL if there isn't one
+String* ImportTarget(DTreeNode node) {
+    auto firstChild = DTGetChildId(node);
+    if (firstChild < 0) return NULL;
+    return DTReadBody_SourceNode(node.Tree, firstChild)->Text;
+}
 
-    if (includedFiles == NULL) {
-        TCW_AddError(wr, StringNewFormat("Files can only be included at the root level [#\03]", root->SourceLocation));
-        return;
+ImportSet* ImportSetAllocate(HashMap* includedFiles, bool debug) {
+    auto result = (ImportSet*)ArenaAllocateAndClear(MMCurrent(), sizeof(ImportSet));
+    if (result == NULL) return NULL;
+    result->includedFiles = includedFiles;
+    result->files = MapAllocate_StringPtr_ImportedFilePtr(32);
+    result->order = VecAllocate_ImportedFilePtr();
+    result->debug = debug;
+
+    result->threads = ThreadCoreCount();
+    if (result->threads > MAX_IMPORT_THREADS) result->threads = MAX_IMPORT_THREADS;
+    return result;
+}
+
+// Drop the memory of every imported file that has its own arena. The paths are kept, as they are used in `includedFiles`
+void ImportSetDeallocate(ImportSet* imports) {
+    if (imports == NULL) return;
+    ImportedFilePtr file = NULL;
+    while (VecPop_ImportedFilePtr(imports->order, &file)) {
+        if (file->ownsMemory) DropArena(&file->memory);
+        ArenaDereference(MMCurrent(), file);
     }
+    VecDeallocate(imports->order);
+    MapDeallocate(imports->files);
+    ArenaDereference(MMCurrent(), imports);
+}
 
-    // check against import list
-    auto tree = node.Tree;
-    auto firstChild = DTGetChildId(node);
-    auto firstChildData = DTReadBody_SourceNode(tree, firstChild);
-    auto targetFile = firstChildData->Text;
+// Add a file to be read, unless it has been already. New files are also pushed onto `batch`
+void ImportSetAdd(ImportSet* imports, String* path, Vector* batch) {
+    if (path == NULL || MapGet_StringPtr_ImportedFilePtr(imports->files, path, NULL)) return;
 
-    if (MapGet_StringPtr_bool(includedFiles, targetFile, NULL)) {
-        TCW_Comment(wr, StringNewFormat("// Ignored import: '\x01'", targetFile));
+    auto file = (ImportedFile*)ArenaAllocateAndClear(MMCurrent(), sizeof(ImportedFile));
+    if (file == NULL) return;
+
+    if (imports->threads > 1) {
+        // Each file gets an arena of its own, so they can be compiled at the same time.
+        // A file that can't be found gets the smallest arena, and fails when it is read.
+        uint64_t length = 0;
+        if (!FileLength(path, &length) || length >= MAX_IMPORT_SIZE) length = 0;
+        size_t size = IMPORT_ARENA_BASE + length * IMPORT_ARENA_PER_BYTE;
+        if (size % ARENA_ZONE_SIZE != 0) size += ARENA_ZONE_SIZE - (size % ARENA_ZONE_SIZE);
+
+        file->memory = NewArena(size);
+        file->ownsMemory = true;
+    } else {
+        // Compiled one at a time on this thread, so there is no need for separate memory
+        file->memory = MMCurrent();
+        file->ownsMemory = false;
+    }
+    if (file->memory == NULL) {
+        ArenaDereference(MMCurrent(), file);
         return;
     }
+    file->path = StringClone(path); // `path` may be in another imported file's memory
+    file->debug = imports->debug;
+
+    MapPut_StringPtr_ImportedFilePtr(imports->files, file->path, file, true);
+    VecPush_ImportedFilePtr(imports->order, file);
+    VecPush_ImportedFilePtr(batch, file);
+}
+
+// Read, parse and compile one imported file (`data` is an array of `ImportedFilePtr`).
+// This can run on a worker thread, so must only change memory in the file's arena.
+void CompileImportedFile(void* data, int index) {
+    auto file = ((ImportedFilePtr*)data)[index];
+    MMPushArena(file->memory);
 
     // read into buffer
     auto inclCode = StringEmpty();
     auto buffer = StringGetByteVector(inclCode);
     uint64_t read = 0;
-    bool ok = FileLoadChunk(targetFile, buffer, 0, MAX_IMPORT_SIZE, &read);
+    bool ok = FileLoadChunk(file->path, buffer, 0, MAX_IMPORT_SIZE, &read);
     if (!ok || read >= MAX_IMPORT_SIZE) {
+        file->readFailed = true;
+        MMPopArena();
+        return;
+    }
+
+    // Parse
+    auto parsed = ParseSourceCode(file->memory, inclCode, false);
+    auto root = DTNode(parsed, DTRootId(parsed));
+    CO_FoldConstants(root, false);
+    CO_MarkInlineCalls(root);
+
+    // Compile, starting a new piece after each import. The imported files are merged in between later.
+    file->pieces = VecAllocate_ImportPiece();
+    auto parameterNames = ScopeAllocate(file->memory);
+    auto piece = ImportPiece{ TCW_Allocate(file->memory), NULL };
+
+    if (IsLeafNode(root)) {
+        CompileInto(piece.code, root, 0, file->debug, parameterNames, NULL, Context::External);
+    } else {
+        for (int chain = DTGetChildId(root); chain >= 0; chain = DTGetSiblingId(parsed, chain)) {
+            if (TCW_HasErrors(piece.code)) break;
+
+            auto node = DTNode(parsed, chain);
+            if (!IsLeafNode(node) && IsInclude(node)) {
+                piece.importTarget = ImportTarget(node);
+                VecPush_ImportPiece(file->pieces, piece);
+                piece = ImportPiece{ TCW_Allocate(file->memory), NULL };
+                continue;
+            }
+            CompileStatement(piece.code, node, 0, file->debug, parameterNames, NULL, Context::External);
+        }
+    }
+    VecPush_ImportPiece(file->pieces, piece);
+
+    MMPopArena();
+}
+
+// Read and compile every file imported by `root`, and by the files it imports.
+// Each round compiles the files found by the last, in parallel.
+void ImportSetPrepare(ImportSet* imports, DTreeNode root) {
+    if (imports == NULL || IsLeafNode(root)) return;
+
+    auto batch = VecAllocate_ImportedFilePtr();
+    for (int chain = DTGetChildId(root); chain >= 0; chain = DTGetSiblingId(root.Tree, chain)) {
+        auto node = DTNode(root.Tree, chain);
+        if (!IsLeafNode(node) && IsInclude(node)) ImportSetAdd(imports, ImportTarget(node), batch);
+    }
+
+    while (VecLength(batch) > 0) {
+        // Workers get a plain array, as even reading a vector can update it
+        int count = VecLength(batch);
+        auto files = (ImportedFilePtr*)ArenaAllocate(MMCurrent(), sizeof(ImportedFilePtr) * count);
+        if (files == NULL) break;
+        for (int i = 0; i < count; i++) { files[i] = *VecGet_ImportedFilePtr(batch, i); }
+        VecClear(batch);
+
+        ThreadRunBatch(CompileImportedFile, files, count, imports->threads);
+
+        // Files imported by this round are read in the next
+        for (int i = 0; i < count; i++) {
+            if (files[i]->readFailed) continue;
+            int pieceCount = VecLength(files[i]->pieces);
+            for (int j = 0; j < pieceCount; j++) {
+                ImportSetAdd(imports, VecGet_ImportPiece(files[i]->pieces, j)->importTarget, batch);
+            }
+        }
+        ArenaDereference(MMCurrent(), files);
+    }
+    VecDeallocate(batch);
+}
+
+// Write the code of an imported file into `wr`, with the files it imports in their places
+void MergeImport(TagCodeCache* wr, bool debug, ImportSet* imports, String* targetFile) {
+    if (targetFile == NULL) {
+        TCW_AddError(wr, StringNew("Import failed. No file name given"));
+        return;
+    }
+
+    // check against import list
+    if (MapGet_StringPtr_bool(imports->includedFiles, targetFile, NULL)) {
+        TCW_Comment(wr, StringNewFormat("// Ignored import: '\x01'", targetFile));
+        return;
+    }
+
+    ImportedFilePtr* found = NULL;
+    if (!MapGet_StringPtr_ImportedFilePtr(imports->files, targetFile, &found)) {
+        // not seen by `ImportSetPrepare`, so compile it now
+        auto batch = VecAllocate_ImportedFilePtr();
+        ImportSetAdd(imports, targetFile, batch);
+        ImportedFilePtr file = NULL;
+        if (VecPop_ImportedFilePtr(batch, &file)) CompileImportedFile(&file, 0);
+        VecDeallocate(batch);
+    }
+    if (!MapGet_StringPtr_ImportedFilePtr(imports->files, targetFile, &found) || (*found)->readFailed) {
         TCW_AddError(wr, StringNewFormat("Import failed. Can't read file '\x01'", targetFile));
         return;
     }
+    auto file = *found;
 
-    // Prevent double include
-    MapPut_StringPtr_bool(includedFiles, targetFile, true, true);
+    // Prevent double include. The key must outlive the imported file's memory.
+    MapPut_StringPtr_bool(imports->includedFiles, file->path, true, true);
 
-    // Parse and compile
-    auto parsed = ParseSourceCode(MMCurrent(), inclCode, false);
-    auto programFragment = Compile(DTNode(parsed, DTRootId(parsed)), level, debug, parameterNames, includedFiles, Context::External);
+    if (debug) { TCW_Comment(wr, StringNewFormat("// File import: '\x01'", file->path)); }
 
-    if (debug) { TCW_Comment(wr, StringNewFormat("// File import: '\x01'", targetFile)); }
+    int count = VecLength(file->pieces);
+    for (int i = 0; i < count; i++) {
+        if (TCW_HasErrors(wr)) return;
 
-    TCW_Merge(wr, programFragment);
+        auto piece = VecGet_ImportPiece(file->pieces, i);
+        TCW_Merge(wr, piece->code);
+        if (piece->importTarget != NULL && !TCW_HasErrors(wr)) MergeImport(wr, debug, imports, piece->importTarget);
+    }
 
-    if (debug) { TCW_Comment(wr, StringNewFormat("// <-- End of file import: '\x01'", targetFile)); }
+    if (debug) { TCW_Comment(wr, StringNewFormat("// <-- End of file import: '\x01'", file->path)); }
 }
 
-bool CompileConditionOrLoop(int level, bool debug, DTreeNode node, TagCodeCache* wr, Scope* parameterNames) {
-    // return true if we output a value
-    bool returns = false;
+void CompileExternalFile(int level, bool debug, DTreeNode node, TagCodeCache* wr, Scope* parameterNames, ImportSet* imports) {
+    //     1) Check against import list. If already done, warn and skip.
+    //     2) Find the file, which `ImportSetPrepare` has read and compiled. Fail = terminate with error
+    //     3) Merge its opcodes into `wr`, with those of the files it imports
+    auto root = DTReadBody_SourceNode(node);
+
+    if (imports == NULL) {
+        TCW_AddError(wr, StringNewFormat("Files can only be included at the root level [#\03]", root->SourceLocation));
+        return;
+    }
+
+    int start = TCW_Position(wr);
+    MergeImport(wr, debug, imports, ImportTarget(node));
+    TCW_ForeignSourceLines(wr, start); // lines of the imported files don't match this one
+}
 
+
+bool CompileConditionOrLoop(int level, bool debug, DTreeNode node, TagCodeCache* wr, Scope* parameterNames) {
     auto nodeData = DTReadBody_SourceNode(node);
     int nodeChildCount = DTCountChildren(node);
 
@@ -334,65 +578,43 @@ bool CompileConditionOrLoop(int level, bool debug, DTreeNode node, TagCodeCache*
     bool isLoop = StringAreEqual(nodeData->Text, "while");
     auto context = isLoop ? Context::Loop : Context::Condition;
 
-    // Split the condition and action
-
-    // build a tree for the if/while condition
-    auto condition = TreeAllocate_SourceNode(MMCurrent());
-    auto condData = TreeReadBody_SourceNode(condition);
-    condData->Text = StringNew("()");
-    condData->SourceLocation = condData->SourceLocation;
-
-    // Copy to top of the condition call:
-    auto crbod = TreeReadBody_SourceNode(TreeChild(node)); // like a '=' call
-    auto call = TreeAddChild_SourceNode(condition, crbod);
-    // add the rest of the condition code:
-    TreeAppendNode(call, TreeChild(TreeChild(node)));
-
-    // build a tree for the if/while body
+    // The first child is the if/while condition, and the rest are the body
+    auto tree = node.Tree;
+    auto condition = DTGetChildId(node);
     int topOfBlock = TCW_Position(wr) - 1;
-    auto body = TreeAllocate_SourceNode(MMCurrent());
-    auto bodyData = TreeReadBody_SourceNode(body);
-    bodyData->Text = StringNew("()");
-    bodyData->SourceLocation = bodyData->SourceLocation;
-
-    auto chain = TreeSibling(TreeChild(node));
-    TreeAppendNode(body, chain);
-
-    auto compiledBody = Compile(body, level + 1, debug, parameterNames, NULL, context);
-    returns |= TCW_ReturnsValues(compiledBody);
-    int opCodeCount = TCW_OpCodeCount(compiledBody); // how far to jump over the body
-    if (isLoop) opCodeCount++; // also skip the end unconditional jump
 
     if (debug) {
-        TCW_Comment(wr, StringNewFormat( "// Compare condition for : '\x01', If false, skip \x02 element(s)", nodeData->Text, opCodeCount ));
+        TCW_Comment(wr, StringNewFormat("// Compare condition for : '\x01', If false, skip to end", nodeData->Text));
     }
 
-    if (CO_IsSimpleComparsion(condition, opCodeCount)) {
+    // The jump distance is written as 0, and patched once the body is written
+    if (CO_IsSimpleComparsion(&node, 0)) {
         // output just the arguments
         CmpOp cmpOp;
         uint16_t argCount;
 
-        auto argNodes = CO_ReadSimpleComparison(condition, &cmpOp, &argCount);
+        auto argNodes = CO_ReadSimpleComparison(&node, &cmpOp, &argCount);
         if (!DTValidNode(argNodes)) {
             TCW_AddError(wr, StringNew("Simple comparison optimisation is faulty. Inspect pre-check."));
             return false;
         }
-        
-        auto conditionArgs = Compile(argNodes, level + 1, debug, parameterNames, NULL, context);
-        TCW_Merge(wr, conditionArgs);
-        TCW_CompoundCompareJump(wr, cmpOp, argCount, opCodeCount);
-    } else {
-        auto conditionCode = Compile(condition, level + 1, debug, parameterNames, NULL, context);
 
+        CompileInto(wr, argNodes, level + 1, debug, parameterNames, NULL, context);
+        TCW_CompoundCompareJump(wr, cmpOp, argCount, 0);
+    } else {
         if (debug) { TCW_Comment(wr, StringNewFormat("// Condition for : '\x01'", nodeData->Text)); }
 
-        TCW_Merge(wr, conditionCode);
-        TCW_CompareJump(wr, opCodeCount);
+        CompileStatement(wr, DTNode(tree, condition), level + 1, debug, parameterNames, NULL, context);
+        TCW_CompareJump(wr, 0);
     }
+    int jumpPosition = TCW_Position(wr) - 1;
 
-    TCW_Merge(wr, compiledBody);
+    bool returns = CompileStatements(wr, tree, DTGetSiblingId(tree, condition), level + 1, debug, parameterNames, NULL, context);
 
     if (debug) { TCW_Comment(wr, StringNewFormat("// End : \x01", nodeData->Text)); }
+
+    // skip the body, and the jump back up if this is a loop
+    TCW_PatchCompareJump(wr, jumpPosition, isLoop ? 1 : 0);
     if (isLoop) {
         int distance = TCW_Position(wr) - topOfBlock;
         TCW_UnconditionalJump(wr, distance);
@@ -412,10 +634,10 @@ bool AllChildrenAreLeaves(DTreeNode node) {
 
 
 void CompileFunctionDefinition(int level, bool debug, DTreeNode node, TagCodeCache* wr, Scope* parameterNames) {
-    // 1) Compile the func to a temporary string
-    // 2) Inject a new 'def' op-code, that names the function and does an unconditional jump over it.
-    // 3) Inject the compiled func
-    // 4) Inject a new 'return' op-code
+    // 1) Write a new 'def' op-code, that names the function and does an unconditional jump over it.
+    // 2) Compile the func after it
+    // 3) Patch the 'def' with the length of the func
+    // 4) Write a new 'return' op-code
 
     auto tree = node.Tree;
     auto nodeData = DTReadBody_SourceNode(node);
@@ -468,17 +690,17 @@ void CompileFunctionDefinition(int level, bool debug, DTreeNode node, TagCodeCac
 
     ParameterPositions(parameterNames, DTNode(tree, definitionNode), wr);
 
-    auto subroutine = Compile(DTNode(tree, bodyNode), level, debug, parameterNames, NULL, Context::Default);
-    int tokenCount = TCW_OpCodeCount(subroutine);
-
     if (debug) {
         TCW_Comment(wr, StringNewFormat("// Function definition : '\x01' with \x02 parameter(s)", functionName, argCount));
     }
 
-    TCW_FunctionDefine(wr, functionName, argCount, tokenCount);
-    TCW_Merge(wr, subroutine);
+    TCW_FunctionDefine(wr, functionName, argCount, 0);
+    int definePosition = TCW_Position(wr) - 1;
+
+    bool returnsValues = CompileInto(wr, DTNode(tree, bodyNode), level, debug, parameterNames, NULL, Context::Default);
+    TCW_PatchFunctionDefine(wr, definePosition);
 
-    if (TCW_ReturnsValues(subroutine)) {
+    if (returnsValues) {
         // Add an invalid return opcode. This will show an error message.
         TCW_InvalidReturn(wr);
     } else {
@@ -492,18 +714,54 @@ void CompileFunctionDefinition(int level, bool debug, DTreeNode node, TagCodeCac
     //   a jump-to-absolute-position by return stack & pop
 }
 
+// Write the body of a small function in place of a call to it (see `CO_MarkInlineCalls`)
+void CompileInlineCall(int level, bool debug, TagCodeCache* wr, DTreeNode node, Scope* parameterNames) {
+    auto nodeData = DTReadBody_SourceNode(node);
+    auto definition = nodeData->InlineDefinition;
+    auto defTree = definition.Tree;
+
+    // Arguments are evaluated as for a normal call, then stored in slots that stand in for the parameters
+    CompileInto(wr, node, level + 1, debug, parameterNames, NULL, Context::Default);
+    if (debug) { TCW_Comment(wr, StringNewFormat("// Inlined function : '\x01'", nodeData->Text)); }
+
+    auto paramList = DTGetChildId(definition);
+    int paramCount = DTCountChildren(defTree, paramList);
+
+    for (int i = paramCount - 1; i >= 0; i--) { // last argument is on the top of the stack
+        TCW_Memory(wr, 's', ScopeNameForInlineSlot(i));
+    }
+
+    ScopePush(parameterNames, NULL);
+    int i = 0;
+    for (int param = DTGetChildId(defTree, paramList); param >= 0; param = DTGetSiblingId(defTree, param), i++) {
+        auto paramData = DTReadBody_SourceNode(defTree, param);
+        auto slot = ScopeNameForInlineSlot(i);
+
+        ScopeSetLocal(parameterNames, GetCrushedName(paramData->Text), EncodeVariableRef(slot));
+        TCW_AddSymbol(wr, slot, StringNewFormat("inline[\x02]", i));
+    }
+
+    // The body is `( return(expr) )`. Compiling the `return` node writes just `expr`.
+    auto returnNode = DTGetChildId(defTree, DTGetSiblingId(defTree, paramList));
+    CompileInto(wr, DTNode(defTree, returnNode), level + 1, debug, parameterNames, NULL, Context::Default);
+    ScopeDrop(parameterNames);
+}
+
 bool CompileFunctionCall(int level, bool debug, TagCodeCache* wr, DTreeNode node, Scope* parameterNames) {
     auto nodeData = DTReadBody_SourceNode(node);
     auto funcName = nodeData->Text;
 
     if (NeedsDesugaring(funcName)) {
         auto newnode = DesugarProcessNode(funcName, parameterNames, node, wr);
-        auto frag = Compile(newnode, level + 1, debug, parameterNames, NULL, Context::Default);
-        TCW_Merge(wr, frag);
-        return  TCW_ReturnsValues(frag);
+        return CompileInto(wr, newnode, level + 1, debug, parameterNames, NULL, Context::Default);
     }
 
-    TCW_Merge(wr, Compile(node, level + 1, debug, parameterNames, NULL, Context::Default));
+    if (nodeData->InlineDefinition.Tree != NULL) {
+        CompileInlineCall(level, debug, wr, node, parameterNames);
+        return false;
+    }
+
+    CompileInto(wr, node, level + 1, debug, parameterNames, NULL, Context::Default);
 
     int nodeChildCount = CountRealFunctionParameters(node);
     if (debug) { TCW_Comment(wr, StringNewFormat("// Function : '\x01' with \x02 parameter(s)", funcName, nodeChildCount)); }
@@ -524,43 +782,52 @@ bool IsLeafNode(DTreeNode node) {
     return DTIsLeaf(node) && !nodeData->functionLike;
 }
 
-// Function/Program compiler. This is called recursively when subroutines are found
-TagCodeCache* Compile(DTreeNode root, int indent, bool debug, Scope* parameterNames, HashMap* includedFiles, Context compileContext) {
-    if (!DTValidNode(root)) return NULL;
+// Compile a single node in a block. Returns true if it returns a value
+bool CompileStatement(TagCodeCache* wr, DTreeNode node, int indent, bool debug, Scope* parameterNames, ImportSet* imports, Context compileContext) {
+    TCW_SourceLine(wr, DTReadBody_SourceNode(node)->SourceLine);
 
-    auto wr = TCW_Allocate(MMCurrent());
+    if (IsLeafNode(node)) {
+        EmitLeafNode(node, debug, parameterNames, compileContext, wr);
+        return false;
+    }
 
-    // end of syntax line
-    if (IsLeafNode(root)) {
-        EmitLeafNode(root, debug, parameterNames, compileContext, wr);
-        return wr;
+    if (IsMemoryFunction(node)) {
+        CompileMemoryFunction(indent, debug, node, wr, parameterNames);
+    } else if (IsInclude(node)) {
+        CompileExternalFile(indent, debug, node, wr, parameterNames, imports);
+    } else if (IsFlowControl(node)) {
+        return CompileConditionOrLoop(indent, debug, node, wr, parameterNames);
+    } else if (IsFunctionDefinition(node)) {
+        CompileFunctionDefinition(indent, debug, node, wr, parameterNames);
+    } else {
+        return CompileFunctionCall(indent, debug, wr, node, parameterNames);
     }
+    return false;
+}
 
-    // otherwise, recurse down (depth first)
-    auto tree = root.Tree;
-    auto rootContainer = root;
-    auto chain = DTGetChildId(root);
+// Compile a node and all of its siblings after it. Returns true if any of them return a value
+bool CompileStatements(TagCodeCache* wr, DTreePtr tree, int chain, int indent, bool debug, Scope* parameterNames, ImportSet* imports, Context compileContext) {
+    bool returns = false;
     while (chain >= 0) {
-        if (TCW_HasErrors(wr)) return wr;
+        if (TCW_HasErrors(wr)) return returns;
 
         auto node = DTNode(tree, chain);
         chain = DTGetSiblingId(tree, chain);
-        if (IsLeafNode(node)) {
-            TCW_Merge(wr, Compile(node, indent + 1, debug, parameterNames, includedFiles, compileContext));
-            continue;
-        }
+        returns |= CompileStatement(wr, node, indent, debug, parameterNames, imports, compileContext);
+    }
+    return returns;
+}
 
-        if (IsMemoryFunction(node)) {
-            CompileMemoryFunction(indent, debug, node, wr, parameterNames);
-        } else if (IsInclude(node)) {
-            CompileExternalFile(indent, debug, node, wr, parameterNames, includedFiles);
-        } else if (IsFlowControl(node)) {
-            if (CompileConditionOrLoop(indent, debug, node, wr, parameterNames)) TCW_SetReturnsValues(wr);
-        } else if (IsFunctionDefinition(node)) {
-            CompileFunctionDefinition(indent, debug, node, wr, parameterNames);
-        } else {
-            if (CompileFunctionCall(indent, debug, wr, node, parameterNames)) TCW_SetReturnsValues(wr);
-        }
+// Function/Program compiler. This is called recursively when subroutines are found
+bool CompileInto(TagCodeCache* wr, DTreeNode root, int indent, bool debug, Scope* parameterNames, ImportSet* imports, Context compileContext) {
+    if (!DTValidNode(root) || wr == NULL) return false;
+
+    // end of syntax line
+    if (IsLeafNode(root)) {
+        EmitLeafNode(root, debug, parameterNames, compileContext, wr);
+        return false;
     }
-    return wr;
-}
\ No newline at end of file
+
+    // otherwise, recurse down (depth first)
+    return CompileStatements(wr, root.Tree, DTGetChildId(root), indent, debug, parameterNames, imports, compileContext);
+}
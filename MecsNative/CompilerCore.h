@@ -7,6 +7,8 @@
 
 Compiles pre-parsed source code into TagCode.
 The compiler uses the FileSys functions to access included files.
+Imported files are found before the program is compiled, and are read and compiled
+in parallel (see ThreadSys), each in its own arena. Their code is merged in import order.
 
 It it recommended that the parse and compile process is done in its own
 memory arena, with the arena being closed AFTER the TagCodeCache has been
@@ -42,7 +44,22 @@ enum class Context {
 // Setting `isSubprogram` to true will set a return-like marker at the end of the program. If false, it will set a termination marker.
 TagCodeCache* CompileRoot(DTreeNode root, bool debug, bool isSubprogram);
 
-// Function/Program compiler. This is called recursively when subroutines are found
-TagCodeCache* Compile(DTreeNode root, int indent, bool debug, Scope* parameterNames, HashMap* includedFiles, Context compileContext);
+// Compile source code from a syntax tree into a tag code cache, as `CompileRoot`.
+// The path of every imported file is added to `includedFiles` (Map<StringPtr -> bool>), so callers can track dependencies.
+TagCodeCache* CompileRootWithImports(DTreeNode root, bool debug, bool isSubprogram, HashMap* includedFiles);
+
+// Compile one top-level part of a larger program into a fragment, to be joined to the others with `TCW_Merge`.
+// Constant propagation and inlining need to see the whole program, so are not done; literal expressions are still folded.
+// Imports are checked against, and added to, `includedFiles` (Map<StringPtr -> bool>).
+TagCodeCache* CompileFragment(DTreeNode root, bool debug, HashMap* includedFiles);
+
+// Files imported by a program being compiled
+typedef struct ImportSet ImportSet;
+
+// Function/Program compiler. This is called recursively when subroutines are found.
+// Opcodes are written to the end of `wr`, with forward jumps patched as each block is closed.
+// Imports are only allowed where `imports` is given, which is the root level.
+// Returns true if the code returns a value.
+bool CompileInto(TagCodeCache* wr, DTreeNode root, int indent, bool debug, Scope* parameterNames, ImportSet* imports, Context compileContext);
 
 #endif
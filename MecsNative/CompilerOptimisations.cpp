@@ -1,5 +1,6 @@
 #include "CompilerOptimisations.h"
 #include "SourceCodeTokeniser.h"
+#include "HashMap.h"
 
 typedef SourceNode Node; // 'SourceNode'. Typedef just for brevity
 
@@ -206,6 +207,615 @@ DTreeNode CO_ReadSimpleComparison(DTreeNode* condition, CmpOp *outCmpOp, uint16_
 
     else return DTreeMakeNode(NULL, -1);
 
-	// TODO...
-    //return Repack(target); // this is weird and tricky. Figure out a nicer way of doing it.
-}
\ No newline at end of file
+    // the comparison's arguments are its children, so compiling this node writes just the arguments
+    return TNode(condition->Tree, target);
+}
+
+// Constant folding and propagation ----------------------------------------------------------------------------------------------
+
+RegisterHashMapStatics(Map)
+RegisterHashMapFor(StringPtr, bool, HashMapStringKeyHash, HashMapStringKeyCompare, Map)
+RegisterHashMapFor(StringPtr, int, HashMapStringKeyHash, HashMapStringKeyCompare, Map)
+
+RegisterVectorStatics(Vec)
+
+// How many times propagation is repeated. Each round can turn more `set`s into constants.
+#define MAX_PROPAGATION_ROUNDS 8
+
+// A variable that might be a constant
+typedef struct ConstantBinding {
+    int setCount; // number of times the name is set anywhere in the program
+    bool excluded; // name is unset, indexed into, or used as a parameter name
+    int setNodeId; // a root level `set` to a literal value, or -1
+    int valueNodeId; // the literal value
+    bool active; // true once the `set` has been passed in source order
+} ConstantBinding;
+RegisterVectorFor(ConstantBinding, Vec)
+
+typedef struct FoldState {
+    DTreePtr tree;
+    HashMap* userFunctions; // Map<StringPtr, bool> of function names defined by `def`. These are never folded.
+    HashMap* bindingIndex; // Map<StringPtr, int> name -> index in `bindings`
+    Vector* bindings; // Vector<ConstantBinding>
+    bool namesObserved; // program uses `eval`, `call` or `import`, so variables can be read or written by name
+    bool changed;
+} FoldState;
+
+inline bool IsCallTo(Node* data, const char* name) {
+    return data->NodeType == NodeType::Atom && StringAreEqual(data->Text, name);
+}
+
+inline bool IsMemoryCall(Node* data) {
+    return IsCallTo(data, "get") || IsCallTo(data, "set") || IsCallTo(data, "isset") || IsCallTo(data, "unset");
+}
+
+// Read a node as a literal integer. `true` and `false` are read as the compiler writes them.
+bool ReadIntegerLiteral(DTreePtr tree, int nodeId, int32_t* outValue) {
+    if (nodeId < 0 || !TIsLeaf(tree, nodeId)) return false;
+    auto data = TReadBody_Node(tree, nodeId);
+    if (data->functionLike) return false;
+    if (data->NodeType == NodeType::Numeric) return StringTryParse_int32(data->Text, outValue);
+    if (data->NodeType == NodeType::Atom) {
+        if (StringAreEqual(data->Text, "true")) { *outValue = -1; return true; }
+        if (StringAreEqual(data->Text, "false")) { *outValue = 0; return true; }
+    }
+    return false;
+}
+
+// Is a node a literal string?
+bool IsStringLiteral(DTreePtr tree, int nodeId) {
+    if (nodeId < 0 || !TIsLeaf(tree, nodeId)) return false;
+    auto data = TReadBody_Node(tree, nodeId);
+    return data->NodeType == NodeType::StringLiteral && !data->functionLike;
+}
+
+bool IsLiteral(DTreePtr tree, int nodeId) {
+    int32_t ignored;
+    return IsStringLiteral(tree, nodeId) || ReadIntegerLiteral(tree, nodeId, &ignored);
+}
+
+// Append a literal to a string, as the interpreter would convert it
+bool AppendLiteralText(DTreePtr tree, int nodeId, String* target) {
+    if (IsStringLiteral(tree, nodeId)) {
+        StringAppend(target, TReadBody_Node(tree, nodeId)->Text);
+        return true;
+    }
+    int32_t value;
+    if (!ReadIntegerLiteral(tree, nodeId, &value)) return false;
+    StringAppendInt32(target, value);
+    return true;
+}
+
+// Turn a node into a literal value, removing its children
+void ReplaceWithLiteral(DTreePtr tree, int nodeId, NodeType type, String* text) {
+    while (TCountChildren(tree, nodeId) > 0) { TRemoveChild(tree, nodeId, 0); }
+    auto data = TReadBody_Node(tree, nodeId);
+    data->NodeType = type;
+    data->functionLike = false;
+    data->Text = text;
+    data->Unescaped = NULL;
+}
+
+void ReplaceWithInteger(DTreePtr tree, int nodeId, int32_t value) {
+    auto text = StringEmpty();
+    StringAppendInt32(text, value);
+    ReplaceWithLiteral(tree, nodeId, NodeType::Numeric, text);
+}
+
+// Math follows the interpreter: values are accumulated as doubles and truncated to an integer.
+// Results that can't be represented (and division by zero) are left for the runtime.
+bool FoldMath(char op, int32_t* values, int count, int32_t* outResult) {
+    if (count == 1) {
+        if (op == '+') { *outResult = values[0]; return true; }
+        if (op == '-' && values[0] != INT32_MIN) { *outResult = -values[0]; return true; }
+        if (op == '%') { *outResult = values[0] % 2; return true; }
+        return false;
+    }
+
+    if (op == '%') {
+        int32_t result = values[0];
+        for (int i = 1; i < count; i++) {
+            if (values[i] == 0 || (values[i] == -1 && result == INT32_MIN)) return false;
+            result = result % values[i];
+        }
+        *outResult = result;
+        return true;
+    }
+
+    double result = (op == '+') ? 0.0 : values[0];
+    for (int i = (op == '+') ? 0 : 1; i < count; i++) {
+        switch (op) {
+        case '+': result += values[i]; break;
+        case '-': result -= values[i]; break;
+        case '*': result *= values[i]; break;
+        case '/':
+            if (values[i] == 0) return false;
+            result /= values[i];
+            break;
+        default: return false;
+        }
+    }
+    if (result <= (double)INT32_MIN || result > (double)INT32_MAX) return false;
+    *outResult = (int32_t)result;
+    return true;
+}
+
+// Try to replace a call to a pure built-in function with its result. Returns true if the node was replaced.
+bool FoldCall(FoldState* state, int nodeId) {
+    auto tree = state->tree;
+    auto data = TReadBody_Node(tree, nodeId);
+    if (data->NodeType != NodeType::Atom || !data->functionLike) return false;
+    if (MapGet_StringPtr_bool(state->userFunctions, data->Text, NULL)) return false;
+
+    int count = TCountChildren(tree, nodeId);
+    if (count < 1 || count > 32) return false;
+
+    // Every argument must be a literal. Numbers are read as we go, in case they are needed.
+    int32_t numbers[32];
+    bool allNumbers = true;
+    int i = 0;
+    for (int child = TGetChildId(tree, nodeId); child >= 0; child = TGetSiblingId(tree, child), i++) {
+        if (!IsLiteral(tree, child)) return false;
+        if (!ReadIntegerLiteral(tree, child, &numbers[i])) allNumbers = false;
+    }
+    auto name = data->Text;
+    int32_t result;
+
+    char op = (StringLength(name) == 1) ? StringCharAtIndex(name, 0) : 0;
+    if (op == '+' || op == '-' || op == '*' || op == '/' || op == '%') {
+        if (!allNumbers || !FoldMath(op, numbers, count, &result)) return false;
+        ReplaceWithInteger(tree, nodeId, result);
+        return true;
+    }
+
+    bool isEqual = StringAreEqual(name, "=") || StringAreEqual(name, "equals");
+    bool isNotEqual = StringAreEqual(name, "<>") || StringAreEqual(name, "not-equal");
+    if ((isEqual || isNotEqual) && count >= 2) {
+        // Numbers compare as numbers. If the first is a string, everything compares as strings.
+        int first = TGetChildId(tree, nodeId);
+        bool match = false;
+        if (allNumbers) {
+            for (int j = 1; j < count; j++) { if (numbers[j] == numbers[0]) match = true; }
+        } else if (IsStringLiteral(tree, first)) {
+            auto target = TReadBody_Node(tree, first)->Text;
+            for (int child = TGetSiblingId(tree, first); child >= 0; child = TGetSiblingId(tree, child)) {
+                auto other = StringEmpty();
+                AppendLiteralText(tree, child, other);
+                if (StringAreEqual(target, other)) match = true;
+                StringDeallocate(other);
+            }
+        } else return false;
+        ReplaceWithInteger(tree, nodeId, (match == isEqual) ? -1 : 0);
+        return true;
+    }
+
+    if ((StringAreEqual(name, "<") || StringAreEqual(name, ">")) && count >= 2 && allNumbers) {
+        bool less = StringAreEqual(name, "<");
+        bool ordered = true;
+        for (int j = 1; j < count; j++) {
+            if (less ? (numbers[j - 1] >= numbers[j]) : (numbers[j - 1] <= numbers[j])) ordered = false;
+        }
+        ReplaceWithInteger(tree, nodeId, ordered ? -1 : 0);
+        return true;
+    }
+
+    if (allNumbers && (StringAreEqual(name, "not") || StringAreEqual(name, "and") || StringAreEqual(name, "or"))) {
+        if (StringAreEqual(name, "not")) {
+            if (count != 1) return false;
+            ReplaceWithInteger(tree, nodeId, (numbers[0] == 0) ? -1 : 0);
+            return true;
+        }
+        bool isAnd = StringAreEqual(name, "and");
+        bool value = isAnd;
+        for (int j = 0; j < count; j++) {
+            if (isAnd && numbers[j] == 0) value = false;
+            if (!isAnd && numbers[j] != 0) value = true;
+        }
+        ReplaceWithInteger(tree, nodeId, value ? -1 : 0);
+        return true;
+    }
+
+    if (StringAreEqual(name, "concat")) {
+        auto text = StringEmpty();
+        for (int child = TGetChildId(tree, nodeId); child >= 0; child = TGetSiblingId(tree, child)) {
+            AppendLiteralText(tree, child, text);
+        }
+        ReplaceWithLiteral(tree, nodeId, NodeType::StringLiteral, text);
+        return true;
+    }
+
+    if (StringAreEqual(name, "length") && count == 1) {
+        auto text = StringEmpty();
+        AppendLiteralText(tree, TGetChildId(tree, nodeId), text);
+        int length = StringLength(text);
+        StringDeallocate(text);
+        ReplaceWithInteger(tree, nodeId, length);
+        return true;
+    }
+
+    if (StringAreEqual(name, "substring") && (count == 2 || count == 3)) {
+        // the offset and length must be numbers, but the source can be anything
+        int first = TGetChildId(tree, nodeId);
+        int32_t offset, length;
+        if (!ReadIntegerLiteral(tree, TGetSiblingId(tree, first), &offset)) return false;
+        auto text = StringEmpty();
+        AppendLiteralText(tree, first, text);
+        if (count == 2) length = StringLength(text) - offset;
+        else if (!ReadIntegerLiteral(tree, TGetNthChildId(tree, nodeId, 2), &length)) {
+            StringDeallocate(text);
+            return false;
+        }
+        auto slice = StringSlice(text, offset, length);
+        StringDeallocate(text);
+        if (slice == NULL) return false;
+        ReplaceWithLiteral(tree, nodeId, NodeType::StringLiteral, slice);
+        return true;
+    }
+
+    return false;
+}
+
+ConstantBinding* FindBinding(FoldState* state, String* name) {
+    int* index = NULL;
+    if (!MapGet_StringPtr_int(state->bindingIndex, name, &index)) return NULL;
+    return VecGet_ConstantBinding(state->bindings, *index);
+}
+
+ConstantBinding* FindOrAddBinding(FoldState* state, String* name) {
+    auto found = FindBinding(state, name);
+    if (found != NULL) return found;
+
+    auto binding = ConstantBinding{};
+    binding.setNodeId = -1;
+    binding.valueNodeId = -1;
+    MapPut_StringPtr_int(state->bindingIndex, name, VecLength(state->bindings), true);
+    VecPush_ConstantBinding(state->bindings, binding);
+    return FindBinding(state, name);
+}
+
+// Find function definitions, uses of variables by name, and everywhere a variable is set.
+void ScanNode(FoldState* state, int nodeId, bool isRootStatement) {
+    auto tree = state->tree;
+    auto data = TReadBody_Node(tree, nodeId);
+
+    if (IsCallTo(data, "eval") || IsCallTo(data, "call") || IsCallTo(data, "import")) {
+        state->namesObserved = true;
+    } else if (IsCallTo(data, "def") && TCountChildren(tree, nodeId) > 0) {
+        // function name, then parameter names, which hide variables of the same name
+        int definition = TGetChildId(tree, nodeId);
+        MapPut_StringPtr_bool(state->userFunctions, TReadBody_Node(tree, definition)->Text, true, true);
+        for (int param = TGetChildId(tree, definition); param >= 0; param = TGetSiblingId(tree, param)) {
+            FindOrAddBinding(state, TReadBody_Node(tree, param)->Text)->excluded = true;
+        }
+    } else if ((IsCallTo(data, "set") || IsCallTo(data, "unset")) && TCountChildren(tree, nodeId) > 0) {
+        int target = TGetChildId(tree, nodeId);
+        auto binding = FindOrAddBinding(state, TReadBody_Node(tree, target)->Text);
+        binding->setCount++;
+        if (IsCallTo(data, "unset") || TCountChildren(tree, target) > 0) binding->excluded = true;
+
+        int value = TGetSiblingId(tree, target);
+        if (isRootStatement && TCountChildren(tree, nodeId) == 2 && IsLiteral(tree, value)) {
+            binding->setNodeId = nodeId;
+            binding->valueNodeId = value;
+        }
+    }
+
+    for (int child = TGetChildId(tree, nodeId); child >= 0; child = TGetSiblingId(tree, child)) {
+        ScanNode(state, child, false);
+    }
+}
+
+void ScanNames(FoldState* state, int rootId) {
+    MapClear(state->bindingIndex);
+    VecClear(state->bindings);
+    for (int statement = TGetChildId(state->tree, rootId); statement >= 0; statement = TGetSiblingId(state->tree, statement)) {
+        ScanNode(state, statement, true);
+    }
+}
+
+// Is there a constant value for this name at this point in the program?
+ConstantBinding* ActiveConstant(FoldState* state, String* name) {
+    auto binding = FindBinding(state, name);
+    if (binding == NULL || !binding->active) return NULL;
+    return binding;
+}
+
+void CopyLiteral(FoldState* state, ConstantBinding* binding, int nodeId) {
+    auto value = TReadBody_Node(state->tree, binding->valueNodeId);
+    ReplaceWithLiteral(state->tree, nodeId, value->NodeType, StringClone(value->Text));
+    state->changed = true;
+}
+
+// Depth-first, in source order: replace reads of constants, then fold calls whose arguments are now all literal
+void FoldNode(FoldState* state, int nodeId) {
+    auto tree = state->tree;
+    auto data = TReadBody_Node(tree, nodeId);
+
+    int child = TGetChildId(tree, nodeId);
+    if (IsMemoryCall(data) && child >= 0) {
+        // `get(x)` of a constant is replaced whole. Otherwise, the target is a name, but any indexes are values.
+        auto targetData = TReadBody_Node(tree, child);
+        if (IsCallTo(data, "get") && TCountChildren(tree, nodeId) == 1 && TIsLeaf(tree, child)) {
+            auto binding = ActiveConstant(state, targetData->Text);
+            if (binding != NULL) CopyLiteral(state, binding, nodeId);
+            return;
+        }
+        for (int index = TGetChildId(tree, child); index >= 0; index = TGetSiblingId(tree, index)) { FoldNode(state, index); }
+        child = TGetSiblingId(tree, child);
+    } else if (IsCallTo(data, "def") && child >= 0) {
+        child = TGetSiblingId(tree, child); // skip name and parameters
+    } else if (TIsLeaf(tree, nodeId)) {
+        if (data->NodeType == NodeType::Atom && !data->functionLike) {
+            auto binding = ActiveConstant(state, data->Text);
+            if (binding != NULL) CopyLiteral(state, binding, nodeId);
+        }
+        return;
+    }
+
+    for (; child >= 0; child = TGetSiblingId(tree, child)) { FoldNode(state, child); }
+
+    if (FoldCall(state, nodeId)) state->changed = true;
+}
+
+// Fold each statement at the root, turning on constants as their `set`s are passed
+void FoldRoot(FoldState* state, int rootId) {
+    auto tree = state->tree;
+    for (int statement = TGetChildId(tree, rootId); statement >= 0; statement = TGetSiblingId(tree, statement)) {
+        FoldNode(state, statement);
+
+        int count = VecLength(state->bindings);
+        for (int i = 0; i < count; i++) {
+            auto binding = VecGet_ConstantBinding(state->bindings, i);
+            if (binding->setNodeId == statement && binding->setCount == 1 && !binding->excluded) binding->active = true;
+        }
+    }
+}
+
+void CO_FoldConstants(DTreeNode root, bool propagate) {
+#ifdef DISABLE_OPTIMISATIONS
+    return;
+#endif
+    if (!TValidNode(root)) return;
+
+    auto state = FoldState{};
+    state.tree = root.Tree;
+    state.userFunctions = MapAllocate_StringPtr_bool(32);
+    state.bindingIndex = MapAllocate_StringPtr_int(64);
+    state.bindings = VecAllocate_ConstantBinding();
+    ScanNames(&state, root.NodeId);
+
+    // Plain folding first, so values like `*(60 60 1000)` can be propagated
+    MapClear(state.bindingIndex);
+    VecClear(state.bindings);
+    FoldRoot(&state, root.NodeId);
+
+    // If names can be seen from outside the program's own text, we can't prove a variable is never changed.
+    for (int round = 0; propagate && !state.namesObserved && round < MAX_PROPAGATION_ROUNDS; round++) {
+        state.changed = false;
+        ScanNames(&state, root.NodeId);
+        FoldRoot(&state, root.NodeId);
+        if (!state.changed) break;
+    }
+
+    MapDeallocate(state.userFunctions);
+    MapDeallocate(state.bindingIndex);
+    VecDeallocate(state.bindings);
+}
+
+// Small function inlining ---------------------------------------------------------------------------------------------------------
+
+// Largest function body (number of syntax nodes in the returned expression) that will be inlined
+#define INLINE_MAX_NODES 24
+
+// A function that can be inlined
+typedef struct InlineCandidate {
+    int defNodeId; // the `def` node
+    int paramCount;
+    bool available; // true once the `def` has been passed in source order
+} InlineCandidate;
+RegisterVectorFor(InlineCandidate, Vec)
+
+typedef struct InlineState {
+    DTreePtr tree;
+    HashMap* definitionCounts; // Map<StringPtr, int> function name -> number of `def`s
+    HashMap* parameterNames; // Map<StringPtr, bool> every parameter name of every function
+    HashMap* setTargets; // Map<StringPtr, bool> every name used as a variable by a memory function
+    HashMap* candidateIndex; // Map<StringPtr, int> function name -> index in `candidates`
+    Vector* candidates; // Vector<InlineCandidate>
+} InlineState;
+
+// Built-in functions that can appear in an inlined body. These never run user code,
+// and don't depend on how many steps the program has taken (so `random` is excluded)
+bool IsInlineSafeBuiltIn(String* name) {
+    const char* safe[] = {
+        "+", "-", "*", "/", "%", "=", "equals", "<>", "not-equal", "<", ">", "not", "and", "or",
+        "concat", "length", "substring", "replace", "find", "count-of", NULL
+    };
+    for (int i = 0; safe[i] != NULL; i++) {
+        if (StringAreEqual(name, safe[i])) return true;
+    }
+    return false;
+}
+
+// Is `name` one of the parameters of a function definition?
+bool IsParameterOf(DTreePtr tree, int definitionId, String* name) {
+    for (int param = TGetChildId(tree, definitionId); param >= 0; param = TGetSiblingId(tree, param)) {
+        if (StringAreEqual(TReadBody_Node(tree, param)->Text, name)) return true;
+    }
+    return false;
+}
+
+// Check an expression can be copied into any call site. Returns false if not.
+// `nodeCount` is increased by the number of nodes in the expression
+bool IsInlineSafeExpression(InlineState* state, int definitionId, int nodeId, int* nodeCount) {
+    auto tree = state->tree;
+    auto data = TReadBody_Node(tree, nodeId);
+    (*nodeCount)++;
+    if (*nodeCount > INLINE_MAX_NODES) return false;
+
+    switch (data->NodeType) {
+    case NodeType::Numeric:
+    case NodeType::StringLiteral:
+        return TIsLeaf(tree, nodeId) && !data->functionLike;
+
+    case NodeType::Atom:
+        break;
+
+    default:
+        return false; // directives, chained calls, `()`
+    }
+
+    if (TIsLeaf(tree, nodeId) && !data->functionLike) {
+        // A variable. Parameters are fine, but other names would be read from the caller's scope,
+        // where a parameter of the same name could hide them.
+        if (StringAreEqual(data->Text, "true") || StringAreEqual(data->Text, "false")) return true;
+        if (IsParameterOf(tree, definitionId, data->Text)) return true;
+        return !MapGet_StringPtr_bool(state->parameterNames, data->Text, NULL);
+    }
+
+    if (!IsInlineSafeBuiltIn(data->Text)) return false;
+
+    for (int child = TGetChildId(tree, nodeId); child >= 0; child = TGetSiblingId(tree, child)) {
+        if (!IsInlineSafeExpression(state, definitionId, child, nodeCount)) return false;
+    }
+    return true;
+}
+
+// Find the single expression in `def(name(params...) ( return(expr) ))`, or -1
+int InlineBodyExpression(DTreePtr tree, int defNodeId) {
+    if (TCountChildren(tree, defNodeId) != 2) return -1;
+    int definition = TGetChildId(tree, defNodeId);
+    int body = TGetSiblingId(tree, definition);
+
+    for (int param = TGetChildId(tree, definition); param >= 0; param = TGetSiblingId(tree, param)) {
+        if (!TIsLeaf(tree, param)) return -1;
+    }
+
+    auto bodyData = TReadBody_Node(tree, body);
+    if (!StringAreEqual(bodyData->Text, "()") || TCountChildren(tree, body) != 1) return -1;
+
+    int statement = TGetChildId(tree, body);
+    if (!IsCallTo(TReadBody_Node(tree, statement), "return") || TCountChildren(tree, statement) != 1) return -1;
+    return TGetChildId(tree, statement);
+}
+
+// Find function definitions, and names that are parameters or variables anywhere in the program
+void ScanForInlining(InlineState* state, int nodeId) {
+    auto tree = state->tree;
+    auto data = TReadBody_Node(tree, nodeId);
+    int child = TGetChildId(tree, nodeId);
+
+    if (IsCallTo(data, "def") && child >= 0) {
+        auto name = TReadBody_Node(tree, child)->Text;
+        int* count = NULL;
+        if (MapGet_StringPtr_int(state->definitionCounts, name, &count)) (*count)++;
+        else MapPut_StringPtr_int(state->definitionCounts, name, 1, true);
+
+        for (int param = TGetChildId(tree, child); param >= 0; param = TGetSiblingId(tree, param)) {
+            MapPut_StringPtr_bool(state->parameterNames, TReadBody_Node(tree, param)->Text, true, true);
+        }
+    } else if (IsMemoryCall(data) && child >= 0) {
+        MapPut_StringPtr_bool(state->setTargets, TReadBody_Node(tree, child)->Text, true, true);
+    }
+
+    for (; child >= 0; child = TGetSiblingId(tree, child)) { ScanForInlining(state, child); }
+}
+
+// Decide which root level functions can be inlined
+void FindInlineCandidates(InlineState* state, int rootId) {
+    auto tree = state->tree;
+    for (int statement = TGetChildId(tree, rootId); statement >= 0; statement = TGetSiblingId(tree, statement)) {
+        if (!IsCallTo(TReadBody_Node(tree, statement), "def")) continue;
+
+        int expression = InlineBodyExpression(tree, statement);
+        if (expression < 0) continue;
+
+        int definition = TGetChildId(tree, statement);
+        auto name = TReadBody_Node(tree, definition)->Text;
+        int* count = NULL;
+        if (!MapGet_StringPtr_int(state->definitionCounts, name, &count) || *count != 1) continue;
+        if (MapGet_StringPtr_bool(state->setTargets, name, NULL)) continue;
+
+        int nodeCount = 0;
+        if (!IsInlineSafeExpression(state, definition, expression, &nodeCount)) continue;
+
+        auto candidate = InlineCandidate{};
+        candidate.defNodeId = statement;
+        candidate.paramCount = TCountChildren(tree, definition);
+        MapPut_StringPtr_int(state->candidateIndex, name, VecLength(state->candidates), true);
+        VecPush_InlineCandidate(state->candidates, candidate);
+    }
+}
+
+// Does a call have chained calls, like `f(x)("key")`?
+bool HasChainedCall(DTreePtr tree, int nodeId) {
+    for (int child = TGetChildId(tree, nodeId); child >= 0; child = TGetSiblingId(tree, child)) {
+        if (StringAreEqual(TReadBody_Node(tree, child)->Text, "()") && TCountChildren(tree, child) > 0) return true;
+    }
+    return false;
+}
+
+// Mark calls to available candidates, depth first
+void MarkInlineCalls(InlineState* state, int nodeId) {
+    auto tree = state->tree;
+    auto data = TReadBody_Node(tree, nodeId);
+    int child = TGetChildId(tree, nodeId);
+
+    if (IsMemoryCall(data) && child >= 0) {
+        // the target is a name, but any indexes are values
+        for (int index = TGetChildId(tree, child); index >= 0; index = TGetSiblingId(tree, index)) { MarkInlineCalls(state, index); }
+        child = TGetSiblingId(tree, child);
+    } else if (IsCallTo(data, "def") && child >= 0) {
+        child = TGetSiblingId(tree, child); // skip name and parameters
+    } else if (data->NodeType == NodeType::Atom && data->functionLike) {
+        int* index = NULL;
+        if (MapGet_StringPtr_int(state->candidateIndex, data->Text, &index)) {
+            auto candidate = VecGet_InlineCandidate(state->candidates, *index);
+            if (candidate->available && TCountChildren(tree, nodeId) == candidate->paramCount && !HasChainedCall(tree, nodeId)) {
+                data->InlineDefinition = TNode(tree, candidate->defNodeId);
+            }
+        }
+    }
+
+    for (; child >= 0; child = TGetSiblingId(tree, child)) { MarkInlineCalls(state, child); }
+}
+
+void CO_MarkInlineCalls(DTreeNode root) {
+#ifdef DISABLE_OPTIMISATIONS
+    return;
+#endif
+    if (!TValidNode(root)) return;
+
+    auto state = InlineState{};
+    state.tree = root.Tree;
+    state.definitionCounts = MapAllocate_StringPtr_int(32);
+    state.parameterNames = MapAllocate_StringPtr_bool(32);
+    state.setTargets = MapAllocate_StringPtr_bool(64);
+    state.candidateIndex = MapAllocate_StringPtr_int(32);
+    state.candidates = VecAllocate_InlineCandidate();
+
+    auto tree = root.Tree;
+    for (int statement = TGetChildId(tree, root.NodeId); statement >= 0; statement = TGetSiblingId(tree, statement)) {
+        ScanForInlining(&state, statement);
+    }
+    FindInlineCandidates(&state, root.NodeId);
+
+    // Calls before the definition are left alone: the function doesn't exist yet when they run
+    if (VecLength(state.candidates) > 0) {
+        for (int statement = TGetChildId(tree, root.NodeId); statement >= 0; statement = TGetSiblingId(tree, statement)) {
+            MarkInlineCalls(&state, statement);
+
+            int count = VecLength(state.candidates);
+            for (int i = 0; i < count; i++) {
+                auto candidate = VecGet_InlineCandidate(state.candidates, i);
+                if (candidate->defNodeId == statement) candidate->available = true;
+            }
+        }
+    }
+
+    MapDeallocate(state.definitionCounts);
+    MapDeallocate(state.parameterNames);
+    MapDeallocate(state.setTargets);
+    MapDeallocate(state.candidateIndex);
+    VecDeallocate(state.candidates);
+}
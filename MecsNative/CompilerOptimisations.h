@@ -24,4 +24,13 @@ bool CO_IsSimpleSet(DTreeNode* setNode);
 // Pack a comparison between two simple values into a single op-code. Reduces loop condition complexity
 DTreeNode CO_ReadSimpleComparison(DTreeNode* condition, CmpOp *outCmpOp, uint16_t* outArgCount);
 
+// Replace calls to pure built-in functions (math, comparison, concat, length, substring) that have only literal arguments
+// with their results. If `propagate` is true, variables set once to a literal at the root level and never changed are
+// also replaced by their value. `root` should be the root of a parsed program.
+void CO_FoldConstants(DTreeNode root, bool propagate);
+
+// Find small root-level functions whose body is a single `return` of built-in calls, and mark calls to them
+// (after their definition) with `SourceNode.InlineDefinition`. The compiler then writes the body in place of the call.
+void CO_MarkInlineCalls(DTreeNode root);
+
 #endif
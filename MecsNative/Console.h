@@ -51,4 +51,4 @@ void LogFmt(ConsolePtr cons, const char* fmt, ...);
 void Log(ConsolePtr cons, char c);
 
 
-#endif console_h
+#endif
@@ -0,0 +1,390 @@
+#include "Deque.h"
+#include "MemoryManager.h"
+
+#include "RawData.h"
+
+#include <stdint.h>
+
+typedef struct Deque {
+    bool IsValid; // if this is false, creation failed
+
+    Arena* _arena; // the arena this deque should be pinned to (the active one when the deque was created)
+
+    // Calculated parts
+
+    // Number of bytes in each element
+    int ElementByteSize;
+    // Largest number of elements we can fit in one block (power of 2)
+    unsigned int MaxBlockElems;
+
+    // dynamic parts
+
+    unsigned int _capacity;     // total number of element slots in the ring (power of 2)
+    unsigned int _blockElems;   // number of elements in each block (power of 2)
+    unsigned int _blockLog2;    // Log2 of `_blockElems`
+    unsigned int _blockCount;   // number of blocks in `_blocks`
+    unsigned int _head;         // ring index of the front element
+    unsigned int _count;        // number of elements stored
+
+    // Table of `_blockCount` pointers to element blocks
+    char** _blocks;
+} Deque;
+
+#ifndef NULL
+#define NULL 0
+#endif
+#ifndef uint
+#define uint uint32_t
+#endif
+
+/*
+ * Structure of the ring:
+ *
+ * [Block ptr 0] --> [Elem 0][Elem 1]...[Elem _blockElems - 1]
+ * . . .
+ * [Block ptr N] --> [Elem ...]...[Elem _capacity - 1]
+ *
+ * Logical index `i` lives at ring index `(_head + i) & (_capacity - 1)`.
+ * While the ring fits in one arena allocation there is a single block.
+ * Above that, blocks are `MaxBlockElems` long and the table doubles instead.
+ * Growth copies the elements into a new ring, so the front is always at `_head`.
+ */
+
+// Tuning parameters
+const int DEQUE_ARENA_SIZE = 65535; // largest single allocation (should match any restriction in the allocator)
+const int DEQUE_INITIAL_ELEMS = 16; // starting ring size. Must be a power of 2
+
+inline uint DequeLog2(uint i) {
+    uint r = 0;
+    while (i > 1) { r++; i >>= 1; }
+    return r;
+}
+
+// Address of ring slot `ringIndex`
+inline char* DequeSlotPtr(char** blocks, uint blockLog2, uint ringIndex, int elemSize) {
+    uint blockMask = (1 << blockLog2) - 1;
+    return blocks[ringIndex >> blockLog2] + ((ringIndex & blockMask) * elemSize);
+}
+
+// Address of logical element `index`, and how many elements follow it in the same block before a break
+inline char* DequeRunPtr(Deque* d, uint index, uint* runLength) {
+    uint ringIndex = (d->_head + index) & (d->_capacity - 1);
+    uint blockMask = d->_blockElems - 1;
+    *runLength = d->_blockElems - (ringIndex & blockMask);
+    return DequeSlotPtr(d->_blocks, d->_blockLog2, ringIndex, d->ElementByteSize);
+}
+
+// Copy `count` elements from `src` into logical positions starting at `index`
+void DequeCopyIn(Deque* d, uint index, char* src, uint count) {
+    auto size = d->ElementByteSize;
+    while (count > 0) {
+        uint run;
+        auto dst = DequeRunPtr(d, index, &run);
+        if (run > count) run = count;
+        writeValue(dst, 0, src, run * size);
+        src += run * size;
+        index += run;
+        count -= run;
+    }
+}
+
+// Copy `count` elements from logical positions starting at `index` to `dst`
+void DequeCopyOut(Deque* d, uint index, char* dst, uint count) {
+    auto size = d->ElementByteSize;
+    while (count > 0) {
+        uint run;
+        auto src = DequeRunPtr(d, index, &run);
+        if (run > count) run = count;
+        writeValue(dst, 0, src, run * size);
+        dst += run * size;
+        index += run;
+        count -= run;
+    }
+}
+
+void DequeFreeBlocks(Arena* a, char** blocks, uint blockCount) {
+    if (blocks == NULL) return;
+    for (uint i = 0; i < blockCount; i++) {
+        if (blocks[i] != NULL) ArenaDereference(a, blocks[i]);
+    }
+    ArenaDereference(a, blocks);
+}
+
+// Allocate a table and blocks for a ring of `capacity` elements.
+// Returns NULL if the arena can't supply the memory.
+char** DequeAllocateBlocks(Deque* d, uint capacity, uint* blockElems, uint* blockCount) {
+    uint elems = (capacity < d->MaxBlockElems) ? capacity : d->MaxBlockElems;
+    uint count = capacity / elems;
+    if (count * sizeof(char*) > DEQUE_ARENA_SIZE) return NULL; // table would be too big
+
+    auto blocks = (char**)ArenaAllocateAndClear(d->_arena, count * sizeof(char*));
+    if (blocks == NULL) return NULL;
+
+    for (uint i = 0; i < count; i++) {
+        blocks[i] = (char*)ArenaAllocate(d->_arena, elems * d->ElementByteSize);
+        if (blocks[i] == NULL) {
+            DequeFreeBlocks(d->_arena, blocks, count);
+            return NULL;
+        }
+    }
+
+    *blockElems = elems;
+    *blockCount = count;
+    return blocks;
+}
+
+// Make sure the ring can hold at least `required` elements.
+// The existing elements are copied to the start of a larger ring if needed.
+bool DequeEnsureCapacity(Deque* d, uint required) {
+    if (required <= d->_capacity) return true;
+
+    uint newCapacity = d->_capacity;
+    while (newCapacity < required) {
+        if (newCapacity >= 0x40000000) return false; // would overflow
+        newCapacity <<= 1;
+    }
+
+    uint newBlockElems, newBlockCount;
+    auto newBlocks = DequeAllocateBlocks(d, newCapacity, &newBlockElems, &newBlockCount);
+    if (newBlocks == NULL) return false;
+
+    // copy old contents, in order, to the start of the new ring
+    auto size = d->ElementByteSize;
+    uint newLog2 = DequeLog2(newBlockElems);
+    uint index = 0;
+    while (index < d->_count) {
+        uint run;
+        auto src = DequeRunPtr(d, index, &run);
+        if (run > d->_count - index) run = d->_count - index;
+
+        // the new ring has blocks at least as big as the old, and starts at zero, so each
+        // source run might still cross one destination block boundary
+        while (run > 0) {
+            uint offset = index & (newBlockElems - 1);
+            uint space = newBlockElems - offset;
+            uint step = (run < space) ? run : space;
+            writeValue(DequeSlotPtr(newBlocks, newLog2, index, size), 0, src, step * size);
+            src += step * size;
+            index += step;
+            run -= step;
+        }
+    }
+
+    DequeFreeBlocks(d->_arena, d->_blocks, d->_blockCount);
+
+    d->_blocks = newBlocks;
+    d->_blockCount = newBlockCount;
+    d->_blockElems = newBlockElems;
+    d->_blockLog2 = newLog2;
+    d->_capacity = newCapacity;
+    d->_head = 0;
+    return true;
+}
+
+Deque* DequeAllocateArena(Arena* a, int elementSize) {
+    if (a == NULL || elementSize < 1) return NULL;
+    auto result = (Deque*)ArenaAllocateAndClear(a, sizeof(Deque));
+    if (result == NULL) return NULL;
+
+    result->_arena = a;
+    result->ElementByteSize = elementSize;
+
+    // Largest power-of-two element count that fits in one allocation
+    uint maxElems = DEQUE_ARENA_SIZE / elementSize;
+    if (maxElems < 1) {
+        result->IsValid = false;
+        return result;
+    }
+    result->MaxBlockElems = 1 << DequeLog2(maxElems);
+
+    uint blockElems, blockCount;
+    result->_capacity = DEQUE_INITIAL_ELEMS;
+    result->_blocks = DequeAllocateBlocks(result, DEQUE_INITIAL_ELEMS, &blockElems, &blockCount);
+    if (result->_blocks == NULL) {
+        result->IsValid = false;
+        return result;
+    }
+    result->_blockElems = blockElems;
+    result->_blockCount = blockCount;
+    result->_blockLog2 = DequeLog2(blockElems);
+    result->_head = 0;
+    result->_count = 0;
+
+    result->IsValid = true;
+    return result;
+}
+
+Deque* DequeAllocate(int elementSize) {
+    return DequeAllocateArena(MMCurrent(), elementSize);
+}
+
+Deque* DequeClone(Deque* source, Arena* a) {
+    if (source == NULL) return NULL;
+    if (a == NULL) a = MMCurrent();
+
+    auto result = DequeAllocateArena(a, source->ElementByteSize);
+    if (result == NULL) return NULL;
+    if (!DequeEnsureCapacity(result, source->_count)) {
+        DequeDeallocate(result);
+        return NULL;
+    }
+
+    // copy across in runs
+    uint index = 0;
+    while (index < source->_count) {
+        uint run;
+        auto src = DequeRunPtr(source, index, &run);
+        if (run > source->_count - index) run = source->_count - index;
+        DequeCopyIn(result, index, src, run);
+        index += run;
+    }
+    result->_count = source->_count;
+    return result;
+}
+
+bool DequeIsValid(Deque* d) {
+    if (d == NULL) return false;
+    return d->IsValid;
+}
+
+void DequeClear(Deque* d) {
+    if (d == NULL) return;
+    d->_head = 0;
+    d->_count = 0;
+}
+
+void DequeDeallocate(Deque* d) {
+    if (d == NULL) return;
+    d->IsValid = false;
+    DequeFreeBlocks(d->_arena, d->_blocks, d->_blockCount);
+    d->_blocks = NULL;
+    d->_blockCount = 0;
+    d->_capacity = 0;
+    d->_count = 0;
+
+    auto a = d->_arena;
+    ArenaDereference(a, d);
+}
+
+int DequeLength(Deque* d) {
+    if (d == NULL) return 0;
+    return d->_count;
+}
+
+int DequeElementSize(Deque* d) {
+    if (d == NULL) return 0;
+    return d->ElementByteSize;
+}
+
+Arena* DequeArena(Deque* d) {
+    if (d == NULL) return NULL;
+    return d->_arena;
+}
+
+void* DequeGet(Deque* d, int index) {
+    if (d == NULL) return NULL;
+    if (index < 0) index += d->_count; // allow negative index syntax
+    if (index < 0 || (uint)index >= d->_count) return NULL;
+
+    uint ringIndex = (d->_head + index) & (d->_capacity - 1);
+    return DequeSlotPtr(d->_blocks, d->_blockLog2, ringIndex, d->ElementByteSize);
+}
+
+bool DequePushBack(Deque* d, void* value) {
+    if (d == NULL || !d->IsValid) return false;
+    if (d->_count >= d->_capacity && !DequeEnsureCapacity(d, d->_count + 1)) return false;
+
+    uint ringIndex = (d->_head + d->_count) & (d->_capacity - 1);
+    writeValue(DequeSlotPtr(d->_blocks, d->_blockLog2, ringIndex, d->ElementByteSize), 0, value, d->ElementByteSize);
+    d->_count++;
+    return true;
+}
+
+bool DequePushFront(Deque* d, void* value) {
+    if (d == NULL || !d->IsValid) return false;
+    if (d->_count >= d->_capacity && !DequeEnsureCapacity(d, d->_count + 1)) return false;
+
+    d->_head = (d->_head - 1) & (d->_capacity - 1);
+    writeValue(DequeSlotPtr(d->_blocks, d->_blockLog2, d->_head, d->ElementByteSize), 0, value, d->ElementByteSize);
+    d->_count++;
+    return true;
+}
+
+bool DequePopBack(Deque* d, void* target) {
+    if (d == NULL || d->_count < 1) return false;
+
+    d->_count--;
+    if (target != NULL) {
+        uint ringIndex = (d->_head + d->_count) & (d->_capacity - 1);
+        writeValue(target, 0, DequeSlotPtr(d->_blocks, d->_blockLog2, ringIndex, d->ElementByteSize), d->ElementByteSize);
+    }
+    return true;
+}
+
+bool DequePopFront(Deque* d, void* target) {
+    if (d == NULL || d->_count < 1) return false;
+
+    if (target != NULL) {
+        writeValue(target, 0, DequeSlotPtr(d->_blocks, d->_blockLog2, d->_head, d->ElementByteSize), d->ElementByteSize);
+    }
+    d->_head = (d->_head + 1) & (d->_capacity - 1);
+    d->_count--;
+    return true;
+}
+
+bool DequePeekBack(Deque* d, void* target) {
+    if (d == NULL || d->_count < 1 || target == NULL) return false;
+
+    uint ringIndex = (d->_head + d->_count - 1) & (d->_capacity - 1);
+    writeValue(target, 0, DequeSlotPtr(d->_blocks, d->_blockLog2, ringIndex, d->ElementByteSize), d->ElementByteSize);
+    return true;
+}
+
+bool DequePeekFront(Deque* d, void* target) {
+    if (d == NULL || d->_count < 1 || target == NULL) return false;
+
+    writeValue(target, 0, DequeSlotPtr(d->_blocks, d->_blockLog2, d->_head, d->ElementByteSize), d->ElementByteSize);
+    return true;
+}
+
+bool DequePushBackMany(Deque* d, void* values, int count) {
+    if (d == NULL || !d->IsValid || count < 0) return false;
+    if (count == 0) return true;
+    if (values == NULL) return false;
+    if (!DequeEnsureCapacity(d, d->_count + count)) return false;
+
+    DequeCopyIn(d, d->_count, (char*)values, count);
+    d->_count += count;
+    return true;
+}
+
+bool DequePushFrontMany(Deque* d, void* values, int count) {
+    if (d == NULL || !d->IsValid || count < 0) return false;
+    if (count == 0) return true;
+    if (values == NULL) return false;
+    if (!DequeEnsureCapacity(d, d->_count + count)) return false;
+
+    d->_head = (d->_head - count) & (d->_capacity - 1);
+    d->_count += count;
+    DequeCopyIn(d, 0, (char*)values, count);
+    return true;
+}
+
+int DequePopFrontMany(Deque* d, void* target, int count) {
+    if (d == NULL || count < 1) return 0;
+    if ((uint)count > d->_count) count = d->_count;
+
+    if (target != NULL) DequeCopyOut(d, 0, (char*)target, count);
+    d->_head = (d->_head + count) & (d->_capacity - 1);
+    d->_count -= count;
+    return count;
+}
+
+int DequePopBackMany(Deque* d, void* target, int count) {
+    if (d == NULL || count < 1) return 0;
+    if ((uint)count > d->_count) count = d->_count;
+
+    d->_count -= count;
+    if (target != NULL) DequeCopyOut(d, d->_count, (char*)target, count);
+    return count;
+}
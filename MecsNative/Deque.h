@@ -0,0 +1,87 @@
+#pragma once
+#ifndef deque_h
+#define deque_h
+
+#include "ArenaAllocator.h"
+
+// Double-ended queue, based on a power-of-two ring buffer.
+// Pushing and popping at either end costs an index update, so this is
+// a better fit than `Vector` for byte streams and message queues.
+typedef struct Deque Deque;
+typedef Deque* DequePtr;
+
+// Create a new deque with the given element size (must be fixed per deque)
+Deque* DequeAllocate(int elementSize);
+// Create a new deque with the given element size (must be fixed per deque) in a specific memory arena
+Deque* DequeAllocateArena(Arena* a, int elementSize);
+// Clone a deque into a new arena
+Deque* DequeClone(Deque* source, Arena* a);
+// Check the deque is correctly allocated
+bool DequeIsValid(Deque* d);
+// Clear all elements out of the deque, but leave it valid
+void DequeClear(Deque* d);
+// Deallocate deque (does not deallocate anything held in the elements)
+void DequeDeallocate(Deque* d);
+// Return number of elements in the deque
+int DequeLength(Deque* d);
+// Size of deque elements, in bytes
+int DequeElementSize(Deque* d);
+// Return the arena that contains this deque
+Arena* DequeArena(Deque* d);
+
+// Get a pointer to an element in the deque, counting from the front. This is an in-place pointer -- no copy is made.
+// Pointers are invalidated by any push.
+void* DequeGet(Deque* d, int index);
+
+// Add a value to the back of the deque
+bool DequePushBack(Deque* d, void* value);
+// Add a value to the front of the deque
+bool DequePushFront(Deque* d, void* value);
+// Read and remove the value at the back of the deque. If `target` is null, only the removal is done.
+bool DequePopBack(Deque* d, void* target);
+// Read and remove the value at the front of the deque. If `target` is null, only the removal is done.
+bool DequePopFront(Deque* d, void* target);
+// Read the value at the back of the deque without removing it
+bool DequePeekBack(Deque* d, void* target);
+// Read the value at the front of the deque without removing it
+bool DequePeekFront(Deque* d, void* target);
+
+// Add `count` contiguous values to the back of the deque, in order
+bool DequePushBackMany(Deque* d, void* values, int count);
+// Add `count` contiguous values to the front of the deque. They keep their order, so `values[0]` becomes the new front.
+bool DequePushFrontMany(Deque* d, void* values, int count);
+// Remove up to `count` values from the front of the deque, copying them in order to `target` (if not null)
+// Returns the number of elements removed
+int DequePopFrontMany(Deque* d, void* target, int count);
+// Remove up to `count` values from the back of the deque, copying them in their original order to `target` (if not null)
+// Returns the number of elements removed
+int DequePopBackMany(Deque* d, void* target, int count);
+
+// Macros to create type-specific versions of the methods above.
+// If you want to use the typed versions, make sure you call `RegisterDequeFor(typeName, namespace)` for EACH type
+
+// These are invariant on type, but can be namespaced
+#define RegisterDequeStatics(nameSpace) \
+    inline void nameSpace##Deallocate(Deque *d){ DequeDeallocate(d); }\
+    inline int nameSpace##Length(Deque *d){ return DequeLength(d); }\
+    inline Deque* nameSpace##Clone(Deque* source, Arena* a){ return DequeClone(source, a); }\
+    inline void nameSpace##Clear(Deque *d) { DequeClear(d); }\
+
+// These must be registered for each type, as they are type variant
+#define RegisterDequeFor(typeName, nameSpace) \
+    inline Deque* nameSpace##Allocate_##typeName(){ return DequeAllocate(sizeof(typeName)); } \
+    inline Deque* nameSpace##AllocateArena_##typeName(Arena* a){ return DequeAllocateArena(a, sizeof(typeName)); } \
+    inline typeName * nameSpace##Get_##typeName(Deque *d, int index){ return (typeName*)DequeGet(d, index); } \
+    inline bool nameSpace##PushBack_##typeName(Deque *d, typeName value){ return DequePushBack(d, (void*)&value); } \
+    inline bool nameSpace##PushFront_##typeName(Deque *d, typeName value){ return DequePushFront(d, (void*)&value); } \
+    inline bool nameSpace##PopBack_##typeName(Deque *d, typeName *target){ return DequePopBack(d, (void*)target); } \
+    inline bool nameSpace##PopFront_##typeName(Deque *d, typeName *target){ return DequePopFront(d, (void*)target); } \
+    inline bool nameSpace##PeekBack_##typeName(Deque *d, typeName *target){ return DequePeekBack(d, (void*)target); } \
+    inline bool nameSpace##PeekFront_##typeName(Deque *d, typeName *target){ return DequePeekFront(d, (void*)target); } \
+    inline bool nameSpace##PushBackMany_##typeName(Deque *d, typeName *values, int count){ return DequePushBackMany(d, (void*)values, count); } \
+    inline bool nameSpace##PushFrontMany_##typeName(Deque *d, typeName *values, int count){ return DequePushFrontMany(d, (void*)values, count); } \
+    inline int nameSpace##PopFrontMany_##typeName(Deque *d, typeName *target, int count){ return DequePopFrontMany(d, (void*)target, count); } \
+    inline int nameSpace##PopBackMany_##typeName(Deque *d, typeName *target, int count){ return DequePopBackMany(d, (void*)target, count); } \
+
+
+#endif
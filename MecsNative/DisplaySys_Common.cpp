@@ -4,6 +4,7 @@
 
 #include "Heap.h"
 #include "Vector.h"
+#include "Sort.h"
 
 
 // entry for each 'pixel' in a scan buffer
@@ -570,15 +571,11 @@ inline void CleanUpHeaps(HeapPtr p_heap, HeapPtr r_heap) {
     }
 }
 
-int CompareSwitchPoint(void* A, void* B) {
-	SwitchPoint* a = (SwitchPoint*)A;
-	SwitchPoint* b = (SwitchPoint*)B;
-
-	// sort by position, with `on` to the left of `off`
-    auto p1 = (a->xpos << 1) + a->state;
-    auto p2 = (b->xpos << 1) + b->state;
-    return p1 - p2;
+// sort key for switch points: by position, with `on` to the left of `off`
+inline uint32_t SwitchPointKey(SwitchPoint* sp) {
+    return (sp->xpos << 1) + sp->state;
 }
+RegisterRadixSortFor(SwitchPoint, uint32_t, SwitchPointKey, Scan)
 
 void RenderScanLine(
     ScanBuffer *buf,             // source scan buffer
@@ -597,7 +594,8 @@ void RenderScanLine(
     auto width = buf->width;
 
     // Note: sorting takes a lot of the time up. Anything we can do to improve it will help frame rates
-    SwitchPoint* list = (SwitchPoint*)IterativeMergeSort(scanLine->points, tmpLine->points, count, sizeof(SwitchPoint), CompareSwitchPoint);
+    // The key is only 12 bits, so the radix sort does at most two passes.
+    SwitchPoint* list = ScanRadixSort_SwitchPoint(scanLine->points, tmpLine->points, count);
 
     
     auto p_heap = buf->p_heap;   // presentation heap
@@ -182,6 +182,121 @@ void DS_Erase(ScreenPtr screen, int left, int top, int right, int bottom, int r,
 
 #endif
 
+#ifdef HEADLESS
+
+#include <stdlib.h>
+#include <string.h>
+
+// With no display device, the frame buffer is plain memory. It is too big for an arena zone,
+// so it comes from the C heap, the same as a device buffer would be outside the arena.
+
+typedef struct Screen {
+	char* pixels; // 32 bits per pixel, BGRx
+
+	int height;
+	int width;
+
+	// Allocation zone
+	ArenaPtr arena;
+} Screen;
+
+
+int DisplaySystem_GetWidth(ScreenPtr screen) {
+	if (screen == NULL) return -1;
+	return screen->width;
+}
+int DisplaySystem_GetHeight(ScreenPtr screen) {
+	if (screen == NULL) return -1;
+	return screen->height;
+}
+
+ArenaPtr DisplaySystem_GetArena(ScreenPtr screen) {
+	if (screen == NULL) return NULL;
+	return screen->arena;
+}
+
+ScreenPtr DisplaySystem_Start(ArenaPtr arena, int width, int height, int r, int g, int b) {
+	if (arena == NULL) return NULL;
+	if (width < 100 || height < 100) return NULL;
+
+	auto result = (ScreenPtr)ArenaAllocateAndClear(arena, sizeof(Screen));
+	if (result == NULL) return NULL;
+	result->arena = arena;
+
+	result->pixels = (char*)malloc((size_t)width * height * 4);
+	if (result->pixels == NULL) {
+		ArenaDereference(arena, result);
+		return NULL;
+	}
+
+	result->height = height;
+	result->width = width;
+
+	DS_Erase(result, 0, 0, width, height, r, g, b);
+	return result;
+}
+
+void DisplaySystem_Shutdown(ScreenPtr screen) {
+	if (screen == NULL) return;
+	free(screen->pixels);
+	ArenaDereference(screen->arena, screen);
+}
+
+char* DisplaySystem_GetFrameBuffer(ScreenPtr screen) {
+	if (screen == NULL) return NULL;
+	return screen->pixels;
+}
+
+void DisplaySystem_PumpIdle(ScreenPtr screen) {
+	// nothing to present
+}
+
+void DS_VScrollScreen(ScreenPtr screen, int distance, int r, int g, int b) {
+	if (screen == NULL || screen->pixels == NULL || distance == 0) return;
+
+	auto buf = screen->pixels;
+	int rowbytes = screen->width * 4;
+
+	// move the rows that stay on screen, then blank the rows uncovered
+	if (distance > 0) {
+		for (int y = screen->height - 1; y >= distance; y--) {
+			memmove(buf + y * rowbytes, buf + (y - distance) * rowbytes, rowbytes);
+		}
+		DS_Erase(screen, 0, 0, screen->width, distance, r, g, b);
+	} else {
+		for (int y = 0; y < screen->height + distance; y++) {
+			memmove(buf + y * rowbytes, buf + (y - distance) * rowbytes, rowbytes);
+		}
+		DS_Erase(screen, 0, screen->height + distance, screen->width, screen->height, r, g, b);
+	}
+}
+
+void DS_Erase(ScreenPtr screen, int left, int top, int right, int bottom, int r, int g, int b) {
+	if (screen == NULL || screen->pixels == NULL) return;
+
+	if (left < 0) left = 0;
+	if (right > screen->width) right = screen->width;
+	if (top < 0) top = 0;
+	if (bottom > screen->height) bottom = screen->height;
+	if (left >= right || top >= bottom) return;
+
+	auto buf = screen->pixels;
+	int rowbytes = screen->width * 4;
+
+	for (int y = top; y < bottom; y++)
+	{
+		int dst_y = y * rowbytes;
+		for (int x = left * 4; x < right * 4; x+=4) {
+			buf[dst_y+x+0] = b;
+			buf[dst_y+x+1] = g;
+			buf[dst_y+x+2] = r;
+			buf[dst_y+x+3] = 0; // NA
+		}
+	}
+}
+
+#endif
+
 #ifdef RASPI
 
 #endif
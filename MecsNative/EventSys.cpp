@@ -23,6 +23,43 @@ bool EventSystem_Start() {
 	return true;
 }
 
+// Convert an SDL event into an IPC target and serialised data.
+// Returns false if the event is not one that programs receive, or could not be stored.
+bool TranslateEvent(SDL_Event* event, StringPtr target, VectorPtr data) {
+	switch (event->type) {
+	case SDL_KEYDOWN:
+	case SDL_KEYUP:
+	{
+		MMPush(256 KILOBYTES);
+		// Make a hashmap to hold event parameters
+		auto evtData = HashMapAllocate_StringPtr_DataTag(2);
+		HashMapPut_StringPtr_DataTag(evtData, StringNew("code"), EncodeInt32(event->key.keysym.scancode), true);
+		HashMapPut_StringPtr_DataTag(evtData, StringNew("char"), EncodeShortStr((char)(event->key.keysym.sym)), true);
+		HashMapPut_StringPtr_DataTag(evtData, StringNew("state"), EncodeBool(event->key.state), true);
+
+		// serialise to data vector
+		bool ok = FreezeToVector(evtData, data);
+		MMPop();
+
+		if (!ok) return false;
+
+		// set the event type
+		StringClear(target);
+		StringAppend(target, "keyboard");
+		return true;
+	}
+		/*
+	case SDL_MOUSEMOTION:
+		//event.motion.x
+		StringAppend(target, "mouse event");
+		return true;
+		*/
+	default:
+		// Ignore any other event
+		return false;
+	}
+}
+
 // Non-blocking check for events.
 // Returns true if events are available.
 // If `target` and `data` should be supplied by the caller, and will be populated with event details
@@ -35,42 +72,30 @@ bool EventPoll(StringPtr target, VectorPtr data) {
 	// Check for events. We only loop here if we are ignoring the event
 	// Otherwise, we return a single event to the caller
 	while (SDL_PollEvent(&event) != 0) {
-		switch (event.type) {
-		case SDL_KEYDOWN:
-		case SDL_KEYUP:
-		{
-			MMPush(256 KILOBYTES);
-			// Make a hashmap to hold event parameters
-			auto evtData = HashMapAllocate_StringPtr_DataTag(2);
-			HashMapPut_StringPtr_DataTag(evtData, StringNew("code"), EncodeInt32(event.key.keysym.scancode), true);
-			HashMapPut_StringPtr_DataTag(evtData, StringNew("char"), EncodeShortStr((char)(event.key.keysym.sym)), true);
-			HashMapPut_StringPtr_DataTag(evtData, StringNew("state"), EncodeBool(event.key.state), true);
-
-			// serialise to data vector
-			bool ok = FreezeToVector(evtData, data);
-			MMPop();
-
-			if (!ok) return false;
-
-			// set the event type
-			StringClear(target);
-			StringAppend(target, "keyboard");
-			return true;
-		}
-			/*
-		case SDL_MOUSEMOTION:
-			//event.motion.x
-			StringAppend(target, "mouse event");
-			return true;
-			*/
-		default:
-			// Ignore any other event -- loop and try again
-			break;
-		}
+		if (TranslateEvent(&event, target, data)) return true;
 	}
 	return false; // no unfiltered event
 }
 
+// Blocking check for events. As `EventPoll`, but waits up to `timeoutMs` milliseconds for an event.
+// Returns false if no event arrived in time.
+bool EventWait(StringPtr target, VectorPtr data, int timeoutMs) {
+	if (target == NULL || data == NULL) return false;
+	if (timeoutMs < 0) timeoutMs = 0;
+
+	SDL_Event event;
+	uint32_t deadline = SDL_GetTicks() + timeoutMs;
+
+	// Sleep in SDL until an event arrives. Ignored events put us back to sleep for the rest of the time.
+	while (true) {
+		int remaining = (int)(deadline - SDL_GetTicks());
+		if (remaining <= 0) return EventPoll(target, data);
+
+		if (SDL_WaitEventTimeout(&event, remaining) == 0) return false; // timed out
+		if (TranslateEvent(&event, target, data)) return true;
+	}
+}
+
 // UK keyboard shift map
 char MapShift(char c) {
 	switch(c) {
@@ -146,6 +171,36 @@ bool EventKeyboardPoll(char *c, bool *down, bool *printable, int* code, bool* sh
 
 #endif
 
+#ifdef HEADLESS
+
+#include <time.h>
+
+// There are no devices to raise events when headless, so waiting is just sleeping
+
+bool EventSystem_Start() {
+	return true;
+}
+
+bool EventPoll(StringPtr target, VectorPtr data) {
+	return false;
+}
+
+bool EventWait(StringPtr target, VectorPtr data, int timeoutMs) {
+	if (timeoutMs <= 0) return false;
+
+	timespec delay;
+	delay.tv_sec = timeoutMs / 1000;
+	delay.tv_nsec = (timeoutMs % 1000) * 1000000L;
+	nanosleep(&delay, NULL);
+	return false;
+}
+
+bool EventKeyboardPoll(char *c, bool *down, bool *printable, int* code, bool* shift, bool* ctrl, bool* alt, bool* gui) {
+	return false;
+}
+
+#endif
+
 #ifdef RASPI
 
 #endif
\ No newline at end of file
@@ -15,6 +15,10 @@ bool EventSystem_Start();
 // that can be used for the runtime scheduler to drive MECS IPC.
 bool EventPoll(StringPtr target, VectorPtr data);
 
+// Blocking check for events. As `EventPoll`, but waits up to `timeoutMs` milliseconds for an event.
+// Returns false if no event arrived in time.
+bool EventWait(StringPtr target, VectorPtr data, int timeoutMs);
+
 // Non-blocking check for keyboard input events.
 // This is used to drive the low-level console, and is not suitable for MECS IPC.
 bool EventKeyboardPoll(char *c, bool *down, bool *printable, int* code, bool* shift, bool* ctrl, bool* alt, bool* gui);
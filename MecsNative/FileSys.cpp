@@ -7,6 +7,9 @@
 #ifdef WIN32
 
 #include <stdio.h>
+#include <direct.h>
+#include <errno.h>
+#include <sys/stat.h>
 
 bool fileWriteModeWindows(String* path, Vector* buffer, const char* mode) {
     if (path == NULL || buffer == NULL) return false;
@@ -22,6 +25,10 @@ bool fileWriteModeWindows(String* path, Vector* buffer, const char* mode) {
     StringDeallocate(realPath);
     ArenaDereference(arena, cpath);
 
+    if (file == NULL) {
+        return false;
+    }
+
     char c = 0;
     while (VectorDequeue(buffer, &c)) {
         if (fputc(c, file) == EOF) break;
@@ -41,6 +48,21 @@ bool FileAppendAll(String* path, Vector* buffer) {
     return fileWriteModeWindows(path, buffer, "ab"); // create or append binary
 }
 
+bool FileMakeDirectory(String* path) {
+    if (path == NULL) return false;
+
+    auto realPath = StringNew("C:\\Temp\\MECS\\"); // jail for testing on Windows
+    StringAppend(realPath, path);
+
+    auto arena = MMCurrent();
+    auto cpath = StringToCStr(realPath, arena);
+    bool ok = (_mkdir(cpath) == 0) || (errno == EEXIST);
+
+    StringDeallocate(realPath);
+    ArenaDereference(arena, cpath);
+    return ok;
+}
+
 bool FileLoadChunk(String* path, Vector* buffer, uint64_t start, uint64_t end, uint64_t* actual) {
     if (path == NULL || buffer == NULL) return false;
     if (VectorElementSize(buffer) < 1 || !VectorIsValid(buffer)) return false; // not valid destination
@@ -91,16 +113,182 @@ bool FileLoadChunk(String* path, Vector* buffer, uint64_t start, uint64_t end, u
     return true;
 }
 
+bool FileLength(String* path, uint64_t* length) {
+    if (path == NULL || length == NULL) return false;
+
+    auto realPath = StringNew("C:\\Temp\\MECS\\"); // jail for testing on Windows
+    StringAppend(realPath, path);
+
+    auto arena = MMCurrent();
+    auto cpath = StringToCStr(realPath, arena);
+    auto file = fopen(cpath, "rb");
+
+    StringDeallocate(realPath);
+    ArenaDereference(arena, cpath);
+
+    if (file == NULL) {
+        return false;
+    }
+
+    bool ok = _fseeki64(file, 0, SEEK_END) == 0;
+    auto end = _ftelli64(file);
+    fclose(file);
+
+    if (!ok || end < 0) return false;
+    *length = (uint64_t)end;
+    return true;
+}
+
+bool FileStatus(String* path, uint64_t* length, uint64_t* modified) {
+    if (path == NULL || length == NULL || modified == NULL) return false;
+
+    auto realPath = StringNew("C:\\Temp\\MECS\\"); // jail for testing on Windows
+    StringAppend(realPath, path);
+
+    auto arena = MMCurrent();
+    auto cpath = StringToCStr(realPath, arena);
+    struct __stat64 info;
+    bool ok = _stat64(cpath, &info) == 0;
+
+    StringDeallocate(realPath);
+    ArenaDereference(arena, cpath);
+
+    if (!ok) return false;
+    *length = (uint64_t)info.st_size;
+    *modified = (uint64_t)info.st_mtime * 1000000000ull; // whole seconds only
+    return true;
+}
+
 #endif
 
-#ifdef RASPI
+// The Raspberry Pi build runs on Linux too, so it shares the POSIX version
+#if defined(HEADLESS) || defined(RASPI)
 
-bool FileLoadChunk(String* path, Vector* buffer, uint64_t start, uint64_t end, uint64_t* actual) {
-    // TODO: SD card reading routines here
+#include <stdio.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+// Paths are relative to the working directory
+
+bool fileWriteModeHeadless(String* path, Vector* buffer, const char* mode) {
+    if (path == NULL || buffer == NULL) return false;
+    if (VectorElementSize(buffer) != 1) return false; // not a byte-size vector
+
+    auto arena = VectorArena(buffer);
+    auto cpath = StringToCStr(path, arena);
+    auto file = fopen(cpath, mode);
+    ArenaDereference(arena, cpath);
+
+    if (file == NULL) {
+        return false;
+    }
+
+    char c = 0;
+    while (VectorDequeue(buffer, &c)) {
+        if (fputc(c, file) == EOF) break;
+    }
+
+    fclose(file);
+
+    return VectorLength(buffer) == 0;
 }
 
 bool FileWriteAll(String* path, Vector* buffer) {
-    // TODO: SD card reading routines here
+    return fileWriteModeHeadless(path, buffer, "wb"); // truncate and write binary
 }
 
-#endif
\ No newline at end of file
+bool FileAppendAll(String* path, Vector* buffer) {
+    return fileWriteModeHeadless(path, buffer, "ab"); // create or append binary
+}
+
+bool FileMakeDirectory(String* path) {
+    if (path == NULL) return false;
+
+    auto arena = MMCurrent();
+    auto cpath = StringToCStr(path, arena);
+    bool ok = (mkdir(cpath, 0775) == 0) || (errno == EEXIST);
+    ArenaDereference(arena, cpath);
+    return ok;
+}
+
+bool FileLoadChunk(String* path, Vector* buffer, uint64_t start, uint64_t end, uint64_t* actual) {
+    if (path == NULL || buffer == NULL) return false;
+    if (VectorElementSize(buffer) < 1 || !VectorIsValid(buffer)) return false; // not valid destination
+
+    auto arena = VectorArena(buffer);
+    auto cpath = StringToCStr(path, arena);
+    auto file = fopen(cpath, "rb");
+    ArenaDereference(arena, cpath);
+
+    if (file == NULL) {
+        return false;
+    }
+
+    if (fseeko(file, (off_t)start, SEEK_SET) != 0) {
+        fclose(file);
+        return false;
+    }
+
+    int elemSize = VectorElementSize(buffer);
+    char* elemBuffer = (char*)ArenaAllocate(arena, elemSize);
+    int idx = 0;
+
+    auto len = end - start;
+    uint64_t readBytes = 0;
+    while (len --> 0) {
+        int r = fgetc(file);
+        if (r < 0) break;
+        elemBuffer[idx] = r;
+        readBytes++;
+
+        idx++;
+        if (idx == elemSize) {
+            idx = 0;
+            VectorPush(buffer, elemBuffer);
+        }
+    }
+    fclose(file);
+
+    if (actual != NULL) *actual = readBytes;
+
+    ArenaDereference(arena, elemBuffer);
+    return true;
+}
+
+bool FileLength(String* path, uint64_t* length) {
+    if (path == NULL || length == NULL) return false;
+
+    auto arena = MMCurrent();
+    auto cpath = StringToCStr(path, arena);
+    auto file = fopen(cpath, "rb");
+    ArenaDereference(arena, cpath);
+
+    if (file == NULL) {
+        return false;
+    }
+
+    bool ok = fseeko(file, 0, SEEK_END) == 0;
+    auto end = ftello(file);
+    fclose(file);
+
+    if (!ok || end < 0) return false;
+    *length = (uint64_t)end;
+    return true;
+}
+
+bool FileStatus(String* path, uint64_t* length, uint64_t* modified) {
+    if (path == NULL || length == NULL || modified == NULL) return false;
+
+    auto arena = MMCurrent();
+    auto cpath = StringToCStr(path, arena);
+    struct stat info;
+    bool ok = stat(cpath, &info) == 0;
+    ArenaDereference(arena, cpath);
+
+    if (!ok) return false;
+    *length = (uint64_t)info.st_size;
+    *modified = (uint64_t)info.st_mtim.tv_sec * 1000000000ull + (uint64_t)info.st_mtim.tv_nsec;
+    return true;
+}
+
+#endif
@@ -13,6 +13,13 @@
 // Read from the file system. Appends a fragment of a file to a preallocated vector of bytes.
 bool FileLoadChunk(String* path, Vector* buffer, uint64_t start, uint64_t end, uint64_t* actual);
 
+// Read the length of a file in bytes, without loading it. Returns false if the file can't be opened.
+bool FileLength(String* path, uint64_t* length);
+
+// Read the length of a file in bytes, and when it was last changed, without opening it.
+// `modified` is only meaningful compared with another reading. Returns false if the file can't be found.
+bool FileStatus(String* path, uint64_t* length, uint64_t* modified);
+
 // Write a file, replacing any existing. Reads from a vector of bytes
 // This removes entries from the buffer, but does not deallocate it.
 bool FileWriteAll(String* path, Vector* buffer);
@@ -21,4 +28,7 @@ bool FileWriteAll(String* path, Vector* buffer);
 // This removes entries from the buffer, but does not deallocate it.
 bool FileAppendAll(String* path, Vector* buffer);
 
+// Create a directory if it does not already exist. Returns true if the directory exists afterwards.
+bool FileMakeDirectory(String* path);
+
 #endif
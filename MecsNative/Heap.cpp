@@ -122,7 +122,8 @@ bool HeapDeleteMin(Heap * H, void* element) {
     }
 
     VectorSet(H->Elements, i, LastElement, NULL);
-    return MinElement;
+    ArenaDereference(arena, LastElement);
+    return true;
 }
 
 void* HeapPeekMin(Heap* H) {
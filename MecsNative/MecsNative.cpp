@@ -3,11 +3,14 @@
 
 // Containers:
 #include "Vector.h"
+#include "Deque.h"
+#include "Sort.h"
 #include "HashMap.h"
 #include "Tree.h"
 #include "Tree_2.h"
 #include "String.h"
 #include "Heap.h"
+#include "TimerWheel.h"
 #include "ArenaAllocator.h"
 #include "MemoryManager.h"
 
@@ -29,6 +32,10 @@
 #include "TagCodeInterpreter.h"
 #include "TypeCoersion.h"
 #include "RuntimeScheduler.h"
+#include "CompileCache.h"
+#include "SourceDocument.h"
+#include "Trace.h"
+#include "BridgeSys.h"
 
 ScreenPtr OutputScreen;
 ConsolePtr cnsl;
@@ -41,6 +48,12 @@ typedef struct exampleElement {
 int CompareExampleElement(exampleElement *left, exampleElement *right) {
     return left->a - right->a;
 }
+uint32_t ExampleElementKey(exampleElement *e) {
+    return (uint32_t)(e->a) ^ 0x80000000u; // flip the sign so negatives go first
+}
+bool ExampleElementLess(exampleElement *left, exampleElement *right) {
+    return left->a < right->a;
+}
 
 // Register type specifics
 RegisterVectorStatics(Vec)
@@ -49,10 +62,18 @@ RegisterVectorFor(HashMap_KVP, Vec)
 RegisterVectorFor(char, Vec)
 RegisterVectorFor(StringPtr, Vec)
 RegisterVectorFor(DataTag, Vec)
+RegisterVectorFor(int, Vec)
+
+RegisterRadixSortFor(exampleElement, uint32_t, ExampleElementKey, Ex)
+RegisterMergeSortFor(exampleElement, ExampleElementLess, Ex)
+
+RegisterDequeStatics(Deq)
+RegisterDequeFor(char, Deq)
 
 RegisterHashMapStatics(Map)
 RegisterHashMapFor(int, int, HashMapIntKeyHash, HashMapIntKeyCompare, Map)
 RegisterHashMapFor(int, float, HashMapIntKeyHash, HashMapIntKeyCompare, Map)
+RegisterHashMapFor(StringPtr, bool, HashMapStringKeyHash, HashMapStringKeyCompare, Map)
 
 RegisterTreeStatics(T)
 RegisterTreeFor(exampleElement, T)
@@ -198,6 +219,27 @@ int TestVector() {
     Log(cnsl,"\n");
     VectorDeallocate(gvec);
 
+    // Typed sort kernels. Big enough that `SortRuns` has to split into several runs and merge them
+    sal = 5000;
+    auto rvec = VecAllocate_exampleElement();
+    auto mvec = VecAllocate_exampleElement();
+    for (int i = 0; i < sal; i++) {
+        int a = (int)(((int64_t)i * 6543127) % sal) - 1000; // 64 bit, as `i * 6543127` is past the int range
+        VecPush_exampleElement(rvec, exampleElement{ a, i });
+        VecPush_exampleElement(mvec, exampleElement{ a, i });
+    }
+    VecSortRuns_exampleElement(rvec, ExRadixSort_exampleElement, CompareExampleElement);
+    VecSortRuns_exampleElement(mvec, ExMergeSort_exampleElement, CompareExampleElement);
+    bool sortedOk = VecLength(rvec) == sal && VecLength(mvec) == sal;
+    for (int i = 1; i < sal && sortedOk; i++) {
+        sortedOk = VecGet_exampleElement(rvec, i - 1)->a <= VecGet_exampleElement(rvec, i)->a
+                && VecGet_exampleElement(mvec, i - 1)->a <= VecGet_exampleElement(mvec, i)->a;
+    }
+    Log(cnsl, sortedOk ? "Typed sorts OK\n" : "Typed sorts FAILED\n");
+    VectorDeallocate(rvec);
+    VectorDeallocate(mvec);
+    if (!sortedOk) return 1;
+
 	// Queue/Dequeue chain
 	Log(cnsl,"Dequeue chain ");
 	auto q = VecAllocate_char();
@@ -220,6 +262,29 @@ int TestVector() {
     Log(cnsl,"\n");
 	VecDeallocate(q);
 
+    // Contiguous mode, including promotion to chunks when it gets too big
+    auto cvec = VecAllocateContiguous_exampleElement();
+    LogFmt(cnsl,"Contiguous vector: \x05\n", VecIsContiguous(cvec) ? "contiguous" : "chunked");
+    for (int i = 0; i < 1000; i++) { VecPush_exampleElement(cvec, exampleElement{ i, -i }); }
+    r = VecGet_exampleElement(cvec, 999);
+    LogFmt(cnsl,"After 1000 pushes: \x05; element 999 = \x02, \x02\n", VecIsContiguous(cvec) ? "contiguous" : "chunked", r->a, r->b);
+    for (int i = 1000; i < 10000; i++) { VecPush_exampleElement(cvec, exampleElement{ i, -i }); }
+    r = VecGet_exampleElement(cvec, 9999);
+    LogFmt(cnsl,"After 10000 pushes: \x05; element 9999 = \x02, \x02\n", VecIsContiguous(cvec) ? "contiguous" : "chunked", r->a, r->b);
+    VecDeallocate(cvec);
+
+    // Preallocate a whole number of chunks, then push and pop past the end. Every element should survive.
+    auto pvec = VecAllocate_exampleElement();
+    VecPrealloc(pvec, 1024);
+    for (int i = 0; i < 1024; i++) { VecSet_exampleElement(pvec, i, exampleElement{ i, -i }, NULL); }
+    VecPush_exampleElement(pvec, exampleElement{ 0, 0 });
+    VecPop_exampleElement(pvec, NULL);
+    bool preallocOk = VecLength(pvec) == 1024;
+    for (int i = 0; i < 1024 && preallocOk; i++) { preallocOk = VecGet_exampleElement(pvec, i)->a == i; }
+    Log(cnsl, preallocOk ? "Preallocated vector OK\n" : "Preallocated vector FAILED\n");
+    VecDeallocate(pvec);
+    if (!preallocOk) return 1;
+
     // Check that vectors pin to the arena they were created in:
     size_t beforeOuter, afterInner, afterOuter, finalOuter;
     ArenaGetState(MMCurrent(), &beforeOuter, NULL, NULL, NULL, NULL, NULL);
@@ -290,6 +355,51 @@ int TestQueue() {
     return 0;
 }
 
+int TestDeque() {
+    Log(cnsl,"**************** DEQUE *******************\n");
+
+    auto q = DeqAllocate_char();
+    auto pal = "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789abcdefghijklmnopqrstuvwxyzzyxwvutsrqponmlkjihgfedcba9876543210ZYXWVUTSRQPONMLKJIHGFEDCBA";
+
+    // Fill from the back, empty from both ends
+    auto ptr = pal;
+    char c;
+    while (*ptr != 0) { DeqPushBack_char(q, *ptr++); }
+    while (DeqLength(q) > 0) {
+        DeqPopFront_char(q, &c); Log(cnsl,c);
+        DeqPopBack_char(q, &c); Log(cnsl,c);
+    }
+    Log(cnsl,"\n");
+
+    // Fill from the front, so it reads backwards
+    ptr = pal;
+    while (*ptr != 0) { DeqPushFront_char(q, *ptr++); }
+    while (DeqPopFront_char(q, &c)) { Log(cnsl,c); }
+    Log(cnsl,"\n");
+
+    // Bulk push and pop, wrapping around the ring many times
+    char buf[100];
+    int expected = 0;
+    bool ok = true;
+    for (int round = 0; round < 1000; round++) {
+        for (int i = 0; i < 37; i++) { buf[i] = (char)((round * 37 + i) % 101); }
+        DeqPushBackMany_char(q, buf, 37);
+        int got = DeqPopFrontMany_char(q, buf, 30);
+        for (int i = 0; i < got; i++) {
+            if (buf[i] != (char)(expected % 101)) ok = false;
+            expected++;
+        }
+    }
+    LogFmt(cnsl,"Bulk transfer \x05; \x02 elements remain (should be 7000)\n", ok ? "OK" : "FAILED", DeqLength(q));
+
+    // Random access from the front
+    auto p = DeqGet_char(q, 0);
+    LogFmt(cnsl,"Front element = \x02 (should be \x02)\n", (int)*p, expected % 101);
+
+    DeqDeallocate(q);
+    return ok ? 0 : 1;
+}
+
 int TestTree() {
     Log(cnsl,"**************** TREE *******************\n");
 
@@ -371,11 +481,20 @@ int TestString() {
     StringDeallocate(str2);
 
     str2 = StringNew("l,o");
-    if (StringFind(str1, str2, 0, &pos)) { // this should trigger the 'add' method to a false positive, but still return not found
+    if (StringFind(str1, str2, 0, &pos)) { // same letters, wrong order: should not be found
         Log(cnsl,"Found a string I wasn't expecting\n");
     }
     StringDeallocate(str2);
 
+    if (!StringFind(str1, "world!", 0, &pos) || pos != 7) { // match right at the end of the string
+        Log(cnsl,"Didn't find a string at the end!?\n");
+    }
+    str2 = StringNew("xxababababababababababababababababababc"); // long needle with repeats (uses the Two-Way search)
+    if (StringFind(str2, "ababababababababababababababababababc", 0, &pos)) {
+        LogFmt(cnsl,"Long needle found at \x02\n", pos); // should be 2
+    }
+    StringDeallocate(str2);
+
     // Slicing and chopping
     str2 = StringChop(StringSlice(str1, -2, 2), 0, 5); // last 2 chars = 'd!', then get 5 chars from that str = 'd!d!d'
     Log(cnsl,str2);
@@ -504,6 +623,16 @@ int TestString() {
     StringDeallocate(needle);
     StringDeallocate(replacement);
 
+    // Short strings are held inline, and move to a vector as they grow. Both should behave the same.
+    str1 = StringNew("short");
+    str2 = StringProxy(str1); // proxies share storage with the original
+    StringAppendChar(str1, '!', 100000); // big enough to go past a single block
+    StringAppend(str2, "end");
+    LogFmt(cnsl,"Long string: length = \x02 (100008); ends with 'end' = \x06; proxy equal = \x06\n",
+        StringLength(str1), StringEndsWith(str1, "end"), StringAreEqual(str1, str2));
+    StringDeallocate(str2);
+    StringDeallocate(str1);
+
     return 0;
 }
 
@@ -549,6 +678,42 @@ int TestHeaps() {
     return 0;
 }
 
+int TestTimerWheel() {
+    Log(cnsl,"*************** TIMER WHEEL *****************\n");
+    auto wheel = TimerWheelAllocate(MMCurrent(), 1000);
+    auto fired = VecAllocate_int();
+
+    // Timers in every level, one past the top level, and one that is cancelled
+    uint64_t dues[] = { 1001, 1005, 1064, 1100, 5000, 70000, 300000, 20000000 };
+    int count = sizeof(dues) / sizeof(uint64_t);
+    for (int i = 0; i < count; i++) { TimerWheelAdd(wheel, dues[i], i); }
+    auto cancelled = TimerWheelAdd(wheel, 2000, count);
+    TimerWheelCancel(wheel, cancelled);
+
+    // Jump to each next due time, and check every timer fires on its own tick
+    bool ok = true;
+    int total = 0;
+    uint64_t now = 1000;
+    while (TimerWheelCount(wheel) > 0) {
+        auto next = TimerWheelNextDue(wheel);
+        if (next < 1) { ok = false; break; }
+        now += next;
+
+        VecClear(fired);
+        TimerWheelAdvance(wheel, now, fired);
+        int owner;
+        while (VecPop_int(fired, &owner)) {
+            if (owner < 0 || owner >= count || dues[owner] != now) ok = false;
+            total++;
+        }
+    }
+    LogFmt(cnsl,"Fired \x02 of \x02 timers (\x05)\n", total, count, ok ? "all on time" : "FAILED");
+
+    VecDeallocate(fired);
+    TimerWheelDeallocate(wheel);
+    return (ok && total == count) ? 0 : 1;
+}
+
 int TestTagData() {
     Log(cnsl,"***************** TAG DATA ******************\n");
 
@@ -959,6 +1124,67 @@ int TestCompiler() {
     return 0;
 }
 
+// Compile a short program from a C string, and return the number of op-codes.
+// This is counted before the peephole pass, so syntax tree optimisations can be compared.
+int CompiledOpCodeCount(const char* source) {
+    auto code = StringNew(source);
+    auto syntaxTree = ParseSourceCode(MMCurrent(), code, false);
+    auto tagCode = CompileRoot(DTreeRootNode(syntaxTree), false, false);
+    int count = TCW_HasErrors(tagCode) ? -1 : TCW_OptimiseStatistics(tagCode).OpCodesBefore;
+    TCW_Deallocate(tagCode);
+    DeallocateAST(syntaxTree);
+    StringDeallocate(code);
+    return count;
+}
+
+int TestConstantFolding() {
+    Log(cnsl,"***************** CONSTANT FOLDING ******************\n");
+
+    // Each pair should compile to the same number of op-codes
+    const char* pairs[] = {
+        "print(*(60 60 1000))", "print(3600000)",
+        "print(concat(\"a\" \"b\" 1))", "print(\"ab1\")",
+        "print(length(substring(\"hello\" 1 3)))", "print(3)",
+        "set(ms *(60 60 1000)) print(+(ms 0))", "set(ms 3600000) print(3600000)",
+        // not folded: `x` is set twice, and `eval` can see variables by name
+        "set(x 1) set(x 2) print(+(x 0))", "set(x 1) set(x 2) print(+(y 0))",
+        "set(x 1) eval(\"set(x 2)\") print(+(x 0))", "set(x 1) eval(\"set(x 2)\") print(+(y 0))"
+    };
+
+    int result = 0;
+    for (int i = 0; i < sizeof(pairs) / sizeof(pairs[0]); i += 2) {
+        int folded = CompiledOpCodeCount(pairs[i]);
+        int expected = CompiledOpCodeCount(pairs[i + 1]);
+        LogFmt(cnsl,"\x05 -> \x02 op-codes (expected \x02)\n", pairs[i], folded, expected);
+        if (folded < 0 || folded != expected) result++;
+    }
+    return result;
+}
+
+int TestInlining() {
+    Log(cnsl,"***************** INLINING ******************\n");
+
+    // Each pair should compile to the same number of op-codes
+    const char* pairs[] = {
+        // two arguments are set, and two read, in place of a call
+        "def(f(a b)(return(+(a b)))) print(f(x y))", "def(f(a b)(return(+(a b)))) print(+(x y z w u v))",
+        "def(f(a)(return(*(a a)))) print(f(f(x)))", "def(f(a)(return(*(a a)))) print(*(+(x y z w u) v w))",
+        // not inlined: called before definition, calls a function that isn't pure, reads a name that is also a parameter
+        "print(f(x y)) def(f(a b)(return(+(a b))))", "print(q(x y)) def(f(a b)(return(+(a b))))",
+        "def(f(a)(return(random(a)))) print(f(x))", "def(f(a)(return(random(a)))) print(q(x))",
+        "def(f(a)(return(+(a z)))) def(g(z)(return(z))) print(f(x))", "def(f(a)(return(+(a z)))) def(g(z)(return(z))) print(q(x))"
+    };
+
+    int result = 0;
+    for (int i = 0; i < sizeof(pairs) / sizeof(pairs[0]); i += 2) {
+        int inlined = CompiledOpCodeCount(pairs[i]);
+        int expected = CompiledOpCodeCount(pairs[i + 1]);
+        LogFmt(cnsl,"\x05 -> \x02 op-codes (expected \x02)\n", pairs[i], inlined, expected);
+        if (inlined < 0 || inlined != expected) result++;
+    }
+    return result;
+}
+
 int TestRuntimeExec() {
     // This relies on the 'tagcode.dat' file created in the test compiler step
     Log(cnsl,"***************** RUNTIME ******************\n");
@@ -1716,6 +1942,810 @@ int TestSchedulerSpawning() {
 	return result;
 }
 
+// Write text to a file in the cache directory, replacing it
+bool WriteTestFile(const char* name, const char* text) {
+    auto dir = StringNew("mecs_cache");
+    FileMakeDirectory(dir);
+    StringDeallocate(dir);
+
+    auto path = StringNew("mecs_cache/");
+    StringAppend(path, name);
+    auto bytes = VecAllocate_char();
+    for (auto c = text; *c != 0; c++) { VecPush_char(bytes, *c); }
+    bool ok = FileWriteAll(path, bytes);
+    VecDeallocate(bytes);
+    StringDeallocate(path);
+    return ok;
+}
+
+// Load a program and release it straight away, returning the change in cache misses (or -1 if it didn't load)
+int CacheMissesFor(CompileCache* cache, const char* name) {
+    int hitsBefore, missesBefore, hits, misses;
+    CompileCacheStatistics(cache, &hitsBefore, &missesBefore);
+
+    auto path = StringNew(name);
+    Vector* code = NULL;
+    bool ok = CompileCacheLoad(cache, path, &code, NULL);
+    StringDeallocate(path);
+    if (ok) CompileCacheRelease(cache, code);
+
+    CompileCacheStatistics(cache, &hits, &misses);
+    return ok ? misses - missesBefore : -1;
+}
+
+int CompileCacheChanges(CompileCache* cache) {
+    if (!WriteTestFile("cc_broken.ecs", "import(\"./mecs_cache/cc_missing.ecs\")\nprint(\"never\")\n")) return 3;
+    if (CacheMissesFor(cache, "mecs_cache/cc_broken.ecs") != -1 || CacheMissesFor(cache, "mecs_cache/cc_broken.ecs") != -1) {
+        Log(cnsl,"Program with errors was loaded\n");
+        return 4;
+    }
+    int hits, misses;
+    CompileCacheStatistics(cache, &hits, &misses);
+    if (misses != 3) { Log(cnsl,"Program with errors was cached\n"); return 5; }
+
+    WriteTestFile("cc_unit.ecs", "x = 1\n");
+    WriteTestFile("cc_main.ecs", "import(\"./mecs_cache/cc_unit.ecs\")\nprint(x)\n");
+    int compiled = CacheMissesFor(cache, "mecs_cache/cc_main.ecs");
+    int reused = CacheMissesFor(cache, "mecs_cache/cc_main.ecs");
+
+    WriteTestFile("cc_unit.ecs", "x = 1\n"); // same contents, so still up to date
+    int touched = CacheMissesFor(cache, "mecs_cache/cc_main.ecs");
+
+    WriteTestFile("cc_unit.ecs", "x = 22\n");
+    int changed = CacheMissesFor(cache, "mecs_cache/cc_main.ecs");
+
+    LogFmt(cnsl,"Import misses: \x02 \x02 \x02 \x02\n", compiled, reused, touched, changed); // should be 1 0 0 1
+    if (compiled != 1 || reused != 0 || touched != 0 || changed != 1) { Log(cnsl,"Import changes were not tracked\n"); return 6; }
+    return 0;
+}
+
+int TestCompileCache() {
+    Log(cnsl,"***************** COMPILE CACHE ******************\n");
+
+    // Loading the same file twice should only compile once
+    auto cache = CompileCacheAllocate(10 MEGABYTES, false);
+    auto path = StringNew("Importer.ecs");
+    Vector* first = NULL;
+    Vector* second = NULL;
+    HashMap* symbols = NULL;
+    bool ok = CompileCacheLoad(cache, path, &first, &symbols)
+           && CompileCacheLoad(cache, path, &second, &symbols);
+
+    int hits, misses;
+    CompileCacheStatistics(cache, &hits, &misses);
+    LogFmt(cnsl,"Cache hits: \x02; misses: \x02\n", hits, misses); // should be 1 and 1
+
+    int result = 0;
+    if (!ok) { Log(cnsl,"Failed to load program\n"); result = 1; }
+    else if (first != second || hits != 1 || misses != 1) { Log(cnsl,"Program was compiled more than once\n"); result = 2; }
+
+    CompileCacheRelease(cache, first);
+    CompileCacheRelease(cache, second);
+    StringDeallocate(path);
+
+    // Programs that fail to compile are not kept, and a changed import makes the program compile again
+    if (result == 0) result = CompileCacheChanges(cache);
+    CompileCacheDeallocate(cache);
+    return result;
+}
+
+int TestEvalCache() {
+    Log(cnsl,"***************** EVAL CACHE ******************\n");
+
+    // Repeated `eval` of the same code should only compile once
+    auto code = Compile("evalLoop.ecs");
+    if (code == NULL) return 1;
+    auto interp = InterpAllocate(code, 1 MEGABYTE, NULL);
+    VecDeallocate(code);
+
+    auto result = InterpRun(interp, 5000);
+    while (result.State == ExecutionState::Paused) { result = InterpRun(interp, 5000); }
+
+    auto str = StringEmpty();
+    int errState = AppendFinishState(interp, result, str);
+    ReadOutput(interp, str);
+    LogLine(cnsl,str);
+    StringDeallocate(str);
+
+    int hits, misses;
+    InterpEvalCacheStatistics(interp, &hits, &misses);
+    LogFmt(cnsl,"Eval cache hits: \x02; misses: \x02\n", hits, misses); // should be 10 and 2
+    InterpDeallocate(interp);
+
+    if (errState != 0) return errState;
+    if (hits != 10 || misses != 2) { Log(cnsl,"Eval code was not cached as expected\n"); return 2; }
+    return 0;
+}
+
+int TestPeephole() {
+    Log(cnsl,"***************** PEEPHOLE OPTIMISER ******************\n");
+
+    // Compile a loop-heavy program, and check the optimised code still gives the right result
+    auto program = VecAllocate_DataTag();
+    MMPush(10 MEGABYTES);
+    auto code = StringEmpty();
+    auto fileName = StringNew("peephole.ecs");
+    uint64_t read = 0;
+    if (!FileLoadChunk(fileName, StringGetByteVector(code), 0, 10000, &read)) {
+        Log(cnsl,"Failed to read file. Test inconclusive.\n");
+        MMPop();
+        VecDeallocate(program);
+        return 1;
+    }
+    auto syntaxTree = ParseSourceCode(MMCurrent(), code, false);
+    auto tagCode = CompileRoot(DTreeRootNode(syntaxTree), false, false);
+    auto stats = TCW_OptimiseStatistics(tagCode);
+
+    LogFmt(cnsl,"Op-codes: \x02 -> \x02\n", stats.OpCodesBefore, stats.OpCodesAfter);
+    LogFmt(cnsl,"Load-math-store: \x02; compare-jump: \x02; indexed get: \x02; set-get: \x02; threaded jumps: \x02\n",
+        stats.LoadMathStore, stats.CompareJump, stats.IndexedGet, stats.SetThenGet, stats.ThreadedJumps);
+
+    TCW_AppendToVector(tagCode, program);
+    MMPop();
+
+    auto interp = InterpAllocate(program, 1 MEGABYTE, NULL);
+    VecDeallocate(program);
+
+    auto result = InterpRun(interp, 5000);
+    while (result.State == ExecutionState::Paused) { result = InterpRun(interp, 5000); }
+
+    auto str = StringEmpty();
+    ReadOutput(interp, str);
+    LogLine(cnsl,str);
+    int errState = AppendFinishState(interp, result, str);
+    InterpDeallocate(interp);
+
+    if (errState != 0) return errState;
+    if (!StringStartsWith(str, "2422 10 ow")) { Log(cnsl,"Optimised program gave the wrong result\n"); return 2; }
+    if (stats.LoadMathStore < 1 || stats.CompareJump < 1 || stats.IndexedGet < 1 || stats.ThreadedJumps < 1) {
+        Log(cnsl,"Expected patterns were not optimised\n");
+        return 3;
+    }
+    return 0;
+}
+
+int TestLongBlocks() {
+    Log(cnsl,"****************** LONG BLOCK COMPILE ******************\n");
+
+    // Blocks too long for a compound compare jump have to be patched into a function call and long jump
+    auto program = VecAllocate_DataTag();
+    MMPush(64 MEGABYTES); // the syntax tree is large
+    auto code = StringNew("set(i 0) set(y 0) while ( <(i 3)\n");
+    for (int i = 0; i < 9000; i++) { StringAppend(code, "set(y +(y i 2))\n"); }
+    StringAppend(code, "set(i +(i 1)) )\nif ( =(y 81000)\n");
+    for (int i = 0; i < 9000; i++) { StringAppend(code, "set(y +(y 0 1))\n"); }
+    StringAppend(code, "print(y) )\n");
+
+    auto startTime = SystemTime();
+    auto syntaxTree = ParseSourceCode(MMCurrent(), code, false);
+    auto tagCode = CompileRoot(DTreeRootNode(syntaxTree), false, false);
+    auto endTime = SystemTime();
+
+    if (TCW_HasErrors(tagCode)) {
+        Log(cnsl,"Long program failed to compile\n");
+        MMPop();
+        VecDeallocate(program);
+        return 1;
+    }
+    LogFmt(cnsl,"Compiled \x02 op-codes in \x02s\n", TCW_OptimiseStatistics(tagCode).OpCodesBefore, endTime - startTime);
+
+    TCW_AppendToVector(tagCode, program);
+    MMPop();
+
+    auto interp = InterpAllocate(program, 1 MEGABYTE, NULL);
+    VecDeallocate(program);
+
+    auto result = InterpRun(interp, 50000);
+    while (result.State == ExecutionState::Paused) { result = InterpRun(interp, 50000); }
+
+    auto str = StringEmpty();
+    ReadOutput(interp, str);
+    LogLine(cnsl,str);
+    int errState = AppendFinishState(interp, result, str);
+    InterpDeallocate(interp);
+
+    if (errState != 0) return errState;
+    if (!StringStartsWith(str, "90000")) { Log(cnsl,"Long blocks gave the wrong result\n"); return 2; }
+    return 0;
+}
+
+int TestSourceDocument() {
+    Log(cnsl,"**************** INCREMENTAL RECOMPILE *****************\n");
+
+    // Edit one form of a document, and check only that form is parsed and compiled again
+    auto program = VecAllocate_DataTag();
+    MMPush(10 MEGABYTES);
+    auto doc = SourceDocumentAllocate(StringNew(
+        "def (double (x) ( *(x 2) ) )\n"
+        "def (inc (x) ( +(x 1) ) ) // comment\n"
+        "print( double(inc(20)) )"));
+    auto tagCode = SourceDocumentCompile(doc, false);
+    TCW_Deallocate(tagCode);
+
+    int parsed, compiled;
+    SourceDocumentStatistics(doc, &parsed, &compiled);
+    LogFmt(cnsl,"Forms: \x02; parsed \x02; compiled \x02\n", SourceDocumentFormCount(doc), parsed, compiled);
+    if (SourceDocumentFormCount(doc) != 3 || parsed != 3 || compiled != 3) {
+        Log(cnsl,"Document was not split into forms\n");
+        MMPop();
+        VecDeallocate(program);
+        return 1;
+    }
+
+    // change `+(x 1)` to `+(x 11)`
+    unsigned int position = 0;
+    StringFind(SourceDocumentText(doc), "+(x 1)", 0, &position);
+    SourceDocumentEdit(doc, position + 5, 0, StringNew("1"));
+    tagCode = SourceDocumentCompile(doc, false);
+
+    SourceDocumentStatistics(doc, &parsed, &compiled);
+    LogFmt(cnsl,"After edit: parsed \x02; compiled \x02\n", parsed, compiled);
+    if (parsed != 4 || compiled != 4 || TCW_HasErrors(tagCode)) {
+        Log(cnsl,"Edit did not recompile a single form\n");
+        MMPop();
+        VecDeallocate(program);
+        return 2;
+    }
+
+    TCW_AppendToVector(tagCode, program);
+    SourceDocumentDeallocate(doc);
+    MMPop();
+
+    auto interp = InterpAllocate(program, 1 MEGABYTE, NULL);
+    VecDeallocate(program);
+
+    auto result = InterpRun(interp, 5000);
+    while (result.State == ExecutionState::Paused) { result = InterpRun(interp, 5000); }
+
+    auto str = StringEmpty();
+    ReadOutput(interp, str);
+    LogLine(cnsl,str);
+    int errState = AppendFinishState(interp, result, str);
+    InterpDeallocate(interp);
+
+    if (errState != 0) return errState;
+    if (!StringStartsWith(str, "62")) { Log(cnsl,"Edited document gave the wrong result\n"); return 3; }
+    return 0;
+}
+
+int TestImports() {
+    Log(cnsl,"******************* FILE IMPORTS *********************\n");
+
+    // Imports are compiled ahead of time, and merged in order. A file imported twice (here, once by `Importer.ecs`) is only included once.
+    auto program = VecAllocate_DataTag();
+    MMPush(10 MEGABYTES);
+    auto code = StringNew("import(\"Importer.ecs\")\nimport(\"./ImportMeUnit.ecs\")\nprint(\"Done\")\n");
+    auto includedFiles = MapAllocate_StringPtr_bool(32);
+
+    auto syntaxTree = ParseSourceCode(MMCurrent(), code, false);
+    auto tagCode = CompileRootWithImports(DTreeRootNode(syntaxTree), false, false, includedFiles);
+    int fileCount = MapCount(includedFiles);
+    LogFmt(cnsl,"Files included: \x02\n", fileCount);
+
+    if (TCW_HasErrors(tagCode) || fileCount != 2) {
+        Log(cnsl,"Imports were not compiled as expected\n");
+        MMPop();
+        VecDeallocate(program);
+        return 1;
+    }
+
+    TCW_AppendToVector(tagCode, program);
+    MMPop();
+
+    auto interp = InterpAllocate(program, 1 MEGABYTE, NULL);
+    VecDeallocate(program);
+
+    auto result = InterpRun(interp, 5000);
+    while (result.State == ExecutionState::Paused) { result = InterpRun(interp, 5000); }
+
+    auto str = StringEmpty();
+    ReadOutput(interp, str);
+    LogLine(cnsl,str);
+    int errState = AppendFinishState(interp, result, str);
+    InterpDeallocate(interp);
+
+    if (errState != 0) return errState;
+    if (!StringStartsWith(str, "The unit supplied \"I am from the imported unit\"")) { Log(cnsl,"Imported code ran in the wrong order\n"); return 2; }
+    return 0;
+}
+
+int TestSchedulerParking() {
+    Log(cnsl,"***************** PARKED IPC WAITERS ******************\n");
+
+    // Many listeners wait on one sender. Waiting programs should be parked, not run.
+    auto sched = RTSchedulerAllocate();
+    for (int i = 0; i < 50; i++) {
+        RTSchedulerAddProgram(sched, StringNew("ipc_prog1.ecs"), NULL);
+    }
+    RTSchedulerAddProgram(sched, StringNew("ipc_prog2.ecs"), NULL);
+
+    int32_t safetyLatch = 50;
+    int passes = 0;
+    int faultLine = 0;
+    while ((faultLine = RTSchedulerRunUntilIdle(sched, 50, NULL, 10)) == 0) {
+        passes++;
+        if (--safetyLatch < 0) {
+            Log(cnsl,"\n########## Schedule ran too long. Abandoning. ##########");
+            break;
+        }
+    }
+
+    auto endState = RTSchedulerState(sched);
+    RTSchedulerDeallocate(&sched);
+
+    LogFmt(cnsl,"Scheduler finished in \x02 passes\n", passes);
+    if (endState != SchedulerState::Complete) {
+        LogFmt(cnsl,"Scheduler did not complete; LINE = \x02\n", faultLine);
+        return 1;
+    }
+    return 0;
+}
+
+int TestSchedulerTimers() {
+    Log(cnsl,"***************** SLEEP, TIMEOUTS AND FRAMES ******************\n");
+
+    auto consoleOut = StringEmpty();
+    auto sched = RTSchedulerAllocate();
+    RTSchedulerAddProgram(sched, StringNew("timers.ecs"), NULL);
+    RTSchedulerSetFrameRate(sched, 60);
+
+    // The program sleeps for 20ms, times out after 10ms, then waits for 3 frames
+    auto start = MonotonicNanoseconds();
+    int32_t safetyLatch = 200;
+    int faultLine = 0;
+    while ((faultLine = RTSchedulerRunUntilIdle(sched, 50, consoleOut, 100)) == 0) {
+        if (StringLength(consoleOut) > 0) {
+            Log(cnsl,consoleOut);
+            StringClear(consoleOut);
+        }
+        if (--safetyLatch < 0) {
+            Log(cnsl,"\n########## Schedule ran too long. Abandoning. ##########");
+            break;
+        }
+    }
+    if (StringLength(consoleOut) > 0) { Log(cnsl,consoleOut); }
+    int elapsedMs = (int)((MonotonicNanoseconds() - start) / 1000000);
+
+    auto endState = RTSchedulerState(sched);
+    RTSchedulerDeallocate(&sched);
+    StringDeallocate(consoleOut);
+
+    LogFmt(cnsl,"\nProgram finished after \x02ms (should be at least 60)\n", elapsedMs);
+    if (endState != SchedulerState::Complete) {
+        LogFmt(cnsl,"Scheduler did not complete; LINE = \x02\n", faultLine);
+        return 1;
+    }
+    return (elapsedMs >= 60) ? 0 : 2;
+}
+
+int TestSchedulerPriorities() {
+    Log(cnsl,"***************** PRIORITY CLASSES ******************\n");
+
+    // Two copies of a long calculation. The interactive one should get eight times the slices of the batch one.
+    auto sched = RTSchedulerAllocate();
+    RTSchedulerAddProgramWithPriority(sched, StringNew("nestedLoops.ecs"), ProgramPriority::Interactive, NULL);
+    RTSchedulerAddProgramWithPriority(sched, StringNew("nestedLoops.ecs"), ProgramPriority::Batch, NULL);
+
+    int slices[2] = { 0, 0 };
+    int faultLine = 0;
+    for (int i = 0; i < 90; i++) {
+        faultLine = RTSchedulerRun(sched, 1000, NULL);
+        if (faultLine != 0) break;
+        slices[RTSchedulerLastProgramIndex(sched)]++;
+    }
+    RTSchedulerDeallocate(&sched);
+
+    LogFmt(cnsl,"Interactive program ran \x02 slices, batch program ran \x02\n", slices[0], slices[1]);
+    if (faultLine != 0) {
+        LogFmt(cnsl,"Scheduler faulted; LINE = \x02\n", faultLine);
+        return 1;
+    }
+    if (slices[1] < 1 || slices[0] < slices[1] * 6) return 2;
+
+    // A program can start another in a priority class
+    auto consoleOut = StringEmpty();
+    sched = RTSchedulerAllocate();
+    RTSchedulerAddProgram(sched, StringNew("priorities.ecs"), NULL);
+    for (int i = 0; i < 10; i++) {
+        faultLine = RTSchedulerRun(sched, 1000, consoleOut);
+        if (faultLine != 0) break;
+    }
+    Log(cnsl, consoleOut);
+    RTSchedulerDeallocate(&sched);
+
+    if (faultLine != 0) {
+        LogFmt(cnsl,"\nScheduler faulted when starting a batch program; LINE = \x02\n", faultLine);
+        return 3;
+    }
+    bool started = StringStartsWith(consoleOut, "Started batch worker #");
+    StringDeallocate(consoleOut);
+    return started ? 0 : 4;
+}
+
+int TestSchedulerStatistics() {
+    Log(cnsl,"***************** PROGRAM STATISTICS ******************\n");
+
+    auto consoleOut = StringEmpty();
+    auto sched = RTSchedulerAllocate();
+    RTSchedulerAddProgram(sched, StringNew("ipc_prog1.ecs"), NULL);
+    RTSchedulerAddProgram(sched, StringNew("ipc_prog2.ecs"), NULL);
+    RTSchedulerAddProgram(sched, StringNew("stats.ecs"), NULL);
+
+    int32_t safetyLatch = 50;
+    int faultLine = 0;
+    while ((faultLine = RTSchedulerRunUntilIdle(sched, 50, consoleOut, 10)) == 0) {
+        if (--safetyLatch < 0) break;
+    }
+
+    ProgramStatistics listener, sender, asker;
+    bool found = RTSchedulerProgramStatistics(sched, 0, &listener)
+        && RTSchedulerProgramStatistics(sched, 1, &sender)
+        && RTSchedulerProgramStatistics(sched, 2, &asker)
+        && !RTSchedulerProgramStatistics(sched, 3, &asker);
+    auto endState = RTSchedulerState(sched);
+    RTSchedulerDeallocate(&sched);
+
+    LogFmt(cnsl,"Listener: \x02 cycles, \x02 slices, \x02 messages in. Sender: \x02 messages out, \x02 bytes\n",
+        (int)listener.Cycles, (int)listener.Slices, (int)listener.MessagesIn, (int)sender.MessagesOut, (int)sender.BytesSent);
+
+    // `stats.ecs` prints a line for each program
+    unsigned int position;
+    bool answered = StringFind(consoleOut, "Program #3:", 0, &position) && StringFind(consoleOut, "Done", 0, &position);
+    StringDeallocate(consoleOut);
+
+    if (endState != SchedulerState::Complete) {
+        LogFmt(cnsl,"Scheduler did not complete; LINE = \x02\n", faultLine);
+        return 1;
+    }
+    if (!found) return 2;
+    if (listener.Cycles < 1 || listener.Slices < 1 || listener.MessagesIn < 2 || asker.MessagesOut != 1) return 3;
+    if (sender.MessagesOut != 10 || sender.BytesSent < 10) return 4;
+    if (!answered) return 5;
+    return 0;
+}
+
+int TestProfiler() {
+    Log(cnsl,"***************** SAMPLING PROFILER ******************\n");
+
+    // Profile a program that spends most of its time in one loop. The samples should find it by function and line.
+    auto program = VecAllocate_DataTag();
+    auto symbolBytes = VecAllocate_char();
+    MMPush(10 MEGABYTES);
+    auto code = StringEmpty();
+    auto fileName = StringNew("profile.ecs");
+    uint64_t read = 0;
+    if (!FileLoadChunk(fileName, StringGetByteVector(code), 0, 10000, &read)) {
+        Log(cnsl,"Failed to read file. Test inconclusive.\n");
+        MMPop();
+        VecDeallocate(program);
+        VecDeallocate(symbolBytes);
+        return 1;
+    }
+    auto syntaxTree = ParseSourceCode(MMCurrent(), code, false);
+    auto tagCode = CompileRoot(DTreeRootNode(syntaxTree), false, false);
+    TCW_WriteSymbolsToStream(tagCode, symbolBytes); // includes the line map
+    TCW_AppendToVector(tagCode, program);
+    MMPop();
+
+    auto symbols = TCR_ReadSymbols(symbolBytes);
+    VecDeallocate(symbolBytes);
+    auto interp = InterpAllocate(program, 1 MEGABYTE, symbols);
+    VecDeallocate(program);
+
+    if (!InterpProfileStart(interp, 100)) {
+        Log(cnsl,"Profiler is not built in. Test skipped.\n");
+        InterpDeallocate(interp);
+        return 0;
+    }
+    auto result = InterpRun(interp, 5000);
+    while (result.State == ExecutionState::Paused) { result = InterpRun(interp, 5000); }
+    InterpProfileStop(interp);
+
+    auto str = StringEmpty();
+    ReadOutput(interp, str);
+    int errState = AppendFinishState(interp, result, str);
+    LogLine(cnsl,str);
+
+    auto profile = StringEmpty();
+    InterpProfileWriteStacks(interp, profile);
+    InterpProfileWriteOpcodeClasses(interp, profile);
+    Log(cnsl,profile);
+    int samples = InterpProfileSampleCount(interp);
+    InterpDeallocate(interp);
+
+    unsigned int position;
+    bool foundLoop = StringFind(profile, "main:25;busy:8 ", 0, &position); // the call to `busy`, and the line in its loop
+    bool foundClasses = StringFind(profile, "m memory ", 0, &position);
+    StringDeallocate(profile);
+
+    if (errState != 0) return errState;
+    if (!StringStartsWith(str, "30090")) { Log(cnsl,"Profiled program gave the wrong result\n"); return 2; }
+    if (samples < 100 || !foundLoop || !foundClasses) { Log(cnsl,"Profile did not show where the program spent its time\n"); return 3; }
+    return 0;
+}
+
+int TestWorkerPool() {
+    Log(cnsl,"***************** WORKER POOL ******************\n");
+
+    // `pool_client.ecs` starts 3 workers, sends them 12 jobs and 3 stops, and checks the answers come back in order
+    auto consoleOut = StringEmpty();
+    auto sched = RTSchedulerAllocate();
+    RTSchedulerAddProgram(sched, StringNew("pool_client.ecs"), NULL);
+
+    int32_t safetyLatch = 500;
+    int faultLine = 0;
+    while ((faultLine = RTSchedulerRunUntilIdle(sched, 500, consoleOut, 10)) == 0) {
+        if (--safetyLatch < 0) break;
+    }
+    LogLine(cnsl,consoleOut);
+
+    // Jobs and answers are delivered only to the one program they are for
+    ProgramStatistics client, worker;
+    RTSchedulerProgramStatistics(sched, 0, &client);
+    uint64_t workerMessages = 0;
+    bool shared = true;
+    int programs = RTSchedulerProgramCount(sched);
+    for (int i = 1; i < programs; i++) {
+        RTSchedulerProgramStatistics(sched, i, &worker);
+        LogFmt(cnsl,"Worker \x02 took \x02 jobs\n", i, (int)worker.MessagesIn);
+        workerMessages += worker.MessagesIn;
+        if (worker.MessagesIn < 2) shared = false; // every worker should get real work, as well as its stop
+    }
+    auto endState = RTSchedulerState(sched);
+    RTSchedulerDeallocate(&sched);
+
+    unsigned int position;
+    bool inOrder = StringFind(consoleOut, "Answers out of order: 0", 0, &position);
+    bool stopped = StringFind(consoleOut, "Pool stopped", 0, &position);
+    StringDeallocate(consoleOut);
+
+    if (endState != SchedulerState::Complete) {
+        LogFmt(cnsl,"Scheduler did not complete; LINE = \x02\n", faultLine);
+        return 1;
+    }
+    if (programs != 4) return 2;
+    if (!inOrder || !stopped) return 3;
+    if (client.MessagesIn != 15 || workerMessages != 15) { Log(cnsl,"Pool messages were not delivered to one program each\n"); return 4; }
+    if (!shared) { Log(cnsl,"Jobs were not shared between the workers\n"); return 5; }
+    return 0;
+}
+
+int TestDirectIPC() {
+    Log(cnsl,"***************** POINT TO POINT IPC ******************\n");
+
+    // `send_to.ecs` starts two servers that listen for the same target, and asks only the first, by process ID
+    auto consoleOut = StringEmpty();
+    auto sched = RTSchedulerAllocate();
+    RTSchedulerAddProgram(sched, StringNew("send_to.ecs"), NULL);
+
+    int32_t safetyLatch = 100;
+    int faultLine = 0;
+    while ((faultLine = RTSchedulerRunUntilIdle(sched, 500, consoleOut, 10)) == 0) {
+        if (--safetyLatch < 0) break;
+    }
+    LogLine(cnsl,consoleOut);
+
+    ProgramStatistics client, asked, bystander;
+    bool found = RTSchedulerProgramStatistics(sched, 0, &client)
+        && RTSchedulerProgramStatistics(sched, 1, &asked)
+        && RTSchedulerProgramStatistics(sched, 2, &bystander);
+    auto endState = RTSchedulerState(sched);
+    RTSchedulerDeallocate(&sched);
+
+    LogFmt(cnsl,"Client got \x02 messages, asked server got \x02, other server got \x02\n",
+        (int)client.MessagesIn, (int)asked.MessagesIn, (int)bystander.MessagesIn);
+
+    unsigned int position;
+    bool answered = StringFind(consoleOut, "Total of answers: 110", 0, &position) && StringFind(consoleOut, "Servers stopped", 0, &position);
+    StringDeallocate(consoleOut);
+
+    if (endState != SchedulerState::Complete) {
+        LogFmt(cnsl,"Scheduler did not complete; LINE = \x02\n", faultLine);
+        return 1;
+    }
+    if (!found) return 2;
+    if (!answered) return 3;
+    // 2 `ready` + 10 answers to the client; 10 questions + a stop to the first server; only a stop to the second
+    if (client.MessagesIn != 12 || asked.MessagesIn != 11 || bystander.MessagesIn != 1) { Log(cnsl,"Messages reached the wrong programs\n"); return 4; }
+    return 0;
+}
+
+int TestIPCBridge() {
+    Log(cnsl,"***************** CROSS-PROCESS IPC BRIDGE ******************\n");
+
+    // The bridge is meant for schedulers in different processes, but two in one process use the same socket and shared memory.
+    // The talker listens before the hub opens, so the listener is told about it when it joins.
+    auto talkerOut = StringEmpty();
+    auto talker = RTSchedulerAllocate();
+    RTSchedulerAddProgram(talker, StringNew("bridge_talker.ecs"), NULL);
+    RTSchedulerRunUntilIdle(talker, 500, talkerOut, 0);
+
+    auto socketPath = StringNew("/tmp/mecs-bridge-test.sock");
+    auto hub = BridgeListen(socketPath, 4 MEGABYTES);
+    if (hub == NULL) {
+        Log(cnsl,"The bridge is not supported on this platform\n");
+        RTSchedulerDeallocate(&talker);
+        return 0;
+    }
+    auto joined = BridgeConnect(socketPath, 4 MEGABYTES);
+    if (joined == NULL) { BridgeClose(&hub); return 1; }
+
+    RTSchedulerAttachBridge(talker, hub);
+    int32_t safetyLatch = 100;
+    while (!BridgeConnected(joined) && --safetyLatch > 0) {
+        RTSchedulerRunUntilIdle(talker, 500, talkerOut, 0); // takes in the connection
+        BridgeWait(joined, 10);
+        RTSchedulerRunUntilIdle(talker, 500, talkerOut, 0);
+        auto target = StringEmpty();
+        const uint8_t* bytes;
+        int length;
+        if (BridgeReceive(joined, target, &bytes, &length)) BridgeRelease(joined);
+        StringDeallocate(target);
+    }
+
+    auto listener = RTSchedulerAllocate();
+    RTSchedulerAttachBridge(listener, joined);
+    RTSchedulerAddProgram(listener, StringNew("bridge_listener.ecs"), NULL);
+
+    // Take turns until both end
+    safetyLatch = 1000;
+    bool talking = true, listening = true;
+    while ((talking || listening) && --safetyLatch > 0) {
+        if (talking) talking = RTSchedulerRunUntilIdle(talker, 500, talkerOut, 1) == 0;
+        if (listening) listening = RTSchedulerRunUntilIdle(listener, 500, NULL, 1) == 0;
+    }
+    LogLine(cnsl,talkerOut);
+
+    bool complete = RTSchedulerState(talker) == SchedulerState::Complete && RTSchedulerState(listener) == SchedulerState::Complete;
+    RTSchedulerDeallocate(&listener);
+    RTSchedulerDeallocate(&talker);
+    BridgeClose(&joined);
+    BridgeClose(&hub);
+
+    unsigned int position;
+    bool answered = StringFind(talkerOut, "Listener total: 1048631", 0, &position);
+    StringDeallocate(talkerOut);
+
+    if (!complete) { Log(cnsl,"Programs did not complete\n"); return 2; }
+    if (!answered) { Log(cnsl,"Messages did not all cross the bridge\n"); return 3; }
+    return 0;
+}
+
+// Fill a ring that one process never reads from. The sender is either the hub, or another process whose messages the hub passes on.
+int BridgeFullRingFrom(bool fromHub) {
+    // A process that never reads must not hold up the sender, and must give back its ring space when it goes
+    auto socketPath = StringNew("/tmp/mecs-bridge-full.sock");
+    auto hub = BridgeListen(socketPath, 4096);
+    if (hub == NULL) {
+        Log(cnsl,"The bridge is not supported on this platform\n");
+        return 0;
+    }
+    auto stuck = BridgeConnect(socketPath, 4096);
+    auto reader = BridgeConnect(socketPath, 4096);
+    auto other = fromHub ? NULL : BridgeConnect(socketPath, 4096);
+    auto sender = fromHub ? hub : other;
+    if (stuck == NULL || reader == NULL || sender == NULL) {
+        BridgeClose(&stuck); BridgeClose(&reader); BridgeClose(&other); BridgeClose(&hub);
+        return 1;
+    }
+
+    auto target = StringNew("full");
+    auto received = StringEmpty();
+    const uint8_t* bytes;
+    int length;
+    int read = 0;
+
+    // Everything except `stuck` takes what arrives. The hub passes messages on as it receives them.
+    auto pump = [&]() {
+        for (int i = 0; i < 5; i++) {
+            while (BridgeReceive(hub, received, &bytes, &length)) BridgeRelease(hub);
+            if (other != NULL) while (BridgeReceive(other, received, &bytes, &length)) BridgeRelease(other);
+            while (BridgeReceive(reader, received, &bytes, &length)) { read++; BridgeRelease(reader); }
+            BridgeWait(hub, 1);
+        }
+    };
+
+    BridgeSubscribe(stuck, target);
+    BridgeSubscribe(reader, target);
+    int32_t safetyLatch = 100;
+    while (--safetyLatch > 0) {
+        pump();
+        if (BridgeReceive(stuck, received, &bytes, &length)) BridgeRelease(stuck);
+        if (BridgeConnected(stuck) && BridgeConnected(reader) && BridgeConnected(sender) && BridgeWanted(sender, target)) break;
+    }
+    if (safetyLatch <= 0) {
+        BridgeClose(&stuck); BridgeClose(&reader); BridgeClose(&other); BridgeClose(&hub);
+        return 2;
+    }
+    read = 0;
+
+    auto data = VectorAllocate(1);
+    for (int i = 0; i < 1000; i++) { uint8_t b = (uint8_t)i; VectorPush(data, &b); }
+    auto tooBig = VectorAllocate(1);
+    for (int i = 0; i < 5000; i++) { uint8_t b = (uint8_t)i; VectorPush(tooBig, &b); }
+
+    // Too big for the ring at all
+    bool refused = !BridgePublish(sender, target, tooBig);
+
+    // Fill the ring while `reader` keeps up. Publish must fail straight away once full, not wait for `stuck`.
+    int sent = 0;
+    auto start = MonotonicNanoseconds();
+    while (sent < 10 && BridgePublish(sender, target, data)) {
+        sent++;
+        pump();
+    }
+    auto waitedMs = (MonotonicNanoseconds() - start) / 1000000;
+
+    // Once `stuck` goes, what it held is released and the space can be used again
+    BridgeClose(&stuck);
+    pump();
+    bool reused = BridgePublish(sender, target, data);
+    pump();
+
+    BridgeClose(&reader);
+    BridgeClose(&other);
+    BridgeClose(&hub);
+    VectorDeallocate(data);
+    VectorDeallocate(tooBig);
+    StringDeallocate(received);
+
+    LogFmt(cnsl,"Sent \x02 before full, in \x02 ms. Read \x02.\n", sent, (int)waitedMs, read);
+    if (!refused) { Log(cnsl,"An oversize message was accepted\n"); return 3; }
+    if (sent < 1 || sent >= 10) { Log(cnsl,"The ring did not fill\n"); return 4; }
+    if (waitedMs > 1000) { Log(cnsl,"Publish waited for ring space\n"); return 5; }
+    if (!reused) { Log(cnsl,"Ring space held by the closed process was not released\n"); return 6; }
+    if (read != sent + 1) { Log(cnsl,"The reader missed messages\n"); return 7; }
+    return 0;
+}
+
+int TestBridgeFullRing() {
+    Log(cnsl,"***************** BRIDGE RING FULL ******************\n");
+
+    auto fromHub = BridgeFullRingFrom(true);
+    if (fromHub != 0) return fromHub;
+    return BridgeFullRingFrom(false);
+}
+
+int TestTrace() {
+    Log(cnsl,"***************** EVENT TRACING ******************\n");
+
+    // Run two programs that message each other, and check the scheduler and IPC events are recorded
+    TraceEnable(TRACE_ALL);
+    auto consoleOut = StringEmpty();
+    auto sched = RTSchedulerAllocate();
+    RTSchedulerAddProgram(sched, StringNew("ipc_prog1.ecs"), NULL);
+    RTSchedulerAddProgram(sched, StringNew("ipc_prog2.ecs"), NULL);
+
+    int32_t safetyLatch = 50;
+    while (RTSchedulerRunUntilIdle(sched, 50, consoleOut, 10) == 0) {
+        if (--safetyLatch < 0) break;
+    }
+    RTSchedulerDeallocate(&sched);
+    StringDeallocate(consoleOut);
+    TraceEnable(0);
+
+    auto json = StringEmpty();
+    bool written = TraceWriteChromeJson(json);
+    unsigned int position;
+    bool foundSlices = StringFind(json, "\"name\":\"slice\",\"cat\":\"slice\",\"ph\":\"E\"", 0, &position);
+    bool foundSends = StringFind(json, "\"name\":\"ipc-send\"", 0, &position);
+    bool foundReceives = StringFind(json, "\"name\":\"ipc-recv\"", 0, &position);
+    LogFmt(cnsl,"Trace is \x02 bytes of JSON\n", (int)StringLength(json));
+    StringClear(json);
+
+    // Buffers are emptied by the gather, and nothing is recorded while tracing is off
+    TRACE_EVENT(TRACE_IPC, "ignored", 0, 0);
+    TraceWriteChromeJson(json);
+    bool emptied = !StringFind(json, "\"name\"", 0, &position);
+    StringDeallocate(json);
+
+    if (!written) return 1;
+    if ((TRACE_COMPILED & TRACE_SLICE) && !foundSlices) { Log(cnsl,"Scheduler slices were not traced\n"); return 2; }
+    if ((TRACE_COMPILED & TRACE_IPC) && (!foundSends || !foundReceives)) { Log(cnsl,"IPC messages were not traced\n"); return 3; }
+    if (!emptied) { Log(cnsl,"Trace buffers were not emptied\n"); return 4; }
+    return 0;
+}
+
 int RunWaiterProgram() {
 	int result = 0;
 	
@@ -1781,15 +2811,115 @@ int main() {
     if (dtree != 0) return dtree;
     MMPop();
 	
-    /*
-    auto aares = TestArenaAllocator();
-    if (aares != 0) return aares;
-
     MMPush(10 MEGABYTE);
     auto vres = TestVector();
     if (vres != 0) return vres;
     MMPop();
 
+    MMPush(10 MEGABYTE);
+    auto dqres = TestDeque();
+    if (dqres != 0) return dqres;
+    MMPop();
+
+    MMPush(10 MEGABYTE);
+    auto twres = TestTimerWheel();
+    if (twres != 0) return twres;
+    MMPop();
+
+    MMPush(10 MEGABYTES);
+    auto cfold = TestConstantFolding();
+    if (cfold != 0) return cfold;
+    MMPop();
+
+    MMPush(10 MEGABYTES);
+    auto inlining = TestInlining();
+    if (inlining != 0) return inlining;
+    MMPop();
+
+    MMPush(10 MEGABYTES);
+    auto park = TestSchedulerParking();
+    if (park != 0) return park;
+    MMPop();
+
+    MMPush(10 MEGABYTES);
+    auto stim = TestSchedulerTimers();
+    if (stim != 0) return stim;
+    MMPop();
+
+    MMPush(10 MEGABYTES);
+    auto sprio = TestSchedulerPriorities();
+    if (sprio != 0) return sprio;
+    MMPop();
+
+    MMPush(10 MEGABYTES);
+    auto sstat = TestSchedulerStatistics();
+    if (sstat != 0) return sstat;
+    MMPop();
+
+    MMPush(10 MEGABYTES);
+    auto prof = TestProfiler();
+    if (prof != 0) return prof;
+    MMPop();
+
+    MMPush(10 MEGABYTES);
+    auto pool = TestWorkerPool();
+    if (pool != 0) return pool;
+    MMPop();
+
+    MMPush(10 MEGABYTES);
+    auto direct = TestDirectIPC();
+    if (direct != 0) return direct;
+    MMPop();
+
+    MMPush(10 MEGABYTES);
+    auto bridge = TestIPCBridge();
+    if (bridge != 0) return bridge;
+    MMPop();
+
+    MMPush(10 MEGABYTES);
+    auto bfull = TestBridgeFullRing();
+    if (bfull != 0) return bfull;
+    MMPop();
+
+    MMPush(10 MEGABYTES);
+    auto trace = TestTrace();
+    if (trace != 0) return trace;
+    MMPop();
+
+    MMPush(10 MEGABYTES);
+    auto cctst = TestCompileCache();
+    if (cctst != 0) return cctst;
+    MMPop();
+
+    MMPush(10 MEGABYTES);
+    auto evtst = TestEvalCache();
+    if (evtst != 0) return evtst;
+    MMPop();
+
+    MMPush(10 MEGABYTES);
+    auto peep = TestPeephole();
+    if (peep != 0) return peep;
+    MMPop();
+
+    MMPush(10 MEGABYTES);
+    auto lblk = TestLongBlocks();
+    if (lblk != 0) return lblk;
+    MMPop();
+
+    MMPush(10 MEGABYTES);
+    auto sdoc = TestSourceDocument();
+    if (sdoc != 0) return sdoc;
+    MMPop();
+
+    MMPush(10 MEGABYTES);
+    auto imps = TestImports();
+    if (imps != 0) return imps;
+    MMPop();
+
+    /*
+    auto aares = TestArenaAllocator();
+    if (aares != 0) return aares;
+
     MMPush(10 MEGABYTE);
     auto qres = TestQueue();
     if (qres != 0) return qres;
@@ -1819,7 +2949,7 @@ int main() {
     auto tagres = TestTagData();
     if (tagres != 0) return tagres;
     MMPop();
-    
+
     MMPush(10 MEGABYTE);
     auto serdsres = TestSerialisation();
     if (serdsres != 0) return serdsres;
@@ -1847,12 +2977,12 @@ int main() {
     auto multi = TestMultipleRuntimes();
     if (multi != 0) return multi;
     MMPop();
-	
+
     MMPush(10 MEGABYTES);
     auto ipct = TestIPC();
     if (ipct != 0) return ipct;
     MMPop();
-	
+
     MMPush(10 MEGABYTES);
     auto schtst = TestSchedulerSpawning();
     //if (schtst != 0) return schtst;
@@ -1864,6 +2994,8 @@ int main() {
 
 	LogFmt(cnsl,"\n\nTest suite finished in \x02s.", (suiteEndTime - suiteStartTime));
 
+    // There is no keyboard when headless, so `make check` finishes here
+#ifndef HEADLESS
     //*
     MMPush(1 MEGABYTES);
     auto sdest = StringEmpty();
@@ -1874,8 +3006,10 @@ int main() {
     // Run a scheduler program to wait for keyboard input
     RunWaiterProgram();
     //*/
+#endif
 
 	CloseConsoleWindow();
     ShutdownManagedMemory();
+    return 0;
 }
 
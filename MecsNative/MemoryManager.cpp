@@ -1,14 +1,13 @@
 #include "MemoryManager.h"
 #include "Vector.h"
 
-#include <stdlib.h>
+#include "Trace.h"
 
-#ifdef ARENA_DEBUG
-#include <iostream>
-#endif
+#include <stdlib.h>
 
-static volatile Vector* MEMORY_STACK = NULL;
-static volatile int LOCK = 0;
+// Each thread has its own stack of arenas, and must call `StartManagedMemory` before using it
+static thread_local volatile Vector* MEMORY_STACK = NULL;
+static thread_local volatile int LOCK = 0;
 
 typedef Arena* ArenaPtr;
 
@@ -35,7 +34,9 @@ void ShutdownManagedMemory() {
     while (VecPop_ArenaPtr(vec, &a)) {
         DropArena(&a);
     }
+    auto stackMemory = VectorArena(vec);
     VecDeallocate(vec);
+    DropArena(&stackMemory);
     MEMORY_STACK = NULL;
 
     LOCK = 0;
@@ -59,6 +60,33 @@ bool MMPush(size_t arenaMemory) {
     return result;
 }
 
+// Make an existing arena the current one, without taking ownership of it
+bool MMPushArena(Arena* arena) {
+    if (MEMORY_STACK == NULL || arena == NULL) return false;
+    while (LOCK != 0) {}
+    LOCK = 1;
+
+    Vector* vec = (Vector*)MEMORY_STACK;
+    bool result = VecPush_ArenaPtr(vec, arena);
+
+    LOCK = 0;
+    return result;
+}
+
+// Remove the most recent arena from the stack, without deallocating it
+Arena* MMPopArena() {
+    if (MEMORY_STACK == NULL) return NULL;
+    while (LOCK != 0) {}
+    LOCK = 1;
+
+    Vector* vec = (Vector*)MEMORY_STACK;
+    ArenaPtr a = NULL;
+    VecPop_ArenaPtr(vec, &a);
+
+    LOCK = 0;
+    return a;
+}
+
 // Deallocate the most recent arena, restoring the previous
 void MMPop() {
     if (MEMORY_STACK == NULL) return;
@@ -154,10 +182,7 @@ void mfree(void* ptr) {
         }
     }
     // never found it. Either bad call or we've leaked some memory
-
-#ifdef ARENA_DEBUG
-    std::cout << "mfree failed. Memory leaked.\n";
-#endif
+    TRACE_EVENT(TRACE_FREE, "mfree-leaked", 0, 0);
 
     LOCK = 0;
 }
\ No newline at end of file
@@ -9,7 +9,7 @@
     Exposes replacements for malloc, calloc and free.
     Maintains a stack of memory arenas, where allocations and deallocations can be made; and all deallocated at once.
 
-    Uses the most recently pushed Arena.
+    Uses the most recently pushed Arena. Each thread has its own stack.
     Uses the stdlib versions if no areas have been pushed, or if not set up.
     When an arena is popped from the manager, it is deallocated
 */
@@ -56,6 +56,13 @@ bool MMPush(size_t arenaMemory);
 // Deallocate the most recent arena, restoring the previous
 void MMPop();
 
+// Make an existing arena the current one. It is not deallocated when removed with `MMPopArena`.
+// This lets work done on one thread be kept in an arena that outlives it.
+bool MMPushArena(Arena* arena);
+
+// Remove the most recent arena from the stack without deallocating it, restoring the previous. Returns the arena, or NULL if none pushed.
+Arena* MMPopArena();
+
 // Deallocate the most recent arena, copying a data item to the next one down (or permanent memory if at the bottom of the stack)
 // NOTE: THIS IS A SHALLOW COPY!
 void* MMPopReturn(void* ptr, size_t size);
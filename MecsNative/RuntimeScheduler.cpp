@@ -3,38 +3,177 @@
 // Compiler & runtime requirements
 #include "MemoryManager.h"
 #include "String.h"
+#include "Deque.h"
+#include "Heap.h"
 #include "FileSys.h"
 #include "SourceCodeTokeniser.h"
 #include "CompilerCore.h"
 #include "TagCodeInterpreter.h"
 #include "TypeCoersion.h"
 #include "RuntimeScheduler.h"
+#include "CompileCache.h"
+#include "TimerWheel.h"
+#include "Serialisation.h"
+#include "Trace.h"
 
 // System IO
 #include "EventSys.h"
 #include "DisplaySys.h"
+#include "TimingSys.h"
+#include "BridgeSys.h"
 
 typedef uint32_t Name;
 RegisterHashMapStatics(Map)
 RegisterHashMapFor(Name, StringPtr, HashMapIntKeyHash, HashMapIntKeyCompare, Map)
+RegisterHashMapFor(StringPtr, DataTag, HashMapStringKeyHash, HashMapStringKeyCompare, Map)
+RegisterHashMapFor(StringPtr, int, HashMapStringKeyHash, HashMapStringKeyCompare, Map)
 
 RegisterVectorFor(InterpreterStatePtr, Vector)
+RegisterVectorFor(VectorPtr, Vector)
 RegisterVectorFor(DataTag, Vector)
+RegisterVectorFor(int, Vector)
+RegisterVectorFor(StringPtr, Vector)
+
+RegisterDequeStatics(Deq)
+RegisterDequeFor(int, Deq)
+
+RegisterHeapFor(int, Heap)
+
+RegisterVectorFor(ProgramPriority, Vector)
+
+// Which set a scheduled program is in
+enum class ProgramSet : uint8_t {
+	// Can be given time (paused, sending, spawning, or woken from a wait)
+	Runnable = 0,
+	// Parked in `IPC_Wait` until a message it's waiting for arrives
+	Waiting = 1,
+	// Ran to completion
+	Finished = 2
+};
+RegisterVectorFor(ProgramSet, Vector)
+
+// Running totals for each program, read by `RTSchedulerProgramStatistics`
+typedef struct ProgramCounters {
+	uint64_t cycles;
+	uint64_t slices;
+	uint64_t runTime;
+	uint64_t waitTime;
+
+	// Processor and wall-clock time of the slices where the processor time was read (see `CPU_SAMPLE_INTERVAL`)
+	uint64_t cpuSampled;
+	uint64_t runSampled;
+	uint64_t messagesOut;
+	uint64_t bytesSent;
+	uint64_t messagesDropped;
+
+	// When the program was last parked
+	uint64_t waitStart;
+} ProgramCounters;
+RegisterVectorFor(ProgramCounters, Vector)
+
+// A message sent to a worker pool. Message data stays in the arena of the program that sent it until the job is answered.
+typedef struct PoolJob {
+	// Index of the program that sent the job. The answer goes back to it.
+	int submitter;
+	// The job message, and the worker's answer (NULL until it arrives)
+	VectorPtr data;
+	VectorPtr answer;
+	// Process ID of the worker that answered, given to the submitter as "reply-to"
+	int answeredBy;
+} PoolJob;
+RegisterDequeFor(PoolJob, Deq)
+
+// A set of programs that share out the messages sent to the pool's name (see `RTSchedulerCreatePool`)
+typedef struct WorkerPool {
+	// The IPC target that jobs are sent to, and answers come back on
+	StringPtr name;
+
+	// Vector<int>, indexes of the worker programs
+	Vector* members;
+
+	// Deque<PoolJob>, jobs that have not been answered to their sender yet, in the order they were sent
+	Deque* jobs;
+
+	// Job number of the front of `jobs`, and of the next job to give to a worker
+	int firstJob;
+	int nextJob;
+
+	// Deque<int>, numbers of jobs to give out again, because their worker ended without answering
+	Deque* retry;
+} WorkerPool;
+RegisterVectorFor(WorkerPool, Vector)
 
 typedef struct RuntimeScheduler {
 	// Vector<InterpreterState*>
 	Vector* interpreters;
 
+	// Vector<Vector<DataTag>*>, the shared code each interpreter is running (same order as `interpreters`)
+	Vector* programCode;
+
 	// Outer arena used for scheduler details
 	// This holds debug symbors, the vector of interpreters, but not the interpreter working memory.
 	Arena* baseMemory;
 
-	// Next interpreter slot that should be used. This may be off the end, and need reset.
+	// Heap<int>, indexes of runnable interpreters, keyed by virtual time. The one that has had the least of its share runs next.
+	Heap* runnable;
+	int runnableCount;
+
+	// Deque<int>, interactive interpreters that were woken, and run before anything in `runnable`
+	Deque* preempting;
+
+	// Vector<ProgramPriority>, the priority class of each interpreter (same order as `interpreters`)
+	Vector* priorities;
+
+	// Vector<int>, the virtual time of each interpreter: cycles run, scaled by the weight of its priority (same order as `interpreters`)
+	Vector* virtualTimes;
+
+	// Virtual time of the last program taken from `runnable`. Programs joining the runnable set start no earlier than this.
+	int virtualClock;
+
+	// Nanoseconds in which every runnable program should get a slice, or zero to always run the rounds asked for
+	uint64_t targetLatency;
+
+	// Running average of the nanoseconds taken by 1024 cycles, or zero before the first measurement
+	uint64_t cycleCost;
+
+	// Vector<ProgramSet>, the set each interpreter is in (same order as `interpreters`)
+	Vector* programSets;
+
+	// Vector<ProgramCounters>, run-time totals for each interpreter (same order as `interpreters`)
+	Vector* counters;
+
+	// Number of interpreters in the waiting and finished sets
+	int waitingCount;
+	int finishedCount;
+
+	// Index of the last interpreter that was run, or -1
 	int roundRobin;
 
+	// Timers for `sleep`, `wait-for` and animation frames. Ticks are milliseconds since `startTime`.
+	TimerWheel* timers;
+
+	// Vector<int>, the handle of the timer for each interpreter's current wait, or -1 (same order as `interpreters`)
+	Vector* waitTimers;
+
+	// Vector<int>, owners of the timers that fired in the last advance
+	Vector* firedTimers;
+
+	// Monotonic time when the scheduler was allocated, in nanoseconds
+	uint64_t startTime;
+
+	// Animation frames per second (zero if not sending frames), the number of the last frame sent,
+	// the time of frame zero, and the handle of the next frame's timer
+	int frameRate;
+	uint64_t frameCount;
+	uint64_t frameStart;
+	int frameTimer;
+
 	// tracker for making unique program IDs
 	int programInstanceNumber;
 
+	// Vector<int>, the index in `interpreters` of each process ID. Process IDs are given out in order, so this is indexed by ID.
+	Vector* processIndex;
+
 	// Last recorded run state
 	SchedulerState state;
 
@@ -43,6 +182,28 @@ typedef struct RuntimeScheduler {
 
 	// Event data container for system events
     VectorPtr sysEventData;
+
+	// Compiled programs, so each source file is only compiled once
+	CompileCachePtr compileCache;
+
+	// Vector<WorkerPool>, and Map<StringPtr -> int> from pool name to index in `pools`
+	Vector* pools;
+	HashMap* poolNames;
+
+	// Vector<int>, the pool each interpreter is a worker in, or -1 (same order as `interpreters`)
+	Vector* poolOf;
+
+	// Vector<int>, the number of the pool job each interpreter is working on, or -1 (same order as `interpreters`)
+	Vector* poolJobs;
+
+	// Link to schedulers in other processes, or NULL
+	IPCBridge* bridge;
+
+	// Total of the interpreters' listen counts when the bridge was last told about them
+	int bridgeListens;
+
+	// Target string container for messages from the bridge
+	StringPtr bridgeTarget;
 } RuntimeScheduler;
 
 // Allocate a new scheduler. The scheduler will create its own memory arenas, and those for the interpreters.
@@ -54,9 +215,31 @@ RuntimeSchedulerPtr RTSchedulerAllocate(){
 
 	result->sysEventData = VectorAllocateArena(coreMem, 1);
 	result->sysEventTarget = StringEmptyInArena(coreMem);
+	result->bridgeTarget = StringEmptyInArena(coreMem);
 
 	auto intVec = VectorAllocateArena_InterpreterStatePtr(coreMem);
-	if (intVec == NULL || result->sysEventData == NULL || result->sysEventTarget == NULL) {
+	auto codeVec = VectorAllocateArena_VectorPtr(coreMem);
+	auto setVec = VectorAllocateArena_ProgramSet(coreMem);
+	auto counters = VectorAllocateArena_ProgramCounters(coreMem);
+	auto runQueue = HeapAllocate_int(coreMem);
+	auto preempting = DeqAllocateArena_int(coreMem);
+	auto priorities = VectorAllocateArena_ProgramPriority(coreMem);
+	auto virtualTimes = VectorAllocateArena_int(coreMem);
+	auto timers = TimerWheelAllocate(coreMem, 0);
+	auto waitTimers = VectorAllocateArena_int(coreMem);
+	auto firedTimers = VectorAllocateArena_int(coreMem);
+	auto pools = VectorAllocateArena_WorkerPool(coreMem);
+	auto poolNames = MapAllocateArena_StringPtr_int(8, coreMem);
+	auto poolOf = VectorAllocateArena_int(coreMem);
+	auto poolJobs = VectorAllocateArena_int(coreMem);
+	auto processIndex = VectorAllocateArena_int(coreMem);
+	auto cache = CompileCacheAllocate(10 MEGABYTES, true);
+	if (intVec == NULL || codeVec == NULL || setVec == NULL || runQueue == NULL || cache == NULL
+		|| preempting == NULL || priorities == NULL || virtualTimes == NULL || counters == NULL
+		|| timers == NULL || waitTimers == NULL || firedTimers == NULL
+		|| pools == NULL || poolNames == NULL || poolOf == NULL || poolJobs == NULL || processIndex == NULL
+		|| result->sysEventData == NULL || result->sysEventTarget == NULL || result->bridgeTarget == NULL) {
+		CompileCacheDeallocate(cache);
 		DropArena(&coreMem);
 		return NULL;
 	}
@@ -65,6 +248,25 @@ RuntimeSchedulerPtr RTSchedulerAllocate(){
 	result->roundRobin = -1;
 	result->programInstanceNumber = 0;
 	result->interpreters = intVec;
+	result->programCode = codeVec;
+	result->programSets = setVec;
+	result->counters = counters;
+	result->runnable = runQueue;
+	result->preempting = preempting;
+	result->priorities = priorities;
+	result->virtualTimes = virtualTimes;
+	result->timers = timers;
+	result->waitTimers = waitTimers;
+	result->firedTimers = firedTimers;
+	result->startTime = MonotonicNanoseconds();
+	result->frameTimer = -1;
+	result->compileCache = cache;
+	result->pools = pools;
+	result->poolNames = poolNames;
+	result->poolOf = poolOf;
+	result->poolJobs = poolJobs;
+	result->processIndex = processIndex;
+	VectorPush_int(processIndex, -1); // there is no process zero
 	result->state = SchedulerState::Running;
 
 	return result;
@@ -79,72 +281,59 @@ void RTSchedulerDeallocate(RuntimeSchedulerPtr* schedHndl) {
 
 	if (sched->interpreters != NULL) {
 		InterpreterState *interp;
+		VectorPtr code;
 		while (VectorPop_InterpreterStatePtr(sched->interpreters, &interp)) {
 			InterpDeallocate(interp);
+			if (VectorPop_VectorPtr(sched->programCode, &code)) CompileCacheRelease(sched->compileCache, code);
 		}
 	}
-	
+
+	CompileCacheDeallocate(sched->compileCache);
 	DropArena(&(sched->baseMemory));
 	schedHndl = NULL;
 }
 
 
-Vector* RTS_Compile(StringPtr filename, HashMap *symbols, Arena* symbolStringStorage) {
-	// Load and compile
-	auto program = VectorAllocate_DataTag();
-
-	// Compile and load
-	MMPush(10 MEGABYTES);
-	auto code = StringEmpty();
-	auto vec = StringGetByteVector(code);
-	uint64_t read = 0;
-	if (!FileLoadChunk(filename, vec, 0, 10000, &read)) {
-		return NULL;
-	}
-
-	auto compilableSyntaxTree = ParseSourceCode(MMCurrent(), code, false);
-
-	auto parseResult = (SourceNode*)DTreeReadBody(compilableSyntaxTree, DTreeRootId(compilableSyntaxTree));
-    if (!parseResult->IsValid) {
-        //Log(cnsl,"The source file was not valid (FAIL!)\n");
-		return NULL;
-    } 
-
-	auto tagCode = CompileRoot(DTreeRootNode(compilableSyntaxTree), false, false);
-
-	auto nextPos = TCW_AppendToVector(tagCode, program);
-	if (symbols != NULL) {
-		TCW_GetSymbolsTo(tagCode, symbols, symbolStringStorage);
-	}
-
-	StringDeallocate(code);
-	DeallocateAST(compilableSyntaxTree);
-	TCW_Deallocate(tagCode);
-	MMPop();
-
-	return program;
-}
-
+void MakeRunnable(RuntimeSchedulerPtr sched, int index, bool woken);
 
 // Read, compile and add a program to the execution schedule
 // Returns false if there were any errors loading
 // If the `processId` string is provided, it will have the process instance unique ID appended to it.
 bool RTSchedulerAddProgram(RuntimeSchedulerPtr sched, StringPtr filePath, StringPtr processId){
+	return RTSchedulerAddProgramWithPriority(sched, filePath, ProgramPriority::Normal, processId);
+}
+
+// Read, compile and add a program to the execution schedule, in a priority class
+bool RTSchedulerAddProgramWithPriority(RuntimeSchedulerPtr sched, StringPtr filePath, ProgramPriority priority, StringPtr processId) {
 	if (sched == NULL || filePath == NULL) return false;
 	
-	auto symbols = MapAllocateArena_Name_StringPtr(16, sched->baseMemory);
-	auto code = RTS_Compile(filePath, symbols, sched->baseMemory); // compile to bytecode in the ambient Memory Manager space
-	if (code == NULL) return false;
-    auto prog = InterpAllocate(code, 10 MEGABYTE, symbols); // copy bytecode into a new interpreter
-    VectorDeallocate(code); // deallocate from ambient memory
-	if (prog == NULL) return false;
+	// compile to bytecode, or reuse an earlier compile of the same source. Code and symbols belong to the cache.
+	Vector* code = NULL;
+	HashMap* symbols = NULL;
+	if (!CompileCacheLoad(sched->compileCache, filePath, &code, &symbols)) return false;
+    auto prog = InterpAllocateShared(code, 10 MEGABYTE, symbols); // all instances of a program run the same code
+	if (prog == NULL) {
+		CompileCacheRelease(sched->compileCache, code);
+		return false;
+	}
 
 	sched->programInstanceNumber++;
 	InterpSetId(prog, sched->programInstanceNumber);
 	if (processId != NULL) StringAppendInt32(processId, sched->programInstanceNumber);
 
-	// Store the interpreter
+	// Store the interpreter, ready to run
+	int index = VectorLength(sched->interpreters);
 	VectorPush_InterpreterStatePtr(sched->interpreters, prog);
+	VectorPush_VectorPtr(sched->programCode, code);
+	VectorPush_ProgramSet(sched->programSets, ProgramSet::Runnable);
+	VectorPush_int(sched->waitTimers, -1);
+	VectorPush_ProgramPriority(sched->priorities, priority);
+	VectorPush_ProgramCounters(sched->counters, ProgramCounters{});
+	VectorPush_int(sched->virtualTimes, sched->virtualClock);
+	VectorPush_int(sched->poolOf, -1);
+	VectorPush_int(sched->poolJobs, -1);
+	VectorPush_int(sched->processIndex, index); // at `programInstanceNumber`
+	MakeRunnable(sched, index, false);
 
 	return true;
 }
@@ -158,18 +347,185 @@ int Fault(RuntimeSchedulerPtr sched, int line) {
 }
 
 
-int BroadcastSystemEvents(RuntimeSchedulerPtr sched) {
+// Virtual time added for each cycle run in a priority class. This gives interactive, normal and batch programs shares of 8:4:1.
+int CycleWeight(ProgramPriority priority) {
+	switch (priority) {
+		case ProgramPriority::Interactive: return 1;
+		case ProgramPriority::Batch: return 8;
+		default: return 2;
+	}
+}
+
+// How far a woken interactive program's virtual time can be ahead of the clock and still pre-empt.
+// Programs that use more than their share wait their turn like any other.
+constexpr auto PREEMPT_ALLOWANCE = 1 << 16;
+
+// When the virtual clock passes this, all virtual times are moved back so they stay inside heap priorities
+constexpr auto VIRTUAL_TIME_LIMIT = 1 << 30;
+
+// Put a program in the runnable set.
+// Time spent waiting doesn't build up credit, so a program never starts behind the virtual clock.
+// An interactive program that was `woken` from a wait runs at the next slice, unless it has been using more than its share.
+void MakeRunnable(RuntimeSchedulerPtr sched, int index, bool woken) {
+	*VectorGet_ProgramSet(sched->programSets, index) = ProgramSet::Runnable;
 
-	// get any event
-	if (!EventPoll(sched->sysEventTarget, sched->sysEventData)) return 0;
+	auto virtualTime = VectorGet_int(sched->virtualTimes, index);
+	if (*virtualTime < sched->virtualClock) *virtualTime = sched->virtualClock;
 
+	if (woken && *VectorGet_ProgramPriority(sched->priorities, index) == ProgramPriority::Interactive
+		&& *virtualTime - sched->virtualClock <= PREEMPT_ALLOWANCE) {
+		DeqPushBack_int(sched->preempting, index);
+		return;
+	}
+
+	HeapInsert_int(sched->runnable, *virtualTime, &index);
+	sched->runnableCount++;
+}
+
+// Take the next program to run out of the runnable set. Returns false if the set is empty.
+bool NextRunnable(RuntimeSchedulerPtr sched, int* index) {
+	if (DeqPopFront_int(sched->preempting, index)) return true;
+	if (!HeapDeleteMin_int(sched->runnable, index)) return false;
+
+	sched->runnableCount--;
+	auto virtualTime = *VectorGet_int(sched->virtualTimes, *index);
+	if (virtualTime > sched->virtualClock) sched->virtualClock = virtualTime;
+	return true;
+}
+
+// Number of programs in the runnable set
+int RunnableCount(RuntimeSchedulerPtr sched) {
+	return sched->runnableCount + DeqLength(sched->preempting);
+}
+
+// Move every virtual time back by the clock, so they don't overflow. Only the order matters.
+// Must be called between slices, when every program in the runnable set is queued. Pre-empting programs lose their place.
+void RebaseVirtualTimes(RuntimeSchedulerPtr sched) {
+	auto shift = sched->virtualClock;
+	sched->virtualClock = 0;
+
+	HeapClear(sched->runnable);
+	DeqClear(sched->preempting);
+	sched->runnableCount = 0;
+
+	int length = VectorLength(sched->virtualTimes);
+	for (int i = 0; i < length; i++) {
+		auto virtualTime = VectorGet_int(sched->virtualTimes, i);
+		*virtualTime = (*virtualTime > shift) ? *virtualTime - shift : 0;
+
+		if (*VectorGet_ProgramSet(sched->programSets, i) != ProgramSet::Runnable) continue;
+		HeapInsert_int(sched->runnable, *virtualTime, &i);
+		sched->runnableCount++;
+	}
+}
+
+// Move a parked program to the runnable set, cancelling any timeout on its wait
+void WakeProgram(RuntimeSchedulerPtr sched, int index) {
+	auto timer = VectorGet_int(sched->waitTimers, index);
+	if (*timer >= 0) TimerWheelCancel(sched->timers, *timer);
+	*timer = -1;
+
+	auto counters = VectorGet_ProgramCounters(sched->counters, index);
+	counters->waitTime += MonotonicNanoseconds() - counters->waitStart;
+
+	sched->waitingCount--;
+	MakeRunnable(sched, index, true);
+}
+
+// If a parked program now has the message it was waiting for, move it to the runnable set
+void WakeIfReady(RuntimeSchedulerPtr sched, int index, InterpreterState* interp) {
+	auto set = VectorGet_ProgramSet(sched->programSets, index);
+	if (*set == ProgramSet::Waiting && InterpreterCurrentState(interp) == ExecutionState::IPC_Ready) {
+		WakeProgram(sched, index);
+	}
+}
+
+// Give a copy of a message to one program, if it listens for it.
+// `sender` is the process ID of the program that sent it, or zero for messages from the system.
+// If the program was parked waiting for the message, it moves to the runnable set.
+// Returns false if the program failed to store the message.
+bool DeliverIPCTo(RuntimeSchedulerPtr sched, int index, StringPtr target, VectorPtr data, int sender) {
+	auto interp = VectorGet_InterpreterStatePtr(sched->interpreters, index);
+	if (interp == NULL || *interp == NULL) return false;
+
+	if (!InterpAddIPC(*interp, target, data, sender)) return false;
+	WakeIfReady(sched, index, *interp);
+	return true;
+}
+
+// Give a copy of a message to every program that listens for it.
+// Parked programs that were waiting for the message move to the runnable set.
+// Returns false if any program failed to store the message.
+bool DeliverIPC(RuntimeSchedulerPtr sched, StringPtr target, VectorPtr data, int sender) {
+	int length = VectorLength(sched->interpreters);
+	for (int i = 0; i < length; i++) {
+		if (!DeliverIPCTo(sched, i, target, data, sender)) return false;
+	}
+	return true;
+}
+
+// Index of the program with a process ID, or -1 if there is none
+int ProcessIndex(RuntimeSchedulerPtr sched, int processId) {
+	if (processId < 1 || processId >= VectorLength(sched->processIndex)) return -1;
+	return *VectorGet_int(sched->processIndex, processId);
+}
+
+// Tell the bridge about any targets programs have started to listen for since it was last told
+void SyncBridgeListens(RuntimeSchedulerPtr sched) {
+	int total = 0;
 	int length = VectorLength(sched->interpreters);
 	for (int i = 0; i < length; i++) {
-		auto target = VectorGet_InterpreterStatePtr(sched->interpreters, i);
-		if (target == NULL || *target == NULL) return Fault(sched, __LINE__);
+		total += InterpListenCount(*VectorGet_InterpreterStatePtr(sched->interpreters, i));
+	}
+	if (total == sched->bridgeListens) return;
+	sched->bridgeListens = total;
+
+	for (int i = 0; i < length; i++) {
+		auto targets = InterpListeningIPC(*VectorGet_InterpreterStatePtr(sched->interpreters, i)); // Vector<StringPtr>
+		StringPtr target;
+		while (VectorPop_StringPtr(targets, &target)) {
+			BridgeSubscribe(sched->bridge, target); // names too long to bridge stay local
+		}
+		VectorDeallocate(targets);
+	}
+}
+
+// Send a broadcast message on to other processes that listen for it
+bool PublishToBridge(RuntimeSchedulerPtr sched, StringPtr target, VectorPtr data) {
+	if (sched->bridge == NULL) return true;
+
+	// The sender may have only just started listening for its answer, so make sure that goes first
+	SyncBridgeListens(sched);
+	return BridgePublish(sched->bridge, target, data);
+}
+
+// Pass all messages from other processes to the programs.
+// They are read straight from shared memory, so each program's copy is the only one made in this process.
+int PumpBridge(RuntimeSchedulerPtr sched) {
+	if (sched->bridge == NULL) return 0;
+	SyncBridgeListens(sched);
+
+	const uint8_t* bytes;
+	int length;
+	while (BridgeReceive(sched->bridge, sched->bridgeTarget, &bytes, &length)) {
+		int count = VectorLength(sched->interpreters);
+		for (int i = 0; i < count; i++) {
+			auto interp = *VectorGet_InterpreterStatePtr(sched->interpreters, i);
+			if (!InterpAddIPCBytes(interp, sched->bridgeTarget, bytes, length, 0)) {
+				BridgeRelease(sched->bridge);
+				return Fault(sched, __LINE__);
+			}
+			WakeIfReady(sched, i, interp);
+		}
+		BridgeRelease(sched->bridge);
+	}
+	return 0;
+}
 
-		bool ok = InterpAddIPC(*target, sched->sysEventTarget, sched->sysEventData);
-		if (!ok) return Fault(sched, __LINE__);
+// Pass all pending system events to the programs
+int BroadcastSystemEvents(RuntimeSchedulerPtr sched) {
+	while (EventPoll(sched->sysEventTarget, sched->sysEventData)) {
+		if (!DeliverIPC(sched, sched->sysEventTarget, sched->sysEventData, 0)) return Fault(sched, __LINE__);
 	}
 	return 0;
 }
@@ -178,58 +534,388 @@ constexpr auto OK = 0;
 constexpr auto ALL_COMPLETE = -1;
 constexpr auto DROP_THRU = -2;
 
-// Run ONE of the scheduled programs for a given number of rounds.
-// Each time you call this, a different program may be given the rounds.
-// Will return false if there is a fault or all programs have ended.
-// (use `RTSchedulerState` function to get a flag, and the `RTSchedulerProgramStatistics` function to get detailed states)
-int RTSchedulerRun(RuntimeSchedulerPtr sched, int rounds, StringPtr consoleOut) {
-	if (sched == NULL) return Fault(sched, __LINE__);
+// Owner of the animation frame timer. Other timers are owned by the index of the waiting program.
+constexpr auto FRAME_TIMER = -1;
 
-	// Check for waiting system events
-	auto sysresult = BroadcastSystemEvents(sched);
-	if (sysresult != OK) return sysresult;
+// Milliseconds since the scheduler was allocated
+uint64_t SchedulerClock(RuntimeSchedulerPtr sched) {
+	return (MonotonicNanoseconds() - sched->startTime) / 1000000;
+}
 
-	// TODO: pump the display system if it's attached
+// Start the timer for the frame after `frameCount`
+void ScheduleNextFrame(RuntimeSchedulerPtr sched) {
+	uint64_t due = sched->frameStart + ((sched->frameCount + 1) * 1000) / sched->frameRate;
+	sched->frameTimer = TimerWheelAdd(sched->timers, due, FRAME_TIMER);
+}
+
+// Send a `frame` message to all programs, and start the timer for the next one.
+// Frames missed while the host was busy are skipped, rather than sent in a burst.
+bool SendFrame(RuntimeSchedulerPtr sched, uint64_t now) {
+	sched->frameTimer = -1;
+	uint64_t reached = ((now - sched->frameStart) * sched->frameRate) / 1000;
+	sched->frameCount = (reached > sched->frameCount) ? reached : sched->frameCount + 1;
+
+	MMPush(256 KILOBYTES);
+	auto frameData = MapAllocate_StringPtr_DataTag(2);
+	MapPut_StringPtr_DataTag(frameData, StringNew("frame"), EncodeInt32((int)sched->frameCount), true);
+	MapPut_StringPtr_DataTag(frameData, StringNew("time"), EncodeInt32((int)now), true);
+	bool ok = FreezeToVector(frameData, sched->sysEventData);
+	MMPop();
+	if (!ok) return false;
+
+	StringClear(sched->sysEventTarget);
+	StringAppend(sched->sysEventTarget, "frame");
+	ok = DeliverIPC(sched, sched->sysEventTarget, sched->sysEventData, 0);
+
+	ScheduleNextFrame(sched);
+	return ok;
+}
+
+// Move the timers on to the current time. Programs whose wait has run out are woken, and animation frames are sent.
+int AdvanceTimers(RuntimeSchedulerPtr sched) {
+	auto now = SchedulerClock(sched);
+	VectorClear(sched->firedTimers);
+	if (TimerWheelAdvance(sched->timers, now, sched->firedTimers) < 1) return OK;
+
+	int owner;
+	while (VectorDequeue_int(sched->firedTimers, &owner)) {
+		if (owner == FRAME_TIMER) {
+			if (!SendFrame(sched, now)) return Fault(sched, __LINE__);
+			continue;
+		}
+
+		*VectorGet_int(sched->waitTimers, owner) = -1;
+		if (*VectorGet_ProgramSet(sched->programSets, owner) != ProgramSet::Waiting) continue;
+
+		auto interp = VectorGet_InterpreterStatePtr(sched->interpreters, owner);
+		if (interp == NULL || *interp == NULL) return Fault(sched, __LINE__);
+		InterpWaitTimedOut(*interp);
+		WakeProgram(sched, owner);
+	}
+	return OK;
+}
+
+// IPC target for asking the scheduler for program statistics, and for the answers
+#define STATISTICS_TARGET "sys-stats"
+
+// Add a statistic to a message map. Counts too big for an integer tag are capped.
+void PutStatistic(HashMap* map, const char* name, uint64_t value) {
+	int32_t capped = (value > INT32_MAX) ? INT32_MAX : (int32_t)value;
+	MapPut_StringPtr_DataTag(map, StringNew(name), EncodeInt32(capped), true);
+}
+
+// Send a `sys-stats` message for each program, to every program listening for them
+bool SendStatistics(RuntimeSchedulerPtr sched) {
+	int count = VectorLength(sched->interpreters);
+	for (int i = 0; i < count; i++) {
+		ProgramStatistics stats;
+		if (!RTSchedulerProgramStatistics(sched, i, &stats)) return false;
+
+		MMPush(256 KILOBYTES);
+		auto map = MapAllocate_StringPtr_DataTag(32);
+		PutStatistic(map, "index", i);
+		PutStatistic(map, "programs", count);
+		PutStatistic(map, "id", stats.ProcessId);
+		PutStatistic(map, "priority", (int)stats.Priority);
+		PutStatistic(map, "state", (int)stats.State);
+		PutStatistic(map, "cycles", stats.Cycles);
+		PutStatistic(map, "slices", stats.Slices);
+		PutStatistic(map, "run-ms", stats.RunTime / 1000000);
+		PutStatistic(map, "cpu-ms", stats.CpuTime / 1000000);
+		PutStatistic(map, "wait-ms", stats.WaitTime / 1000000);
+		PutStatistic(map, "messages-in", stats.MessagesIn);
+		PutStatistic(map, "messages-out", stats.MessagesOut);
+		PutStatistic(map, "messages-queued", stats.MessagesQueued);
+		PutStatistic(map, "bytes-sent", stats.BytesSent);
+		PutStatistic(map, "messages-dropped", stats.MessagesDropped);
+		PutStatistic(map, "memory-allocated", stats.MemoryAllocated);
+		PutStatistic(map, "memory-free", stats.MemoryFree);
+		PutStatistic(map, "memory-zones-used", stats.MemoryOccupiedZones);
+		PutStatistic(map, "memory-zones-empty", stats.MemoryEmptyZones);
+		PutStatistic(map, "memory-live-allocations", stats.MemoryLiveAllocations);
+		bool ok = FreezeToVector(map, sched->sysEventData);
+		MMPop();
+		if (!ok) return false;
+
+		StringClear(sched->sysEventTarget);
+		StringAppend(sched->sysEventTarget, STATISTICS_TARGET);
+		if (!DeliverIPC(sched, sched->sysEventTarget, sched->sysEventData, 0)) return false;
+	}
+	return true;
+}
 
-	// Advance the schedule
-	sched->roundRobin++;
+// IPC target for asking the scheduler to start a worker pool
+#define POOL_TARGET "sys-pool"
 
-	// ensure we're in bounds
+// Most workers in one pool. Each worker has its own interpreter memory.
+constexpr auto MAX_POOL_SIZE = 64;
+
+// Index of the pool with this name, or -1 if there is none
+int FindPool(RuntimeSchedulerPtr sched, StringPtr name) {
+	int* pool;
+	if (!MapGet_StringPtr_int(sched->poolNames, name, &pool)) return -1;
+	return *pool;
+}
+
+// Give queued jobs to workers that are idle and listening for the pool's name, one job per worker
+bool DispatchPoolJobs(RuntimeSchedulerPtr sched, int poolIndex) {
+	auto pool = VectorGet_WorkerPool(sched->pools, poolIndex);
+	int count = VectorLength(pool->members);
+	for (int i = 0; i < count; i++) {
+		bool retrying = DeqLength(pool->retry) > 0;
+		if (!retrying && pool->nextJob >= pool->firstJob + DeqLength(pool->jobs)) return true; // nothing left to give out
+
+		int member = *VectorGet_int(pool->members, i);
+		auto working = VectorGet_int(sched->poolJobs, member);
+		if (*working >= 0) continue; // busy
+		if (*VectorGet_ProgramSet(sched->programSets, member) == ProgramSet::Finished) continue;
+		if (!InterpIsListening(*VectorGet_InterpreterStatePtr(sched->interpreters, member), pool->name)) continue; // not started yet
+
+		int number;
+		if (!(retrying && DeqPopFront_int(pool->retry, &number))) number = pool->nextJob++;
+		*working = number;
+
+		auto job = DeqGet_PoolJob(pool->jobs, number - pool->firstJob);
+		auto submitter = VectorGet_InterpreterStatePtr(sched->interpreters, job->submitter);
+		if (!DeliverIPCTo(sched, member, pool->name, job->data, InterpGetId(*submitter))) return false;
+	}
+	return true;
+}
+
+// Send answers back to the programs that sent the jobs, in the order the jobs were sent.
+// Answers that arrive early are held until every earlier job has been answered.
+bool ReturnPoolAnswers(RuntimeSchedulerPtr sched, int poolIndex) {
+	auto pool = VectorGet_WorkerPool(sched->pools, poolIndex);
+	PoolJob job;
+	while (DeqPeekFront_PoolJob(pool->jobs, &job) && job.answer != NULL) {
+		DeqPopFront_PoolJob(pool->jobs, &job);
+		pool->firstJob++;
+
+		bool ok = DeliverIPCTo(sched, job.submitter, pool->name, job.answer, job.answeredBy);
+		VectorDeallocate(job.data);
+		VectorDeallocate(job.answer);
+		if (!ok) return false;
+	}
+	return true;
+}
+
+// Queue a job sent to a pool. The pool takes ownership of the message data.
+bool SubmitPoolJob(RuntimeSchedulerPtr sched, int poolIndex, int submitter, VectorPtr data) {
+	auto pool = VectorGet_WorkerPool(sched->pools, poolIndex);
+	if (!DeqPushBack_PoolJob(pool->jobs, PoolJob{ submitter, data, NULL, 0 })) return false;
+	return DispatchPoolJobs(sched, poolIndex);
+}
+
+// Take a worker's answer to its current job. Answers from a worker with no job are dropped.
+bool AnswerPoolJob(RuntimeSchedulerPtr sched, int poolIndex, int worker, VectorPtr data) {
+	auto working = VectorGet_int(sched->poolJobs, worker);
+	if (*working < 0) {
+		VectorDeallocate(data);
+		return true;
+	}
+
+	auto pool = VectorGet_WorkerPool(sched->pools, poolIndex);
+	auto job = DeqGet_PoolJob(pool->jobs, *working - pool->firstJob);
+	job->answer = data;
+	job->answeredBy = InterpGetId(*VectorGet_InterpreterStatePtr(sched->interpreters, worker));
+	*working = -1;
+
+	return ReturnPoolAnswers(sched, poolIndex) && DispatchPoolJobs(sched, poolIndex);
+}
+
+// A worker has ended. If it had a job, give the job to another worker.
+bool RetryPoolJob(RuntimeSchedulerPtr sched, int worker) {
+	int poolIndex = *VectorGet_int(sched->poolOf, worker);
+	auto working = VectorGet_int(sched->poolJobs, worker);
+	if (poolIndex < 0 || *working < 0) return true;
+
+	auto pool = VectorGet_WorkerPool(sched->pools, poolIndex);
+	if (!DeqPushBack_int(pool->retry, *working)) return false;
+	*working = -1;
+	return DispatchPoolJobs(sched, poolIndex);
+}
+
+bool RTSchedulerCreatePool(RuntimeSchedulerPtr sched, StringPtr name, StringPtr filePath, int size) {
+	if (sched == NULL || name == NULL || filePath == NULL) return false;
+	if (size < 1 || size > MAX_POOL_SIZE || StringLength(name) < 1) return false;
+	if (StringAreEqual(name, POOL_TARGET) || StringAreEqual(name, STATISTICS_TARGET)) return false;
+
+	int poolIndex = FindPool(sched, name);
+	if (poolIndex < 0) {
+		WorkerPool pool = {};
+		pool.name = StringClone(name, sched->baseMemory);
+		pool.members = VectorAllocateArena_int(sched->baseMemory);
+		pool.jobs = DeqAllocateArena_PoolJob(sched->baseMemory);
+		pool.retry = DeqAllocateArena_int(sched->baseMemory);
+		if (pool.name == NULL || pool.members == NULL || pool.jobs == NULL || pool.retry == NULL) return false;
+
+		poolIndex = VectorLength(sched->pools);
+		if (!VectorPush_WorkerPool(sched->pools, pool)) return false;
+		if (!MapPut_StringPtr_int(sched->poolNames, pool.name, poolIndex, true)) return false;
+	}
+
+	for (int i = 0; i < size; i++) {
+		int index = VectorLength(sched->interpreters);
+		if (!RTSchedulerAddProgram(sched, filePath, NULL)) return false;
+
+		*VectorGet_int(sched->poolOf, index) = poolIndex;
+		if (!VectorPush_int(VectorGet_WorkerPool(sched->pools, poolIndex)->members, index)) return false;
+	}
+	return true;
+}
+
+// Copy a string value out of a map that was defrosted into `memory`. Returns false if the key is missing or not a string.
+bool ReadMessageString(Arena* memory, HashMap* map, const char* key, StringPtr target) {
+	DataTag* value;
+	if (!MapGet_StringPtr_DataTag(map, StringNew(key), &value)) return false;
+
+	switch ((DataType)value->type) {
+		case DataType::SmallString:
+			DecodeShortStr(*value, target);
+			return true;
+		case DataType::StringPtr:
+			StringAppend(target, (StringPtr)ArenaOffsetToPtr(memory, DecodePointer(*value)));
+			return true;
+		default:
+			return false;
+	}
+}
+
+// Start a pool from a `sys-pool` request: a map with "name", "program" and "size" keys
+bool StartPoolFromMessage(RuntimeSchedulerPtr sched, VectorPtr data) {
+	auto name = StringEmptyInArena(sched->baseMemory);
+	auto filePath = StringEmptyInArena(sched->baseMemory);
+	int size = 1;
+
+	MMPush(256 KILOBYTES);
+	auto memory = MMCurrent();
+	DataTag root = {};
+	bool ok = DefrostFromVector(&root, memory, data) && root.type == (int)DataType::HashtablePtr;
+	if (ok) {
+		auto map = (HashMap*)ArenaOffsetToPtr(memory, DecodePointer(root));
+		ok = ReadMessageString(memory, map, "name", name) && ReadMessageString(memory, map, "program", filePath);
+
+		DataTag* sizeTag;
+		if (MapGet_StringPtr_DataTag(map, StringNew("size"), &sizeTag)) {
+			ok = ok && sizeTag->type == (int)DataType::Integer;
+			size = DecodeInt32(*sizeTag);
+		}
+	}
+	MMPop();
+
+	ok = ok && RTSchedulerCreatePool(sched, name, filePath, size);
+	StringDeallocate(name);
+	StringDeallocate(filePath);
+	return ok;
+}
+
+// Result of `RunSlice` when no program could be run. Never returned to the caller.
+constexpr auto NOTHING_RUNNABLE = -3;
+
+// Put a program that has just run into the set that matches its new state
+void PlaceProgram(RuntimeSchedulerPtr sched, int index, ExecutionState state) {
+	auto set = VectorGet_ProgramSet(sched->programSets, index);
+	switch (state) {
+		case ExecutionState::IPC_Wait:
+			*set = ProgramSet::Waiting;
+			sched->waitingCount++;
+			VectorGet_ProgramCounters(sched->counters, index)->waitStart = MonotonicNanoseconds();
+			break;
+
+		case ExecutionState::Complete:
+			*set = ProgramSet::Finished;
+			sched->finishedCount++;
+			break;
+
+		default:
+			MakeRunnable(sched, index, false);
+			break;
+	}
+}
+
+// Processor time is read for one slice in this many, as reading it costs about as much as a short slice.
+// A program's processor time is estimated from the sampled slices, in proportion to its total run time.
+constexpr auto CPU_SAMPLE_INTERVAL = 16;
+
+// Fewest rounds in a slice when slices are sized to the target latency
+constexpr auto MIN_SLICE_ROUNDS = 64;
+
+// Rounds for the next slice. With a target latency, slices get shorter as more programs are runnable, but are never longer than `rounds`.
+int SliceRounds(RuntimeSchedulerPtr sched, int rounds) {
+	if (sched->targetLatency == 0 || sched->cycleCost == 0) return rounds;
+
+	uint64_t perSlice = sched->targetLatency / (RunnableCount(sched) + 1); // +1 for the program about to run
+	uint64_t cycles = (perSlice * 1024) / sched->cycleCost;
+	if (cycles >= (uint64_t)rounds) return rounds;
+	if (cycles < MIN_SLICE_ROUNDS) return (rounds < MIN_SLICE_ROUNDS) ? rounds : MIN_SLICE_ROUNDS;
+	return (int)cycles;
+}
+
+// Update the average cost of a cycle from a slice that ran `cycles` in `nanoseconds`
+void MeasureSlice(RuntimeSchedulerPtr sched, int cycles, uint64_t nanoseconds) {
+	if (cycles < MIN_SLICE_ROUNDS) return; // too short to tell the cost of cycles from the cost of switching
+	uint64_t cost = (nanoseconds * 1024) / cycles;
+	sched->cycleCost = (sched->cycleCost == 0) ? cost : (sched->cycleCost * 7 + cost) / 8;
+}
+
+// Run the next program in the runnable set for (at most) a given number of rounds
+int RunSlice(RuntimeSchedulerPtr sched, int rounds, StringPtr consoleOut) {
 	int max = VectorLength(sched->interpreters);
 	if (max < 1) return Fault(sched, __LINE__);
-	if (sched->roundRobin >= max) { sched->roundRobin = 0; }
+
+	if (sched->virtualClock > VIRTUAL_TIME_LIMIT) RebaseVirtualTimes(sched);
 
 	// find the interpreter
-	auto isp = VectorGet_InterpreterStatePtr(sched->interpreters, sched->roundRobin);
+	int index;
+	if (!NextRunnable(sched, &index)) {
+		if (sched->finishedCount < max) return NOTHING_RUNNABLE;
+		sched->state = SchedulerState::Complete;
+		return ALL_COMPLETE;
+	}
+	sched->roundRobin = index;
+
+	auto isp = VectorGet_InterpreterStatePtr(sched->interpreters, index);
 	if (isp == NULL || *isp == NULL) return Fault(sched, __LINE__);
 	auto is = *isp;
 
-	// check state and run if appropriate
-	// if not, we do nothing and return true (expecting the scheduler to be run endlessly)
-	auto state = InterpreterCurrentState(is);
+	int sliceRounds = SliceRounds(sched, rounds);
+	auto counters = VectorGet_ProgramCounters(sched->counters, index);
+	bool sampleCpu = (counters->slices % CPU_SAMPLE_INTERVAL) == 0;
+	uint64_t cpuStart = sampleCpu ? ThreadCpuNanoseconds() : 0;
+	uint64_t sliceStart = MonotonicNanoseconds();
 
+	// Only runnable states should be in the set
 	ExecutionResult result;
-	switch (state) {
+	switch (InterpreterCurrentState(is)) {
 		// Valid run states
 		case ExecutionState::Paused: // normal stop for time-slice
 		case ExecutionState::Waiting: // waiting for console data. Will loop if not enough data
 		case ExecutionState::IPC_Ready: // was waiting, now has data
 		case ExecutionState::IPC_Send: // requested a send, can now continue
 		case ExecutionState::IPC_Spawn:
-			result = InterpRun(is, rounds);
+			TRACE_BEGIN(TRACE_SLICE, "slice", index);
+			result = InterpRun(is, sliceRounds);
+			TRACE_END(TRACE_SLICE, "slice", index);
 			break;
 
-		// Valid wait states
-		case ExecutionState::Complete:
-		case ExecutionState::Running:
-		case ExecutionState::IPC_Wait:
-			return OK; // calling again will cycle through interpreters
-
 		// Fail states
 		default:
 			return Fault(sched, __LINE__);
 	}
 
+	// Charge the program for the cycles it used
+	uint64_t sliceTime = MonotonicNanoseconds() - sliceStart;
+	if (sampleCpu) {
+		counters->cpuSampled += ThreadCpuNanoseconds() - cpuStart;
+		counters->runSampled += sliceTime;
+	}
+	counters->runTime += sliceTime;
+	counters->cycles += result.Cycles;
+	counters->slices++;
+
+	if (sched->targetLatency > 0) MeasureSlice(sched, result.Cycles, sliceTime);
+	*VectorGet_int(sched->virtualTimes, index) += result.Cycles * CycleWeight(*VectorGet_ProgramPriority(sched->priorities, index));
+
 	// Move output
 	ReadOutput(is, consoleOut);
 
@@ -245,8 +931,10 @@ int RTSchedulerRun(RuntimeSchedulerPtr sched, int rounds, StringPtr consoleOut)
 
 		case ExecutionState::IPC_Spawn:
 		{
+			PlaceProgram(sched, index, result.State);
 			StringPtr procId = StringEmptyInArena(sched->baseMemory);
-			if (!RTSchedulerAddProgram(sched, result.IPC_Out_Target, procId)){
+			auto priority = (result.IPC_Priority < 0) ? ProgramPriority::Normal : (ProgramPriority)result.IPC_Priority;
+			if (!RTSchedulerAddProgramWithPriority(sched, result.IPC_Out_Target, priority, procId)){
 				return Fault(sched, __LINE__);
 			}
 			StringClear(result.IPC_Out_Target);
@@ -256,18 +944,45 @@ int RTSchedulerRun(RuntimeSchedulerPtr sched, int rounds, StringPtr consoleOut)
 			return OK;
 		}
 
-		// Broadcast IPC to all programs (including self)
+		// Send IPC to one program, or broadcast to all programs (including self)
 		case ExecutionState::IPC_Send:
 		{
 			if (result.IPC_Out_Target == NULL || result.IPC_Out_Data == NULL) return Fault(sched, __LINE__); // invalid IPC call
-			int length = VectorLength(sched->interpreters);
-			for (int i = 0; i < length; i++) {
-				auto target = VectorGet_InterpreterStatePtr(sched->interpreters, i);
-				if (target == NULL || *target == NULL) return Fault(sched, __LINE__);
+			PlaceProgram(sched, index, result.State);
+			counters->messagesOut++;
+			counters->bytesSent += VectorLength(result.IPC_Out_Data);
+			TRACE_EVENT(TRACE_IPC, "ipc-send", VectorLength(result.IPC_Out_Data), index);
+
+			// Messages sent to one program go straight to it, without looking at any other program.
+			// Messages for programs that don't exist are dropped, as a broadcast nobody listens to would be.
+			if (result.IPC_Out_Process != 0) {
+				int receiver = ProcessIndex(sched, result.IPC_Out_Process);
+				bool delivered = (receiver < 0) || DeliverIPCTo(sched, receiver, result.IPC_Out_Target, result.IPC_Out_Data, InterpGetId(is));
+				VectorDeallocate(result.IPC_Out_Data);
+				StringDeallocate(result.IPC_Out_Target);
+				return delivered ? OK : Fault(sched, __LINE__);
+			}
+
+			// Messages to a pool go to one of its workers, or back from the worker to the sender. The pool takes the message data.
+			int pool = FindPool(sched, result.IPC_Out_Target);
+			if (pool >= 0) {
+				bool handled = (*VectorGet_int(sched->poolOf, index) == pool)
+					? AnswerPoolJob(sched, pool, index, result.IPC_Out_Data)
+					: SubmitPoolJob(sched, pool, index, result.IPC_Out_Data);
+				StringDeallocate(result.IPC_Out_Target);
+				return handled ? OK : Fault(sched, __LINE__);
+			}
 
-				bool ok = InterpAddIPC(*target, result.IPC_Out_Target, result.IPC_Out_Data);
-				if (!ok) return Fault(sched, __LINE__);
+			// Requests to the scheduler are answered, rather than passed on
+			bool delivered;
+			if (StringAreEqual(result.IPC_Out_Target, STATISTICS_TARGET)) delivered = SendStatistics(sched);
+			else if (StringAreEqual(result.IPC_Out_Target, POOL_TARGET)) delivered = StartPoolFromMessage(sched, result.IPC_Out_Data);
+			else {
+				delivered = DeliverIPC(sched, result.IPC_Out_Target, result.IPC_Out_Data, InterpGetId(is));
+				// Other processes missing a message is not a fault here: their ring space is not ours to wait for
+				if (delivered && !PublishToBridge(sched, result.IPC_Out_Target, result.IPC_Out_Data)) counters->messagesDropped++;
 			}
+			if (!delivered) return Fault(sched, __LINE__);
 
 			// deallocate IPC data
 			VectorDeallocate(result.IPC_Out_Data);
@@ -280,30 +995,114 @@ int RTSchedulerRun(RuntimeSchedulerPtr sched, int rounds, StringPtr consoleOut)
 		case ExecutionState::Complete:
 		{
 			// TODO: Broadcast a termination message to remaining interpreters with the stopped program's unique instance ID
+			PlaceProgram(sched, index, result.State);
+			if (!RetryPoolJob(sched, index)) return Fault(sched, __LINE__);
 
-			// Check to see if all programs have finished.
-			// If so, return non-success.
-			int length = VectorLength(sched->interpreters);
-			for (int i = 0; i < length; i++) {
-				auto target = VectorGet_InterpreterStatePtr(sched->interpreters, i);
-				if (target == NULL || *target == NULL) return Fault(sched, __LINE__);
-				bool done = InterpreterCurrentState(*target) == ExecutionState::Complete;
-
-				if (!done) return OK; // at least one more to run
-			}
+			// If all programs have finished, return non-success.
+			if (sched->finishedCount < max) return OK; // at least one more to run
 			sched->state = SchedulerState::Complete;
 			return ALL_COMPLETE;
 		}
 		break;
 
+		// Waiting for a message or a time. If there is a time limit, start a timer to wake the program.
+		case ExecutionState::IPC_Wait:
+		{
+			PlaceProgram(sched, index, result.State);
+			if (result.IPC_Timeout >= 0) {
+				auto handle = TimerWheelAdd(sched->timers, SchedulerClock(sched) + result.IPC_Timeout, index);
+				if (handle < 0) return Fault(sched, __LINE__);
+				*VectorGet_int(sched->waitTimers, index) = handle;
+			}
+
+			// A new worker is ready once it listens for its pool
+			int pool = *VectorGet_int(sched->poolOf, index);
+			if (pool >= 0 && !DispatchPoolJobs(sched, pool)) return Fault(sched, __LINE__);
+			return OK;
+		}
+
 		// Valid stop states
 		default:
+			PlaceProgram(sched, index, result.State);
 			return OK;
 	}
 
 	return DROP_THRU; // Shouldn't actually hit this
 }
 
+// Run ONE of the runnable programs for a given number of rounds.
+// Each time you call this, a different program may be given the rounds.
+// Programs waiting for IPC are skipped, so this returns quickly if nothing can run.
+// Will return non-zero if there is a fault or all programs have ended.
+// (use `RTSchedulerState` function to get a flag, and the `RTSchedulerProgramStatistics` function to get detailed states)
+int RTSchedulerRun(RuntimeSchedulerPtr sched, int rounds, StringPtr consoleOut) {
+	if (sched == NULL) return Fault(sched, __LINE__);
+
+	// Check for waiting system events, messages from other processes, and timers that have run out
+	auto sysresult = BroadcastSystemEvents(sched);
+	if (sysresult != OK) return sysresult;
+	auto bridgeResult = PumpBridge(sched);
+	if (bridgeResult != OK) return bridgeResult;
+	auto timerResult = AdvanceTimers(sched);
+	if (timerResult != OK) return timerResult;
+
+	// TODO: pump the display system if it's attached
+
+	auto result = RunSlice(sched, rounds, consoleOut);
+	return (result == NOTHING_RUNNABLE) ? OK : result;
+}
+
+// Give every runnable program one slice of the given number of rounds.
+// If no program can run, sleep until a system event arrives or `maxWaitMs` has passed.
+// Will return non-zero if there is a fault or all programs have ended.
+int RTSchedulerRunUntilIdle(RuntimeSchedulerPtr sched, int rounds, StringPtr consoleOut, int maxWaitMs) {
+	if (sched == NULL) return Fault(sched, __LINE__);
+	if (VectorLength(sched->interpreters) < 1) return Fault(sched, __LINE__);
+
+	auto sysresult = BroadcastSystemEvents(sched);
+	if (sysresult != OK) return sysresult;
+	auto bridgeResult = PumpBridge(sched);
+	if (bridgeResult != OK) return bridgeResult;
+	auto timerResult = AdvanceTimers(sched);
+	if (timerResult != OK) return timerResult;
+
+	// Programs woken during this pass wait for the next, so a chatty pair can't hold the caller here
+	int slices = RunnableCount(sched);
+	for (int i = 0; i < slices; i++) {
+		auto result = RunSlice(sched, rounds, consoleOut);
+		if (result == NOTHING_RUNNABLE) break;
+		if (result != OK) return result;
+	}
+	if (RunnableCount(sched) > 0) return OK;
+
+	if (sched->finishedCount >= VectorLength(sched->interpreters)) {
+		sched->state = SchedulerState::Complete;
+		return ALL_COMPLETE;
+	}
+
+	// Timers may have run out while the programs ran
+	timerResult = AdvanceTimers(sched);
+	if (timerResult != OK) return timerResult;
+	if (RunnableCount(sched) > 0) return OK;
+
+	// Everything left is parked. Sleep until an event, or the next timer.
+	auto nextTimer = TimerWheelNextDue(sched->timers);
+	if (nextTimer >= 0 && nextTimer < maxWaitMs) maxWaitMs = (int)nextTimer;
+
+	// With a bridge, sleep on its sockets instead, and only check for system events
+	if (sched->bridge != NULL) {
+		if (BridgeWait(sched->bridge, maxWaitMs)) {
+			bridgeResult = PumpBridge(sched);
+			if (bridgeResult != OK) return bridgeResult;
+		}
+		maxWaitMs = 0;
+	}
+	if (EventWait(sched->sysEventTarget, sched->sysEventData, maxWaitMs)) {
+		if (!DeliverIPC(sched, sched->sysEventTarget, sched->sysEventData, 0)) return Fault(sched, __LINE__);
+	}
+	return AdvanceTimers(sched);
+}
+
 // Write a description of the compiled code to a string
 void RTSchedulerDebugDump(RuntimeSchedulerPtr sched, StringPtr target) {
 	if (sched == NULL || target == NULL) return;
@@ -321,11 +1120,74 @@ void RTSchedulerDebugDump(RuntimeSchedulerPtr sched, StringPtr target) {
 	}
 }
 
+void RTSchedulerSetTargetLatency(RuntimeSchedulerPtr sched, int milliseconds) {
+	if (sched == NULL) return;
+	sched->targetLatency = (milliseconds > 0) ? (uint64_t)milliseconds * 1000000 : 0;
+}
+
+void RTSchedulerSetFrameRate(RuntimeSchedulerPtr sched, int framesPerSecond) {
+	if (sched == NULL) return;
+
+	if (sched->frameTimer >= 0) TimerWheelCancel(sched->timers, sched->frameTimer);
+	sched->frameTimer = -1;
+	sched->frameRate = (framesPerSecond > 0) ? framesPerSecond : 0;
+	if (sched->frameRate == 0) return;
+
+	sched->frameStart = SchedulerClock(sched);
+	sched->frameCount = 0;
+	ScheduleNextFrame(sched);
+}
+
+void RTSchedulerAttachBridge(RuntimeSchedulerPtr sched, IPCBridge* bridge) {
+	if (sched == NULL) return;
+	sched->bridge = bridge;
+	sched->bridgeListens = -1; // tell the new bridge about everything
+}
+
 int RTSchedulerLastProgramIndex(RuntimeSchedulerPtr sched) {
 	if (sched == NULL) return -1;
 	return sched->roundRobin;
 }
 
+int RTSchedulerProgramCount(RuntimeSchedulerPtr sched) {
+	if (sched == NULL) return 0;
+	return VectorLength(sched->interpreters);
+}
+
+bool RTSchedulerProgramStatistics(RuntimeSchedulerPtr sched, int index, ProgramStatistics* stats) {
+	if (sched == NULL || stats == NULL || index < 0 || index >= RTSchedulerProgramCount(sched)) return false;
+
+	auto isp = VectorGet_InterpreterStatePtr(sched->interpreters, index);
+	if (isp == NULL || *isp == NULL) return false;
+	auto is = *isp;
+	auto counters = VectorGet_ProgramCounters(sched->counters, index);
+
+	*stats = ProgramStatistics{};
+	stats->ProcessId = InterpGetId(is);
+	stats->Priority = *VectorGet_ProgramPriority(sched->priorities, index);
+	stats->State = InterpreterCurrentState(is);
+
+	stats->Cycles = counters->cycles;
+	stats->Slices = counters->slices;
+	stats->RunTime = counters->runTime;
+	if (counters->runSampled > 0) stats->CpuTime = (uint64_t)(((double)counters->cpuSampled / counters->runSampled) * counters->runTime);
+	stats->WaitTime = counters->waitTime;
+	if (*VectorGet_ProgramSet(sched->programSets, index) == ProgramSet::Waiting) {
+		stats->WaitTime += MonotonicNanoseconds() - counters->waitStart; // include the wait it's in now
+	}
+
+	int received = 0;
+	InterpIPCStatistics(is, &received, &stats->MessagesQueued);
+	stats->MessagesIn = received;
+	stats->MessagesOut = counters->messagesOut;
+	stats->BytesSent = counters->bytesSent;
+	stats->MessagesDropped = counters->messagesDropped;
+
+	ArenaGetState(InterpInternalMemory(is), &stats->MemoryAllocated, &stats->MemoryFree,
+		&stats->MemoryOccupiedZones, &stats->MemoryEmptyZones, &stats->MemoryLiveAllocations, NULL);
+	return true;
+}
+
 // Return a state for the scheduler
 SchedulerState RTSchedulerState(RuntimeSchedulerPtr sched){
 	if (sched == NULL) return SchedulerState::Faulted;
@@ -8,6 +8,7 @@
 #include "String.h"
 #include "Vector.h"
 #include "TagCodeInterpreter.h"
+#include "BridgeSys.h"
 
 #ifndef runtimescheduler_h
 #define runtimescheduler_h
@@ -25,6 +26,51 @@ enum class SchedulerState {
 	Complete = 3
 };
 
+// Share of time given to a program. Runnable programs get cycles in the ratio 8:4:1, by class.
+enum class ProgramPriority : uint8_t {
+	// Handles input or display. When woken by a message or timer, it runs at the next slice.
+	Interactive = 0,
+	// The default for new programs
+	Normal = 1,
+	// Background work, that gets time when other programs don't need it
+	Batch = 2
+};
+
+// Run-time statistics for one scheduled program. Times are in nanoseconds.
+typedef struct ProgramStatistics {
+	// Unique instance ID, as given back by `run:`
+	int ProcessId;
+	ProgramPriority Priority;
+	// State the program stopped in after its last slice
+	ExecutionState State;
+
+	// Opcodes run, and time slices given
+	uint64_t Cycles;
+	uint64_t Slices;
+	// Wall-clock and processor time spent running. Processor time is estimated from a sample of the slices.
+	uint64_t RunTime;
+	uint64_t CpuTime;
+	// Wall-clock time spent parked, waiting for a message or timer
+	uint64_t WaitTime;
+
+	// IPC messages accepted, sent, and accepted but not yet read
+	uint64_t MessagesIn;
+	uint64_t MessagesOut;
+	int MessagesQueued;
+	// Serialised size of all the messages sent
+	uint64_t BytesSent;
+	// Messages that could not be passed to other processes on the bridge, because its ring was full or they were too big
+	uint64_t MessagesDropped;
+
+	// The program's memory arena. Memory is given out from zones, and a zone is only reused once everything in it is freed,
+	// so `MemoryAllocated` includes freed space in zones still in use. Many occupied zones holding few allocations is fragmentation.
+	size_t MemoryAllocated;
+	size_t MemoryFree;
+	int MemoryOccupiedZones;
+	int MemoryEmptyZones;
+	int MemoryLiveAllocations;
+} ProgramStatistics;
+
 // Allocate a new scheduler. The scheduler will create its own memory arenas, and those for the interpreters.
 RuntimeSchedulerPtr RTSchedulerAllocate();
 
@@ -34,18 +80,62 @@ void RTSchedulerDeallocate(RuntimeSchedulerPtr *sched);
 // Read, compile and add a program to the execution schedule
 // Returns false if there were any errors loading
 // If the `processId` string is provided, it will have the process instance unique ID appended to it.
+// Programs can message each other by process ID with `send-to`. Messages are found from the ID in constant time, without looking at other programs.
 bool RTSchedulerAddProgram(RuntimeSchedulerPtr sched, StringPtr filePath, StringPtr processId);
 
+// Read, compile and add a program to the execution schedule, in a priority class.
+// Programs started with `run:("file.ecs" "batch")` are added this way. `RTSchedulerAddProgram` uses the normal class.
+bool RTSchedulerAddProgramWithPriority(RuntimeSchedulerPtr sched, StringPtr filePath, ProgramPriority priority, StringPtr processId);
+
 // Run ONE of the scheduled programs for a given number of rounds.
-// Each time you call this, a different program may be given the rounds.
+// Each time you call this, a different program may be given the rounds. The program that has had least of its share of cycles runs next.
+// Programs waiting for IPC are parked, and are not run again until a message they are waiting for arrives.
 // Will return non-zero if there is a fault or all programs have ended.
 // (use `RTSchedulerState` function to get a flag, and the `RTSchedulerProgramStatistics` function to get detailed states)
 // `consoleOut` is optional. If supplied, it will be filled with console data from the run program. If not, the program's console will be cleared.
 int RTSchedulerRun(RuntimeSchedulerPtr sched, int rounds, StringPtr consoleOut);
 
+// Give every runnable program one slice of the given number of rounds.
+// If no program can run, this blocks until a system event arrives, the next timer (`sleep`, `wait-for` or frame) is due,
+// or until `maxWaitMs` has passed.
+// Use this in a loop instead of `RTSchedulerRun` so idle programs don't use any CPU time.
+// Return values are as for `RTSchedulerRun`.
+int RTSchedulerRunUntilIdle(RuntimeSchedulerPtr sched, int rounds, StringPtr consoleOut, int maxWaitMs);
+
+// Size time slices so every runnable program gets a turn within this many milliseconds.
+// Slices are never longer than the `rounds` given to the run calls. Use zero (the default) to always run the full rounds.
+void RTSchedulerSetTargetLatency(RuntimeSchedulerPtr sched, int milliseconds);
+
+// Send a `frame` message to all programs this many times a second, with the frame number and time in milliseconds.
+// Use zero to stop sending frames. Frames are off when the scheduler is allocated.
+void RTSchedulerSetFrameRate(RuntimeSchedulerPtr sched, int framesPerSecond);
+
 // Return a state for the scheduler
 SchedulerState RTSchedulerState(RuntimeSchedulerPtr sched);
 
+// Number of programs that have been added to the scheduler, including any that have finished
+int RTSchedulerProgramCount(RuntimeSchedulerPtr sched);
+
+// Read statistics for the program at `index` (zero up to `RTSchedulerProgramCount`). Returns false if there is no such program.
+// Programs can ask for the same figures by sending any message to `sys-stats`. The scheduler then sends one `sys-stats` message
+// per program, each a map with "index" and "programs" keys so the listener knows how many to read. Times in the map are milliseconds.
+bool RTSchedulerProgramStatistics(RuntimeSchedulerPtr sched, int index, ProgramStatistics* stats);
+
+// Start `size` copies of a program as a worker pool, and take over the IPC target `name` for the pool.
+// Messages sent to the pool's name are no longer broadcast. Each is held by the scheduler as a job, and given to one idle worker
+// that listens for the name. Workers get one job at a time, so busy workers are not given more.
+// A worker answers by sending to the pool's name. Answers go back only to the program that sent the job, and always in the order
+// the jobs were sent, so a sender should `listen` for the pool's name too. If a worker ends without answering, its job goes to another.
+// If the pool already exists, more workers are added to it. Returns false if the program could not be loaded, or the size is not 1 to 64.
+// Programs can start a pool by sending a map with "name", "program" and "size" keys to `sys-pool`.
+bool RTSchedulerCreatePool(RuntimeSchedulerPtr sched, StringPtr name, StringPtr filePath, int size);
+
+// Share IPC targets with schedulers in other processes (see `BridgeSys.h`). Pass NULL to stop.
+// Broadcast messages are also sent to other processes that listen for the target, and their messages arrive here as if sent
+// by the system (with no "reply-to"). Messages to process IDs, pools and the scheduler itself stay in this process.
+// The scheduler does not own the bridge: close it after the scheduler is deallocated, or after attaching NULL.
+void RTSchedulerAttachBridge(RuntimeSchedulerPtr sched, IPCBridge* bridge);
+
 // Return the index of the last program that ran
 int RTSchedulerLastProgramIndex(RuntimeSchedulerPtr sched);
 
@@ -1,4 +1,5 @@
 #include "Scope.h"
+#include "Trace.h"
 
 typedef HashMap* MapPtr;
 typedef uint32_t Name;
@@ -69,6 +70,7 @@ void ScopePush(Scope* s, Vector* parameters) {
         s->_scopes = VecAllocateArena_MapPtr(s->_memory); // THIS SHOULD NOT HAPPEN!
     }
     VecPush_MapPtr(s->_scopes, newLevel);
+    TRACE_EVENT(TRACE_SCOPE, "scope-push", VecLength(s->_scopes), 0); // value is the new depth
 
     if (parameters == NULL) return;
 
@@ -89,6 +91,7 @@ void ScopePush(Scope* s, DataTag* parameters, uint32_t paramCount) {
         s->_scopes = VecAllocateArena_MapPtr(s->_memory); // THIS SHOULD NOT HAPPEN!
     }
     VecPush_MapPtr(s->_scopes, newLevel);
+    TRACE_EVENT(TRACE_SCOPE, "scope-push", VecLength(s->_scopes), 0); // value is the new depth
 
     if (parameters == NULL) return;
 
@@ -107,7 +110,10 @@ void ScopeDrop(Scope* s) {
 
     MapPtr last = NULL;
     VecPop_MapPtr(s->_scopes, &last);
+    TRACE_EVENT(TRACE_SCOPE, "scope-drop", length - 1, 0);
     if (last == NULL) return;
+
+    MapDeallocate(last);
 }
 
 DataTag ScopeResolve(Scope* s, uint32_t crushedName) {
@@ -156,6 +162,14 @@ void ScopeSetValue(Scope* s, uint32_t crushedName, DataTag newValue) {
     MapPut_Name_DataTag(innerScope, crushedName, newValue, true);
 }
 
+void ScopeSetLocal(Scope* s, uint32_t crushedName, DataTag newValue) {
+    if (s == NULL) return;
+
+    MapPtr innerScope = NULL;
+    if (!VecPeek_MapPtr(s->_scopes, &innerScope) || innerScope == NULL) return;
+    MapPut_Name_DataTag(innerScope, crushedName, newValue, true);
+}
+
 bool ScopeCanResolve(Scope* s, uint32_t crushedName) {
     auto tag = ScopeResolve(s, crushedName);
     return IsTagValid(tag);
@@ -188,6 +202,14 @@ uint32_t ScopeNameForPosition(int i) {
     return h;
 }
 
+uint32_t ScopeNameForInlineSlot(int i) {
+    // Same scheme as positions, but with bit 15 set (positions only set it past 32K parameters)
+    uint32_t h = i;
+    h = (h << 16) + i;
+    h |= 0x80008000;
+    return h;
+}
+
 void ScopeMutateNumber(Scope* s, uint32_t crushedName, int8_t increment) {
     if (s == NULL) return;
 
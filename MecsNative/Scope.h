@@ -42,6 +42,8 @@ void ScopeDrop(Scope* s);
 DataTag ScopeResolve(Scope* s, uint32_t crushedName);
 // Set a value by name. If no scope has it, then it will be defined in the innermost scope
 void ScopeSetValue(Scope* s, uint32_t crushedName, DataTag newValue);
+// Set a value in the innermost scope, hiding any value with the same name in other scopes
+void ScopeSetLocal(Scope* s, uint32_t crushedName, DataTag newValue);
 // Does this name exist in any scopes?
 bool ScopeCanResolve(Scope* s, uint32_t crushedName);
 // Remove this variable. NOTE: this will only work in the local or global scopes, but not any intermediaries.
@@ -50,6 +52,8 @@ void ScopeRemove(Scope* s, uint32_t crushedName);
 
 // Get the crushed name for a positional argument
 uint32_t ScopeNameForPosition(int i);
+// Get the crushed name for a parameter of an inlined function. These never match positional names.
+uint32_t ScopeNameForInlineSlot(int i);
 // Does this name exist in the inner-most scope?  Will ignore other scopes, including global.
 bool InScope(Scope* s, uint32_t crushedName);
 // Add an increment to a stored number
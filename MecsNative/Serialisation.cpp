@@ -8,6 +8,9 @@ RegisterVectorStatics(Vec)
 RegisterVectorFor(byte, Vec)
 RegisterVectorFor(DataTag, Vec)
 
+RegisterDequeStatics(Deq)
+RegisterDequeFor(byte, Deq)
+
 RegisterHashMapStatics(Map);
 RegisterHashMapFor(StringPtr, DataTag, HashMapStringKeyHash, HashMapStringKeyCompare, Map)
 
@@ -32,24 +35,18 @@ inline void PushUInt32(uint32_t value, Vector* target) {
     }
 }
 
-inline bool DequeueUInt32(uint32_t* value, Vector* target) {
+inline bool DequeueUInt32(uint32_t* value, Deque* target) {
     //if (value == NULL) return false;
-    uint32_t tmp = 0;
-    uint8_t b;
-    for (int i = 3; i >= 0; i--) {
-        if (!VecDequeue_byte(target, &b)) return false;
-        tmp |= ((uint32_t)b) << (i * 8);
-    }
-    *value = tmp;
+    uint8_t b[4];
+    if (DeqPopFrontMany_byte(target, b, 4) != 4) return false;
+    *value = ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | (uint32_t)b[3];
     return true;
 }
 
 // Push the bytes of a string to a byte vector, without destroying the original string
 void PushStringBytes(String* str, Vector* target) {
-	auto bvec = VecClone(StringGetByteVector(str), VectorArena(target));
-	uint8_t b;
-	while (VecDequeue_byte(bvec, &b)) VecPush_byte(target, b);
-	VecDeallocate(bvec);
+	unsigned int len = StringLength(str);
+	for (unsigned int i = 0; i < len; i++) VecPush_byte(target, StringCharAtIndex(str, i));
 }
 
 bool RecursiveWrite(DataTag source, InterpreterState* state, Vector* target) {
@@ -147,8 +144,10 @@ bool RecursiveWrite(DataTag source, InterpreterState* state, Vector* target) {
         // indirect types
     case DataType::VariableRef:
         // resolve to a real datatag, and use that. There is nothing written for the var-ref itself
+    {
         auto next = ScopeResolve(InterpreterScope(state), source.data);
         return RecursiveWrite(next, state, target);
+    }
 
     default: // nothing else is supported yet
         return false;
@@ -196,7 +195,7 @@ bool WriteStateless(DataTag source, Vector* target) {
     return false;
 }
 
-bool RecursiveRead(DataTag* dest, Arena* memory, Vector* source) {
+bool RecursiveRead(DataTag* dest, Arena* memory, Deque* source) {
 
     // This needs to take the raw bytes and put everything back together
     // Strings will be rolled out to their full containers (including static strings -- we don't assume code will be same)
@@ -205,7 +204,7 @@ bool RecursiveRead(DataTag* dest, Arena* memory, Vector* source) {
     // read the type header:
     uint8_t type = 0;
     uint8_t b=0;
-    auto ok = VecDequeue_byte(source, &type);
+    auto ok = DeqPopFront_byte(source, &type);
     if (!ok) return false;
 
     switch ((DataType)type) {
@@ -224,14 +223,10 @@ bool RecursiveRead(DataTag* dest, Arena* memory, Vector* source) {
     {
         // Unpack from serial form
         dest->type = type;
-        for (int i = 2; i >= 0; i--) {
-            if (!VecDequeue_byte(source, &b)) return false; // vector too short
-            dest->params |= ((uint32_t)b) << (i*8);
-        }
-        for (int i = 3; i >= 0; i--) {
-            if (!VecDequeue_byte(source, &b)) return false; // vector too short
-            dest->data |= ((uint32_t)b) << (i*8);
-        }
+        uint8_t p[3];
+        if (DeqPopFrontMany_byte(source, p, 3) != 3) return false; // data too short
+        dest->params = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | (uint32_t)p[2];
+        if (!DequeueUInt32(&dest->data, source)) return false; // data too short
         return true;
     }
 
@@ -239,7 +234,7 @@ bool RecursiveRead(DataTag* dest, Arena* memory, Vector* source) {
     {
         // Read string into arena, get offset, encode to output.
         uint32_t len;
-        if (!DequeueUInt32(&len, source)) return false; // vector too short
+        if (!DequeueUInt32(&len, source)) return false; // data too short
         auto str = StringEmptyInArena(memory);
         auto offset = ArenaPtrToOffset(memory, str);
         if (offset < 1) return false; // out of memory
@@ -252,7 +247,7 @@ bool RecursiveRead(DataTag* dest, Arena* memory, Vector* source) {
 
         // fill the string
         for (uint32_t i = 0; i < len; i++) {
-            if (!VecDequeue_byte(source, &b)) return false; // vector too short
+            if (!DeqPopFront_byte(source, &b)) return false; // data too short
             StringAppendChar(str, b);
         }
 
@@ -307,7 +302,7 @@ bool RecursiveRead(DataTag* dest, Arena* memory, Vector* source) {
             if (keyLen < 1) return false; // invalid key
             StringClear(keyStr);
             for (j = 0; j < keyLen; j++) {
-                if (!VecDequeue_byte(source, &b)) return false; // vector too short
+                if (!DeqPopFront_byte(source, &b)) return false; // data too short
                 StringAppendChar(keyStr, b);
             }
 
@@ -387,6 +382,37 @@ bool FreezeToVector(HashMapPtr source, VectorPtr target) {
     return true;
 }
 
+// Copy the bytes of a vector filled by `FreezeToVector` onto the end of a byte deque
+bool CopyToByteDeque(Vector* source, Deque* target) {
+    if (source == NULL || target == NULL) return false;
+    if (VectorElementSize(source) != 1 || DequeElementSize(target) != 1) return false;
+
+    // copy across in windows, as vectors don't promise to be contiguous
+    int length = VectorLength(source);
+    int low = 0;
+    while (low < length) {
+        int high = low + 32767;
+        auto block = (byte*)VectorCacheRange(source, &low, &high);
+        if (block == NULL) return false;
+        bool ok = DeqPushBackMany_byte(target, block, (high - low) + 1);
+        VectorFreeCache(source, block);
+        if (!ok) return false;
+        low = high + 1;
+    }
+    return true;
+}
+
+// Expand a byte deque that has been filled from `FreezeToVector` into an arena
+// The data tag that is the root of the resulting structure is passed through `dest`
+bool DefrostFromDeque(DataTag* dest, Arena* memory, Deque* source) {
+    if (source == NULL) return false;
+    if (memory == NULL) return false;
+    if (dest == NULL) return false;
+    if (DequeElementSize(source) != 1) return false;
+
+    return RecursiveRead(dest, memory, source);
+}
+
 // Expand a byte vector that has been filled by `FreezeToVector` into an arena
 // The data tag that is the root of the resulting structure is passed through `dest`
 bool DefrostFromVector(DataTag* dest, Arena* memory, Vector* source) {
@@ -394,6 +420,12 @@ bool DefrostFromVector(DataTag* dest, Arena* memory, Vector* source) {
     if (memory == NULL) return false;
     if (dest == NULL) return false;
 
-    return RecursiveRead(dest, memory, source);
+    auto bytes = DeqAllocateArena_byte(VectorArena(source));
+    bool ok = CopyToByteDeque(source, bytes);
+    VectorClear(source); // the data is consumed
+
+    if (ok) ok = RecursiveRead(dest, memory, bytes);
+    DeqDeallocate(bytes);
+    return ok;
 }
 
@@ -5,6 +5,7 @@
 
 #include "TagData.h"
 #include "Vector.h"
+#include "Deque.h"
 #include "HashMap.h"
 #include "ArenaAllocator.h"
 #include "TagCodeInterpreter.h"
@@ -26,4 +27,12 @@ bool FreezeToVector(HashMapPtr source, VectorPtr target); // Future idea: use va
 // Data in `source` will be consumed during deserialisation.
 bool DefrostFromVector(DataTag* dest, Arena* memory, Vector* source);
 
+// Expand a byte deque (filled with `CopyToByteDeque`) into an arena.
+// The data tag that is the root of the resulting structure is passed through `dest`
+// Data in `source` will be consumed during deserialisation.
+bool DefrostFromDeque(DataTag* dest, Arena* memory, Deque* source);
+
+// Copy the bytes of a vector filled by `FreezeToVector` onto the end of a byte deque
+bool CopyToByteDeque(Vector* source, Deque* target);
+
 #endif
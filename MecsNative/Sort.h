@@ -0,0 +1,82 @@
+#pragma once
+
+#ifndef sort_h
+#define sort_h
+
+#include <stdint.h>
+
+// Typed sort kernels for flat arrays.
+// These are generated per element type by the macros below, so the key or order function
+// is inlined into the sort loop rather than called through a function pointer.
+// All kernels are stable. They take the data in `arr1` and a scratch array `arr2` of the same length,
+// and return whichever of the two arrays holds the sorted result (like `IterativeMergeSort`)
+
+// Runs of this many elements or fewer are insertion sorted
+#define SORT_SMALL_RUN 16
+
+// LSD radix sort, ascending by an unsigned key (`uint32_t` or `uint64_t`) read with `keyType keyFunc(typeName*)`.
+// Key bytes that are the same in every element are skipped, so small packed keys only pay for the bytes they use.
+// Makes `nameSpace##RadixSort_##typeName(typeName* arr1, typeName* arr2, int n)`
+#define RegisterRadixSortFor(typeName, keyType, keyFunc, nameSpace) \
+    inline typeName* nameSpace##RadixSort_##typeName(typeName* arr1, typeName* arr2, int n) { \
+        if (n < 2) return arr1; \
+        if (n <= SORT_SMALL_RUN) { \
+            for (int i = 1; i < n; i++) { \
+                typeName item = arr1[i]; keyType k = keyFunc(&item); int j = i - 1; \
+                while (j >= 0 && keyFunc(&arr1[j]) > k) { arr1[j + 1] = arr1[j]; j--; } \
+                arr1[j + 1] = item; \
+            } \
+            return arr1; \
+        } \
+        uint32_t counts[sizeof(keyType)][256] = {}; \
+        for (int i = 0; i < n; i++) { \
+            keyType k = keyFunc(&arr1[i]); \
+            for (int b = 0; b < (int)sizeof(keyType); b++) { counts[b][(k >> (b * 8)) & 0xFF]++; } \
+        } \
+        typeName* src = arr1; typeName* dst = arr2; \
+        for (int b = 0; b < (int)sizeof(keyType); b++) { \
+            uint32_t* c = counts[b]; \
+            if (c[(keyFunc(&src[0]) >> (b * 8)) & 0xFF] == (uint32_t)n) continue; /* every key has this byte */ \
+            uint32_t total = 0; \
+            for (int d = 0; d < 256; d++) { uint32_t t = c[d]; c[d] = total; total += t; } \
+            for (int i = 0; i < n; i++) { dst[c[(keyFunc(&src[i]) >> (b * 8)) & 0xFF]++] = src[i]; } \
+            { typeName* t = src; src = dst; dst = t; } \
+        } \
+        return src; \
+    }\
+
+// Bottom-up merge sort, using `bool lessFunc(typeName* a, typeName* b)` which should be true if `a` must come before `b`.
+// The merge picks from either side without branching on the comparison.
+// Makes `nameSpace##MergeSort_##typeName(typeName* arr1, typeName* arr2, int n)`
+#define RegisterMergeSortFor(typeName, lessFunc, nameSpace) \
+    inline typeName* nameSpace##MergeSort_##typeName(typeName* arr1, typeName* arr2, int n) { \
+        for (int lo = 0; lo < n; lo += SORT_SMALL_RUN) { \
+            int hi = lo + SORT_SMALL_RUN; if (hi > n) hi = n; \
+            for (int i = lo + 1; i < hi; i++) { \
+                typeName item = arr1[i]; int j = i - 1; \
+                while (j >= lo && lessFunc(&item, &arr1[j])) { arr1[j + 1] = arr1[j]; j--; } \
+                arr1[j + 1] = item; \
+            } \
+        } \
+        typeName* src = arr1; typeName* dst = arr2; \
+        for (int width = SORT_SMALL_RUN; width < n; width *= 2) { \
+            for (int left = 0; left < n; left += 2 * width) { \
+                int right = left + width; if (right > n) right = n; \
+                int end = right + width; if (end > n) end = n; \
+                int l = left, r = right, t = left; \
+                while (l < right && r < end) { \
+                    int takeRight = lessFunc(&src[r], &src[l]) ? 1 : 0; \
+                    typeName* pick = takeRight ? &src[r] : &src[l]; \
+                    dst[t++] = *pick; \
+                    r += takeRight; l += 1 - takeRight; \
+                } \
+                while (l < right) { dst[t++] = src[l++]; } \
+                while (r < end) { dst[t++] = src[r++]; } \
+            } \
+            { typeName* t = src; src = dst; dst = t; } \
+        } \
+        return src; \
+    }\
+
+
+#endif
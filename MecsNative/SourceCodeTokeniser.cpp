@@ -106,19 +106,107 @@ inline bool IsQuote(char c) {
     return (c == '"' || c == '\'' || c == '`');
 }
 
+// A read-only window onto the source text. Characters are read from the string's own storage a block at a time,
+// so the scanner doesn't go through the string API for every character.
+typedef struct SourceView {
+    String* source;
+    int length;
+    Arena* arena; // node text is copied into here
+    const char* block; // characters `blockStart` to `blockEnd - 1` of the source
+    int blockStart;
+    int blockEnd;
+
+    // If true, nodes are given a `SourceLine` as they are added. `line` is the line that position `lineScanned` is on.
+    bool countLines;
+    int lineScanned;
+    int line;
+} SourceView;
+
+SourceView ViewOf(String* source) {
+    auto view = SourceView{};
+    view.source = source;
+    view.length = StringLength(source);
+    view.arena = MMCurrent();
+    view.block = NULL;
+    view.countLines = false;
+    view.lineScanned = 0;
+    view.line = 1;
+    return view;
+}
+
+// Character at a position in the source, or 0 if out of range
+inline char ViewAt(SourceView* view, int i) {
+    if (i >= view->blockStart && i < view->blockEnd) return view->block[i - view->blockStart];
+
+    int start, count;
+    auto block = StringBlockAt(view->source, i, &start, &count);
+    if (block == NULL) return 0;
+
+    view->block = block;
+    view->blockStart = start;
+    view->blockEnd = start + count;
+    return block[i - start];
+}
+
+// Line (counting from 1) that a source position is on, or zero if lines are not being counted.
+// Nodes are mostly added in source order, so the text is only scanned once.
+int ViewLineAt(SourceView* view, int position) {
+    if (!view->countLines || position < 0) return 0;
+    if (position < view->lineScanned) { view->lineScanned = 0; view->line = 1; } // out of order: count again from the start
+    if (position > view->length) position = view->length;
+
+    for (; view->lineScanned < position; view->lineScanned++) {
+        if (ViewAt(view, view->lineScanned) == '\n') view->line++;
+    }
+    return view->line;
+}
+
+// Add a node as the last child of `parent`, with its `SourceLine` set
+int AddNode(DTreeNode parent, Node node, SourceView* view) {
+    node.SourceLine = ViewLineAt(view, node.SourceLocation);
+    return DTAddChild_Node(parent, node);
+}
+
+// Copy part of the source into a new string in the view's arena, a block at a time.
+// Stops at the end of the source.
+String* ViewSlice(SourceView* view, int start, int length) {
+    auto result = StringEmptyInArena(view->arena);
+    int end = start + length;
+    int i = start;
+    while (i < end) {
+        ViewAt(view, i); // makes the block holding `i` current, if there is one
+        if (i < view->blockStart || i >= view->blockEnd) break;
+
+        int count = view->blockEnd - i;
+        if (count > end - i) count = end - i;
+        StringAppendBytes(result, view->block + (i - view->blockStart), count);
+        i += count;
+    }
+    return result;
+}
+
 // skip any whitespace (any of ',', ' ', '\t', '\r', '\n'). Most of the complexity is to capture metadata for auto-format
-int SkipWhitespace(String* exp, int position, DTreeNode* mdParent) {
-    int lastcap = position;
+// If `mdParent` is NULL, no metadata is captured.
+int SkipWhitespace(SourceView* view, int position, DTreeNode* mdParent) {
     int i = position;
-    int length = StringLength(exp);
+    int length = view->length;
 
+    if (mdParent == NULL) {
+        while (i < length) {
+            char c = ViewAt(view, i);
+            if (c != ' ' && c != ',' && c != '\t' && c != '\r' && c != '\n') break;
+            i++;
+        }
+        return i;
+    }
+
+    int lastcap = position;
     bool capWS = false;
     bool capNL = false;
-    auto tmp = Node{};
 
     while (i < length)
     {
-        char c = StringCharAtIndex(exp, i);
+        char c = ViewAt(view, i);
         bool found = false;
 
         switch (c)
@@ -130,7 +218,7 @@ int SkipWhitespace(String* exp, int position, DTreeNode* mdParent) {
             if (capNL) {
                 // switch from newlines to regular space
                 // output NL so far
-                if (mdParent != NULL) DTAddChild_Node(*mdParent, newNode(lastcap, StringSlice(exp, lastcap, i - lastcap), NodeType::Newline));
+                AddNode(*mdParent, newNode(lastcap, ViewSlice(view, lastcap, i - lastcap), NodeType::Newline), view);
                 lastcap = i;
             }
             capNL = false;
@@ -144,7 +232,7 @@ int SkipWhitespace(String* exp, int position, DTreeNode* mdParent) {
             if (capWS) {
                 // switch from regular space to newlines
                 // output WS so far
-                if (mdParent != NULL) DTAddChild_Node(*mdParent, newNode(lastcap, StringSlice(exp, lastcap, i - lastcap), NodeType::Whitespace));
+                AddNode(*mdParent, newNode(lastcap, ViewSlice(view, lastcap, i - lastcap), NodeType::Whitespace), view);
                 lastcap = i;
             }
             i++;
@@ -161,14 +249,10 @@ int SkipWhitespace(String* exp, int position, DTreeNode* mdParent) {
 
     if (i != lastcap) {
         if (capNL) {
-            if (mdParent != NULL) {
-                DTAddChild_Node(*mdParent, newNode(lastcap, StringSlice(exp, lastcap, i - lastcap), NodeType::Newline));
-            }
+            AddNode(*mdParent, newNode(lastcap, ViewSlice(view, lastcap, i - lastcap), NodeType::Newline), view);
         }
         if (capWS) {
-            if (mdParent != NULL) {
-                DTAddChild_Node(*mdParent, newNode(lastcap, StringSlice(exp, lastcap, i - lastcap), NodeType::Whitespace));
-            }
+            AddNode(*mdParent, newNode(lastcap, ViewSlice(view, lastcap, i - lastcap), NodeType::Whitespace), view);
         }
     }
 
@@ -190,23 +274,37 @@ char Unescape(char car) {
 }
 
 // read a string literal from the source code
-String* ReadString (String* exp, int* inOutPosition, char end, bool* outEndedCorrectly) {
-    int i = *inOutPosition;
-    int length = StringLength(exp);
-    auto sb = StringEmpty();
+String* ReadString (SourceView* view, int* inOutPosition, char end, bool* outEndedCorrectly) {
+    int start = *inOutPosition;
+    int i = start;
+    int length = view->length;
     *outEndedCorrectly = false;
     
     char end2 = end;
     if (end == '`') { end2 = '\'';} // allow `quote' as a string
 
+    // Most strings have no escape codes, and are copied straight from the source
+    while (i < length) {
+        char car = ViewAt(view, i);
+        if (car == '\\') break;
+        if (car == end || car == end2) { *outEndedCorrectly = true; break; }
+        i++;
+    }
+    auto sb = ViewSlice(view, start, i - start);
+    if (i >= length || *outEndedCorrectly) {
+        *inOutPosition = i;
+        return sb;
+    }
+
+    // Decode the rest one character at a time
     while (i < length) {
-        char car = StringCharAtIndex(exp, i);
+        char car = ViewAt(view, i);
 
         if (car == '\\') { // escape sequences
             int nb = 0;
             i++;
             while (i < length) {
-                car = StringCharAtIndex(exp, i);
+                car = ViewAt(view, i);
                 if (car == '\\') {
                     if (nb % 2 == 0) {
                         StringAppendChar(sb, car);
@@ -236,32 +334,24 @@ String* ReadString (String* exp, int* inOutPosition, char end, bool* outEndedCor
     return sb;
 }
 
-int NextNewline(String* source, int i) {
-    unsigned int npos;
-    unsigned int rpos;
-    bool nfound = StringFind(source, '\n', i, &npos);
-    bool rfound = StringFind(source, '\r', i, &rpos);
-
-    if (nfound && rfound) {
-        return (npos < rpos) ? npos : rpos;
-    } else if (nfound) {
-        return npos;
-    } else if (rfound) {
-        return rpos;
-    } else {
-        return StringLength(source);
+int NextNewline(SourceView* view, int i) {
+    int length = view->length;
+    while (i < length) {
+        char c = ViewAt(view, i);
+        if (c == '\n' || c == '\r') return i;
+        i++;
     }
+    return length;
 }
 
-// Read an identifier
-String* ReadWord(String* expression, int position) {
+// Find the end of an identifier. Returns the position after its last character
+int EndOfWord(SourceView* view, int position) {
     int i = position;
-    int length = StringLength(expression);
-    auto sb = StringEmpty();
+    int length = view->length;
 
     while (i < length)
     {
-        char c = StringCharAtIndex(expression, i);
+        char c = ViewAt(view, i);
 
         if (c == ' ' || c == '\n' || c == '\r' || c == '\t' // whitespace
             || c == ')' || c == '('                         // parens
@@ -270,39 +360,38 @@ String* ReadWord(String* expression, int position) {
             break;
         }
 
-        StringAppendChar(sb, c);
-
         i++;
     }
-    return sb;
+    return i;
 }
 
 // Try to read a line comment. Returns false if it's not a line comment
-bool TryCaptureComment(String* source, int* inOutPosition, bool preserveMetadata, DTreeNode* mdParent)
+bool TryCaptureComment(SourceView* view, int* inOutPosition, bool preserveMetadata, DTreeNode* mdParent)
 {
     unsigned int end;
+    auto source = view->source;
     int i = *inOutPosition;
-    if (i >= StringLength(source)) return false;
-    char k = StringCharAtIndex(source, i + 1);
+    if (i >= view->length) return false;
+    char k = ViewAt(view, i + 1);
     Node tmp = newNodeInvalid();
 
     switch (k)
     {
     case '/': // line comment
-        end = NextNewline(source, i);
+        end = NextNewline(view, i);
         if (preserveMetadata) {
-            tmp = newNode(i, StringSlice(source, i, end - i), NodeType::Comment);
-            DTAddChild_Node(*mdParent, tmp);
+            tmp = newNode(i, ViewSlice(view, i, end - i), NodeType::Comment);
+            AddNode(*mdParent, tmp, view);
         }
         *inOutPosition = end - 1;
         return true;
     case '*': // block comment
     {
         bool found = StringFind(source, "*/", i + 2, &end);
-        if (!found) end = StringLength(source);
+        if (!found) end = view->length;
         if (preserveMetadata) {
-            tmp = newNode(i, StringSlice(source, i, end - i + 2), NodeType::Comment);
-            DTAddChild_Node(*mdParent, tmp);
+            tmp = newNode(i, ViewSlice(view, i, end - i + 2), NodeType::Comment);
+            AddNode(*mdParent, tmp, view);
         }
         *inOutPosition = end + 1;
         return true;
@@ -312,6 +401,9 @@ bool TryCaptureComment(String* source, int* inOutPosition, bool preserveMetadata
 }
 
 bool IsNumeric(String* word) {
+    // Only words starting with one of these can parse as numbers. This saves trying every name.
+    char c = StringCharAtIndex(word, 0);
+    if ((c < '0' || c > '9') && c != '-' && c != '+' && c != '.' && c != '_') return false;
     return StringTryParse_double(word, NULL);
 }
 
@@ -330,42 +422,56 @@ void PrepareWhitespaceContainer(DTreeNode* wsNode) {
     wsNode->NodeId = DTRootId(wsNode->Tree);
 }
 
-bool ParseSource(String* source, DTreePtr tree, int position, bool preserveMetadata) {
+// Parse source code into the tree, starting at `position`.
+// If `outFormEnd` is not NULL, parsing stops after the first complete top-level form, and its end position is written there.
+bool ParseSource(String* source, DTreePtr tree, int position, bool preserveMetadata, int* outFormEnd) {
     int i = position;
-    int length = StringLength(source);
+    auto view = ViewOf(source);
+    view.countLines = (outFormEnd == NULL); // forms don't get lines: see `ParseSourceForm`
+    int length = view.length;
     auto current = DTNode(tree, DTRootId(tree));
+    int rootId = current.NodeId;
+    bool formStarted = false; // becomes true when we read anything other than whitespace and comments
+    if (outFormEnd != NULL) *outFormEnd = length; // unfinished or broken forms run to the end
     //Node tmp = newNodeInvalid();
     DTreeNode parent = current;
 
-    DTreePtr wsTree = DTAllocate_Node(DTArena(tree));
-    DTreeNode wsNode = DTNode(wsTree, DTRootId(wsTree));
+    // Whitespace is only collected if we are keeping metadata
+    DTreeNode wsNode = DTNode(NULL, -1);
+    DTreeNode* ws = NULL;
+    if (preserveMetadata) {
+        DTreePtr wsTree = DTAllocate_Node(DTArena(tree));
+        wsNode = DTNode(wsTree, DTRootId(wsTree));
+        ws = &wsNode;
+    }
 
     while (i < length)
     {
-        PrepareWhitespaceContainer(&wsNode);
-        i = SkipWhitespace(source, i, &wsNode);
-        MaybeIncludeWhitespace(preserveMetadata, &wsNode, current);
+        PrepareWhitespaceContainer(ws);
+        i = SkipWhitespace(&view, i, ws);
+        MaybeIncludeWhitespace(preserveMetadata, ws, current);
 
         if (i >= length) { break; }
 
-        char car = StringCharAtIndex(source, i);
+        char car = ViewAt(&view, i);
 
 
         switch (car)
         {
         case '(': // start of call
+            formStarted = true;
             parent = current;
-            current.NodeId = DTAddChild_Node(parent, newNodeOpenCall(i));
+            current.NodeId = AddNode(parent, newNodeOpenCall(i), &view);
             break;
         case ')': // end of call
         {
             if (preserveMetadata) {
-                DTAddChild_Node(current, newNodeCloseCall(i));
+                AddNode(current, newNodeCloseCall(i), &view);
             }
 
             current.NodeId = DTGetParentId(current);
             if (!DTValidNode(current)) {
-				DTAddChild_Node(current, newNodeError(i, StringNew("###PARSER ERROR: ROOT CRASH###")));
+				AddNode(current, newNodeError(i, StringNew("###PARSER ERROR: ROOT CRASH###")), &view);
                 return false;
             }
             break;
@@ -375,31 +481,32 @@ bool ParseSource(String* source, DTreePtr tree, int position, bool preserveMetad
         case '\'':
         case '`':
         {
+            formStarted = true;
             if (preserveMetadata) {
-                DTAddChild_Node(current, newNodeDelimiter(i, car));
+                AddNode(current, newNodeDelimiter(i, car), &view);
             }
 
             i++;
             auto old_i = i;
             bool endedCorrectly;
-            auto words = ReadString(source, &i, car, &endedCorrectly);
+            auto words = ReadString(&view, &i, car, &endedCorrectly);
 
             auto tmp = newNodeString(old_i, words);
             if (preserveMetadata) {
-                tmp.Unescaped = StringSlice(source, old_i, i - old_i);
+                tmp.Unescaped = ViewSlice(&view, old_i, i - old_i);
             }
 
-            DTAddChild_Node(current, tmp);
+            AddNode(current, tmp, &view);
 
             if (preserveMetadata && endedCorrectly) {
-                car = StringCharAtIndex(source, i);
-                DTAddChild_Node(current, newNodeDelimiter(i, car));
+                car = ViewAt(&view, i);
+                AddNode(current, newNodeDelimiter(i, car), &view);
             }
             break;
         }
 
         case '/': //maybe a comment?
-            if (TryCaptureComment(source, &i, preserveMetadata, &current))
+            if (TryCaptureComment(&view, &i, preserveMetadata, &current))
             {
                 break;
             }
@@ -407,41 +514,42 @@ bool ParseSource(String* source, DTreePtr tree, int position, bool preserveMetad
 
         default:
         {
-            auto word = ReadWord(source, i);
-            int wordLength = StringLength(word);
-            if (wordLength == 0) {
-                StringDeallocate(word);
-            } else {
+            int wordLength = EndOfWord(&view, i) - i;
+            if (wordLength > 0) {
+                formStarted = true;
+                auto word = ViewSlice(&view, i, wordLength);
                 int startLoc = i;
                 i += wordLength;
 
-                PrepareWhitespaceContainer(&wsNode);
-                i = SkipWhitespace(source, i, &wsNode);
+                PrepareWhitespaceContainer(ws);
+                i = SkipWhitespace(&view, i, ws);
                 if (i > length) {
                     // Unexpected end of input
                     // To help formatting and diagnosis, write the last bits.
-                    DTAddSibling_Node(current, newNodeAtom(startLoc, word));
-                    MaybeIncludeWhitespace(preserveMetadata, &wsNode, current);
+                    auto atom = newNodeAtom(startLoc, word);
+                    atom.SourceLine = ViewLineAt(&view, startLoc);
+                    DTAddSibling_Node(current, atom);
+                    MaybeIncludeWhitespace(preserveMetadata, ws, current);
                     return false;
                 }
-                car = StringCharAtIndex(source, i);
+                car = ViewAt(&view, i);
                 if (car == '(')
                 {
                     // we need the atom we create to NOT be a leaf!
                     if (IsNumeric(word)) {
-                        DTAddChild_Node(current, 
-                            newNodeError(i, StringNewFormat("Error: '\x01' used like a function name, but looks like a number", word ))
+                        AddNode(current, 
+                            newNodeError(i, StringNewFormat("Error: '\x01' used like a function name, but looks like a number", word )), &view
                         );
                         return false;
                     } else {
 						parent = current;
 						auto tmp = newNodeAtom(startLoc, word);
 						tmp.functionLike = true;
-						current.NodeId = DTAddChild_Node(parent, tmp);
+						current.NodeId = AddNode(parent, tmp, &view);
 
-						MaybeIncludeWhitespace(preserveMetadata, &wsNode, current);
+						MaybeIncludeWhitespace(preserveMetadata, ws, current);
 						if (preserveMetadata) {
-							DTAddChild_Node(current, newNodeOpenCall(i));
+							AddNode(current, newNodeOpenCall(i), &view);
 						}
                     }
                 }
@@ -451,21 +559,32 @@ bool ParseSource(String* source, DTreePtr tree, int position, bool preserveMetad
                     
 					StringAppendChar(word, ':'); // the ':' is part of the directive name, so it doesn't clash with variables.
                     i++;
-					i = SkipWhitespace(source, i, &wsNode);
-                    MaybeIncludeWhitespace(preserveMetadata, &wsNode, current);
-					car = StringCharAtIndex(source, i);
+					i = SkipWhitespace(&view, i, ws);
+                    MaybeIncludeWhitespace(preserveMetadata, ws, current);
+					car = ViewAt(&view, i);
 
-                    if (IsQuote(car)) {
+                    if (car == '(') {
+                        // A directive with a parameter list, like `run:("file.ecs" "batch")`. Parameters are read like a function call's.
+						parent = current;
+						auto tmp = newNodeDirective(startLoc, word);
+						tmp.functionLike = true;
+						current.NodeId = AddNode(parent, tmp, &view);
+
+						if (preserveMetadata) {
+							AddNode(current, newNodeOpenCall(i), &view);
+						}
+                    }
+                    else if (IsQuote(car)) {
                         // OK, a directive string
 						i++;
 						auto old_i = i;
 						bool endedCorrectly;
-						auto words = ReadString(source, &i, car, &endedCorrectly);
+						auto words = ReadString(&view, &i, car, &endedCorrectly);
                         i++;
 
                         if (!endedCorrectly) {
-							DTAddChild_Node(current, 
-                                newNodeError(i, StringNewFormat("\r\nError: '\x01' system directive argument was not ended correctly", word))
+							AddNode(current, 
+                                newNodeError(i, StringNewFormat("\r\nError: '\x01' system directive argument was not ended correctly", word)), &view
                             );
 							return false;
                         }
@@ -476,25 +595,26 @@ bool ParseSource(String* source, DTreePtr tree, int position, bool preserveMetad
 
                         // add to tree
 						//parent = current;
-						auto dirPos = DTAddChild_Node(current, tmp);
+						auto dirPos = AddNode(current, tmp, &view);
                         
 						if (preserveMetadata) {
-							DTAddChild_Node(current, newNodeDelimiter(i, car));
+							AddNode(current, newNodeDelimiter(i, car), &view);
 						}
 
                         // add directive argument to directive node
-						int id = DTAddChild_Node(current.Tree, dirPos, newNodeString(old_i, words));
+						auto arg = newNodeString(old_i, words);
+						int id = AddNode(DTNode(current.Tree, dirPos), arg, &view);
                         
 
                         // This isn't working well
 						if (preserveMetadata && endedCorrectly) {
-							car = StringCharAtIndex(source, i);
-							DTAddChild_Node(current, newNodeDelimiter(i, car));
+							car = ViewAt(&view, i);
+							AddNode(current, newNodeDelimiter(i, car), &view);
 						}
 					}
 					else {
-						DTAddChild_Node(current, 
-                            newNodeError(i, StringNewFormat("\r\nError: '\x01' looks like a system directive, but you didn't give a string", word))
+						AddNode(current, 
+                            newNodeError(i, StringNewFormat("\r\nError: '\x01' looks like a system directive, but you didn't give a string", word)), &view
                         );
 						return false;
 					}
@@ -505,9 +625,9 @@ bool ParseSource(String* source, DTreePtr tree, int position, bool preserveMetad
                     auto tmp = newNodeAtom(startLoc, word);
                     if (IsNumeric(word)) tmp.NodeType = NodeType::Numeric;
 
-                    DTAddChild_Node(current, tmp);
+                    AddNode(current, tmp, &view);
 
-                    MaybeIncludeWhitespace(preserveMetadata, &wsNode, current);
+                    MaybeIncludeWhitespace(preserveMetadata, ws, current);
                 }
             }
         }
@@ -516,12 +636,18 @@ bool ParseSource(String* source, DTreePtr tree, int position, bool preserveMetad
         }
 
         i++;
+
+        if (outFormEnd != NULL && formStarted && current.NodeId == rootId) {
+            *outFormEnd = i;
+            break;
+        }
     }
-    DTDeallocate(wsNode);
+    if (ws != NULL) DTDeallocate(wsNode);
     return true;
 }
 
-DTreePtr ParseSourceCode(ArenaPtr arena, String* source, bool preserveMetadata) {
+// Make a tree with just a root node
+DTreePtr NewSourceTree(ArenaPtr arena) {
     auto root = Node();
     root.NodeType = NodeType::Root;
     root.SourceLocation = 0;
@@ -532,14 +658,31 @@ DTreePtr ParseSourceCode(ArenaPtr arena, String* source, bool preserveMetadata)
 
     auto tree = DTAllocate_Node(arena);
     DTSetValue_Node(tree, 0, root);
+    return tree;
+}
+
+// Mark the root of a tree as failed
+void InvalidateSourceTree(DTreePtr tree) {
+    auto root = DTReadBody_Node(tree, DTRootId(tree));
+    root->IsValid = false;
+}
 
-    bool valid = ParseSource(source, tree, 0, preserveMetadata);
+DTreePtr ParseSourceCode(ArenaPtr arena, String* source, bool preserveMetadata) {
+    auto tree = NewSourceTree(arena);
 
-    if (!valid) {
-        root.IsValid = false;
-		DTSetValue_Node(tree, 0, root);
-    }
+    bool valid = ParseSource(source, tree, 0, preserveMetadata, NULL);
+    if (!valid) InvalidateSourceTree(tree);
+    return tree;
+}
+
+DTreePtr ParseSourceForm(ArenaPtr arena, String* source, int position, bool preserveMetadata, int* outEnd) {
+    int end;
+    auto tree = NewSourceTree(arena);
+
+    bool valid = ParseSource(source, tree, position, preserveMetadata, &end);
+    if (!valid) InvalidateSourceTree(tree);
 
+    if (outEnd != NULL) *outEnd = end;
     return tree;
 }
 
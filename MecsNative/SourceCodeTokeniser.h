@@ -52,11 +52,14 @@ enum NodeType {
 // This is the body structure of each tree node produced by `ParseSourceCode()`
 typedef struct SourceNode {
     // Semantic class of the node
-    NodeType NodeType;
+    ::NodeType NodeType;
 
     // If true, this atom is used like a function call.
     bool functionLike;
 
+    // For calls that the compiler will inline, the `def` of the function. Tree is NULL otherwise.
+    DTreeNode InlineDefinition;
+
     // Text value of the node. For strings, this is after escape codes are processed
     String* Text;
 
@@ -66,6 +69,9 @@ typedef struct SourceNode {
     // Location in the source file that this node was found
     int SourceLocation;
 
+    // Line in the source file (counting from 1) that this node was found on. Zero if not known.
+    int SourceLine;
+
     // If false, the parse tree was not successful
     bool IsValid;
 
@@ -85,8 +91,15 @@ typedef SourceNode* SourceNodePtr;
 /// </summary>
 /// <param name="source">Input text</param>
 /// <param name="preserveMetadata">if true, comments and spacing will be included</param>
+/// <remarks>Nodes are given a `SourceLine`, for the compiler's line to tag-code mapping</remarks>
 DTreePtr ParseSourceCode(ArenaPtr arena, String* source, bool preserveMetadata);
 
+// Read a single top-level form (a call, atom, string or directive, and any whitespace and comments around it) starting at `position`.
+// `outEnd` is set to the position after the form, which is where the next form starts.
+// Node locations are positions in the whole `source`. A form that is broken or not closed runs to the end of the source.
+// Nodes don't get a `SourceLine`, as forms are kept while the lines above them move.
+DTreePtr ParseSourceForm(ArenaPtr arena, String* source, int position, bool preserveMetadata, int* outEnd);
+
 // Write the abstract syntax tree out as a source code string. This does auto-formatting
 String* RenderAstToSource(DTreePtr ast);
 
@@ -0,0 +1,264 @@
+#include "SourceDocument.h"
+
+#include "MemoryManager.h"
+#include "SourceCodeTokeniser.h"
+#include "CompilerCore.h"
+
+// One top-level form of the document
+typedef struct DocumentForm {
+    int start;              // position of the form in the text
+    int length;             // number of characters in the form
+    int parsedAt;           // value of `start` when the form was parsed. Node locations are relative to the text at that time.
+    DTreePtr syntax;        // syntax tree with metadata, for the editor
+    DTreePtr compiled;      // tree the code was compiled from, or NULL. The compiler changes the tree, and the code refers to its strings.
+    TagCodeCache* code;     // compiled code, or NULL if not compiled since the form was parsed
+    bool isImport;          // true if the form is an `import` (only valid when `compiled` is set)
+} DocumentForm;
+
+RegisterHashMapStatics(Map)
+RegisterHashMapFor(StringPtr, bool, HashMapStringKeyHash, HashMapStringKeyCompare, Map)
+
+RegisterVectorStatics(Vec)
+RegisterVectorFor(DocumentForm, Vec)
+
+RegisterDTreeStatics(DT)
+RegisterDTreeFor(SourceNode, DT)
+
+typedef struct SourceDocument {
+    // Current text of the whole document
+    String* text;
+
+    // Vector<DocumentForm>, in order. Together, the forms cover all of the text.
+    Vector* forms;
+
+    // True if the code in the forms was compiled with debug symbols
+    bool debug;
+
+    // Counts of forms parsed and compiled
+    int formsParsed;
+    int formsCompiled;
+
+    // Memory holding the document
+    Arena* memory;
+} SourceDocument;
+
+
+// Deallocate the compiled code of a form, so it will be compiled again
+void DropCode(DocumentForm* form) {
+    if (form->code != NULL) TCW_Deallocate(form->code);
+    if (form->compiled != NULL) DeallocateAST(form->compiled);
+    form->code = NULL;
+    form->compiled = NULL;
+}
+
+void FreeForm(DocumentForm* form) {
+    DropCode(form);
+    DeallocateAST(form->syntax);
+    form->syntax = NULL;
+}
+
+// Index of the first form that ends at or after `position`, or the form count if there is none
+int FirstFormEndingFrom(Vector* forms, int position) {
+    int low = 0;
+    int high = VecLength(forms);
+    while (low < high) {
+        int mid = (low + high) / 2;
+        auto form = VecGet_DocumentForm(forms, mid);
+        if (form->start + form->length < position) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
+
+// Parse the text again after an edit, reusing every form that can't have changed.
+// `editStart` and `editEnd` are the range that was replaced, in the old text, and `delta` is the change in length.
+void ReparseEdit(SourceDocument* doc, int editStart, int editEnd, int delta) {
+    auto oldForms = doc->forms;
+    int oldCount = VecLength(oldForms);
+    int length = StringLength(doc->text);
+
+    // A form that ends exactly at the edit is parsed again too, as the parser looks one character past a word to see if it is a call.
+    int first = FirstFormEndingFrom(oldForms, editStart);
+    int position = (first < oldCount) ? VecGet_DocumentForm(oldForms, first)->start : 0;
+
+    auto newForms = VecAllocateArena_DocumentForm(doc->memory);
+    for (int i = 0; i < first; i++) { VecPush_DocumentForm(newForms, *VecGet_DocumentForm(oldForms, i)); }
+
+    // Parse new forms until one ends where an old form after the edit started. From there, the text and so the parse is the same as before.
+    int next = first; // first old form that we might line up with
+    bool linedUp = false;
+    while (position < length) {
+        while (next < oldCount && VecGet_DocumentForm(oldForms, next)->start + delta < position) next++;
+        if (next < oldCount) {
+            auto oldStart = VecGet_DocumentForm(oldForms, next)->start;
+            if (oldStart >= editEnd && oldStart + delta == position) {
+                linedUp = true;
+                break;
+            }
+        }
+
+        int end;
+        auto form = DocumentForm{};
+        form.syntax = ParseSourceForm(doc->memory, doc->text, position, true, &end);
+        if (end <= position) end = length;
+        form.start = position;
+        form.parsedAt = position;
+        form.length = end - position;
+        VecPush_DocumentForm(newForms, form);
+        doc->formsParsed++;
+
+        position = end;
+    }
+    if (!linedUp) next = oldCount;
+
+    for (int i = first; i < next; i++) { FreeForm(VecGet_DocumentForm(oldForms, i)); }
+    for (int i = next; i < oldCount; i++) {
+        auto form = *VecGet_DocumentForm(oldForms, i);
+        form.start += delta;
+        VecPush_DocumentForm(newForms, form);
+    }
+
+    VecDeallocate(oldForms);
+    doc->forms = newForms;
+}
+
+SourceDocument* SourceDocumentAllocate(String* source) {
+    auto memory = MMCurrent();
+    auto result = (SourceDocument*)ArenaAllocateAndClear(memory, sizeof(SourceDocument));
+    if (result == NULL) return NULL;
+
+    result->memory = memory;
+    result->text = StringEmptyInArena(memory);
+    result->forms = VecAllocateArena_DocumentForm(memory);
+    if (result->text == NULL || result->forms == NULL) {
+        SourceDocumentDeallocate(result);
+        return NULL;
+    }
+
+    StringAppend(result->text, source);
+    ReparseEdit(result, 0, 0, 0);
+    return result;
+}
+
+void SourceDocumentDeallocate(SourceDocument* doc) {
+    if (doc == NULL) return;
+
+    if (doc->forms != NULL) {
+        auto form = DocumentForm{};
+        while (VecPop_DocumentForm(doc->forms, &form)) { FreeForm(&form); }
+        VecDeallocate(doc->forms);
+    }
+    StringDeallocate(doc->text);
+
+    ArenaDereference(doc->memory, doc);
+}
+
+bool SourceDocumentEdit(SourceDocument* doc, int position, int removeLength, String* insert) {
+    if (doc == NULL) return false;
+
+    int oldLength = StringLength(doc->text);
+    if (position < 0 || removeLength < 0 || position + removeLength > oldLength) return false;
+
+    int insertLength = (insert == NULL) ? 0 : StringLength(insert);
+    if (insertLength == 0 && removeLength == 0) return true;
+
+    auto text = StringEmptyInArena(doc->memory);
+    if (text == NULL) return false;
+    StringAppendSubstr(text, doc->text, 0, position);
+    if (insert != NULL) StringAppend(text, insert);
+    StringAppendSubstr(text, doc->text, position + removeLength, oldLength - (position + removeLength));
+
+    StringDeallocate(doc->text);
+    doc->text = text;
+
+    ReparseEdit(doc, position, position + removeLength, insertLength - removeLength);
+    return true;
+}
+
+String* SourceDocumentText(SourceDocument* doc) {
+    if (doc == NULL) return NULL;
+    return doc->text;
+}
+
+int SourceDocumentFormCount(SourceDocument* doc) {
+    if (doc == NULL) return 0;
+    return VecLength(doc->forms);
+}
+
+DTreeNode SourceDocumentForm(SourceDocument* doc, int index, int* outStart, int* outLength, int* outLocationShift) {
+    if (doc == NULL || index < 0 || index >= VecLength(doc->forms)) return DTNode(NULL, -1);
+
+    auto form = VecGet_DocumentForm(doc->forms, index);
+    if (outStart != NULL) *outStart = form->start;
+    if (outLength != NULL) *outLength = form->length;
+    if (outLocationShift != NULL) *outLocationShift = form->start - form->parsedAt;
+    return DTNode(form->syntax, DTRootId(form->syntax));
+}
+
+int SourceDocumentFormAt(SourceDocument* doc, int position) {
+    if (doc == NULL || position < 0 || position >= (int)StringLength(doc->text)) return -1;
+
+    // the form ending at `position` doesn't hold it, so look for the first ending after
+    return FirstFormEndingFrom(doc->forms, position + 1);
+}
+
+// Parse a form again without metadata, ready to compile
+void ParseForCompile(SourceDocument* doc, DocumentForm* form) {
+    form->compiled = ParseSourceForm(doc->memory, doc->text, form->start, false, NULL);
+
+    form->isImport = false;
+    auto root = DTRootId(form->compiled);
+    auto statement = DTGetChildId(form->compiled, root);
+    if (statement >= 0) {
+        auto node = DTReadBody_SourceNode(form->compiled, statement);
+        form->isImport = node->functionLike && StringAreEqual(node->Text, "import");
+    }
+}
+
+TagCodeCache* SourceDocumentCompile(SourceDocument* doc, bool debug) {
+    if (doc == NULL) return NULL;
+    int count = VecLength(doc->forms);
+
+    if (debug != doc->debug) {
+        for (int i = 0; i < count; i++) { DropCode(VecGet_DocumentForm(doc->forms, i)); }
+        doc->debug = debug;
+    }
+
+    // An import is ignored if an earlier one read the same file, so if any import changed, all of them are compiled again in order
+    bool importsChanged = false;
+    for (int i = 0; i < count; i++) {
+        auto form = VecGet_DocumentForm(doc->forms, i);
+        if (form->code != NULL) continue;
+        if (form->compiled == NULL) ParseForCompile(doc, form);
+        importsChanged |= form->isImport;
+    }
+    if (importsChanged) {
+        for (int i = 0; i < count; i++) {
+            auto form = VecGet_DocumentForm(doc->forms, i);
+            if (!form->isImport || form->code == NULL) continue;
+            DropCode(form);
+            ParseForCompile(doc, form);
+        }
+    }
+
+    auto includedFiles = MapAllocate_StringPtr_bool(32);
+    auto result = TCW_Allocate(MMCurrent());
+    for (int i = 0; i < count; i++) {
+        auto form = VecGet_DocumentForm(doc->forms, i);
+        if (form->code == NULL) {
+            form->code = CompileFragment(DTNode(form->compiled, DTRootId(form->compiled)), debug, includedFiles);
+            doc->formsCompiled++;
+        }
+        TCW_Merge(result, form->code);
+    }
+    MapDeallocate(includedFiles);
+
+    TCW_Optimise(result);
+    TCW_RawToken(result, MarkEndOfProgram());
+    return result;
+}
+
+void SourceDocumentStatistics(SourceDocument* doc, int* outFormsParsed, int* outFormsCompiled) {
+    if (outFormsParsed != NULL) *outFormsParsed = (doc == NULL) ? 0 : doc->formsParsed;
+    if (outFormsCompiled != NULL) *outFormsCompiled = (doc == NULL) ? 0 : doc->formsCompiled;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#ifndef sourcedocument_h
+#define sourcedocument_h
+
+/*
+    A source file that is being edited, for the REPL and editor.
+
+    The text is split into top-level forms (each root-level call, atom or string, with the whitespace and
+    comments around it). Each form has its own syntax tree and its own compiled code.
+    After an edit, only the forms that touch the changed text are parsed again, and parsing stops as soon
+    as it lines up with the start of an unchanged form. Only changed forms are compiled again.
+
+    The document, and everything it parses and compiles, is held in the arena that is current when it is
+    allocated. The same arena must be current for every call. The compiler leaks a little on each recompile,
+    so use an arena that is closed with the editor.
+*/
+
+#include "Tree_2.h"
+#include "String.h"
+#include "TagCodeWriter.h"
+
+typedef struct SourceDocument SourceDocument;
+typedef SourceDocument* SourceDocumentPtr;
+
+// Parse a new document from source text. The text is copied.
+SourceDocument* SourceDocumentAllocate(String* source);
+
+// Deallocate a document, and all its syntax trees and code
+void SourceDocumentDeallocate(SourceDocument* doc);
+
+// Replace `removeLength` characters at `position` with `insert` (which can be NULL to only remove).
+// Returns false if the range is outside the document.
+bool SourceDocumentEdit(SourceDocument* doc, int position, int removeLength, String* insert);
+
+// The current text of the document. This belongs to the document, and is replaced by the next edit.
+String* SourceDocumentText(SourceDocument* doc);
+
+// Number of top-level forms in the document
+int SourceDocumentFormCount(SourceDocument* doc);
+
+// Read the syntax tree of a top-level form, with metadata, for highlighting and formatting.
+// `outStart` and `outLength` are set to the form's range of the text.
+// Node `SourceLocation`s are from when the form was parsed, and `outLocationShift` must be added to get the current position.
+// Returns an invalid node if the index is out of range.
+DTreeNode SourceDocumentForm(SourceDocument* doc, int index, int* outStart, int* outLength, int* outLocationShift);
+
+// Index of the form holding a position in the text, or -1 if out of range
+int SourceDocumentFormAt(SourceDocument* doc, int position);
+
+// Compile the whole document, as `CompileRoot`. Only forms changed since the last compile are compiled again.
+// Constant propagation and inlining across forms is not done, as either would make one form's code depend on others.
+TagCodeCache* SourceDocumentCompile(SourceDocument* doc, bool debug);
+
+// Read the total number of forms that have been parsed and compiled since the document was allocated
+void SourceDocumentStatistics(SourceDocument* doc, int* outFormsParsed, int* outFormsCompiled);
+
+#endif
@@ -3,97 +3,188 @@
 #include "MemoryManager.h"
 
 #include <stdarg.h>
-
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_AMD64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define STRING_SSE2 1
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Number of characters that can be stored inside the String structure itself.
+// This is picked to make the structure 48 bytes on 64-bit systems.
+#define STRING_SMALL_SIZE 25
+
+// Needles at least this long are searched with the Two-Way algorithm, which has no bad cases.
+// Shorter needles use a first/last byte filter, which is faster on normal text.
+#define TWO_WAY_MIN_NEEDLE 32
+
+/*
+ * Strings of up to `STRING_SMALL_SIZE` chars are stored in `small`, with no other allocation.
+ * Longer strings move to `chars`, a contiguous vector (which falls back to chunks past one arena allocation).
+ * Once a string has a vector, it keeps using it until deallocated.
+ */
 typedef struct String {
-    Vector* chars; // vector of characters
-    bool isProxy; // normally false. If true, the vector is not touched when deallocating
-    uint32_t hashval; // cached hash value. Any time we change the string, this should be set to 0.
+    Vector* chars;          // vector of characters, or NULL if the string is stored in `small`
+    Arena* arena;           // memory the string and its vector live in. NULL after deallocation.
+    uint32_t hashval;       // cached hash value. Any time we change the string, this should be set to 0.
+    bool isProxy;           // normally false. If true, the vector is not touched when deallocating
+    bool isShared;          // true if proxies have been made. Hashes are not cached, as proxies can change the string.
+    uint8_t smallLength;    // number of characters in `small` (only when `chars` is NULL)
+    char small[STRING_SMALL_SIZE];
 } String;
 
 RegisterVectorStatics(V)
 RegisterVectorFor(char, V)
 
 
-inline ArenaPtr FindArena(VectorPtr vec) {
-    auto arena = VectorArena(vec);
-	if (arena == NULL) arena = MMCurrent();
-	return arena;
+// Number of characters in the string
+inline uint32_t StrLen(String* str) {
+    return (str->chars == NULL) ? str->smallLength : VLength(str->chars);
 }
 
-String * StringEmpty() {
-    auto vec = VAllocate_char();
-    if (!VectorIsValid(vec)) return NULL;
+// Pointer to the characters if they are held in one block, which is true unless the string is very long.
+// Returns NULL for chunked strings. Invalidated by any change to the string.
+inline char* StrFlat(String* str) {
+    return (str->chars == NULL) ? str->small : (char*)VectorContiguousData(str->chars);
+}
 
-    auto arena = FindArena(vec);
-	if (arena == NULL) return NULL;
+// Read a character, with no bounds check
+inline char StrAt(String* str, uint32_t idx) {
+    auto flat = StrFlat(str);
+    if (flat != NULL) return flat[idx];
+    return *VGet_char(str->chars, idx);
+}
 
-    auto str = (String*)ArenaAllocateAndClear(arena, sizeof(String));
+// Move characters out of `small` into a new vector
+bool StrSpill(String* str) {
+    if (str->chars != NULL) return true;
+    auto vec = VAllocateArenaContiguous_char(str->arena);
+    if (!VectorIsValid(vec)) return false;
+    if (!VectorPushMany(vec, str->small, str->smallLength)) return false;
     str->chars = vec;
+    str->smallLength = 0;
+    return true;
+}
+
+// Add characters to the end of the string
+bool StrPushBytes(String* str, const char* src, uint32_t length) {
     str->hashval = 0;
-    str->isProxy = false;
+    if (str->chars == NULL) {
+        if (str->smallLength + length <= STRING_SMALL_SIZE) {
+            memcpy(str->small + str->smallLength, src, length);
+            str->smallLength += length;
+            return true;
+        }
+        if (!StrSpill(str)) return false;
+    }
+    return VectorPushMany(str->chars, (void*)src, length);
+}
 
-    return str;
+// Add a character to the end of the string
+inline bool StrPush(String* str, char c) {
+    if (str->chars == NULL && str->smallLength < STRING_SMALL_SIZE) {
+        str->hashval = 0;
+        str->small[str->smallLength++] = c;
+        return true;
+    }
+    return StrPushBytes(str, &c, 1);
+}
+
+// Compare a range of two strings for equality
+bool StrRangeEqual(String* a, uint32_t aStart, String* b, uint32_t bStart, uint32_t length) {
+    auto fa = StrFlat(a);
+    auto fb = StrFlat(b);
+    if (fa != NULL && fb != NULL) return memcmp(fa + aStart, fb + bStart, length) == 0;
+
+    for (uint32_t i = 0; i < length; i++) {
+        if (StrAt(a, aStart + i) != StrAt(b, bStart + i)) return false;
+    }
+    return true;
+}
+
+// Compare a range of a string with a c-string of known length
+bool StrRangeEqual(String* a, uint32_t aStart, const char* b, uint32_t length) {
+    auto fa = StrFlat(a);
+    if (fa != NULL) return memcmp(fa + aStart, b, length) == 0;
+
+    for (uint32_t i = 0; i < length; i++) {
+        if (StrAt(a, aStart + i) != b[i]) return false;
+    }
+    return true;
+}
+
+String * StringEmpty() {
+    auto arena = MMCurrent();
+    if (arena == NULL) return NULL;
+    return StringEmptyInArena(arena);
 }
 
 // Create an empty string in a specific memory arena
 String *StringEmptyInArena(Arena* a) {
     if (a == NULL) return NULL;
-    auto vec = VAllocateArena_char(a);
-    if (!VectorIsValid(vec)) return NULL;
 
     auto str = (String*)ArenaAllocateAndClear(a, sizeof(String));
-    str->chars = vec;
+    if (str == NULL) return NULL;
+    str->chars = NULL;
+    str->arena = a;
     str->hashval = 0;
     str->isProxy = false;
+    str->smallLength = 0;
 
     return str;
 }
 
 String* StringProxy(String* original) {
-    if (original == NULL) return NULL;
+    if (original == NULL || original->arena == NULL) return NULL;
 
-    auto arena = FindArena(original->chars);
-	if (arena == NULL) return NULL;
+    // The proxy has to share storage with the original, so a short string is moved to a vector
+    if (!StrSpill(original)) return NULL;
+    original->isShared = true;
+    original->hashval = 0;
 
-    auto str = (String*)ArenaAllocateAndClear(arena, sizeof(String)); // put the proxy in the same memory as the original
+    auto str = (String*)ArenaAllocateAndClear(original->arena, sizeof(String)); // put the proxy in the same memory as the original
+    if (str == NULL) return NULL;
     str->chars = original->chars;
+    str->arena = original->arena;
     str->hashval = 0;
     str->isProxy = true;
+    str->isShared = true;
 
     return str;
 }
 
 void StringClear(String *str) {
-    if (str == NULL) return;
-    if (VectorIsValid(str->chars) == false) return;
+    if (!StringIsValid(str)) return;
 
     str->hashval = 0;
-    VClear(str->chars);
+    if (str->chars != NULL) VClear(str->chars);
+    else str->smallLength = 0;
 }
 
 void StringDeallocate(String *str) {
-    if (str == NULL) return;
+    if (str == NULL || str->arena == NULL) return;
 
-    auto arena = FindArena(str->chars);
+    auto arena = str->arena;
     if (str->isProxy == false && VectorIsValid(str->chars) == true) VectorDeallocate(str->chars);
 
+    str->chars = NULL;
+    str->arena = NULL;
     ArenaDereference(arena, str);
 }
 
 bool StringIsValid(String *str) {
-    if (str == NULL) return false;
-    return VectorIsValid(str->chars);
+    if (str == NULL || str->arena == NULL) return false;
+    return (str->chars == NULL) || VectorIsValid(str->chars);
 }
 
 String* StringNewInArena(const char* str, Arena* a) {
     auto result = (a == NULL) ? StringEmpty() : StringEmptyInArena(a);
     if (result == NULL) return NULL;
-    if (VectorIsValid(result->chars) == false) return NULL;
 
-    while (*str != 0) {
-        VPush_char(result->chars, *str);
-        str++;
-    }
+    if (!StrPushBytes(result, str, (uint32_t)strlen(str))) return NULL;
     return result;
 }
 
@@ -104,20 +195,19 @@ String* StringNew(const char * str) {
 String *StringNew(char c) {
     auto result = StringEmpty();
     if (result == NULL) return NULL;
-    if (VectorIsValid(result->chars) == false) return NULL;
-    VPush_char(result->chars, c);
+    StrPush(result, c);
     return result;
 }
 
 void StringAppendInt32(String *str, int32_t value) {
-    if (str == NULL) return;
-    if (VectorIsValid(str->chars) == false) return;
+    if (!StringIsValid(str)) return;
 
-    str->hashval = 0;
+    char buf[12];
+    int len = 0;
     bool latch = false; // have we got a sig digit yet?
     int64_t remains = value;
     if (remains < 0) {
-        VPush_char(str->chars, '-');
+        buf[len++] = '-';
         remains = -remains;
     }
     int64_t scale = 1000000000;// max value of int32 = 2147483647
@@ -128,7 +218,7 @@ void StringAppendInt32(String *str, int32_t value) {
 
         if (digit > 0 || latch) {
             latch = true;
-            VPush_char(str->chars, '0' + digit);
+            buf[len++] = (char)('0' + digit);
             remains = remains % scale;
         }
 
@@ -136,7 +226,9 @@ void StringAppendInt32(String *str, int32_t value) {
     }
 
     // if exactly zero...
-    if (!latch) VPush_char(str->chars, '0');
+    if (!latch) buf[len++] = '0';
+
+    StrPushBytes(str, buf, len);
 }
 
 String* StringFromInt32(int32_t i) {
@@ -146,33 +238,35 @@ String* StringFromInt32(int32_t i) {
 }
 
 void StringAppendInt8Hex(String *str, uint8_t value) {
-    if (str == NULL) return;
-    if (VectorIsValid(str->chars) == false) return;
+    if (!StringIsValid(str)) return;
 
-    str->hashval = 0;
+    char buf[2];
     uint32_t nybble = 0xF0;
     uint32_t digit = 0;
+    int len = 0;
     for (int i = 4; i >= 0; i-=4) {
         digit = (value & nybble) >> i;
-        if (digit <= 9) VPush_char(str->chars, '0' + digit);
-        else VPush_char(str->chars, '7' + digit); // line up with capital 'A'
+        if (digit <= 9) buf[len++] = '0' + digit;
+        else buf[len++] = '7' + digit; // line up with capital 'A'
         nybble >>= 4;
     }
+    StrPushBytes(str, buf, len);
 }
 
 void StringAppendInt32Hex(String *str, uint32_t value) {
-    if (str == NULL) return;
-    if (VectorIsValid(str->chars) == false) return;
+    if (!StringIsValid(str)) return;
 
-    str->hashval = 0;
+    char buf[8];
     uint32_t nybble = 0xF0000000;
     uint32_t digit = 0;
+    int len = 0;
     for (int i = 28; i >= 0; i-=4) {
         digit = (value & nybble) >> i;
-        if (digit <= 9) VPush_char(str->chars, '0' + digit);
-        else VPush_char(str->chars, '7' + digit); // line up with capital 'A'
+        if (digit <= 9) buf[len++] = '0' + digit;
+        else buf[len++] = '7' + digit; // line up with capital 'A'
         nybble >>= 4;
     }
+    StrPushBytes(str, buf, len);
 }
 
 void StringAppendInt64Hex(String *str, uint64_t value) {
@@ -182,14 +276,13 @@ void StringAppendInt64Hex(String *str, uint64_t value) {
 }
 
 void StringAppendDouble(String *str, double value) {
-    if (str == NULL) return;
-    if (VectorIsValid(str->chars) == false) return;
+    if (!StringIsValid(str)) return;
 
     str->hashval = 0;
 
     double uvalue = value;
     if (value < 0) {
-        VPush_char(str->chars, '-');
+        StrPush(str, '-');
         uvalue = -value;
     }
 
@@ -198,7 +291,7 @@ void StringAppendDouble(String *str, double value) {
     uint32_t fracpart = (uvalue - intpart) * 100000;
 
     StringAppendInt32(str, intpart);
-    VPush_char(str->chars, '.');
+    StrPush(str, '.');
 
     int64_t digit = 0;
 
@@ -210,19 +303,42 @@ void StringAppendDouble(String *str, double value) {
         fracpart = fracpart % scale;
 
         tail = false;
-        VPush_char(str->chars, '0' + digit);
+        StrPush(str, '0' + digit);
 
         scale /= 10;
     }
 
-    if (tail) VPush_char(str->chars, '0'); // fractional part is exactly zero
+    if (tail) StrPush(str, '0'); // fractional part is exactly zero
 }
 
 void StringAppend(String *first, String *second) {
-    if (first == NULL || second == NULL) return;
-    unsigned int len = VLength(second->chars);
+    if (!StringIsValid(first) || !StringIsValid(second)) return;
+    unsigned int len = StrLen(second);
+
+    auto src = StrFlat(second);
+    bool sameStorage = (first == second) || (first->chars != NULL && first->chars == second->chars);
+    if (src != NULL && !sameStorage) {
+        StrPushBytes(first, src, len);
+        return;
+    }
+
+    // from a chunked string, copy a chunk at a time
+    if (!sameStorage) {
+        unsigned int i = 0;
+        while (i < len) {
+            int blockStart, blockLength;
+            auto block = StringBlockAt(second, i, &blockStart, &blockLength);
+            if (block == NULL) return;
+            unsigned int count = (blockStart + blockLength) - i;
+            if (!StrPushBytes(first, block + (i - blockStart), count)) return;
+            i += count;
+        }
+        return;
+    }
+
+    // appending to self: go one at a time, as the source can move
     for (unsigned int i = 0; i < len; i++) {
-        VPush_char(first->chars, *VGet_char(second->chars, i));
+        StrPush(first, StrAt(second, i));
     }
     first->hashval = 0;
 }
@@ -242,21 +358,21 @@ String* StringClone(String *str) {
 
 void StringAppend(String *first, const char *second) {
     if (first == NULL || second == NULL) return;
-    while (*second != 0) {
-        VPush_char(first->chars, *second);
-        second++;
-    }
-    first->hashval = 0;
+    StrPushBytes(first, second, (uint32_t)strlen(second));
 }
 
 void StringAppendChar(String *str, char c) {
-    VPush_char(str->chars, c);
-    str->hashval = 0;
+    StrPush(str, c);
+}
+
+void StringAppendBytes(String *str, const char* bytes, unsigned int length) {
+    if (str == NULL || bytes == NULL || length < 1) return;
+    StrPushBytes(str, bytes, length);
 }
 
 void StringAppendChar(String *str, char c, int count) {
     str->hashval = 0;
-    for (int i = 0; i < count; i++) VPush_char(str->chars, c);
+    for (int i = 0; i < count; i++) StrPush(str, c);
 }
 
 // internal var-arg appender. `fmt` is taken literally, except for these low ascii chars:
@@ -266,7 +382,6 @@ void vStringAppendFormat(String *str, const char* fmt, va_list args) {
     
     // NOTE: When expanding this, the low-ascii points \x00, \x0A, \x0D are not to be used (null, lf, cr)
     str->hashval = 0;
-    auto chars = str->chars;
 
     while (*fmt != '\0') {
         if (*fmt == '\x01') {
@@ -279,16 +394,16 @@ void vStringAppendFormat(String *str, const char* fmt, va_list args) {
             int i = va_arg(args, int);
             StringAppendInt32Hex(str, i);
         } else if (*fmt == '\x04') {
-            char c = va_arg(args, char);
-            VPush_char(chars, c);
+            char c = (char)va_arg(args, int); // `...` promotes char and bool to int
+            StrPush(str, c);
         } else if (*fmt == '\x05') {
             char* s = va_arg(args, char*);
             StringAppend(str, s);
         } else if (*fmt == '\x06') {
-            bool s = va_arg(args, bool);
+            bool s = va_arg(args, int) != 0;
 			StringAppend(str, (s) ? "true" : "false");
 		} else if (*fmt == '\x07') {
-            char i = va_arg(args, char);
+            char i = (char)va_arg(args, int);
             StringAppendInt8Hex(str, i);
         } else {
             StringAppendChar(str, *fmt);
@@ -319,58 +434,110 @@ String * StringNewFormat(const char* fmt, ...) {
 
 
 void StringNL(String *str) {
-    VPush_char(str->chars, '\n');
-    str->hashval = 0;
+    StrPush(str, '\n');
 }
 
 char StringDequeue(String* str) {
-    if (str == NULL) return '\0';
+    if (!StringIsValid(str)) return '\0';
     str->hashval = 0;
     char c;
-    if (!VDequeue_char(str->chars, &c)) return '\0';
+    if (str->chars != NULL) {
+        if (!VDequeue_char(str->chars, &c)) return '\0';
+        return c;
+    }
+
+    if (str->smallLength < 1) return '\0';
+    c = str->small[0];
+    str->smallLength--;
+    memmove(str->small, str->small + 1, str->smallLength);
     return c;
 }
 
 // remove and return the last char of the string. If string is empty, returns '\0'
 char StringPop(String* str) {
-    if (str == NULL) return '\0';
+    if (!StringIsValid(str)) return '\0';
     str->hashval = 0;
     char c;
-    if (!VPop_char(str->chars, &c)) return '\0';
-    return c;
+    if (str->chars != NULL) {
+        if (!VPop_char(str->chars, &c)) return '\0';
+        return c;
+    }
+
+    if (str->smallLength < 1) return '\0';
+    str->smallLength--;
+    return str->small[str->smallLength];
 }
 
 unsigned int StringLength(String * str) {
     if (str == NULL) return 0;
-    return VLength(str->chars);
+    return StrLen(str);
 }
 
 char StringCharAtIndex(String *str, int idx) {
-    char val = 0;
+    if (str == NULL) return 0;
+    int len = (int)StrLen(str);
     if (idx < 0) { // from end
-        idx += VLength(str->chars);
+        idx += len;
+    }
+    if (idx < 0 || idx >= len) return 0;
+    return StrAt(str, idx);
+}
+
+const char* StringBlockAt(String *str, int idx, int* outStart, int* outLength) {
+    if (str == NULL || outStart == NULL || outLength == NULL) return NULL;
+    if (idx < 0 || idx >= (int)StrLen(str)) return NULL;
+
+    auto flat = StrFlat(str);
+    if (flat != NULL) {
+        *outStart = 0;
+        *outLength = StrLen(str);
+        return flat;
     }
-    auto ok = VCopy_char(str->chars, idx, &val);
-    if (!ok) return 0;
-    return val;
+    return (const char*)VectorBlockAt(str->chars, idx, outStart, outLength);
 }
 
 // Create a new string from a range in an existing string. The existing string is not modified
 String *StringSlice(String* str, int startIdx, int length) {
-    if (str == NULL) return NULL;
-    auto len = StringLength(str);
+    if (!StringIsValid(str)) return NULL;
+    int len = StrLen(str);
     if (len < 1) return NULL;
 
-    auto arena = FindArena(str->chars);
-	if (arena == NULL) return NULL;
-
-    String *result = StringEmptyInArena(arena);
+    String *result = StringEmptyInArena(str->arena);
+    if (result == NULL) return NULL;
     while (startIdx < 0) { startIdx += len; }
     if (length < 0) { length += len; length -= startIdx - 1; }
 
+    // Most slices don't wrap around the end, and can be copied in one go
+    auto flat = StrFlat(str);
+    if (flat != NULL && length > 0 && startIdx + length <= len) {
+        if (!StrPushBytes(result, flat + startIdx, length)) {
+            StringDeallocate(result);
+            return NULL;
+        }
+        return result;
+    }
+
+    // Long strings are stored in chunks, which we copy one at a time
+    if (flat == NULL && length > 0 && startIdx + length <= len) {
+        int i = startIdx;
+        int end = startIdx + length;
+        while (i < end) {
+            int blockStart, blockLength;
+            auto block = StringBlockAt(str, i, &blockStart, &blockLength);
+            int count = (blockStart + blockLength) - i;
+            if (count > end - i) count = end - i;
+            if (block == NULL || !StrPushBytes(result, block + (i - blockStart), count)) {
+                StringDeallocate(result);
+                return NULL;
+            }
+            i += count;
+        }
+        return result;
+    }
+
     for (int i = 0; i < length; i++) {
         uint32_t x = (i + startIdx) % len;
-        if (!VPush_char(result->chars, *VGet_char(str->chars, x))) {
+        if (!StrPush(result, StrAt(str, x))) {
             // out of memory?
             StringDeallocate(result);
             return NULL;
@@ -387,12 +554,23 @@ String *StringChop(String* str, int startIdx, int length) {
     return result;
 }
 
+// Copy characters from a string into a c-string buffer
+void StrCopyOut(String *str, uint32_t start, uint32_t length, char* target) {
+    auto flat = StrFlat(str);
+    if (flat != NULL) {
+        memcpy(target, flat + start, length);
+        return;
+    }
+    for (uint32_t i = 0; i < length; i++) {
+        target[i] = StrAt(str, i + start);
+    }
+}
+
 char *StringToCStr(String *str, Arena* a) {
     auto len = StringLength(str);
     auto result = (char*)ArenaAllocate(a, 1 + (sizeof(char) * len)); // need extra byte for '\0'
-    for (unsigned int i = 0; i < len; i++) {
-        result[i] = *VGet_char(str->chars, i);
-    }
+    if (result == NULL) return NULL;
+    if (len > 0) StrCopyOut(str, 0, len, result);
     result[len] = 0;
     return result;
 }
@@ -403,22 +581,20 @@ char *SubstringToCStr(String *str, int start, Arena* a) {
         start += len;
     }
     if (len > start) { len -= start; }
+    else { len = 0; }
     if (a == NULL) a = MMCurrent();
 
     auto result = (char*)ArenaAllocate(a, 1 + (sizeof(char) * len)); // need extra byte for '\0'
-    for (unsigned int i = 0; i < len; i++) {
-        char *cp = VGet_char(str->chars, i + start);
-        if (cp == NULL) {
-            break;
-        }
-        result[i] = *cp;
-    }
+    if (result == NULL) return NULL;
+    if (len > 0) StrCopyOut(str, start, len, result);
     result[len] = 0;
     return result;
 }
 
 Vector* StringGetByteVector(String* str) {
-    if (str == NULL) return NULL;
+    if (!StringIsValid(str)) return NULL;
+    if (!StrSpill(str)) return NULL; // callers can write to the vector, so it must be the real storage
+    str->hashval = 0;
     return str->chars;
 }
 
@@ -428,8 +604,9 @@ uint32_t StringHash(String* str) {
 
     uint32_t len = StringLength(str);
     uint32_t hash = len;
+    auto flat = StrFlat(str);
     for (uint32_t i = 0; i < len; i++) {
-        hash += *VGet_char(str->chars, i);;
+        hash += (flat != NULL) ? flat[i] : StrAt(str, i);
         hash ^= hash >> 16;
         hash *= 0x7feb352d;
         hash ^= hash >> 15;
@@ -445,17 +622,18 @@ uint32_t StringHash(String* str) {
     hash += len;
 
     if (hash == 0) return 0x800800; // never return zero
-    str->hashval = hash;
+    if (!str->isShared) str->hashval = hash;
     return hash;
 }
 
 void StringToLower(String *str) {
-    if (str == NULL) return;
+    if (!StringIsValid(str)) return;
     str->hashval = 0;
     // Simple 7-bit ASCII only at present
-    uint32_t len = VLength(str->chars);
+    uint32_t len = StrLen(str);
+    auto flat = StrFlat(str);
     for (uint32_t i = 0; i < len; i++) {
-        auto chr = VGet_char(str->chars, i);
+        auto chr = (flat != NULL) ? (flat + i) : VGet_char(str->chars, i);
         if (*chr >= 'A' && *chr <= 'Z') {
             *chr = *chr + 0x20;
         }
@@ -463,12 +641,13 @@ void StringToLower(String *str) {
 }
 
 void StringToUpper(String *str) {
-    if (str == NULL) return;
+    if (!StringIsValid(str)) return;
     str->hashval = 0;
     // Simple 7-bit ASCII only at present
-    uint32_t len = VLength(str->chars);
+    uint32_t len = StrLen(str);
+    auto flat = StrFlat(str);
     for (uint32_t i = 0; i < len; i++) {
-        auto chr = VGet_char(str->chars, i);
+        auto chr = (flat != NULL) ? (flat + i) : VGet_char(str->chars, i);
         if (*chr >= 'a' && *chr <= 'z') {
             *chr = *chr - 0x20;
         }
@@ -480,25 +659,14 @@ bool StringStartsWith(String* haystack, String *needle) {
     if (needle == NULL) return true;
     auto len = StringLength(needle);
     if (len > StringLength(haystack)) return false;
-    for (uint32_t i = 0; i < len; i++) {
-        auto a = VGet_char(haystack->chars, i);
-        auto b = VGet_char(needle->chars, i);
-        if (*a != *b) return false;
-    }
-    return true;
+    return StrRangeEqual(haystack, 0, needle, 0, len);
 }
 bool StringStartsWith(String* haystack, const char* needle) {
     if (haystack == NULL) return false;
     if (needle == NULL) return true;
-    auto limit = StringLength(haystack);
-    uint32_t i = 0;
-    while (needle[i] != 0) {
-        if (i >= limit) return false;
-        auto chr = VGet_char(haystack->chars, i);
-        if (*chr != needle[i]) return false;
-        i++;
-    }
-    return true;
+    auto len = (uint32_t)strlen(needle);
+    if (len > StringLength(haystack)) return false;
+    return StrRangeEqual(haystack, 0, needle, len);
 }
 
 
@@ -509,46 +677,181 @@ bool StringEndsWith(String* haystack, String *needle) {
     auto off = StringLength(haystack);
     if (len > off) return false;
     off -= len;
-    for (uint32_t i = 0; i < len; i++) {
-        auto a = VGet_char(haystack->chars, i + off);
-        auto b = VGet_char(needle->chars, i);
-        if (*a != *b) return false;
-    }
-    return true;
+    return StrRangeEqual(haystack, off, needle, 0, len);
 }
 bool StringEndsWith(String* haystack, const char* needle) {
-    auto str2 = StringNew(needle);
-    bool match = StringEndsWith(haystack, str2);
-    StringDeallocate(str2);
-    return match;
+    if (haystack == NULL) return false;
+    if (needle == NULL) return true;
+    auto len = (uint32_t)strlen(needle);
+    auto off = StringLength(haystack);
+    if (len > off) return false;
+    off -= len;
+    return StrRangeEqual(haystack, off, needle, len);
 }
 
 bool StringAreEqual(String* a, String* b) {
-    if (a == NULL || a->chars == NULL || !VectorIsValid(a->chars)) return false;
-    if (b == NULL || b->chars == NULL || !VectorIsValid(b->chars)) return false;
-    uint32_t len = StringLength(a);
-    if (len != StringLength(b)) return false;
-    for (uint32_t i = 0; i < len; i++) {
-        auto ca = VGet_char(a->chars, i);
-        auto cb = VGet_char(b->chars, i);
-        if (*ca != *cb) return false;
-    }
-    return true;
+    if (!StringIsValid(a) || !StringIsValid(b)) return false;
+    uint32_t len = StrLen(a);
+    if (len != StrLen(b)) return false;
+    return StrRangeEqual(a, 0, b, 0, len);
 }
 bool StringAreEqual(String* a, const char* b) {
     if (a == NULL) return false;
     if (b == NULL) return false;
-    uint32_t limit = StringLength(a);
+    uint32_t len = (uint32_t)strlen(b);
+    if (len != StringLength(a)) return false;
+    return StrRangeEqual(a, 0, b, len);
+}
+
+
+// Find the lowest set bit in a non-zero mask
+inline uint32_t LowestSetBit(uint32_t mask) {
+#ifdef _MSC_VER
+    unsigned long idx;
+    _BitScanForward(&idx, mask);
+    return (uint32_t)idx;
+#else
+    return (uint32_t)__builtin_ctz(mask);
+#endif
+}
+
+// Search for a needle of 2 or more bytes by checking the first and last bytes of each candidate position,
+// and only comparing the rest where both match. With SSE2, 16 positions are filtered at a time.
+const char* SearchFirstLast(const char* hay, uint32_t hayLen, const char* needle, uint32_t needleLen) {
+    uint32_t last = needleLen - 1;
+    uint32_t limit = hayLen - needleLen; // last position a match could start at
     uint32_t i = 0;
-    while (b[i] != 0) {
-        if (i >= limit) return false;
-        auto chr = VGet_char(a->chars, i);
-        if (*chr != b[i]) return false;
+
+#ifdef STRING_SSE2
+    const __m128i firstByte = _mm_set1_epi8(needle[0]);
+    const __m128i lastByte = _mm_set1_epi8(needle[last]);
+    for (; i + 15 <= limit; i += 16) {
+        __m128i blockFirst = _mm_loadu_si128((const __m128i*)(hay + i));
+        __m128i blockLast = _mm_loadu_si128((const __m128i*)(hay + i + last));
+        __m128i both = _mm_and_si128(_mm_cmpeq_epi8(firstByte, blockFirst), _mm_cmpeq_epi8(lastByte, blockLast));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(both);
+        while (mask != 0) {
+            uint32_t pos = i + LowestSetBit(mask);
+            if (memcmp(hay + pos + 1, needle + 1, last - 1) == 0) return hay + pos;
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    // Remaining positions (or all of them without SSE2)
+    while (i <= limit) {
+        auto next = (const char*)memchr(hay + i, needle[0], limit - i + 1);
+        if (next == NULL) return NULL;
+        i = (uint32_t)(next - hay);
+        if (hay[i + last] == needle[last] && memcmp(next + 1, needle + 1, last - 1) == 0) return next;
         i++;
     }
-    return i == limit;
+    return NULL;
+}
+
+// Maximal suffix of the needle, for the Two-Way critical factorisation.
+// `reversed` uses the opposite byte order. Returns the position before the suffix starts, and its period in `period`.
+int TwoWayMaxSuffix(const unsigned char* needle, int length, int* period, bool reversed) {
+    int ms = -1, j = 0, k = 1, p = 1;
+    while (j + k < length) {
+        unsigned char a = needle[j + k];
+        unsigned char b = needle[ms + k];
+        if (reversed ? (a > b) : (a < b)) {
+            j += k; k = 1; p = j - ms;
+        } else if (a == b) {
+            if (k != p) k++;
+            else { j += p; k = 1; }
+        } else {
+            ms = j; j = ms + 1; k = p = 1;
+        }
+    }
+    *period = p;
+    return ms;
+}
+
+// Crochemore-Perrin Two-Way search. Linear time and constant space for any needle,
+// so long needles with repeats can't make the search quadratic.
+const char* SearchTwoWay(const char* hay, uint32_t hayLen, const char* needle, uint32_t needleLen) {
+    auto x = (const unsigned char*)needle;
+    auto y = (const unsigned char*)hay;
+    int m = (int)needleLen;
+    int n = (int)hayLen;
+
+    int p, q;
+    int i = TwoWayMaxSuffix(x, m, &p, false);
+    int j = TwoWayMaxSuffix(x, m, &q, true);
+    int ell, per;
+    if (i > j) { ell = i; per = p; }
+    else { ell = j; per = q; }
+
+    if (memcmp(x, x + per, ell + 1) == 0) {
+        // Needle is periodic: remember how much of the prefix is already known to match
+        int memory = -1;
+        j = 0;
+        while (j <= n - m) {
+            i = ((ell > memory) ? ell : memory) + 1;
+            while (i < m && x[i] == y[i + j]) i++;
+            if (i >= m) {
+                i = ell;
+                while (i > memory && x[i] == y[i + j]) i--;
+                if (i <= memory) return hay + j;
+                j += per;
+                memory = m - per - 1;
+            } else {
+                j += i - ell;
+                memory = -1;
+            }
+        }
+    } else {
+        per = ((ell + 1 > m - ell - 1) ? ell + 1 : m - ell - 1) + 1;
+        j = 0;
+        while (j <= n - m) {
+            i = ell + 1;
+            while (i < m && x[i] == y[i + j]) i++;
+            if (i >= m) {
+                i = ell;
+                while (i >= 0 && x[i] == y[i + j]) i--;
+                if (i < 0) return hay + j;
+                j += per;
+            } else {
+                j += i - ell;
+            }
+        }
+    }
+    return NULL;
 }
 
+// Find the first position of `needle` in `hay`, or NULL if it does not occur
+const char* StrSearch(const char* hay, uint32_t hayLen, const char* needle, uint32_t needleLen) {
+    if (needleLen == 0) return hay;
+    if (needleLen > hayLen) return NULL;
+    if (needleLen == 1) return (const char*)memchr(hay, needle[0], hayLen);
+    if (needleLen < TWO_WAY_MIN_NEEDLE) return SearchFirstLast(hay, hayLen, needle, needleLen);
+    return SearchTwoWay(hay, hayLen, needle, needleLen);
+}
+
+// Find a needle of known length, starting at `start`
+bool StrFind(String* haystack, const char* needle, uint32_t needleLen, uint32_t start, unsigned int* outPosition) {
+    uint32_t hayLen = StrLen(haystack);
+    if (start > hayLen || needleLen > hayLen - start) return false;
+
+    auto flat = StrFlat(haystack);
+    if (flat != NULL) {
+        auto found = StrSearch(flat + start, hayLen - start, needle, needleLen);
+        if (found == NULL) return false;
+        if (outPosition != NULL) *outPosition = (unsigned int)(found - flat);
+        return true;
+    }
+
+    // Very long strings are chunked, so check each position
+    for (uint32_t i = start; i + needleLen <= hayLen; i++) {
+        if (StrRangeEqual(haystack, i, needle, needleLen)) {
+            if (outPosition != NULL) *outPosition = i;
+            return true;
+        }
+    }
+    return false;
+}
 
 bool StringFind(String* haystack, String* needle, unsigned int start, unsigned int* outPosition) {
     // get a few special cases out of the way
@@ -556,88 +859,53 @@ bool StringFind(String* haystack, String* needle, unsigned int start, unsigned i
     if (outPosition != NULL) *outPosition = 0;
     if (needle == NULL) return true; // treating null as empty
 
-    uint32_t hayLen = VLength(haystack->chars);
-    uint32_t needleLen = VLength(needle->chars);
-    if (needleLen > hayLen) return false;
-    if (start < 0) { // from end
-        start += hayLen;
-    }
-    
-    auto arena = FindArena(haystack->chars);
-	if (arena == NULL) return false;
-
-    // RabinKarp method, but using sum rather than hash (more false positives, but much cheaper on average)
-    // get a hash of the 'needle', and try to find somewhere in the haystack that matches.
-    // double-check if we find one.
-    char *matchStr = StringToCStr(needle, arena);
-    char *scanStr = SubstringToCStr(haystack, start, arena);
-
-    // make sum of the needle, and an initial sum of the scan hash
-    int match = 0;
-    int scan = 0;
-    uint32_t i = 0;
-    for (i = 0; i < needleLen; i++) {
-        match += matchStr[i];
-        scan += scanStr[i];
-    }
-
-    // now roll the hash until until we find a match or run out of string
-    for (i = needleLen; i < hayLen; i++) {
-        if (match == scan) { // possible match, double check
-            uint32_t idx = i - needleLen;
-            if (outPosition != NULL) *outPosition = idx + start;
-            bool found = true;
-            for (uint32_t j = 0; j < needleLen; j++) {
-                if (matchStr[j] != scanStr[j + idx]) {
-                    found = false;
-                    break;
-                }
-            }
-            if (!found) {
-                scan -= scanStr[i - needleLen];
-                scan += scanStr[i];
-                continue;
-            }
+    auto flatNeedle = StrFlat(needle);
+    if (flatNeedle != NULL) return StrFind(haystack, flatNeedle, StrLen(needle), start, outPosition);
 
-            // OK, this is a match
-            ArenaDereference(arena, matchStr);
-            ArenaDereference(arena, scanStr);
+    // Needle is too long to be flat
+    uint32_t hayLen = StrLen(haystack);
+    uint32_t needleLen = StrLen(needle);
+    if (start > hayLen || needleLen > hayLen - start) return false;
+    for (uint32_t i = start; i + needleLen <= hayLen; i++) {
+        if (StrRangeEqual(haystack, i, needle, 0, needleLen)) {
+            if (outPosition != NULL) *outPosition = i;
             return true;
         }
-
-        scan -= scanStr[i - needleLen];
-        scan += scanStr[i];
     }
-
-    // Clean up.
-    ArenaDereference(arena, matchStr);
-    ArenaDereference(arena, scanStr);
     return false;
 }
 
 
 // Find the position of a substring. If the outPosition is NULL, it is ignored
 bool StringFind(String* haystack, const char * needle, unsigned int start, unsigned int* outPosition) {
-    auto needl = StringNew(needle);
-    bool result = StringFind(haystack, needl, start, outPosition);
-    StringDeallocate(needl);
-    return result;
+    if (haystack == NULL) return false;
+    if (outPosition != NULL) *outPosition = 0;
+    if (needle == NULL) return true; // treating null as empty
+    return StrFind(haystack, needle, (uint32_t)strlen(needle), start, outPosition);
 }
 
 // Find the next position of a character. If the outPosition is NULL, it is ignored
 bool StringFind(String* haystack, char needle, unsigned int start, unsigned int* outPosition) {
     if (haystack == NULL) return false;
     if (outPosition != NULL) *outPosition = 0;
-    if (needle == NULL) return true; // treating null as empty
+    if (needle == 0) return true; // treating null as empty
 
-    uint32_t hayLen = VLength(haystack->chars);
+    uint32_t hayLen = StringLength(haystack);
     if (start < 0) { // from end
         start += hayLen;
     }
     if (hayLen < start) return false;
 
-    for (int i = start; i < hayLen; i++) {
-        char c = StringCharAtIndex(haystack, i);
+    auto flat = StrFlat(haystack);
+    if (flat != NULL) {
+        auto found = (const char*)memchr(flat + start, needle, hayLen - start);
+        if (found == NULL) return false;
+        if (outPosition != NULL) *outPosition = (unsigned int)(found - flat);
+        return true;
+    }
+
+    for (uint32_t i = start; i < hayLen; i++) {
+        char c = StrAt(haystack, i);
         if (c == needle) {
             if (outPosition != NULL) *outPosition = i;
             return true;
@@ -651,6 +919,17 @@ bool StringFind(String* haystack, char needle, unsigned int start, unsigned int*
 // Append part of a source string into the end of the destination
 void StringAppendSubstr(String* dest, String* src, int srcStart, int srcLength) {
     if (dest == NULL || src == NULL) return;
+
+    // Copy directly when the range is in bounds and doesn't overlap the destination's storage
+    int len = StrLen(src);
+    if (srcLength < 0) { srcLength += len; srcLength -= srcStart - 1; }
+    auto flat = StrFlat(src);
+    if (flat != NULL && dest != src && (dest->chars == NULL || dest->chars != src->chars)
+        && srcStart >= 0 && srcLength >= 0 && srcStart + srcLength <= len) {
+        StrPushBytes(dest, flat + srcStart, srcLength);
+        return;
+    }
+
     auto slice = StringSlice(src, srcStart, srcLength);
     StringAppend(dest, slice);
     StringDeallocate(slice);
@@ -660,38 +939,53 @@ void StringAppendSubstr(String* dest, String* src, int srcStart, int srcLength)
 String* StringReplace(String* haystack, String* needle, String* replacement) {
     if (haystack == NULL || needle == NULL) return NULL;
 
-    // use `StringFind` to get to the next occurance.
-    // for each occurance, copy across the chars up to that point, then copy across replacement, then skip the occurance
-    
-	auto arena = FindArena(haystack->chars);
+	auto arena = haystack->arena;
 	if (arena == NULL) return NULL;
 
     String *result = StringEmptyInArena(arena);
     if (result == NULL) return NULL;
 
-    int length = StringLength(haystack);
-    int nlen = StringLength(needle);
-    uint32_t tail = 0;
-    uint32_t next = 0;
-    bool found = StringFind(haystack, needle, tail, &next);
-    
-    while (found) {
-        // replacements
-        StringAppendSubstr(result, haystack, tail, next - tail);
-        StringAppend(result, replacement);
-
-        // next one
-        tail = next+nlen;
-        found = StringFind(haystack, needle, tail, &next);
-        if (next == 0) {
-            found = false;
+    uint32_t length = StrLen(haystack);
+    uint32_t nlen = StrLen(needle);
+    uint32_t rlen = StringLength(replacement);
+    if (nlen < 1 || nlen > length) {
+        StringAppend(result, haystack);
+        return result;
+    }
+
+    auto hay = StrFlat(haystack);
+    auto find = StrFlat(needle);
+    auto with = (rlen > 0) ? StrFlat(replacement) : "";
+    if (hay == NULL || find == NULL || with == NULL) {
+        // Very long strings: copy across the chars up to each occurance, then the replacement, then skip the occurance
+        uint32_t tail = 0;
+        uint32_t next = 0;
+        while (StringFind(haystack, needle, tail, &next)) {
+            StringAppendSubstr(result, haystack, tail, next - tail);
+            StringAppend(result, replacement);
+            tail = next + nlen;
         }
+        if (tail < length) StringAppendSubstr(result, haystack, tail, length - tail);
+        return result;
     }
 
-    // final tail
-    if (tail < length) {
-        StringAppendSubstr(result, haystack, tail, -1);
+    // One pass over the haystack, writing into an output that is already big enough unless the replacement is longer
+    if (length > STRING_SMALL_SIZE) {
+        if (!StrSpill(result) || !VectorReserve(result->chars, length)) {
+            StringDeallocate(result);
+            return NULL;
+        }
+    }
+    const char* tail = hay;
+    auto end = hay + length;
+    while (true) {
+        auto found = StrSearch(tail, (uint32_t)(end - tail), find, nlen);
+        if (found == NULL) break;
+        StrPushBytes(result, tail, (uint32_t)(found - tail));
+        StrPushBytes(result, with, rlen);
+        tail = found + nlen;
     }
+    StrPushBytes(result, tail, (uint32_t)(end - tail));
 
     return result;
 }
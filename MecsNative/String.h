@@ -6,6 +6,7 @@
 #include "Vector.h"
 #include "ArenaAllocator.h"
 #include <stdint.h>
+#include <stdarg.h>
 
 // A mutable variable length string structure
 typedef struct String String;
@@ -46,6 +47,10 @@ bool StringIsValid(String *str);
 unsigned int StringLength(String* str);
 // Get char at index. Returns 0 if invalid. Negative indexes are from end
 char StringCharAtIndex(String *str, int idx);
+// Read-only pointer to the characters stored together around `idx`, for scanning without copying.
+// `outStart` and `outLength` are set to the range of the string covered. Returns NULL if `idx` is out of range.
+// Invalidated by any change to the string.
+const char* StringBlockAt(String *str, int idx, int* outStart, int* outLength);
 
 // Add a newline character
 void StringNL(String *str);
@@ -57,6 +62,8 @@ void StringAppend(String *first, const char *second);
 void StringAppendChar(String *str, char c);
 // Add a character to the end of a string, that character repeated a number of times
 void StringAppendChar(String *str, char c, int count);
+// Add `length` bytes to the end of a string. The bytes may include zeros.
+void StringAppendBytes(String *str, const char* bytes, unsigned int length);
 // Append, somewhat like sprintf. `fmt` is taken literally, except for these low ascii chars:
 //'\x01'=(String*); '\x02'=int as dec; '\x03'=int as hex; '\x04'=char; '\x05'=C string (const char*); '\x06'=bool; '\x07'=byte as hex
 void StringAppendFormat(String *str, const char* fmt, ...);
@@ -78,7 +85,8 @@ char StringPop(String* str);
 uint32_t StringHash(String* str);
 // Alloc and copy a new c-string from a mutable string. The result is stored in the target arena
 char *StringToCStr(String *str, Arena* a);
-// Access the underlying byte vector of the string
+// Access the underlying byte vector of the string. Changes to the vector are changes to the string.
+// Short strings are normally stored without a vector, so this will allocate one for them.
 Vector* StringGetByteVector(String* str);
 
 // Change all upper-case letters to lower case, in place (existing string is modified)
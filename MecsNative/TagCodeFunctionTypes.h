@@ -38,6 +38,9 @@ enum class FuncDef {
     Length,
     Replace,
     Concat,
+    Find,
+    Split,
+    CountOf,
 
     Assert,
     Random,
@@ -55,10 +58,14 @@ enum class FuncDef {
     Push,
     Pop,
     Dequeue,
+    Sort,
 
 	Send,
+	SendTo,
 	Listen,
 	Wait,
+	WaitFor,
+	Sleep,
     Directive_Run,
 
     UnitEmpty
@@ -73,4 +80,8 @@ typedef struct FunctionDefinition
 
 FuncDef CmpOpToFunction(CmpOp cmpOp);
 
+// Debug symbol that holds the tag-code to source line map (see `TCW_WriteSymbolsToStream` and `TCR_ReadLineMap`).
+// The space means it can't be the name of anything in a program.
+#define LINE_MAP_SYMBOL " line-map"
+
 #endif
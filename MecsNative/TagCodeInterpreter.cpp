@@ -2,12 +2,15 @@
 
 #include "MemoryManager.h"
 #include "HashMap.h"
+#include "Deque.h"
 #include "Scope.h"
 #include "TagCodeFunctionTypes.h"
 #include "TagCodeReader.h"
 #include "TypeCoersion.h"
 #include "MathBits.h"
 #include "Serialisation.h"
+#include "Sort.h"
+#include "Trace.h"
 
 // required only for 'eval'
 #include "SourceCodeTokeniser.h"
@@ -25,7 +28,7 @@ RegisterHashMapStatics(Map)
 RegisterHashMapFor(Name, StringPtr, HashMapIntKeyHash, HashMapIntKeyCompare, Map)
 RegisterHashMapFor(Name, FunctionDefinition, HashMapIntKeyHash, HashMapIntKeyCompare, Map)
 RegisterHashMapFor(StringPtr, DataTag, HashMapStringKeyHash, HashMapStringKeyCompare, Map)
-RegisterHashMapFor(StringPtr, VectorPtr, HashMapStringKeyHash, HashMapStringKeyCompare, Map)
+RegisterHashMapFor(StringPtr, DequePtr, HashMapStringKeyHash, HashMapStringKeyCompare, Map)
 RegisterHashMapFor(StringPtr, bool, HashMapStringKeyHash, HashMapStringKeyCompare, Map)
 
 RegisterVectorStatics(Vec)
@@ -36,12 +39,53 @@ RegisterVectorFor(VectorPtr, Vec)
 RegisterVectorFor(StringPtr, Vec)
 RegisterVectorFor(HashMap_KVP, Vec)
 
+RegisterDequeStatics(Deq)
+RegisterDequeFor(DequePtr, Deq)
+
+// Sort keys for lists of numbers. These order the same way as the `<` function.
+// `Integer` tags are sorted by their 32-bit data (with sign bit flipped),
+inline uint32_t IntegerSortKey(DataTag* t) { return t->data ^ 0x80000000u; }
+// `Fraction` tags by the 56 double bits they hold (flipped so negatives order correctly)
+inline uint64_t FractionSortKey(DataTag* t) {
+    uint64_t bits = ((uint64_t)t->params << 32) | t->data;
+    return (bits & 0x0080000000000000ull) ? (~bits & 0x00FFFFFFFFFFFFFFull) : (bits | 0x0080000000000000ull);
+}
+int CompareIntegerTags(DataTag* a, DataTag* b) { auto ka = IntegerSortKey(a), kb = IntegerSortKey(b); return (ka > kb) - (ka < kb); }
+int CompareFractionTags(DataTag* a, DataTag* b) { auto ka = FractionSortKey(a), kb = FractionSortKey(b); return (ka > kb) - (ka < kb); }
+RegisterRadixSortFor(DataTag, uint32_t, IntegerSortKey, Int)
+RegisterRadixSortFor(DataTag, uint64_t, FractionSortKey, Frac)
+
+// Mixed lists are sorted on a precalculated numeric value
+typedef struct SortEntry {
+    double key;
+    DataTag tag;
+} SortEntry;
+inline bool SortEntryLess(SortEntry* a, SortEntry* b) { return a->key < b->key; }
+int CompareSortEntry(SortEntry* a, SortEntry* b) { return (a->key > b->key) - (a->key < b->key); }
+RegisterMergeSortFor(SortEntry, SortEntryLess, Entry)
+RegisterVectorFor(SortEntry, Vec)
+
 // the smallest difference considered for float equality
 const float ComparisonPrecision = 1e-10;
 
 // Maximum size of the value stack.
 const int MAX_STACK = 512;
 
+// Maximum number of compiled `eval` fragments kept by each interpreter
+const int EVAL_CACHE_ENTRIES = 32;
+// Maximum number of tags held by cached `eval` fragments. Larger fragments are not cached.
+const int EVAL_CACHE_MAX_TAGS = 8192;
+
+// A compiled `eval` fragment, resident in the interpreter's overlay
+typedef struct EvalCacheEntry {
+    uint32_t hash; // `StringHash` of the source
+    String* source; // source code, to confirm a hash match
+    int start; // first tag of the fragment, relative to the overlay
+    int length; // number of tags in the fragment
+    uint32_t lastUsed; // value of `_evalClock` when last used
+} EvalCacheEntry;
+RegisterVectorFor(EvalCacheEntry, Vec)
+
 /*
     Our interpreter is a two-stack model
 */
@@ -57,7 +101,17 @@ typedef struct InterpreterState {
 	ExecutionState State;
 
     // the string table and opcodes
-    Vector* _program; // Vector<DataTag> (read only)
+    Vector* _program; // Vector<DataTag> (read only, and may be shared with other interpreters)
+    int _programLength; // length of `_program`. Positions from here on are in `_overlay`
+    Vector* _overlay; // Vector<DataTag> of code added by `eval`, private to this interpreter
+
+    // Compiled `eval` code is kept at the start of `_overlay`, so repeated evals can skip compiling.
+    // Fragments after `_evalCacheEnd` are not cached, and are rolled back when they finish.
+    Vector* _evalCache; // Vector<EvalCacheEntry>
+    int _evalCacheEnd; // overlay length covered by cached fragments
+    int _evalDepth; // number of `eval` fragments currently running. Cached code is only moved when this is zero.
+    uint32_t _evalClock; // incremented on each cache use, for least-recently-used eviction
+    int _evalHits, _evalMisses;
     Scope* _variables; // scoped variable references
     Arena* _memory; // read/write memory (for non-short strings and other 'heap' containers)
 
@@ -66,12 +120,23 @@ typedef struct InterpreterState {
     HashMap* DebugSymbols; // Map<CrushName -> String>
 
 	// Inter-Program Communication
-	HashMap* IPC_Queues; // Map<TargetName -> Vector< datavec > >; where datavec is Vector<byte>
+	HashMap* IPC_Queues; // Map<TargetName -> Deque< datadeq > >; where datadeq is Deque<byte>
 	HashMap* IPC_Queue_WaitFlags; // Map<TargetName -> bool>; `true` means the interpreter is waiting for this message
+	int IPC_WaitTimeout; // milliseconds the current wait may last, or -1 to wait until a message arrives
+	DataTag IPC_TimeoutValue; // value given back by a wait that timed out (`Void` for nothing)
+	bool IPC_TimedOut; // set by the scheduler when the wait ran out of time
+	int IPC_SpawnPriority; // priority class asked for by the last `run:`, or -1 if none was given
+	int IPC_MessagesReceived; // count of messages accepted into `IPC_Queues`
+	int IPC_SendProcess; // process ID the message being sent is for (`send-to`), or zero to broadcast it (`send`)
     int ExternalId; // ID for use by scheduler
 
     // number of byte codes interpreted (also used for random number generation)
     int _stepsTaken;
+#ifdef INTERP_PROFILER
+    // op-codes to run before the next profile sample. Counted down even when not profiling, so the run loop has only one test.
+    int _profileCountdown;
+    struct ProfileState* _profile; // NULL until `InterpProfileStart`
+#endif
     // if `true`, write lots of output
     bool _runningVerbose;
     // the PC. This is in TOKEN positions, not bytes
@@ -108,19 +173,21 @@ void AddBuiltInFunctionSymbols(HashMap* fd) {
     add("readkey", FuncDef::ReadKey); add("readline", FuncDef::ReadLine);
     add("print", FuncDef::Print); add("substring", FuncDef::Substring);
     add("length", FuncDef::Length); add("replace", FuncDef::Replace); add("concat", FuncDef::Concat);
+    add("find", FuncDef::Find); add("split", FuncDef::Split); add("count-of", FuncDef::CountOf);
 
     add("+", FuncDef::MathAdd); add("-", FuncDef::MathSub); add("*", FuncDef::MathProd);
     add("/", FuncDef::MathDiv); add("%", FuncDef::MathMod);
     
     add("new-map", FuncDef::NewMap); 
     add("new-list", FuncDef::NewList); add("push", FuncDef::Push);
-    add("pop", FuncDef::Pop); add("dequeue", FuncDef::Dequeue);
+    add("pop", FuncDef::Pop); add("dequeue", FuncDef::Dequeue); add("sort", FuncDef::Sort);
 
-	add("listen", FuncDef::Listen); add("wait", FuncDef::Wait); add("send", FuncDef::Send);
+	add("listen", FuncDef::Listen); add("wait", FuncDef::Wait); add("send", FuncDef::Send); add("send-to", FuncDef::SendTo);
+	add("sleep", FuncDef::Sleep); add("wait-for", FuncDef::WaitFor);
     add("run:", FuncDef::Directive_Run);
 
     add("()", FuncDef::UnitEmpty); // empty value marker
-#undef add;
+#undef add
 }
 
 void InterpSetId(InterpreterState* is, int id) {
@@ -128,6 +195,11 @@ void InterpSetId(InterpreterState* is, int id) {
     is->ExternalId = id;
 }
 
+int InterpGetId(InterpreterState* is) {
+    if (is == NULL) return 0;
+    return is->ExternalId;
+}
+
 void InterpDescribeCode(InterpreterState* is, String* target){
 	if (is == NULL || target == NULL) return;
 	auto str = TCR_Describe(is->_program, is->DebugSymbols);
@@ -137,9 +209,10 @@ void InterpDescribeCode(InterpreterState* is, String* target){
 
 // Start up an interpreter
 // tagCode is Vector<DataTag>, debugSymbols in Map<CrushName -> StringPtr>.
-InterpreterState* InterpAllocate(Vector* tagCode, size_t memorySize, HashMap* debugSymbols) {
-    if (tagCode == NULL) return NULL;
+// Set up everything except the program
+InterpreterState* InterpAllocateInternal(size_t memorySize, HashMap* debugSymbols) {
     auto memory = NewArena(memorySize);
+    if (memory == NULL) return NULL;
     
     auto result = (InterpreterState*)ArenaAllocateAndClear(memory, sizeof(InterpreterState));
     if (result == NULL) return NULL;
@@ -151,16 +224,19 @@ InterpreterState* InterpAllocate(Vector* tagCode, size_t memorySize, HashMap* de
     result->State = ExecutionState::Paused;
     result->_variables = ScopeAllocate(memory);
 
-    //result->_program = tagCode;
-    // Copy program into this interpreter (non-destructively)
-    result->_program = VecClone(tagCode, memory);
+    // Code compiled by `eval` is appended here, so the shared program is never changed
+    result->_overlay = VecAllocateArenaContiguous_DataTag(memory);
+    result->_evalCache = VecAllocateArena_EvalCacheEntry(memory);
 
     result->_position = 0;
     result->_stepsTaken = 0;
     result->_runningVerbose = false;
+#ifdef INTERP_PROFILER
+    result->_profileCountdown = INT32_MAX;
+#endif
 
-    result->_returnStack = VecAllocateArena_int(result->_memory);
-    result->_valueStack = VecAllocateArena_DataTag(result->_memory);
+    result->_returnStack = VecAllocateArenaContiguous_int(result->_memory);
+    result->_valueStack = VecAllocateArenaContiguous_DataTag(result->_memory);
 
     result->_input = StringEmptyInArena(result->_memory);
     result->_output = StringEmptyInArena(result->_memory);
@@ -170,7 +246,8 @@ InterpreterState* InterpAllocate(Vector* tagCode, size_t memorySize, HashMap* de
         || (result->_valueStack == NULL)
         || (result->_input == NULL)
         || (result->_variables == NULL)
-        || (result->_memory == NULL)
+        || (result->_overlay == NULL)
+        || (result->_evalCache == NULL)
         || (result->_output == NULL)) {
         InterpDeallocate(result);
         return NULL;
@@ -181,6 +258,43 @@ InterpreterState* InterpAllocate(Vector* tagCode, size_t memorySize, HashMap* de
     return result;
 }
 
+InterpreterState* InterpAllocate(Vector* tagCode, size_t memorySize, HashMap* debugSymbols) {
+    if (tagCode == NULL) return NULL;
+    auto result = InterpAllocateInternal(memorySize, debugSymbols);
+    if (result == NULL) return NULL;
+
+    // Copy program into this interpreter (non-destructively).
+    // Contiguous storage makes each opcode fetch a single indexed read, unless the program is very large.
+    result->_program = VecAllocateArenaContiguous_DataTag(result->_memory);
+    if (result->_program == NULL) {
+        InterpDeallocate(result);
+        return NULL;
+    }
+    int programLength = VecLength(tagCode);
+    for (int i = 0; i < programLength; i++) {
+        VecPush_DataTag(result->_program, *VecGet_DataTag(tagCode, i));
+    }
+    result->_programLength = programLength;
+
+    return result;
+}
+
+InterpreterState* InterpAllocateShared(Vector* sharedCode, size_t memorySize, HashMap* debugSymbols) {
+    if (sharedCode == NULL) return NULL;
+    auto result = InterpAllocateInternal(memorySize, debugSymbols);
+    if (result == NULL) return NULL;
+
+    result->_program = sharedCode;
+    result->_programLength = VecLength(sharedCode);
+    return result;
+}
+
+// Find the tag at a program position. Positions past the end of the main program are in the `eval` overlay.
+inline DataTag* ProgramAt(InterpreterState* is, int position) {
+    if (position < is->_programLength) return VecGet_DataTag(is->_program, position);
+    return VecGet_DataTag(is->_overlay, position - is->_programLength);
+}
+
 // Close down an interpreter and free all memory (except input tagCode and debugSymbols)
 void InterpDeallocate(InterpreterState* is) {
     if (is == NULL) return;
@@ -207,12 +321,9 @@ void ReadOutput(InterpreterState* is, String* receiver) {
 		return;
 	}
 
-    int limit = StringLength(is->_output);
-    char c;
-    for (int i = 0; i < limit; i++) {
-        c = StringDequeue(is->_output);
-        if (c != 0) StringAppendChar(receiver, c);
-    }
+    // move the whole buffer in one go, rather than dequeuing each character
+    StringAppend(receiver, is->_output);
+    StringClear(is->_output);
 }
 
 // pop items from the interpreter program until we see either EndOfProgram or EndOfSubProgram
@@ -220,7 +331,7 @@ int RollBackSubProgram(InterpreterState* is) {
     DataTag tag = {};
     int rollBackCount = 0;
 
-    bool found = VecPeek_DataTag(is->_program, &tag);
+    bool found = VecPeek_DataTag(is->_overlay, &tag);
     // sanity check:
     if (!found || tag.type != (int)DataType::EndOfSubProgram) {
         StringAppend(is->_output, "Tried to rollback a sub program, but failed\n");
@@ -231,16 +342,16 @@ int RollBackSubProgram(InterpreterState* is) {
     DescribeTag(tag, is->_output, NULL);
     StringAppend(is->_output, "\r\n");*/
 
-    int s = VecLength(is->_program);
+    int s = VecLength(is->_overlay);
 
     while (true) {
         rollBackCount++;
-        if (!VecPop_DataTag(is->_program, NULL)) {
+        if (!VecPop_DataTag(is->_overlay, NULL)) {
 			is->State = ExecutionState::ErrorState;
             StringAppend(is->_output, "Tried to rollback a sub program. Never found the end marker.\n");
             return rollBackCount;
         }
-        found = VecPeek_DataTag(is->_program, &tag);
+        found = VecPeek_DataTag(is->_overlay, &tag);
 
         /*StringAppend(is->_output, "   /\\ "); // reverse order!!!
         DescribeTag(tag, is->_output, NULL);
@@ -254,6 +365,461 @@ int RollBackSubProgram(InterpreterState* is) {
     }
 }
 
+// Returns true if the program position is inside a cached `eval` fragment
+inline bool IsCachedEvalPosition(InterpreterState* is, int position) {
+    int offset = position - is->_programLength;
+    return offset >= 0 && offset < is->_evalCacheEnd;
+}
+
+// Find the index of a cached `eval` fragment by its source code, or -1 if not cached
+int EvalCacheFind(InterpreterState* is, uint32_t hash, String* code) {
+    int count = VecLength(is->_evalCache);
+    for (int i = 0; i < count; i++) {
+        auto entry = VecGet_EvalCacheEntry(is->_evalCache, i);
+        if (entry->hash == hash && StringAreEqual(entry->source, code)) return i;
+    }
+    return -1;
+}
+
+// Find the index of the cached `eval` fragment that was used longest ago
+int EvalCacheLeastRecent(InterpreterState* is) {
+    int count = VecLength(is->_evalCache);
+    int oldest = 0;
+    for (int i = 1; i < count; i++) {
+        if (VecGet_EvalCacheEntry(is->_evalCache, i)->lastUsed < VecGet_EvalCacheEntry(is->_evalCache, oldest)->lastUsed) oldest = i;
+    }
+    return oldest;
+}
+
+// Remove a cached `eval` fragment, moving the code after it down to close the gap.
+// This must only be done while no `eval` code is running, as return positions are not updated.
+void EvalCacheEvict(InterpreterState* is, int index) {
+    auto entry = VecGet_EvalCacheEntry(is->_evalCache, index);
+    int gapStart = entry->start;
+    int gap = entry->length;
+    int gapEnd = gapStart + gap;
+    StringDeallocate(entry->source);
+
+    // Close the gap in the overlay
+    int overlayLength = VecLength(is->_overlay);
+    for (int i = gapEnd; i < overlayLength; i++) {
+        VecSet_DataTag(is->_overlay, i - gap, *VecGet_DataTag(is->_overlay, i), NULL);
+    }
+    for (int i = 0; i < gap; i++) { VecPop_DataTag(is->_overlay, NULL); }
+    is->_evalCacheEnd -= gap;
+
+    // Static strings are referenced by absolute position, so the moved fragments need updating.
+    // Each fragment starts with a skip over its string table, and everything after that is op-codes.
+    int count = VecLength(is->_evalCache);
+    for (int i = 0; i < count; i++) {
+        auto moved = VecGet_EvalCacheEntry(is->_evalCache, i);
+        if (moved->start < gapEnd) continue;
+        moved->start -= gap;
+
+        char codeClass, codeAction;
+        uint32_t tableLength;
+        uint8_t p3;
+        DecodeLongOpcode(*VecGet_DataTag(is->_overlay, moved->start), &codeClass, &codeAction, &tableLength, &p3);
+        int end = moved->start + moved->length;
+        for (int p = moved->start + 1 + (int)tableLength; p < end; p++) {
+            auto tag = VecGet_DataTag(is->_overlay, p);
+            if (tag->type == (int)DataType::StaticStringPtr) tag->data -= gap;
+        }
+    }
+
+    // Functions defined by the removed code are dropped. Those defined by moved code are updated.
+    auto functions = MapAllEntries(is->Functions);
+    auto dropped = VecAllocateArena_int(is->_memory);
+    HashMap_KVP kvp;
+    while (VecPop_HashMap_KVP(functions, &kvp)) {
+        auto def = (FunctionDefinition*)kvp.Value;
+        int offset = def->StartPosition - is->_programLength;
+        if (def->Kind != FuncDef::Custom || offset < gapStart) continue;
+        if (offset < gapEnd) VecPush_int(dropped, *(int*)kvp.Key);
+        else def->StartPosition -= gap;
+    }
+    int name;
+    while (VecPop_int(dropped, &name)) { MapRemove_Name_FunctionDefinition(is->Functions, name); }
+    VecDeallocate(dropped);
+    VecDeallocate(functions);
+
+    // Entry order doesn't matter, so swap the last into the space
+    VecSwap(is->_evalCache, index, count - 1);
+    VecPop_EvalCacheEntry(is->_evalCache, NULL);
+}
+
+// Find or compile the code for an `eval`, and return the position to jump to. Returns -1 if the code can't be compiled.
+int EvalFragment(InterpreterState* is, String* code) {
+    auto hash = StringHash(code);
+    int index = EvalCacheFind(is, hash, code);
+    if (index >= 0) {
+        auto entry = VecGet_EvalCacheEntry(is->_evalCache, index);
+        entry->lastUsed = ++(is->_evalClock);
+        is->_evalHits++;
+        return is->_programLength + entry->start;
+    }
+    is->_evalMisses++;
+
+    // Fragments can only be cached if there are no un-cached ones in the way, as they are rolled back from the end.
+    int start = VecLength(is->_overlay);
+    bool canCache = (start == is->_evalCacheEnd);
+
+    MMPush(1 MEGABYTE); // Arena for COMPILING, not for running.
+
+    auto compilableSyntaxTree = ParseSourceCode(MMCurrent(), code, false);
+    auto tagCode = CompileRoot(DTreeRootNode(compilableSyntaxTree), false, true); // a variant that 'EndOfSubProgram' instead of 'EndOfProgram'
+    auto nextPos = TCW_AppendToVectorAt(tagCode, is->_overlay, is->_programLength);
+
+    DeallocateAST(compilableSyntaxTree);
+    TCW_Deallocate(tagCode);
+
+    MMPop();
+
+    if (nextPos < 0) return -1;
+    int length = VecLength(is->_overlay) - start;
+    if (!canCache || length > EVAL_CACHE_MAX_TAGS) return nextPos; // This is removed when 'EndOfSubProgram' is reached
+
+    // Cached code can't be moved while an `eval` is running, so if the cache is full, this one is not kept.
+    bool full = VecLength(is->_evalCache) >= EVAL_CACHE_ENTRIES || is->_evalCacheEnd + length > EVAL_CACHE_MAX_TAGS;
+    if (full && is->_evalDepth > 0) return nextPos;
+
+    EvalCacheEntry entry = {};
+    entry.hash = hash;
+    entry.source = StringClone(code, is->_memory);
+    entry.start = start;
+    entry.length = length;
+    entry.lastUsed = ++(is->_evalClock);
+    if (entry.source == NULL || !VecPush_EvalCacheEntry(is->_evalCache, entry)) return nextPos;
+    is->_evalCacheEnd += length;
+
+    // Drop the least recently used fragments to get back under the limits. The new fragment is always the most recent.
+    while (VecLength(is->_evalCache) > EVAL_CACHE_ENTRIES || is->_evalCacheEnd > EVAL_CACHE_MAX_TAGS) {
+        EvalCacheEvict(is, EvalCacheLeastRecent(is));
+    }
+
+    // The new fragment is at the end of the cached code, but may have moved
+    return is->_programLength + is->_evalCacheEnd - length;
+}
+
+void InterpEvalCacheStatistics(InterpreterState* is, int* outHits, int* outMisses) {
+    if (is == NULL) return;
+    if (outHits != NULL) *outHits = is->_evalHits;
+    if (outMisses != NULL) *outMisses = is->_evalMisses;
+}
+
+void InterpIPCStatistics(InterpreterState* is, int* outReceived, int* outQueued) {
+    if (is == NULL) return;
+    if (outReceived != NULL) *outReceived = is->IPC_MessagesReceived;
+    if (outQueued == NULL) return;
+
+    *outQueued = 0;
+    if (is->IPC_Queues == NULL) return;
+    auto queues = MapAllEntries(is->IPC_Queues); // Vector<HashMap_KVP>
+    HashMap_KVP entry;
+    while (VecPop_HashMap_KVP(queues, &entry)) {
+        auto queue = (DequePtr*)entry.Value;
+        if (queue != NULL && *queue != NULL) *outQueued += DeqLength(*queue);
+    }
+    VecDeallocate(queues);
+}
+
+#ifdef INTERP_PROFILER
+
+/*
+    Sampling profiler.
+    Every few op-codes the run loop records the program position and the return stack (which holds the call site of each
+    function that is running). Samples with the same stack are counted together, so memory use depends on the program
+    rather than how long it runs. Positions are only turned into function names and lines when the profile is written out.
+*/
+
+// Deepest stack kept by a sample. Deeper stacks keep their innermost frames.
+const int PROFILE_MAX_FRAMES = 64;
+
+typedef struct ProfileState {
+    bool running;
+    int interval; // average op-codes between samples
+    int sampleCount;
+    HashMap* stackIndex; // Map<stack hash -> offset in `stacks` of the first record with that hash>
+    Vector* stacks; // Vector<int> of records: [offset of next record with the same hash or -1, sample count, truncated (0|1), frame count, positions...]
+    int classCounts[128]; // samples by op-code class character. Tags that are not op-codes are counted at zero.
+} ProfileState;
+
+// A function defined by the program, for finding which one a position is in
+typedef struct ProfileFunction {
+    Name name;
+    int start; // position of the `fd` op-code
+    int end; // position of the last op-code of the body
+} ProfileFunction;
+
+RegisterHashMapFor(Name, int, HashMapIntKeyHash, HashMapIntKeyCompare, Map)
+RegisterHashMapFor(StringPtr, int, HashMapStringKeyHash, HashMapStringKeyCompare, Map)
+RegisterVectorFor(ProfileFunction, Vec)
+
+// Op-codes until the next sample. This is jittered, so a loop isn't always caught at the same place.
+inline int NextProfileCountdown(ProfileState* prof) {
+    return 1 + (prof->interval / 2) + (int)(int_random(prof->sampleCount) % (uint32_t)prof->interval);
+}
+
+// True if the stack record at `offset` has the given frames
+bool SameProfileStack(Vector* stacks, int offset, int truncated, int frameCount, Vector* returnStack, int firstReturn, int position) {
+    if (*VecGet_int(stacks, offset + 2) != truncated || *VecGet_int(stacks, offset + 3) != frameCount) return false;
+    int frame = offset + 4;
+    for (int i = firstReturn; i < firstReturn + frameCount - 1; i++) {
+        if (*VecGet_int(stacks, frame++) != *VecGet_int(returnStack, i)) return false;
+    }
+    return *VecGet_int(stacks, frame) == position;
+}
+
+// Record where the program is. Called by the run loop when `_profileCountdown` runs out.
+void ProfileSample(InterpreterState* is, DataTag word) {
+    auto prof = is->_profile;
+    if (prof == NULL || !prof->running) {
+        is->_profileCountdown = INT32_MAX;
+        return;
+    }
+    prof->sampleCount++;
+    is->_profileCountdown = NextProfileCountdown(prof);
+
+    if (word.type == (int)DataType::Opcode) {
+        char codeClass, codeAction;
+        uint16_t p1, p2;
+        DecodeOpcode(word, &codeClass, &codeAction, &p1, &p2, NULL);
+        prof->classCounts[codeClass & 0x7F]++;
+    } else {
+        prof->classCounts[0]++;
+    }
+
+    // The frames are the return positions, then the current position
+    int returns = VecLength(is->_returnStack);
+    int frameCount = returns + 1;
+    int truncated = 0;
+    if (frameCount > PROFILE_MAX_FRAMES) {
+        frameCount = PROFILE_MAX_FRAMES;
+        truncated = 1;
+    }
+    int firstReturn = returns - (frameCount - 1);
+
+    uint32_t hash = 2166136261u ^ truncated; // FNV-1a over the positions
+    for (int i = firstReturn; i < returns; i++) { hash = (hash ^ (uint32_t)*VecGet_int(is->_returnStack, i)) * 16777619u; }
+    hash = (hash ^ (uint32_t)is->_position) * 16777619u;
+
+    auto stacks = prof->stacks;
+    int* first = NULL;
+    int offset = MapGet_Name_int(prof->stackIndex, hash, &first) ? *first : -1;
+    int previous = -1;
+    while (offset >= 0) {
+        if (SameProfileStack(stacks, offset, truncated, frameCount, is->_returnStack, firstReturn, is->_position)) {
+            (*VecGet_int(stacks, offset + 1))++;
+            return;
+        }
+        previous = offset;
+        offset = *VecGet_int(stacks, offset);
+    }
+
+    // A new stack
+    int record = VecLength(stacks);
+    bool ok = VecPush_int(stacks, -1) && VecPush_int(stacks, 1) && VecPush_int(stacks, truncated) && VecPush_int(stacks, frameCount);
+    for (int i = firstReturn; ok && i < returns; i++) { ok = VecPush_int(stacks, *VecGet_int(is->_returnStack, i)); }
+    ok = ok && VecPush_int(stacks, is->_position);
+    if (ok && previous >= 0) VecSet_int(stacks, previous, record, NULL);
+    else if (ok) ok = MapPut_Name_int(prof->stackIndex, hash, record, true);
+
+    if (!ok) { // out of memory. Keep what we have, and stop.
+        while (VecLength(stacks) > record) { VecPop_int(stacks, NULL); }
+        prof->running = false;
+    }
+}
+
+bool InterpProfileStart(InterpreterState* is, int interval) {
+    if (is == NULL) return false;
+    if (interval < 1) interval = 1;
+
+    auto prof = is->_profile;
+    if (prof == NULL) {
+        prof = (ProfileState*)ArenaAllocateAndClear(is->_memory, sizeof(ProfileState));
+        if (prof == NULL) return false;
+        prof->stackIndex = MapAllocateArena_Name_int(256, is->_memory);
+        prof->stacks = VecAllocateArena_int(is->_memory);
+        if (prof->stackIndex == NULL || prof->stacks == NULL) return false;
+        is->_profile = prof;
+    } else {
+        HashMapClear(prof->stackIndex);
+        VecClear(prof->stacks);
+        for (int i = 0; i < 128; i++) { prof->classCounts[i] = 0; }
+    }
+
+    prof->interval = interval;
+    prof->sampleCount = 0;
+    prof->running = true;
+    is->_profileCountdown = NextProfileCountdown(prof);
+    return true;
+}
+
+void InterpProfileStop(InterpreterState* is) {
+    if (is == NULL || is->_profile == NULL) return;
+    is->_profile->running = false;
+    is->_profileCountdown = INT32_MAX;
+}
+
+int InterpProfileSampleCount(InterpreterState* is) {
+    if (is == NULL || is->_profile == NULL) return 0;
+    return is->_profile->sampleCount;
+}
+
+// Position of the first op-code, after the string table that the program starts by jumping over
+int ProfileCodeStart(InterpreterState* is) {
+    if (is->_programLength < 1) return 0;
+    char codeClass, codeAction;
+    uint16_t p1, p2;
+    auto first = *ProgramAt(is, 0);
+    if (first.type != (int)DataType::Opcode) return 0;
+    DecodeOpcode(first, &codeClass, &codeAction, &p1, &p2, NULL);
+    if (codeClass != 'c' || codeAction != 's') return 0;
+    return 1 + p2 + (p1 << 16);
+}
+
+// Append `function:line` for a program position
+void AppendProfileFrame(InterpreterState* is, Vector* functions, Vector* lines, int codeStart, int position, String* target) {
+    if (position >= is->_programLength) { // line numbers of `eval` code are not kept
+        StringAppend(target, "eval");
+        return;
+    }
+
+    // The innermost function that holds the position
+    ProfileFunction* found = NULL;
+    int count = VecLength(functions);
+    for (int i = 0; i < count; i++) {
+        auto fn = VecGet_ProfileFunction(functions, i);
+        if (position > fn->start && position <= fn->end && (found == NULL || fn->start > found->start)) found = fn;
+    }
+
+    StringPtr* name = NULL;
+    if (found == NULL) StringAppend(target, "main");
+    else if (is->DebugSymbols != NULL && MapGet_Name_StringPtr(is->DebugSymbols, found->name, &name)) StringAppend(target, *name);
+    else { StringAppendChar(target, '#'); StringAppendInt32Hex(target, found->name); }
+
+    // The last line that starts at or before the position
+    if (lines == NULL) return;
+    int index = position - codeStart;
+    int low = 0, high = VecLength(lines) / 2 - 1, line = 0;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        if (*VecGet_int(lines, mid * 2) <= index) {
+            line = *VecGet_int(lines, mid * 2 + 1);
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    if (line > 0) StringAppendFormat(target, ":\x02", line);
+}
+
+// Working memory comes from the caller's arena, as the interpreter's own may be full
+void InterpProfileWriteStacks(InterpreterState* is, String* target) {
+    if (is == NULL || target == NULL || is->_profile == NULL) return;
+
+    auto lines = TCR_ReadLineMap(is->DebugSymbols, MMCurrent());
+    int codeStart = ProfileCodeStart(is);
+
+    // Functions of the program, found by their `fd` op-codes, which hold the length of the body.
+    // This doesn't use `Functions`, so functions are found even if the interpreter has no memory left.
+    auto functions = VecAllocate_ProfileFunction();
+    if (functions == NULL) return;
+    for (int i = codeStart + 1; i < is->_programLength; i++) {
+        auto code = ProgramAt(is, i);
+        if (code->type != (int)DataType::Opcode) continue;
+        char codeClass, codeAction;
+        uint16_t argCount, tokenCount;
+        DecodeOpcode(*code, &codeClass, &codeAction, &argCount, &tokenCount, NULL);
+        if (codeClass != 'f' || codeAction != 'd') continue;
+        VecPush_ProfileFunction(functions, ProfileFunction{ DecodeVariableRef(*ProgramAt(is, i - 1)), i, i + tokenCount });
+    }
+
+    // Different positions can be on the same line, so stacks are counted again by their text
+    auto counts = MapAllocate_StringPtr_int(256);
+    auto order = VecAllocate_StringPtr(); // first-seen order, so the output is stable
+    auto stacks = is->_profile->stacks;
+    int length = (counts == NULL || order == NULL) ? 0 : VecLength(stacks);
+    int offset = 0;
+    while (offset < length) {
+        int samples = *VecGet_int(stacks, offset + 1);
+        int frameCount = *VecGet_int(stacks, offset + 3);
+
+        auto text = StringEmpty();
+        if (text == NULL) break;
+        if (*VecGet_int(stacks, offset + 2) != 0) StringAppend(text, "...;"); // outer frames were cut off
+        for (int i = 0; i < frameCount; i++) {
+            if (i > 0) StringAppendChar(text, ';');
+            AppendProfileFrame(is, functions, lines, codeStart, *VecGet_int(stacks, offset + 4 + i), text);
+        }
+        offset += 4 + frameCount;
+
+        int* count = NULL;
+        if (MapGet_StringPtr_int(counts, text, &count)) {
+            *count += samples;
+            StringDeallocate(text);
+        } else {
+            MapPut_StringPtr_int(counts, text, samples, true);
+            VecPush_StringPtr(order, text);
+        }
+    }
+
+    int stackCount = VecLength(order);
+    for (int i = 0; i < stackCount; i++) {
+        auto text = *VecGet_StringPtr(order, i);
+        int* count = NULL;
+        MapGet_StringPtr_int(counts, text, &count);
+        StringAppendFormat(target, "\x01 \x02\n", text, *count);
+        StringDeallocate(text);
+    }
+
+    MapDeallocate(counts);
+    VecDeallocate(order);
+    VecDeallocate(functions);
+    VecDeallocate(lines);
+}
+
+// Name of an op-code class, for the histogram
+const char* OpcodeClassName(int codeClass) {
+    switch (codeClass) {
+    case 0: return "value";
+    case 'f': return "function";
+    case 'c': return "control";
+    case 'C': return "compare-jump";
+    case 'K': return "compare-operands";
+    case 'A': return "math-store";
+    case 'm': return "memory";
+    case 'i': return "increment";
+    case 'd': return "directive";
+    default: return "other";
+    }
+}
+
+void InterpProfileWriteOpcodeClasses(InterpreterState* is, String* target) {
+    if (is == NULL || target == NULL || is->_profile == NULL) return;
+    auto prof = is->_profile;
+    int total = prof->sampleCount;
+    if (total < 1) return;
+
+    for (int i = 0; i < 128; i++) {
+        int count = prof->classCounts[i];
+        if (count < 1) continue;
+        int permille = (int)(((int64_t)count * 1000) / total);
+        StringAppendChar(target, (i == 0) ? '-' : (char)i);
+        StringAppendFormat(target, " \x05 \x02 \x02.\x02%\n", OpcodeClassName(i), count, permille / 10, permille % 10);
+    }
+}
+
+#else
+
+bool InterpProfileStart(InterpreterState* is, int interval) { return false; }
+void InterpProfileStop(InterpreterState* is) { }
+int InterpProfileSampleCount(InterpreterState* is) { return 0; }
+void InterpProfileWriteStacks(InterpreterState* is, String* target) { }
+void InterpProfileWriteOpcodeClasses(InterpreterState* is, String* target) { }
+
+#endif
+
 ExecutionResult FailureResult(uint32_t position) {
     ExecutionResult r = {};
     r.Result = RuntimeError(position);
@@ -278,10 +844,11 @@ ExecutionResult WaitingExecutionResult() {
     r.State = ExecutionState::Waiting;
     return r;
 }
-ExecutionResult IPCWaitExecutionResult() {
+ExecutionResult IPCWaitExecutionResult(InterpreterState* is) {
     ExecutionResult r = {};
     r.Result = NonResult();
     r.State = ExecutionState::IPC_Wait;
+    r.IPC_Timeout = is->IPC_WaitTimeout;
     return r;
 }
 ExecutionResult IPCSendExecutionResult(InterpreterState* is) {
@@ -313,6 +880,7 @@ ExecutionResult IPCSendExecutionResult(InterpreterState* is) {
     }
 
 	r.IPC_Out_Target = CastString(is, tag);
+	r.IPC_Out_Process = is->IPC_SendProcess;
 
 	return r;
 }
@@ -321,6 +889,7 @@ ExecutionResult IPCSpawnExecutionResult(InterpreterState* is) {
     ExecutionResult r = {};
     r.Result = NonResult();
     r.State = ExecutionState::IPC_Spawn;
+    r.IPC_Priority = is->IPC_SpawnPriority;
 
 	DataTag tag;
 
@@ -364,7 +933,7 @@ String* DiagnosticString(DataTag tag, InterpreterState* is) {
 void DescribeCodePosition(InterpreterState* is, String* outp) {
 	if (is == NULL || outp == NULL) return;
 
-	auto tagptr = VecGet_DataTag(is->_program, is->_position);
+	auto tagptr = ProgramAt(is, is->_position);
 	if (tagptr == NULL) {
 		StringAppend(outp, "<out of bounds>");
 		return;
@@ -909,14 +1478,34 @@ DataType WriteErrorState(InterpreterStatePtr is, const char* message) {
 	return DataType::Exception;
 }
 
+// Read a priority class name for `run:`. Returns -1 if the name is not known.
+int PriorityClassNumber(InterpreterState* is, DataTag name) {
+    auto str = CastString(is, name);
+    int result = -1;
+    if (StringAreEqual(str, "interactive")) result = 0;
+    else if (StringAreEqual(str, "normal")) result = 1;
+    else if (StringAreEqual(str, "batch")) result = 2;
+    StringDeallocate(str);
+    return result;
+}
+
 DataType HandleSchedulerDirective(InterpreterState* is, uint32_t directiveHash, uint8_t paramCount) {
     auto run_ = GetCrushedName("run:");
 
     if (directiveHash != run_) return WriteErrorState(is, "Unknown directive. Expected `run:`");
-	if (paramCount != 1) return WriteErrorState(is, "A `run:` directive must have 1 parameter: source file name");
+	if (paramCount < 1 || paramCount > 2) return WriteErrorState(is, "A `run:` directive must have 1 or 2 parameters: source file name, and optional priority");
 
     auto param = ReadParams(is, paramCount);
 	auto target = param[0]; // the string target name
+
+	is->IPC_SpawnPriority = -1;
+	if (paramCount > 1) {
+		is->IPC_SpawnPriority = PriorityClassNumber(is, param[1]);
+		if (is->IPC_SpawnPriority < 0) {
+			ArenaDereference(is->_memory, param);
+			return WriteErrorState(is, "Unknown `run:` priority. Expected \"interactive\", \"normal\" or \"batch\"");
+		}
+	}
     
 	VecPush_DataTag(is->_valueStack, target);
     
@@ -1059,6 +1648,20 @@ inline DataType HandleControlSignal(int* position, char codeAction, int opCodeCo
     return DataType::Void;
 }
 
+// Run a comparison for a compare-and-jump. Returns 1 if true, 0 if false, or -1 if the comparison is not known
+inline int CompareForJump(int position, CmpOp cmp, uint16_t argCount, DataTag* param, InterpreterState* is) {
+    switch (cmp) {
+    case CmpOp::Equal: return ListEquals(argCount, param, is) ? 1 : 0;
+    case CmpOp::NotEqual: return ListEquals(argCount, param, is) ? 0 : 1;
+    case CmpOp::Less: return FoldLessThan(argCount, param, is) ? 1 : 0;
+    case CmpOp::Greater: return FoldGreaterThan(argCount, param, is) ? 1 : 0;
+    default:
+		is->State = ExecutionState::ErrorState;
+        StringAppendFormat(is->_output, "Unknown compound compare at position \x02", position);
+        return -1;
+    }
+}
+
 inline int HandleCompoundCompare(int position, char codeAction, uint16_t argCount, uint16_t opCodeCount, InterpreterState* is) {
     auto param = ReadParams(is, argCount);
 
@@ -1068,34 +1671,82 @@ inline int HandleCompoundCompare(int position, char codeAction, uint16_t argCoun
         return -1;
     }
 
-    int result;
-    auto cmp = (CmpOp)codeAction;
-    switch (cmp) {
-    case CmpOp::Equal:
-        result = ListEquals(argCount, param, is) ? position : position + opCodeCount;
-        break;
-    case CmpOp::NotEqual:
-        result = ListEquals(argCount, param, is) ? position + opCodeCount : position;
-        break;
-    case CmpOp::Less:
-        result = FoldLessThan(argCount, param, is) ? position : position + opCodeCount;
-        break;
-    case CmpOp::Greater:
-        result = FoldGreaterThan(argCount, param, is) ? position : position + opCodeCount;
-        break;
-    default:
-    {
-		is->State = ExecutionState::ErrorState;
-        StringAppendFormat(is->_output, "Unknown compound compare at position \x02", position);
-        result = -1;
-        break;
-    }
+    int result = -1;
+    switch (CompareForJump(position, (CmpOp)codeAction, argCount, param, is)) {
+    case 1: result = position; break;
+    case 0: result = position + opCodeCount; break;
     }
 
     ArenaDereference(is->_memory, param);
     return result;
 }
 
+// Read an operand word that follows a super-instruction (see `TCW_Optimise`).
+// Variable references are read like a `get`; anything else is a literal value.
+inline DataTag ReadOperand(InterpreterState* is, int position) {
+    auto word = ProgramAt(is, position);
+    if (word == NULL) return InvalidTag();
+    if (word->type != (int)DataType::VariableRef) return *word;
+
+    auto tag = ScopeResolve(is->_variables, DecodeVariableRef(*word));
+    ResolveIndexIfRequired(is, &tag);
+    return tag;
+}
+
+// Compare two operands, and jump if false. Like a compound compare, but the values are not on the stack.
+// Unlike other forward jumps, the distance is signed.
+inline int HandleOperandCompare(int position, char codeAction, int32_t opCodeCount, InterpreterState* is) {
+    DataTag param[2];
+    param[0] = ReadOperand(is, position + 1);
+    param[1] = ReadOperand(is, position + 2);
+    if (param[0].type == 0 || param[1].type == 0) {
+		is->State = ExecutionState::ErrorState;
+        StringAppendFormat(is->_output, "\nInvalid value in parameters! Found when comparing at position \x03 (\x02)\n", position, position);
+        return -1;
+    }
+
+    switch (CompareForJump(position, (CmpOp)codeAction, 2, param, is)) {
+    case 1: return position + 2; // skip the operands
+    case 0: return position + opCodeCount;
+    default: return -1;
+    }
+}
+
+// Load a variable, apply a math function with an operand, and store the result back in the variable
+inline DataType HandleMathAssign(int* position, char codeAction, uint32_t varRef, InterpreterState* is) {
+    FuncDef kind;
+    switch (codeAction) {
+    case '+': kind = FuncDef::MathAdd; break;
+    case '-': kind = FuncDef::MathSub; break;
+    case '*': kind = FuncDef::MathProd; break;
+    case '/': kind = FuncDef::MathDiv; break;
+    case '%': kind = FuncDef::MathMod; break;
+    default: return WriteErrorState(is, "Unknown math-assign op code");
+    }
+
+    DataTag param[2];
+    param[0] = ScopeResolve(is->_variables, varRef);
+    ResolveIndexIfRequired(is, &param[0]);
+    param[1] = ReadOperand(is, *position + 1);
+    if (param[0].type == 0 || param[1].type == 0) {
+		is->State = ExecutionState::ErrorState;
+        StringAppendFormat(is->_output, "\nInvalid value in parameters! Found when calling at position \x03 (\x02)\n", *position, *position);
+        return DataType::Exception;
+    }
+    *position += 1; // skip the operand
+
+    auto result = EvaluateBuiltInFunction(position, kind, 2, param, is);
+    if (result.type == (int)DataType::Exception || result.type == 0) {
+		is->State = ExecutionState::ErrorState;
+        VecPush_DataTag(is->_valueStack, (result.type == 0) ? RuntimeError(is->_position) : result);
+        return DataType::Exception;
+    }
+
+    ResolveIndexIfRequired(is, &result);
+    ScopeSetValue(is->_variables, varRef, result);
+    return DataType::Void;
+}
+
 inline void HandleMemoryAccess(int* position, char action, uint32_t varRef, uint8_t paramCount, InterpreterState* is) {
     switch (action)
     {
@@ -1127,6 +1778,26 @@ inline void HandleMemoryAccess(int* position, char action, uint32_t varRef, uint
         ScopeSetValue(is->_variables, varRef, tag);
         break;
     }
+    case 'k': // set, and keep the value on the stack (replaces a `set` then `get` of the same name)
+    {
+        DataTag tag;
+        if (!VecPop_DataTag(is->_valueStack, &tag)) {
+			is->State = ExecutionState::ErrorState;
+            StringAppendFormat(is->_output, "There were no values to save. Did you forget a `return` in a function? Position:  \x02", *position);
+            return;
+        }
+        ResolveIndexIfRequired(is, &tag);
+
+        ScopeSetValue(is->_variables, varRef, tag);
+        VecPush_DataTag(is->_valueStack, tag);
+        break;
+    }
+    case 'l': // get with a single literal index. The index is in the param count slot
+    {
+        VecPush_DataTag(is->_valueStack, EncodeInt32(paramCount));
+        DoIndexedGet(is, varRef, 1);
+        break;
+    }
     case 'i': // is set? (adds a bool to the stack)
     {
 		if (paramCount < 1) { // check a reference is in scope
@@ -1203,6 +1874,14 @@ inline DataType ProcessOpCode(char codeClass, char codeAction, uint16_t p1, uint
 		*position = HandleCompoundCompare(*position, codeAction, p1, p2, is);
 		return DataType::Void;
 
+	case 'K': // compare two operand words and jump (super-instruction from the peephole optimiser)
+		*position = HandleOperandCompare(*position, codeAction, (int32_t)(p2 + ((uint32_t)p1 << 16)), is);
+		return DataType::Void;
+
+	case 'A': // load, math, and store back to a variable, with an operand word (super-instruction from the peephole optimiser)
+		varRef = p2 + (p1 << 16);
+		return HandleMathAssign(position, codeAction, varRef, is);
+
 	case 'm': // Memory access - get|set|isset|unset
 		varRef = p2 + (p1 << 16);
 		HandleMemoryAccess(position, codeAction, varRef, p3, is);
@@ -1226,58 +1905,85 @@ inline DataType ProcessOpCode(char codeClass, char codeAction, uint16_t p1, uint
 
 
 
-// comment this out to trace IPC flow
-#define IPC_TRACE / ## /
-
 
 // Try to add an incoming IPC message to an InterpreterState.
 // Only call when the program is in a wait state.
 // The call will ignore the request if it is not interested in the target type
 // Returns false iff there is an error storing the message. Successful stores AND ignored messages return true.
-bool InterpAddIPC(InterpreterState* is, String* targetName, Vector* ipcMessageData) {
-
-	IPC_TRACE StringAppendFormat(is->_output, "\nReceiving \x01", targetName);
-
-	if (is == NULL || targetName == NULL || ipcMessageData == NULL) return true; // invalid
-	if (is->IPC_Queues == NULL) {
-		IPC_TRACE StringAppend(is->_output, " -- nothing bound\n");
-		return true; // no bindings
-	}
-	
-	VectorPtr *queue;
-	bool mapped = MapGet_StringPtr_VectorPtr(is->IPC_Queues, targetName, &queue);
-	if (!mapped) {
-		IPC_TRACE StringAppend(is->_output, " -- not mapped\n");
-		return true; // this one not bound
+// Find the message queue for a target the program listens to. Returns NULL if it does not listen.
+DequePtr* ListeningQueue(InterpreterState* is, String* targetName) {
+	if (is == NULL || targetName == NULL || is->IPC_Queues == NULL) return NULL;
+
+	DequePtr *queue;
+	if (!MapGet_StringPtr_DequePtr(is->IPC_Queues, targetName, &queue)) return NULL;
+	return queue;
+}
+
+// Start a copy of an incoming message in the interpreter's arena, with the sender's ID in front
+Deque* NewIPCMessage(InterpreterState* is, int senderId) {
+	auto newMsg = DequeAllocateArena(is->_memory, 1);
+	uint8_t sender[4] = { (uint8_t)(senderId >> 24), (uint8_t)(senderId >> 16), (uint8_t)(senderId >> 8), (uint8_t)senderId };
+	if (newMsg != NULL && !DequePushBackMany(newMsg, sender, 4)) {
+		DequeDeallocate(newMsg);
+		return NULL;
 	}
+	return newMsg;
+}
 
-	// `queue` is a vector of byte-vectors. We want to import a *copy* of the incoming data
-	// migrated into the interpreter's arena.
+// Add a copied message to its queue, and set a ready state if we're waiting for a message we have.
+bool QueueIPCMessage(InterpreterState* is, DequePtr* queue, String* targetName, Deque* newMsg) {
+	auto ok = DeqPushBack_DequePtr(*queue, newMsg);
+	if (ok) is->IPC_MessagesReceived++;
 
-	auto newMsg = VecClone(ipcMessageData, is->_memory); // copy of IPC data in our own arena
-	if (newMsg == NULL) {
-		IPC_TRACE StringAppend(is->_output, " -- failed to clone data\n");
-		return false;
-	}
-	auto ok = VecPush_VectorPtr(*queue, newMsg);
-	
-	IPC_TRACE StringAppend(is->_output, " accepted! ");
-
-	// set a ready state if we're waiting for a message we have.
 	if (is->State == ExecutionState::IPC_Wait) {
 		bool *flag;
 		if (MapGet_StringPtr_bool(is->IPC_Queue_WaitFlags, targetName, &flag)) {
 			if (flag != NULL && *flag == true) {
 				is->State = ExecutionState::IPC_Ready;
-				IPC_TRACE StringAppend(is->_output, " set ready ");
 			}
 		}
 	}
-	
-	IPC_TRACE StringAppend(is->_output, "\n");
 	return ok;
 }
 
+bool InterpAddIPC(InterpreterState* is, String* targetName, Vector* ipcMessageData, int senderId) {
+
+	if (is == NULL || targetName == NULL || ipcMessageData == NULL) return true; // invalid
+	auto queue = ListeningQueue(is, targetName);
+	if (queue == NULL) return true; // no bindings, or this one not bound
+
+	// `queue` is a deque of byte-deques. We want to import a *copy* of the incoming data
+	// migrated into the interpreter's arena, after the sender's ID.
+	auto newMsg = NewIPCMessage(is, senderId);
+	if (newMsg == NULL || !CopyToByteDeque(ipcMessageData, newMsg)) {
+		TRACE_EVENT(TRACE_IPC, "ipc-recv-failed", VectorLength(ipcMessageData), is->ExternalId);
+		DequeDeallocate(newMsg);
+		return false;
+	}
+	TRACE_EVENT(TRACE_IPC, "ipc-recv", VectorLength(ipcMessageData), is->ExternalId);
+	return QueueIPCMessage(is, queue, targetName, newMsg);
+}
+
+bool InterpAddIPCBytes(InterpreterState* is, String* targetName, const uint8_t* bytes, int length, int senderId) {
+	if (is == NULL || targetName == NULL || bytes == NULL || length < 0) return true; // invalid
+	auto queue = ListeningQueue(is, targetName);
+	if (queue == NULL) return true;
+
+	auto newMsg = NewIPCMessage(is, senderId);
+	if (newMsg == NULL || !DequePushBackMany(newMsg, (void*)bytes, length)) {
+		TRACE_EVENT(TRACE_IPC, "ipc-recv-failed", length, is->ExternalId);
+		DequeDeallocate(newMsg);
+		return false;
+	}
+	TRACE_EVENT(TRACE_IPC, "ipc-recv", length, is->ExternalId);
+	return QueueIPCMessage(is, queue, targetName, newMsg);
+}
+
+bool InterpIsListening(InterpreterState* is, String* targetName) {
+	if (is == NULL || targetName == NULL || is->IPC_Queues == NULL) return false;
+	return MapGet_StringPtr_DequePtr(is->IPC_Queues, targetName, NULL);
+}
+
 // Clear all wait flags for IPC targets
 void ResetIPCWaits(InterpreterState* is) {
 	if (is == NULL || is->IPC_Queue_WaitFlags == NULL) return;
@@ -1298,13 +2004,13 @@ void AddWaitFlag(InterpreterState* is, String* target) {
 	if (is == NULL || target == NULL) return;
 
 	// Check we have a queue map ready:
-	if (is->IPC_Queues == NULL) { is->IPC_Queues = MapAllocateArena_StringPtr_VectorPtr(5, is->_memory); }
+	if (is->IPC_Queues == NULL) { is->IPC_Queues = MapAllocateArena_StringPtr_DequePtr(5, is->_memory); }
 
 	// check there is a message queue for the specific target:
-	VectorPtr *msgQueue;
-	if (!MapGet_StringPtr_VectorPtr(is->IPC_Queues, target, &msgQueue)) {
-		auto newQueue = VecAllocateArena_VectorPtr(is->_memory);
-		MapPut_StringPtr_VectorPtr(is->IPC_Queues, target, newQueue, true);
+	DequePtr *msgQueue;
+	if (!MapGet_StringPtr_DequePtr(is->IPC_Queues, target, &msgQueue)) {
+		auto newQueue = DeqAllocateArena_DequePtr(is->_memory);
+		MapPut_StringPtr_DequePtr(is->IPC_Queues, target, newQueue, true);
 		msgQueue = &newQueue;
 	}
 
@@ -1315,6 +2021,32 @@ void AddWaitFlag(InterpreterState* is, String* target) {
 	MapPut_StringPtr_bool(is->IPC_Queue_WaitFlags, target, true, true);
 }
 
+void InterpWaitTimedOut(InterpreterState* is) {
+	if (is == NULL || is->State != ExecutionState::IPC_Wait) return;
+	is->IPC_TimedOut = true;
+	is->State = ExecutionState::IPC_Ready;
+}
+
+int InterpListenCount(InterpreterState* is) {
+	if (is == NULL || is->IPC_Queues == NULL) return 0;
+	return MapCount(is->IPC_Queues);
+}
+
+Vector* InterpListeningIPC(InterpreterState* is) {
+	auto result = VecAllocateArena_StringPtr(is->_memory);
+
+	if (is->IPC_Queues != NULL) {
+		auto ptrs = MapAllEntries(is->IPC_Queues); // Vector<HashMap_KVP>
+		HashMap_KVP target;
+		while (VecPop_HashMap_KVP(ptrs, &target)) {
+			VecPush_StringPtr(result, *((StringPtr*)target.Key));
+		}
+		VectorDeallocate(ptrs);
+	}
+
+	return result;
+}
+
 Vector* InterpWaitingIPC(InterpreterState* is) {
 	auto result = VecAllocateArena_StringPtr(is->_memory);
 
@@ -1387,7 +2119,7 @@ DataTag ConcatStrings(int nbParams, InterpreterState * is, DataTag * param)
 }
 
 DataTag ConcatVectors(int nbParams, InterpreterState * is, DataTag * param) {
-    auto list = VecAllocateArena_DataTag(is->_memory);
+    auto list = VecAllocateArenaContiguous_DataTag(is->_memory);
 
     // unpack each vector, and copy its data across
     for (int i = 0; i < nbParams; i++) {
@@ -1414,9 +2146,87 @@ bool AllVectors(int nbParams, DataTag * param) {
     return true;
 }
 
+// Sort a list into ascending order, in place. Returns false if we ran out of memory.
+// All-`Integer` and all-`Fraction` lists are radix sorted on the tags directly;
+// anything else is ordered by its numeric value, the same as `<` does.
+bool SortList(InterpreterState* is, Vector* list) {
+    int n = VecLength(list);
+    if (n < 2) return true;
+
+    bool allInt = true, allFrac = true;
+    for (int i = 0; i < n && (allInt || allFrac); i++) {
+        auto type = VecGet_DataTag(list, i)->type;
+        allInt &= type == (int)DataType::Integer;
+        allFrac &= type == (int)DataType::Fraction;
+    }
+
+    if (allInt) return VecSortRuns_DataTag(list, IntRadixSort_DataTag, CompareIntegerTags);
+    if (allFrac) return VecSortRuns_DataTag(list, FracRadixSort_DataTag, CompareFractionTags);
+
+    auto entries = VecAllocateArena_SortEntry(is->_memory);
+    DataTag tag;
+    while (VecDequeue_DataTag(list, &tag)) {
+        VecPush_SortEntry(entries, SortEntry{ CastDouble(is, tag), tag });
+    }
+    bool ok = VecSortRuns_SortEntry(entries, EntryMergeSort_SortEntry, CompareSortEntry);
+    SortEntry entry;
+    while (VecDequeue_SortEntry(entries, &entry)) {
+        VecPush_DataTag(list, entry.tag);
+    }
+    VecDeallocate(entries);
+    return ok;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // This is where all the code for the built-in functions are
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Set the wait flags for `wait` and `wait-for`, and yield to the scheduler.
+// `timeout` is in milliseconds, or -1 to wait until a message arrives.
+// Serialise a message into the IPC outbox, and kick back to the scheduler to deliver it.
+// `process` is the ID of the program to deliver to, or zero to give a copy to every program that listens for the target.
+DataTag BeginIPCSend(InterpreterState* is, DataTag target, DataTag message, int process) {
+	auto data = VecAllocateArena_char(is->_memory);
+	auto ok = FreezeToVector(message, is, data);
+	if (!ok) { return _Exception(is, "Failed to serialise data for IPC send"); }
+
+	uint32_t encPtr = ArenaPtrToOffset(is->_memory, data); // allows us to place a 32-bit ptr in 64-bit space
+	if (encPtr < 1) { return _Exception(is, "Failed to serialise data for IPC send: nonsense result from arena allocation"); }
+	DataTag final = EncodePointer(encPtr, DataType::VectorPtr);
+
+	VecPush_DataTag(is->_valueStack, target);
+	VecPush_DataTag(is->_valueStack, final);
+	is->IPC_SendProcess = process;
+
+	return IPCSendRequest();
+}
+
+DataTag BeginIPCWait(InterpreterState* is, DataTag* param, int targetCount, int timeout) {
+	if (is->IPC_Queues == NULL) return _Exception(is, "Tried to `wait`, but you didn't say `listen` first.");
+
+	// Kick back to the interpreter with a special status code, and set an IPC flag for ourselves.
+	// When we resume, we should be able to read our IPC map into the value stack before continuing
+	ResetIPCWaits(is);
+	if (is->IPC_Queue_WaitFlags == NULL) { is->IPC_Queue_WaitFlags = MapAllocateArena_StringPtr_bool(5, is->_memory); }
+	
+	// Re-add every requested target
+	// also, check we have an appropriate queue, otherwise fail.
+	for (int i = 0; i < targetCount; i++) {
+		auto target = CastString(is, param[i]);
+		if (StringLength(target) < 1) continue; // ignore empty strings
+
+		bool listening = MapGet_StringPtr_DequePtr(is->IPC_Queues, target, NULL);
+		if (!listening) return _Exception(is, "Tried to `wait` for a message you didn't add to `listen`");
+
+		if (!MapPut_StringPtr_bool(is->IPC_Queue_WaitFlags, target, true, true)) {
+			return _Exception(is, "`wait` failed: could not store wait states");
+		}
+	}
+
+	is->IPC_WaitTimeout = timeout;
+	is->IPC_TimeoutValue = NonResult();
+	return IPCWaitRequest();
+}
+
 DataTag EvaluateBuiltInFunction(int* position, FuncDef kind, int nbParams, DataTag* param, InterpreterState* is){
     switch (kind) {
         // each element equal to the first
@@ -1535,14 +2345,14 @@ DataTag EvaluateBuiltInFunction(int* position, FuncDef kind, int nbParams, DataT
             auto newString = CastString(is, param[0]);
             int origLen = StringLength(newString);
             int offset = CastInt(is, param[1]);
-            StringChop(newString, offset, origLen - offset);
+            newString = StringChop(newString, offset, origLen - offset);
             return StoreStringAndGetReference(is, newString);
 
         } else if (nbParams == 3) {
             auto newString = CastString(is, param[0]);
             int offset = CastInt(is, param[1]);
             int len = CastInt(is, param[2]);
-            StringChop(newString, offset, len);
+            newString = StringChop(newString, offset, len);
             return StoreStringAndGetReference(is, newString);
 
         } else {
@@ -1600,6 +2410,65 @@ DataTag EvaluateBuiltInFunction(int* position, FuncDef kind, int nbParams, DataT
         return ConcatStrings(nbParams, is, param);
     }
 
+    case FuncDef::Find:
+    {
+        if (nbParams < 2 || nbParams > 3) return _Exception(is, "`find` needs a string, a string to look for, and optionally a start position");
+        auto haystack = CastString(is, param[0]);
+        auto needle = CastString(is, param[1]);
+        int start = (nbParams > 2) ? CastInt(is, param[2]) : 0;
+
+        unsigned int position = 0;
+        bool found = (start >= 0) && StringFind(haystack, needle, start, &position);
+        StringDeallocate(haystack);
+        StringDeallocate(needle);
+        return EncodeInt32(found ? (int)position : -1);
+    }
+
+    case FuncDef::CountOf:
+    {
+        if (nbParams != 2) return _Exception(is, "`count-of` needs a string and a string to look for");
+        auto haystack = CastString(is, param[0]);
+        auto needle = CastString(is, param[1]);
+
+        // Count matches that don't overlap, the same ones `replace` would change
+        int count = 0;
+        uint32_t step = StringLength(needle);
+        if (step > 0) {
+            unsigned int position = 0;
+            while (StringFind(haystack, needle, position, &position)) {
+                count++;
+                position += step;
+            }
+        }
+        StringDeallocate(haystack);
+        StringDeallocate(needle);
+        return EncodeInt32(count);
+    }
+
+    case FuncDef::Split:
+    {
+        if (nbParams != 2) return _Exception(is, "`split` needs a string and a separator");
+        auto src = CastString(is, param[0]);
+        auto separator = CastString(is, param[1]);
+
+        auto list = VecAllocateArenaContiguous_DataTag(is->_memory);
+        if (list == NULL) return _Exception(is, "Not enough memory to `split` the string");
+
+        // Each piece is copied once, straight from the source string
+        uint32_t step = StringLength(separator);
+        unsigned int tail = 0;
+        unsigned int next = 0;
+        while (step > 0 && StringFind(src, separator, tail, &next)) {
+            VecPush_DataTag(list, StoreSubstring(is, src, tail, next - tail));
+            tail = next + step;
+        }
+        VecPush_DataTag(list, StoreSubstring(is, src, tail, StringLength(src) - tail));
+
+        StringDeallocate(src);
+        StringDeallocate(separator);
+        return EncodePointer(ArenaPtrToOffset(is->_memory, list), DataType::VectorPtr);
+    }
+
     case FuncDef::UnitEmpty:
 	{
 		if (nbParams > 0) {
@@ -1645,26 +2514,17 @@ DataTag EvaluateBuiltInFunction(int* position, FuncDef kind, int nbParams, DataT
         // that keeps our stepping mechanism working.
         // Static string pointers need an offset mechanism,
         // handled by the tag code writer.
-
-        MMPush(1 MEGABYTE); // Arena for COMPILING, not for running.
+        // Compiled blocks are cached, so evaluating the same code again jumps straight to it.
 
         auto code = CastString(is, param[0]);
         //StringAppendFormat(is->_output, "\nEvaluating: [[\x01]]\n", code);
-        auto compilableSyntaxTree = ParseSourceCode(MMCurrent(), code, false);
-
-        auto tagCode = CompileRoot(DTreeRootNode(compilableSyntaxTree), false, true); // a variant that 'EndOfSubProgram' instead of 'EndOfProgram'
-
-        auto nextPos = TCW_AppendToVector(tagCode, is->_program); // These opcodes should be removed when 'EndOfSubProgram' is reached
+        auto nextPos = EvalFragment(is, code);
+        StringDeallocate(code);
         if (nextPos < 0) return RuntimeError(is->_position);
-        // NOTE: If `eval` code uses `return` to exit, we will probably leak.
+        // NOTE: If `eval` code uses `return` to exit, we will probably leak, and cached code will no longer be moved.
         // Because `eval` is greedy, it should be ok to nest evals inside other evals. Not a good idea, but possible.
 
-        StringDeallocate(code);
-        DeallocateAST(compilableSyntaxTree);
-        TCW_Deallocate(tagCode);
-
-        MMPop();
-
+        is->_evalDepth++;
         ScopePush(is->_variables, param, nbParams); // write parameters into new scope
         VecPush_int(is->_returnStack, *position); // set position for 'cret' call
         *position = nextPos; // move pointer to start of function, taking into account the interpreter's auto-advance
@@ -1684,7 +2544,7 @@ DataTag EvaluateBuiltInFunction(int* position, FuncDef kind, int nbParams, DataT
     }
     case FuncDef::NewList:
     {
-        auto list = VecAllocateArena_DataTag(is->_memory);
+        auto list = VecAllocateArenaContiguous_DataTag(is->_memory);
 
         // lists store datatags directly
         for (int i = 0; i < nbParams; i++) {
@@ -1753,6 +2613,17 @@ DataTag EvaluateBuiltInFunction(int* position, FuncDef kind, int nbParams, DataT
         if (!VecDequeue_DataTag(vec, &result)) { return NonResult(); }
         return result;
     }
+    case FuncDef::Sort:
+    {
+        if (nbParams != 1) return _Exception(is, "`sort` needs a single list");
+        if (param[0].type != (int)DataType::VectorPtr) return _Exception(is, "First parameter to `sort` must be a list");
+
+        auto vec = (Vector*)InterpreterDeref(is, param[0]);
+        if (vec == NULL) return _Exception(is, "The list you tried to `sort` was invalid");
+
+        if (!SortList(is, vec)) return _Exception(is, "Not enough memory to `sort` the list");
+        return param[0]; // sorted in place, but returning the list is handy for chaining
+    }
 
 	case FuncDef::Listen:
 	{
@@ -1763,7 +2634,7 @@ DataTag EvaluateBuiltInFunction(int* position, FuncDef kind, int nbParams, DataT
 
 		// Check we have a queue map ready:
 		if (is->IPC_Queues == NULL) { 
-			is->IPC_Queues = MapAllocateArena_StringPtr_VectorPtr(5, is->_memory);
+			is->IPC_Queues = MapAllocateArena_StringPtr_DequePtr(5, is->_memory);
 			if (is->IPC_Queues == NULL) {
 				return _Exception(is, "Failed to allocate an IPC queue");
 			}
@@ -1774,10 +2645,10 @@ DataTag EvaluateBuiltInFunction(int* position, FuncDef kind, int nbParams, DataT
 			auto target = CastString(is, param[i]);
 			if (StringLength(target) < 1) continue; // ignore empty strings
 
-			VectorPtr* msgQueue;
-			if (!MapGet_StringPtr_VectorPtr(is->IPC_Queues, target, &msgQueue)) {
-				auto newQueue = VecAllocateArena_VectorPtr(is->_memory);
-				MapPut_StringPtr_VectorPtr(is->IPC_Queues, target, newQueue, true);
+			DequePtr* msgQueue;
+			if (!MapGet_StringPtr_DequePtr(is->IPC_Queues, target, &msgQueue)) {
+				auto newQueue = DeqAllocateArena_DequePtr(is->_memory);
+				MapPut_StringPtr_DequePtr(is->IPC_Queues, target, newQueue, true);
 				msgQueue = &newQueue;
 			} else {
 				StringDeallocate(target);
@@ -1792,29 +2663,29 @@ DataTag EvaluateBuiltInFunction(int* position, FuncDef kind, int nbParams, DataT
 
 	case FuncDef::Wait:
 	{
-		if (is->IPC_Queues == NULL) return _Exception(is, "Tried to `wait`, but you didn't say `listen` first.");
 		if (nbParams < 1) return _Exception(is, "Tried to `wait`, but you didn't say name any targets");
+		return BeginIPCWait(is, param, nbParams, -1);
+	}
 
-		// Kick back to the interpreter with a special status code, and set an IPC flag for ourselves.
-		// When we resume, we should be able to read our IPC map into the value stack before continuing
-		ResetIPCWaits(is);
-		if (is->IPC_Queue_WaitFlags == NULL) { is->IPC_Queue_WaitFlags = MapAllocateArena_StringPtr_bool(5, is->_memory); }
-		
-		// Re-add every requested target
-		// also, check we have an appropriate queue, otherwise fail.
-		for (int i = 0; i < nbParams; i++) {
-			auto target = CastString(is, param[i]);
-			if (StringLength(target) < 1) continue; // ignore empty strings
-
-			bool listening = MapGet_StringPtr_VectorPtr(is->IPC_Queues, target, NULL);
-			if (!listening) return _Exception(is, "Tried to `wait` for a message you didn't add to `listen`");
+	case FuncDef::WaitFor:
+	{
+		// Like `wait`, but the last parameter is the longest time to wait in milliseconds.
+		// If no message arrives in time, the result is NaR.
+		if (nbParams < 2) return _Exception(is, "A `wait-for` call needs at least 2 parameters: targets and time in milliseconds");
+		auto timeout = CastInt(is, param[nbParams - 1]);
+		return BeginIPCWait(is, param, nbParams - 1, (timeout < 0) ? 0 : timeout);
+	}
 
-			if (!MapPut_StringPtr_bool(is->IPC_Queue_WaitFlags, target, true, true)) {
-				return _Exception(is, "`wait` failed: could not store wait states");
-			}
-		}
+	case FuncDef::Sleep:
+	{
+		// A wait for no messages, that always times out. Gives back nothing.
+		if (nbParams != 1) return _Exception(is, "A `sleep` call must have 1 parameter: time in milliseconds");
+		auto timeout = CastInt(is, param[0]);
 
-        return IPCWaitRequest();
+		ResetIPCWaits(is);
+		is->IPC_WaitTimeout = (timeout < 0) ? 0 : timeout;
+		is->IPC_TimeoutValue = VoidReturn();
+		return IPCWaitRequest();
 	}
 
 	case FuncDef::Send:
@@ -1827,20 +2698,17 @@ DataTag EvaluateBuiltInFunction(int* position, FuncDef kind, int nbParams, DataT
 		// Senders have no idea how many (if any) programs got their message.
 		
 		if (nbParams != 2) return _Exception(is, "A `send` call must have 2 parameters: target and data");
+		return BeginIPCSend(is, param[0], param[1], 0);
+	}
 
-		auto target = param[0]; // the string target name
-		auto data = VecAllocateArena_char(is->_memory);
-		auto ok = FreezeToVector(param[1], is, data);
-		if (!ok) { return _Exception(is, "Failed to serialise data for IPC send"); }
-
-		uint32_t encPtr = ArenaPtrToOffset(is->_memory, data); // allows us to place a 32-bit ptr in 64-bit space
-		if (encPtr < 1) { return _Exception(is, "Failed to serialise data for IPC send: nonsense result from arena allocation"); }
-		DataTag final = EncodePointer(encPtr, DataType::VectorPtr);
-		
-		VecPush_DataTag(is->_valueStack, target);
-		VecPush_DataTag(is->_valueStack, final);
-
-        return IPCSendRequest();
+	case FuncDef::SendTo:
+	{
+		// Like `send`, but the message only goes to one program, by process ID (as given back by `run:`, or the "reply-to" of a message).
+		// The program must still listen for the target. If there is no such program, the message is dropped.
+		if (nbParams != 3) return _Exception(is, "A `send-to` call must have 3 parameters: process ID, target and data");
+		auto process = CastInt(is, param[0]);
+		if (process < 1) return _Exception(is, "The process ID given to `send-to` was not valid");
+		return BeginIPCSend(is, param[1], param[2], process);
 	}
 
     default:
@@ -1852,9 +2720,8 @@ DataTag EvaluateBuiltInFunction(int* position, FuncDef kind, int nbParams, DataT
 // Read and return a copy of the opcode at the given index
 DataTag GetOpcodeAtIndex(InterpreterState* is, uint32_t index) {
     if (is == NULL) return InvalidTag();
-    if (index >= VecLength(is->_program)) return InvalidTag();
-
-    auto p = VecGet_DataTag(is->_program, index);
+    auto p = ProgramAt(is, index);
+    if (p == NULL) return InvalidTag();
     return *p;
 }
 
@@ -1885,10 +2752,7 @@ DataTag StoreStringAndGetReference(InterpreterState* is, String* str) {
     // The arena is overall better, but the de-referencing has to be smarter (esp. between static and non-static)
 
     String* result = StringEmptyInArena(is->_memory);
-    auto length = StringLength(str);
-    for (uint32_t i = 0; i < length; i++) {
-        StringAppendChar(result, StringDequeue(str));
-    }
+    StringAppend(result, str);
     StringDeallocate(str);
     
     uint32_t encPtr = ArenaPtrToOffset(is->_memory, result); // allows us to place a 32-bit ptr in 64-bit space
@@ -1899,10 +2763,33 @@ DataTag StoreStringAndGetReference(InterpreterState* is, String* str) {
     return EncodePointer(encPtr, DataType::StringPtr);
 }
 
+DataTag StoreSubstring(InterpreterState* is, String* src, uint32_t start, uint32_t length) {
+    if (src == NULL) return RuntimeError(is->_position);
+
+    // short strings are built straight into the tag
+    if (length <= 6) {
+        char chars[8] = {};
+        for (uint32_t i = 0; i < length; i++) { chars[i] = StringCharAtIndex(src, start + i); }
+        return EncodeShortStr(chars);
+    }
+
+    String* result = StringEmptyInArena(is->_memory);
+    StringAppendSubstr(result, src, start, length);
+
+    uint32_t encPtr = ArenaPtrToOffset(is->_memory, result);
+    if (encPtr < 1) {
+        return RuntimeError(is->_position);
+    }
+
+    return EncodePointer(encPtr, DataType::StringPtr);
+}
+
 
 String* ReadStaticString(InterpreterState* is, int position, int length) {
     if (is == NULL) return NULL;
-    return DecodeString(is->_program, position, length, is->_memory);
+    // strings are always in the same segment as the code that uses them
+    if (position < is->_programLength) return DecodeString(is->_program, position, length, is->_memory);
+    return DecodeString(is->_overlay, position - is->_programLength, length, is->_memory);
 }
 
 inline bool CheckProgramWindow(InterpreterState* is, DataTag** programWindow, int* low, int* high) {
@@ -1925,10 +2812,11 @@ inline bool CheckProgramWindow(InterpreterState* is, DataTag** programWindow, in
     return true;
 }
 
-// Read a byte vector into an interpreter object, and push that to the value stack.
-bool DeserialiseIPCData(InterpreterState* is, VectorPtr ipcData, StringPtr target) {
-	DataTag dest; // ref we will put in the map
-    bool ok = DefrostFromVector(&dest, is->_memory, ipcData); // failing?
+// Read a byte deque into an interpreter object, and push that to the value stack.
+// The object is wrapped in a map under the target name. If the message came from a program, its process ID is added as "reply-to".
+bool DeserialiseIPCData(InterpreterState* is, DequePtr ipcData, StringPtr target, int senderId) {
+	DataTag dest = {}; // ref we will put in the map
+    bool ok = DefrostFromDeque(&dest, is->_memory, ipcData);
 	if (!ok) return false;
 
 	// Make a map to store it in
@@ -1938,6 +2826,16 @@ bool DeserialiseIPCData(InterpreterState* is, VectorPtr ipcData, StringPtr targe
 	// add the data
 	ok = MapPut_StringPtr_DataTag(map, target, dest, true);
 	if (!ok) return false;
+
+	// add the sender, in the same form `run:` gives back
+	if (senderId > 0) {
+		auto id = StringEmpty();
+		StringAppendInt32(id, senderId);
+		auto idTag = EncodeShortStr(id);
+		StringDeallocate(id);
+		ok = MapPut_StringPtr_DataTag(map, StringNewInArena("reply-to", is->_memory), idTag, true);
+		if (!ok) return false;
+	}
 	
 	// Encode a pointer to the map
 	uint32_t encPtr = ArenaPtrToOffset(is->_memory, map); // allows us to place a 32-bit ptr in 64-bit space
@@ -1955,13 +2853,10 @@ bool LoadIPCData(InterpreterState *is) {
 	// map, whose key is the matching IPC target.
 
 	if (is->IPC_Queues == NULL || is->IPC_Queue_WaitFlags == NULL) {
-		IPC_TRACE StringAppend(is->_output, "IPC queue containers are invalid\n");
 		return false;
 	}
 
 	VectorPtr vecWait = MapAllEntries(is->IPC_Queue_WaitFlags); // Vector<HashMap_KVP>
-	
-	IPC_TRACE StringAppendFormat(is->_output, "\nWait entries: \x02\n", VecLength(vecWait));
 
 	bool ok = false;
 	// For each message we're waiting for...
@@ -1969,40 +2864,37 @@ bool LoadIPCData(InterpreterState *is) {
 	while (VecPop_HashMap_KVP(vecWait, &waitEntry)) {
 		StringPtr target = *((StringPtr*)waitEntry.Key);
 		bool set = *((bool*)waitEntry.Value);
-		
-		IPC_TRACE StringAppendFormat(is->_output, "\nChecking '\x01'\n", target);
 
 		// ... see if we have data ...
-		VectorPtr *ipcChannelDataQueue; // Vector< ByteVec >
-		bool found = MapGet_StringPtr_VectorPtr(is->IPC_Queues, target, &ipcChannelDataQueue);
+		DequePtr *ipcChannelDataQueue; // Deque< ByteDeque >
+		bool found = MapGet_StringPtr_DequePtr(is->IPC_Queues, target, &ipcChannelDataQueue);
 		if (!found || ipcChannelDataQueue == NULL) {
-			IPC_TRACE StringAppend(is->_output, "queue not found\n");
 			continue; // no queue?
 		}
-		if (VecLength(*ipcChannelDataQueue) < 1) {
-			IPC_TRACE StringAppend(is->_output, "queue was empty\n");
+		if (DeqLength(*ipcChannelDataQueue) < 1) {
 			continue; // empty queue
 		}
 
-		VectorPtr ipcObject = NULL;
-		if (!VecDequeue_VectorPtr(*ipcChannelDataQueue, &ipcObject)) {
-			IPC_TRACE StringAppend(is->_output, "IPC object dequeue failed\n");
+		DequePtr ipcObject = NULL;
+		if (!DeqPopFront_DequePtr(*ipcChannelDataQueue, &ipcObject)) {
 			continue; // failed to read object?
 		}
 		if (ipcObject == NULL) {
-			IPC_TRACE StringAppend(is->_output, "IPC object was null\n");
 			continue; // failed to read object
 		}
 
-		IPC_TRACE StringAppendFormat(is->_output, "\nFound IPC data for '\x01', \x02 bytes\n", target, VecLength(ipcObject));
-
-		ok = DeserialiseIPCData(is, ipcObject, target);
-
-		if (!ok) {
-			IPC_TRACE StringAppend(is->_output, "IPC deserialising failed\n");
+		uint8_t sender[4];
+		if (DequePopFrontMany(ipcObject, sender, 4) != 4) {
+			DeqDeallocate(ipcObject);
+			continue; // damaged message
 		}
+		int senderId = ((int)sender[0] << 24) | ((int)sender[1] << 16) | ((int)sender[2] << 8) | (int)sender[3];
+
+		int byteCount = DeqLength(ipcObject);
+		ok = DeserialiseIPCData(is, ipcObject, target, senderId);
+		TRACE_EVENT(TRACE_IPC, ok ? "ipc-load" : "ipc-load-failed", byteCount, is->ExternalId);
 
-		VecDeallocate(ipcObject); // we will have copied the data by deserialising.
+		DeqDeallocate(ipcObject); // we will have copied the data by deserialising.
 		break; // only load one message at a time
 	}
 	VecDeallocate(vecWait);
@@ -2010,6 +2902,23 @@ bool LoadIPCData(InterpreterState *is) {
 	return ok;
 }
 
+// Returns true if a message is already queued for any target the program is waiting for
+bool IPCDataWaiting(InterpreterState *is) {
+	if (is->IPC_Queues == NULL || is->IPC_Queue_WaitFlags == NULL) return false;
+
+	VectorPtr vecWait = MapAllEntries(is->IPC_Queue_WaitFlags); // Vector<HashMap_KVP>
+	bool found = false;
+	HashMap_KVP waitEntry;
+	while (!found && VecPop_HashMap_KVP(vecWait, &waitEntry)) {
+		StringPtr target = *((StringPtr*)waitEntry.Key);
+		DequePtr *ipcChannelDataQueue;
+		found = MapGet_StringPtr_DequePtr(is->IPC_Queues, target, &ipcChannelDataQueue)
+			&& ipcChannelDataQueue != NULL && DeqLength(*ipcChannelDataQueue) > 0;
+	}
+	VecDeallocate(vecWait);
+	return found;
+}
+
 // Run the interpreter until end or cycle count (whichever comes first)
 // This is the internal call. The public one is below (it sets the last state of the interpreter)
 ExecutionResult InterpRunInternal(InterpreterState* is, int maxCycles) {
@@ -2023,8 +2932,12 @@ ExecutionResult InterpRunInternal(InterpreterState* is, int maxCycles) {
 
 
 	// If we are coming out of an IPC wait state, we need to load the message data onto the value stack here.
-	if (is->State == ExecutionState::IPC_Ready) {
-		IPC_TRACE StringAppend(is->_output, "Attempting IPC read from queue");
+	// If the wait timed out, there is no message, so the wait's timeout value is used instead.
+	if (is->State == ExecutionState::IPC_Ready && is->IPC_TimedOut) {
+		is->IPC_TimedOut = false;
+		ResetIPCWaits(is);
+		if (is->IPC_TimeoutValue.type != (int)DataType::Void) VecPush_DataTag(is->_valueStack, is->IPC_TimeoutValue);
+	} else if (is->State == ExecutionState::IPC_Ready) {
 		auto ok = LoadIPCData(is);
 		if (!ok) {
 			_Exception(is, "Failed to load IPC data");
@@ -2068,9 +2981,14 @@ ExecutionResult InterpRunInternal(InterpreterState* is, int maxCycles) {
 
         /*if (!CheckProgramWindow(is, &programWindow, &lowIndex, &highIndex)) break;
         auto word = programWindow[is->_position - lowIndex];*/
-        auto wordPtr = VecGet_DataTag(is->_program, is->_position);
+        auto wordPtr = ProgramAt(is, is->_position);
+        if (wordPtr == NULL) break;
         auto word = *wordPtr;
 
+#ifdef INTERP_PROFILER
+        if (--(is->_profileCountdown) <= 0) ProfileSample(is, word);
+#endif
+
 		if (word.type == opCodeType) { // instructions
 			DecodeOpcode(word, &codeClass, &codeAction, &p1, &p2, &p3);
 			auto result = ProcessOpCode(codeClass, codeAction, p1, p2, p3, &(is->_position), word, is);
@@ -2083,7 +3001,7 @@ ExecutionResult InterpRunInternal(InterpreterState* is, int maxCycles) {
 					return WaitingExecutionResult(); // program is waiting for console input, and is yielding
 				case DataType::IPCWait:
 					is->_position++; // don't repeat wait command
-					return IPCWaitExecutionResult(); // program is waiting for an IPC message, and is yielding
+					return IPCWaitExecutionResult(is); // program is waiting for an IPC message, and is yielding
 				case DataType::IPCSend:
 					is->_position++; // don't repeat send command
 					return IPCSendExecutionResult(is); // program wants to broadcast an IPC message. It has set stack values and is yielding.
@@ -2108,9 +3026,11 @@ ExecutionResult InterpRunInternal(InterpreterState* is, int maxCycles) {
 			}
 			case (int)DataType::EndOfSubProgram:
 			{
-				// Delete back to the 'EndOfProgram' marker
+				// Delete back to the 'EndOfProgram' marker, unless the code is cached for reuse
+				bool cached = IsCachedEvalPosition(is, is->_position);
 				HandleReturn(is);
-				highIndex -= RollBackSubProgram(is);
+				if (is->_evalDepth > 0) is->_evalDepth--;
+				if (!cached) highIndex -= RollBackSubProgram(is);
 				programEnd = VectorLength(is->_program);
 				break;
 			}
@@ -2153,7 +3073,14 @@ GOOD_EXIT:
 // Run the interpreter until end or cycle count (whichever comes first)
 // Remember to check execution state afterward
 ExecutionResult InterpRun(InterpreterState* is, int maxCycles) {
+	if (is == NULL) return FailureResult(0);
+	auto stepsBefore = (uint32_t)is->_stepsTaken;
 	auto result = InterpRunInternal(is, maxCycles);
+	result.Cycles = (int)((uint32_t)is->_stepsTaken - stepsBefore);
+
+	// Messages that arrived before the `wait` won't wake the program later, so it's ready now
+	if (result.State == ExecutionState::IPC_Wait && IPCDataWaiting(is)) result.State = ExecutionState::IPC_Ready;
+
 	is->State = result.State;
 	return result;
 }
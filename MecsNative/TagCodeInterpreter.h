@@ -7,6 +7,9 @@
 #include "Vector.h"
 #include "Scope.h"
 
+// Build in the sampling profiler (see `InterpProfileStart`). Comment out to take it, and its cost, out of the run loop.
+#define INTERP_PROFILER 1
+
 enum class ExecutionState {
     // Program could continue, but stopped by request (debug, step, etc.)
     Paused,
@@ -19,7 +22,8 @@ enum class ExecutionState {
     // Program failed with an error
     ErrorState,
 
-	// Program is waiting for an IPC message (InterpreterState.IPC_Queue_WaitFlags should be populated)
+	// Program is waiting for an IPC message (InterpreterState.IPC_Queue_WaitFlags should be populated),
+	// or for a time to pass (ExecutionResult.IPC_Timeout will be zero or more)
 	IPC_Wait,
 	// Program wants to send an IPC message (ExecutionResult.IPC_Out_Target and ExecutionResult.IPC_Out_Data should be populated)
 	IPC_Send,
@@ -40,6 +44,18 @@ typedef struct ExecutionResult {
 	String* IPC_Out_Target;
     // If not null, the serialised data to be send to other programs
     Vector* IPC_Out_Data;
+	// If the state is `IPC_Send`, the process ID the message is for (from `send-to`), or zero to send to every program that listens.
+	int IPC_Out_Process;
+
+	// If the state is `IPC_Wait`, the longest time to wait in milliseconds, or -1 to wait until a message arrives.
+	// When the time has passed, call `InterpWaitTimedOut`.
+	int IPC_Timeout;
+
+	// If the state is `IPC_Spawn`, the priority class given to `run:` (0 = interactive, 1 = normal, 2 = batch), or -1 if none was given.
+	int IPC_Priority;
+
+	// Number of cycles run by this call
+	int Cycles;
 } ExecutionResult;
 
 // Runtime state and stack for the interpreter
@@ -51,6 +67,11 @@ typedef InterpreterState* InterpreterStatePtr;
 // memory size must be enough for value and return stack, but does not include tagCode size
 InterpreterState* InterpAllocate(Vector* tagCode, size_t memorySize, HashMap* debugSymbols);
 
+// Start up an interpreter that runs shared tag code, without copying it.
+// The code must already be in machine byte order (see `TCR_Read`), and must not be changed or
+// deallocated until the interpreter is. Code from `eval` goes into a private overlay.
+InterpreterState* InterpAllocateShared(Vector* sharedCode, size_t memorySize, HashMap* debugSymbols);
+
 // Close down an interpreter and free all memory
 void InterpDeallocate(InterpreterState* is);
 
@@ -58,17 +79,59 @@ void InterpDeallocate(InterpreterState* is);
 ExecutionState InterpreterCurrentState(InterpreterState* is);
 
 // Run the interpreter until end or cycle count (whichever comes first)
-// Remember to check execution state afterward
+// Remember to check execution state afterward.
+// If the program waits for a message that is already queued, the state is `IPC_Ready` rather than `IPC_Wait`.
 ExecutionResult InterpRun(InterpreterState* is, int maxCycles);
 
+// Read the number of `eval` calls that ran cached code, and the number that had to compile
+void InterpEvalCacheStatistics(InterpreterState* is, int* outHits, int* outMisses);
+
+// Read the number of IPC messages this interpreter has accepted, and the number still queued (accepted but not read by `wait`)
+void InterpIPCStatistics(InterpreterState* is, int* outReceived, int* outQueued);
+
+// Start sampling the position of the program, about once every `interval` op-codes. Any earlier samples are dropped.
+// Returns false if the profiler is not built in (see `INTERP_PROFILER`), or there is not enough memory.
+bool InterpProfileStart(InterpreterState* is, int interval);
+// Stop sampling. Samples are kept until the next `InterpProfileStart`.
+void InterpProfileStop(InterpreterState* is);
+// Number of samples taken since `InterpProfileStart`
+int InterpProfileSampleCount(InterpreterState* is);
+// Append the samples as collapsed stacks, for flame graph tools: one line per distinct stack, with frames outermost first
+// split by `;`, then a space and the sample count. Frames are `function:line`, or just `function` if the line is not known.
+// Code outside of any function is `main`, and code run by `eval` is `eval`.
+void InterpProfileWriteStacks(InterpreterState* is, String* target);
+// Append a histogram of sampled op-code classes: one line per class, with its sample count and percentage of all samples.
+void InterpProfileWriteOpcodeClasses(InterpreterState* is, String* target);
+
 // Set an ID for this interpreter. Used by the scheduler.
 void InterpSetId(InterpreterState* is, int id);
+// Read the ID set by `InterpSetId`
+int InterpGetId(InterpreterState* is);
 
 // Try to add an incoming IPC message to an InterpreterState.
 // Only call when the program is in a wait state.
 // The call will ignore the request if it is not interested in the target type
+// `senderId` is the process ID of the program that sent the message, given to the program as "reply-to", or zero for the system.
 // returns false if there was not enough memory to store the event.
-bool InterpAddIPC(InterpreterState* is, String* targetName, Vector* ipcMessageData);
+bool InterpAddIPC(InterpreterState* is, String* targetName, Vector* ipcMessageData, int senderId);
+
+// As `InterpAddIPC`, but the serialised message is read from a plain block of memory, such as a shared memory ring.
+// The bytes are copied, so the block can be reused as soon as this returns.
+bool InterpAddIPCBytes(InterpreterState* is, String* targetName, const uint8_t* bytes, int length, int senderId);
+
+// Returns true if the program has said `listen` for a target, so messages sent to it will be kept
+bool InterpIsListening(InterpreterState* is, String* targetName);
+
+// Number of targets the program has said `listen` for. This only changes when a new target is listened for.
+int InterpListenCount(InterpreterState* is);
+
+// Return a vector of IPC targets the program listens for. Caller should dealloc the vector but not the strings.
+// Returns Vector<StringPtr>
+Vector* InterpListeningIPC(InterpreterState* is);
+
+// Wake a program in the `IPC_Wait` state without a message, because its timeout has passed.
+// `wait-for` gives back NaR, and `sleep` continues.
+void InterpWaitTimedOut(InterpreterState* is);
 
 // Return a vector of IPC targets the interpreter is waiting for. Caller should dealloc the vector but not the strings.
 // Returns Vector<StringPtr>
@@ -95,6 +158,10 @@ bool InterpreterPushValue(InterpreterState* is, DataTag value);
 // The original string parameter is deallocated
 DataTag StoreStringAndGetReference(InterpreterState* is, String* str);
 
+// Store a copy of part of a string in the RW memory, and return a string token for it.
+// The source string is not changed
+DataTag StoreSubstring(InterpreterState* is, String* src, uint32_t start, uint32_t length);
+
 // Read and return a copy of the opcode at the given index
 DataTag GetOpcodeAtIndex(InterpreterState* is, uint32_t index);
 
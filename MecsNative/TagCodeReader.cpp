@@ -9,6 +9,7 @@ RegisterVectorStatics(Vec)
 RegisterVectorFor(DataTag, Vec)
 RegisterVectorFor(BYTE, Vec)
 RegisterVectorFor(char, Vec)
+RegisterVectorFor(int, Vec)
 
 
 void TCR_Swizzle(Vector* v, int i) {
@@ -191,14 +192,39 @@ HashMap* TCR_ReadSymbols(Vector* v) {
     add("and"); add("readkey"); add("readline"); add("print"); add("substring");
     add("length"); add("replace"); add("concat"); add("+"); add("-"); add("*");
     add("/"); add("%"); add("()"); add("new-list"); add("push"); add("pop"); add("dequeue");
-    add("new-map"); add("listen"); add("wait"); add("send"); add("run:");
-#undef add;
+    add("find"); add("split"); add("count-of");
+    add("sort"); add("new-map"); add("listen"); add("wait"); add("send"); add("send-to"); add("run:");
+    add("sleep"); add("wait-for");
+#undef add
 
     return outp;
 }
 
 
 
+Vector* TCR_ReadLineMap(HashMap* symbols, Arena* arena) {
+    StringPtr* text = NULL;
+    if (symbols == NULL || !MapGet_int_StringPtr(symbols, GetCrushedName(LINE_MAP_SYMBOL), &text)) return NULL;
+
+    auto result = VecAllocateArena_int(arena);
+    if (result == NULL) return NULL;
+
+    // `position:line` pairs, split by spaces
+    int length = StringLength(*text);
+    int value = 0;
+    for (int i = 0; i <= length; i++) {
+        char c = (i < length) ? StringCharAtIndex(*text, i) : ' ';
+        if (c >= '0' && c <= '9') {
+            value = (value * 10) + (c - '0');
+            continue;
+        }
+        VecPush_int(result, value);
+        value = 0;
+    }
+    if (VecLength(result) % 2 != 0) VecPop_int(result, NULL);
+    return result;
+}
+
 bool TCR_Read(Vector* v, uint32_t* outStartOfCode, uint32_t* outStartOfMemory) {
     if (v == NULL || outStartOfCode == NULL || outStartOfMemory == NULL) return false;
     if (!TCR_FixByteOrder(v)) return false;
@@ -26,6 +26,11 @@ bool TCR_Read(Vector* v, uint32_t* outStartOfCode, uint32_t* outStartOfMemory);
 // This should also add the default (built-in) symbols
 HashMap* TCR_ReadSymbols(Vector* v);
 
+// Read the tag-code to source line map from a symbol map (see `TCW_WriteSymbolsToStream`).
+// Returns a Vector<int> of pairs: [op-code position, source line], in position order, where positions count from the first op-code after the string table.
+// Each line runs to the next pair, and line zero is not from the program's source file. Returns NULL if the symbols have no line map.
+Vector* TCR_ReadLineMap(HashMap* symbols, Arena* arena);
+
 // Generate a string representation of the tag code data
 String* TCR_Describe(Vector* data, HashMap* symbols);
 
@@ -8,6 +8,7 @@ const char* FATAL_MESSAGE = "### THE COMPILER OR OUTPUT STAGE FAILED ###";
 RegisterHashMapStatics(Map)
 RegisterHashMapFor(int, StringPtr, HashMapIntKeyHash, HashMapIntKeyCompare, Map)
 RegisterHashMapFor(int, int, HashMapIntKeyHash, HashMapIntKeyCompare, Map)
+RegisterHashMapFor(StringPtr, int, HashMapStringKeyHash, HashMapStringKeyCompare, Map)
 
 RegisterVectorStatics(Vec)
 RegisterVectorFor(StringPtr, Vec)
@@ -19,6 +20,8 @@ RegisterVectorFor(HashMap_KVP, Vec)
 typedef struct TagCodeCache {
     // Literal strings to be written into data section of code
     Vector* _stringTable; // Vector of string
+    // Position of each string in the string table, for duplicate checks
+    HashMap* _stringIndex; // Map of String -> int
 
     // Nan-boxed opcodes and values
     Vector* _opcodes; // Vector of DataTag
@@ -26,8 +29,8 @@ typedef struct TagCodeCache {
     // Names that we've hashed
     HashMap* _symbols; // Map of uint32_t -> String (the crush hash to the original symbol name)
 
-    // Map from input location to output location
-    Vector* _codeMap; // Vector<int>; index is opcode position, value is approximate source text position
+    // Map from output location to input line
+    Vector* _codeMap; // Vector<int> of pairs: [opcode position, source line], in position order. Each line runs to the next pair. Line zero is not from this source.
 
     // any errors that have been found
     Vector* _errors; // Vector of string
@@ -35,6 +38,9 @@ typedef struct TagCodeCache {
     // True, if this tcc is a fragment that returns non-void
     bool _returnsValues; // set externally
 
+    // Results of the peephole optimiser
+    PeepholeStatistics _peephole;
+
     // memory zone we are using
     ArenaPtr _arena;
 } TagCodeCache;
@@ -46,13 +52,14 @@ TagCodeCache * TCW_Allocate(ArenaPtr arena) {
 
     result->_opcodes = VecAllocate_DataTag();
     result->_stringTable = VecAllocate_StringPtr();
+    result->_stringIndex = MapAllocate_StringPtr_int(256);
     result->_symbols = MapAllocate_int_StringPtr(1024);
     result->_codeMap = VecAllocate_int();
     result->_errors = NULL;
     result->_returnsValues = false;
     result->_arena = arena;
 
-    if (result->_opcodes == NULL || result->_stringTable == NULL || result->_symbols == NULL) {
+    if (result->_opcodes == NULL || result->_stringTable == NULL || result->_stringIndex == NULL || result->_symbols == NULL || result->_codeMap == NULL) {
         TCW_Deallocate(result);
         return NULL;
     }
@@ -66,14 +73,17 @@ void TCW_Deallocate(TagCodeCache* tcc) {
     // This *WILL* leak strings. Make sure to run inside an arena
     if (tcc->_opcodes != NULL) VectorDeallocate(tcc->_opcodes);
     if (tcc->_stringTable != NULL) VectorDeallocate(tcc->_stringTable);
+    if (tcc->_stringIndex != NULL) HashMapDeallocate(tcc->_stringIndex);
     if (tcc->_symbols != NULL) HashMapDeallocate(tcc->_symbols);
     if (tcc->_errors != NULL) VectorDeallocate(tcc->_errors);
-    if (tcc->_codeMap != NULL) VectorDeallocate(tcc->_errors);
+    if (tcc->_codeMap != NULL) VectorDeallocate(tcc->_codeMap);
 
     tcc->_opcodes = NULL;
     tcc->_stringTable = NULL;
+    tcc->_stringIndex = NULL;
     tcc->_symbols = NULL;
     tcc->_errors = NULL;
+    tcc->_codeMap = NULL;
 
 	ArenaDereference(tcc->_arena, tcc);
 }
@@ -130,6 +140,46 @@ int TCW_OpCodeCount(TagCodeCache* tcc) {
     return VecLength(tcc->_opcodes);
 }
 
+// Set the line of code from `position` onward. `position` must not be before the last pair in the map.
+void SetLineAt(Vector* map, int position, int line) {
+    int length = VecLength(map);
+    if (length == 0 && line == 0) return; // lines are unknown until the first is set
+    if (length >= 2 && *VecGet_int(map, length - 1) == line) return; // already on this line
+    if (length >= 2 && *VecGet_int(map, length - 2) == position) {
+        // nothing written since the last change
+        VecSet_int(map, length - 1, line, NULL);
+        if (length >= 4 && *VecGet_int(map, length - 3) == line) { VecPop_int(map, NULL); VecPop_int(map, NULL); }
+        return;
+    }
+    VecPush_int(map, position);
+    VecPush_int(map, line);
+}
+
+void TCW_SourceLine(TagCodeCache* tcc, int line) {
+    if (tcc == NULL || line <= 0) return;
+    SetLineAt(tcc->_codeMap, VecLength(tcc->_opcodes), line);
+}
+
+void TCW_ForeignSourceLines(TagCodeCache* tcc, int position) {
+    if (tcc == NULL) return;
+    auto map = tcc->_codeMap;
+    while (VecLength(map) >= 2 && *VecGet_int(map, VecLength(map) - 2) >= position) {
+        VecPop_int(map, NULL); VecPop_int(map, NULL);
+    }
+    SetLineAt(map, position, 0);
+}
+
+int TCW_LineAt(TagCodeCache* tcc, int position) {
+    if (tcc == NULL) return 0;
+    int line = 0;
+    int length = VecLength(tcc->_codeMap);
+    for (int i = 0; i < length; i += 2) {
+        if (*VecGet_int(tcc->_codeMap, i) > position) break;
+        line = *VecGet_int(tcc->_codeMap, i + 1);
+    }
+    return line;
+}
+
 void TCW_Merge(TagCodeCache* dest, TagCodeCache* fragment) {
     if (dest == NULL || fragment == NULL) return;
 
@@ -137,15 +187,33 @@ void TCW_Merge(TagCodeCache* dest, TagCodeCache* fragment) {
     int srcLength = VecLength(codes);
     auto strings = fragment->_stringTable;
 
+    // Each op-code is copied to one op-code, so the fragment's lines just move down
+    int destStart = VecLength(dest->_opcodes);
+    int lineCount = VecLength(fragment->_codeMap);
+    if (lineCount == 0 || *VecGet_int(fragment->_codeMap, 0) != 0) SetLineAt(dest->_codeMap, destStart, 0);
+    for (int i = 0; i < lineCount; i += 2) {
+        SetLineAt(dest->_codeMap, destStart + *VecGet_int(fragment->_codeMap, i), *VecGet_int(fragment->_codeMap, i + 1));
+    }
+
+    // Errors and symbols are copied too, so the fragment's arena can be closed after merging
     if (fragment->_errors != NULL) {
         if (dest->_errors == NULL) dest->_errors = VecAllocate_StringPtr();
-        StringPtr err = NULL;
-        while (VecDequeue_StringPtr(fragment->_errors, &err)) {
-            VecPush_StringPtr(dest->_errors, err);
+        int errCount = VecLength(fragment->_errors);
+        for (int i = 0; i < errCount; i++) {
+            VecPush_StringPtr(dest->_errors, StringClone(*VecGet_StringPtr(fragment->_errors, i)));
         }
     }
 
-    TCW_AddSymbols(dest, fragment->_symbols);
+    auto symbols = MapAllEntries(fragment->_symbols);
+    HashMap_KVP entry;
+    while (VecPop_HashMap_KVP(symbols, &entry)) {
+        auto crushed = *(int32_t*)entry.Key;
+        auto name = *(StringPtr*)entry.Value;
+        StringPtr* existing = NULL;
+        if (MapGet_int_StringPtr(dest->_symbols, crushed, &existing) && StringAreEqual(*existing, name)) continue;
+        TCW_AddSymbol(dest, crushed, StringClone(name));
+    }
+    VecDeallocate(symbols);
 
     for (int i = 0; i < srcLength; i++) {
         auto code = VecGet_DataTag(codes, i);
@@ -155,10 +223,11 @@ void TCW_Merge(TagCodeCache* dest, TagCodeCache* fragment) {
         case DataType::StaticStringPtr:
         case DataType::StringPtr:
         {
-            auto strPtr = *VecGet_StringPtr(strings, code->data);
+            // Writing out the code deallocates its string table, so `dest` gets its own copy
+            auto strPtr = StringClone(*VecGet_StringPtr(strings, code->data));
             if (TCW_LiteralString(dest, strPtr)) {
                 // string is a duplicate. We can clean up:
-                //StringDeallocate(strPtr);
+                StringDeallocate(strPtr);
             }
             break;
         }
@@ -295,20 +364,21 @@ int TCW_AppendToStream(TagCodeCache* tcc, Vector* output) {
     // 2) Write the strings, with a mapping dictionary
     long location = VecLength(output); // counting initial jump as 0
     int stringTableCount = VecLength(tcc->_stringTable);
+    HashMapClear(tcc->_stringIndex); // the table is consumed below
     auto mapping = MapAllocate_int_int(1024);
     for (int index = 0; index < stringTableCount; index++) {
         String* staticStr = NULL;
         VecDequeue_StringPtr(tcc->_stringTable, &staticStr);
 
         if (!StringIsValid(staticStr)) {
-            return NULL; // something went very wrong
+            return -1; // something went very wrong
         }
 
         auto bytes = StringLength(staticStr);
 
         location = VecLength(output);
         if (location % 8 != 0) { // alignment went wrong!
-            return NULL;
+            return -1;
         }
 
         MapPut_int_int(mapping, index, location / 8, true);
@@ -352,14 +422,14 @@ int TCW_AppendToStream(TagCodeCache* tcc, Vector* output) {
                 WriteCode(output, EncodePointer(*final, DataType::StaticStringPtr));
             } else {
                 // String mapping went totally wrong
-                return NULL;
+                return -1;
             }
             break;
         }
 
         case DataType::Invalid:
             // Total failure!
-            return NULL;
+            return -1;
 
         default:
             WriteCode(output, code);
@@ -371,6 +441,10 @@ int TCW_AppendToStream(TagCodeCache* tcc, Vector* output) {
 }
 
 int TCW_AppendToVector(TagCodeCache* tcc, Vector* output) {
+    return TCW_AppendToVectorAt(tcc, output, 0);
+}
+
+int TCW_AppendToVectorAt(TagCodeCache* tcc, Vector* output, int positionOffset) {
 
     // a string is [Integer Tag: byte length] [string bytes, padded to 8 byte chunks]
 
@@ -382,6 +456,7 @@ int TCW_AppendToVector(TagCodeCache* tcc, Vector* output) {
     // 2) Write the strings, with a mapping dictionary
     long location = VecLength(output); // counting initial jump as 0
     int stringTableCount = VecLength(tcc->_stringTable);
+    HashMapClear(tcc->_stringIndex); // the table is consumed below
     auto mapping = MapAllocate_int_int(128);
     if (mapping == NULL) return -1;
     for (int index = 0; index < stringTableCount; index++) {
@@ -395,7 +470,7 @@ int TCW_AppendToVector(TagCodeCache* tcc, Vector* output) {
         auto bytes = StringLength(staticStr);
 
         location = VecLength(output);
-        MapPut_int_int(mapping, index, location, true); // note: no division unlike the byte stream version
+        MapPut_int_int(mapping, index, location + positionOffset, true); // note: no division unlike the byte stream version
 
         auto headerOpCode = EncodeInt32(bytes);
         VecPush_DataTag(output, headerOpCode);
@@ -444,10 +519,26 @@ int TCW_AppendToVector(TagCodeCache* tcc, Vector* output) {
         }
     }
     MapDeallocate(mapping);
-    return baseLocation;
+    return baseLocation + positionOffset;
 }
 
 // Adds a symbol map to a BYTE vector.
+// The line map as text: `position:line` pairs, split by spaces. Positions count from the first op-code, after the string table.
+// Returns NULL if there are no lines.
+String* LineMapString(TagCodeCache* tcc) {
+    int length = VecLength(tcc->_codeMap);
+    if (length < 2) return NULL;
+
+    auto result = StringEmpty();
+    for (int i = 0; i < length; i += 2) {
+        if (i > 0) StringAppendChar(result, ' ');
+        StringAppendInt32(result, *VecGet_int(tcc->_codeMap, i));
+        StringAppendChar(result, ':');
+        StringAppendInt32(result, *VecGet_int(tcc->_codeMap, i + 1));
+    }
+    return result;
+}
+
 bool TCW_WriteSymbolsToStream(TagCodeCache* tcc, Vector* v) {
     if (tcc == NULL || v == NULL) return false;
 
@@ -475,6 +566,14 @@ bool TCW_WriteSymbolsToStream(TagCodeCache* tcc, Vector* v) {
     }
     VecDeallocate(symbols);
 
+    auto lines = LineMapString(tcc);
+    if (lines != NULL) {
+        WriteUint32(v, GetCrushedName(LINE_MAP_SYMBOL));
+        WriteUint32(v, StringLength(lines));
+        WriteString(v, lines);
+        StringDeallocate(lines);
+    }
+
     return true;
 }
 
@@ -505,6 +604,12 @@ void TCW_GetSymbolsTo(TagCodeCache* tcc, HashMap* sym, Arena* strMem) {
     }
     VecDeallocate(content);
 
+    auto lines = LineMapString(tcc);
+    if (lines != NULL) {
+        MapPut_int_StringPtr(sym, GetCrushedName(LINE_MAP_SYMBOL), StringClone(lines, strMem), true);
+        StringDeallocate(lines);
+    }
+
     return;
 }
 
@@ -627,6 +732,92 @@ void TCW_CompareJump(TagCodeCache* tcc, int opCodeCount) {
     VecPush_DataTag(tcc->_opcodes, EncodeLongOpcode('c', 'c', opCodeCount));
 }
 
+// Name of the runtime function that does the same test as a compound compare
+const char* CompareFunctionName(CmpOp operation) {
+    switch (operation) {
+    case CmpOp::Equal: return "=";
+    case CmpOp::NotEqual: return "<>";
+    case CmpOp::Less: return "<";
+    case CmpOp::Greater: return ">";
+    default: return NULL;
+    }
+}
+
+// Shift everything from `position` down by one, and write `code` into the gap
+void InsertOpCode(TagCodeCache* tcc, int position, DataTag code) {
+    int end = VecLength(tcc->_opcodes);
+    VecPush_DataTag(tcc->_opcodes, code);
+    for (int i = end; i > position; i--) {
+        VecSet_DataTag(tcc->_opcodes, i, *VecGet_DataTag(tcc->_opcodes, i - 1), NULL);
+    }
+    VecSet_DataTag(tcc->_opcodes, position, code, NULL);
+
+    // The new op-code takes the line of the one before it
+    int lineCount = VecLength(tcc->_codeMap);
+    for (int i = lineCount - 2; i >= 0; i -= 2) {
+        auto linePosition = VecGet_int(tcc->_codeMap, i);
+        if (*linePosition < position) break;
+        (*linePosition)++;
+    }
+}
+
+int TCW_PatchCompareJump(TagCodeCache* tcc, int jumpPosition, int trailingOpCodes) {
+    if (tcc == NULL) return 0;
+    auto code = VecGet_DataTag(tcc->_opcodes, jumpPosition);
+    if (code == NULL) return 0;
+
+    int distance = (VecLength(tcc->_opcodes) + trailingOpCodes) - jumpPosition - 1;
+
+    char codeClass, codeAction;
+    uint16_t p1, p2;
+    DecodeOpcode(*code, &codeClass, &codeAction, &p1, &p2, NULL);
+
+    if (codeClass == 'c' && codeAction == 'c') {
+        *code = EncodeLongOpcode('c', 'c', distance);
+        return 0;
+    }
+    if (codeClass != 'C') {
+        TCW_AddError(tcc, StringNewFormat("Internal compiler error: no compare jump at \x02", jumpPosition));
+        return 0;
+    }
+
+    if (distance < 32767) {
+        *code = EncodeOpcode('C', codeAction, p1, distance);
+        return 0;
+    }
+
+    // Too far for a compound compare: call the comparison as a function, and follow it with a long jump.
+    // The jump lands in the same place, as everything after it has moved down by one.
+    auto functionName = StringNew(CompareFunctionName((CmpOp)codeAction));
+    uint32_t crush;
+    EncodeVariableRef(functionName, &crush);
+    TCW_AddSymbol(tcc, crush, functionName);
+    *code = EncodeWideLongOpcode('f', 'c', crush, p1);
+    InsertOpCode(tcc, jumpPosition + 1, EncodeLongOpcode('c', 'c', distance));
+    return 1;
+}
+
+void TCW_PatchFunctionDefine(TagCodeCache* tcc, int definePosition) {
+    if (tcc == NULL) return;
+    auto code = VecGet_DataTag(tcc->_opcodes, definePosition);
+    if (code == NULL) return;
+
+    char codeClass, codeAction;
+    uint16_t argCount, oldCount;
+    DecodeOpcode(*code, &codeClass, &codeAction, &argCount, &oldCount, NULL);
+    if (codeClass != 'f' || codeAction != 'd') {
+        TCW_AddError(tcc, StringNewFormat("Internal compiler error: no function definition at \x02", definePosition));
+        return;
+    }
+
+    int tokenCount = VecLength(tcc->_opcodes) - definePosition - 1;
+    if (tokenCount > 0xFFFF) {
+        TCW_AddError(tcc, StringNew("Function is too long to encode. Split it into smaller functions."));
+        return;
+    }
+    *code = EncodeOpcode('f', 'd', argCount, tokenCount);
+}
+
 void TCW_UnconditionalJump(TagCodeCache* tcc, int opCodeCount) {
     if (tcc == NULL) return;
     VecPush_DataTag(tcc->_opcodes, EncodeLongOpcode('c', 'j', opCodeCount));
@@ -642,16 +833,17 @@ bool TCW_LiteralString(TagCodeCache* tcc, String* s) {
     if (tcc == NULL || s == NULL) return false;
 
     // duplication check (only need 1 copy of any given static literal)
-    int len = VecLength(tcc->_stringTable);
-    for (int i = 0; i < len; i++) {
-        if (!StringAreEqual(s, *VecGet_StringPtr(tcc->_stringTable, i))) continue;
+    int* existing = NULL;
+    if (MapGet_StringPtr_int(tcc->_stringIndex, s, &existing)) {
         // found duplicate. Reference and leave
-        VecPush_DataTag(tcc->_opcodes, EncodePointer(i, DataType::StaticStringPtr));
+        VecPush_DataTag(tcc->_opcodes, EncodePointer(*existing, DataType::StaticStringPtr));
         return true;
     }
 
     // no existing matches
+    int len = VecLength(tcc->_stringTable);
     VecPush_StringPtr(tcc->_stringTable, s);
+    MapPut_StringPtr_int(tcc->_stringIndex, s, len, true);
     VecPush_DataTag(tcc->_opcodes, EncodePointer(len, DataType::StaticStringPtr));
     return false;
 }
@@ -660,3 +852,310 @@ void TCW_RawToken(TagCodeCache* tcc, DataTag value) {
     if (tcc == NULL) return;
     VecPush_DataTag(tcc->_opcodes, value);
 }
+
+
+// Peephole optimiser --------------------------------------------------------------------------------------------------------------
+
+// Longest chain of jumps that will be followed when threading
+#define MAX_JUMP_THREAD 8
+
+// An op-code being written by the optimiser, with the position it jumps to.
+// Targets start as positions in the original code, and are moved to positions in the new code.
+typedef struct PeepholeCode {
+    DataTag code;
+    int target; // jump target, or the `return` of a function definition. -1 if not a jump
+} PeepholeCode;
+RegisterVectorFor(PeepholeCode, Vec)
+
+inline bool IsOpcode(DataTag tag, char codeClass, char codeAction) {
+    if (tag.type != (int)DataType::Opcode) return false;
+    char c, a;
+    DecodeOpcode(tag, &c, &a, NULL, NULL, NULL);
+    return c == codeClass && a == codeAction;
+}
+
+inline uint8_t OpcodeParamCount(DataTag tag) {
+    uint8_t p3;
+    DecodeOpcode(tag, NULL, NULL, NULL, NULL, &p3);
+    return p3;
+}
+
+inline DataTag CodeAt(Vector* codes, int position) {
+    if (position < 0 || position >= VecLength(codes)) return InvalidTag();
+    return *VecGet_DataTag(codes, position);
+}
+
+// Position that an op-code can move execution to (the interpreter adds one after every op-code).
+// For function definitions, this is the `return` at the end of the function. Returns -1 for other op-codes.
+int JumpTarget(DataTag tag, int position) {
+    if (tag.type != (int)DataType::Opcode) return -1;
+
+    char codeClass, codeAction;
+    uint16_t p1, p2;
+    DecodeOpcode(tag, &codeClass, &codeAction, &p1, &p2, NULL);
+    switch (codeClass) {
+    case 'c':
+        if (codeAction == 'c' || codeAction == 's') return position + (int)tag.data + 1;
+        if (codeAction == 'j') return position - (int)tag.data + 1;
+        return -1;
+    case 'C': return position + p2 + 1;
+    case 'K': return position + (int32_t)tag.data + 1;
+    case 'f': return (codeAction == 'd') ? position + p2 + 1 : -1;
+    default: return -1;
+    }
+}
+
+// Can the op-code at `position` be re-encoded to reach `target`? Most jumps can only go in one direction.
+bool CanJumpTo(DataTag tag, int position, int target) {
+    int distance = target - position - 1;
+    if (IsOpcode(tag, 'c', 'j')) return distance <= 0;
+    if (IsOpcode(tag, 'c', 'c') || IsOpcode(tag, 'c', 's')) return distance >= 0;
+
+    char codeClass;
+    DecodeOpcode(tag, &codeClass, NULL, NULL, NULL, NULL);
+    if (codeClass == 'K') return true;
+    if (codeClass == 'C' || codeClass == 'f') return distance >= 0 && distance <= 0xFFFF;
+    return false;
+}
+
+// Write the distance from `position` to `target` into a jump op-code
+DataTag EncodeJump(DataTag tag, int position, int target) {
+    char codeClass, codeAction;
+    uint16_t p1, p2;
+    DecodeOpcode(tag, &codeClass, &codeAction, &p1, &p2, NULL);
+
+    int distance = target - position - 1;
+    switch (codeClass) {
+    case 'c':
+        if (codeAction == 'j') return EncodeLongOpcode('c', 'j', -distance);
+        return EncodeLongOpcode('c', codeAction, distance);
+    case 'C': return EncodeOpcode('C', codeAction, p1, distance);
+    case 'K': return EncodeLongOpcode('K', codeAction, (uint32_t)distance);
+    case 'f': return EncodeOpcode('f', 'd', p1, distance);
+    default: return tag;
+    }
+}
+
+// Is this a call to a built-in math function with two parameters? These never return to the op-code after them.
+bool IsMathCall(DataTag tag, char* outOperation) {
+    if (!IsOpcode(tag, 'f', 'c') || OpcodeParamCount(tag) != 2) return false;
+
+    const char* operations = "+-*/%";
+    for (int i = 0; operations[i] != 0; i++) {
+        char name[2] = { operations[i], 0 };
+        if (tag.data != GetCrushedName(name)) continue;
+        *outOperation = operations[i];
+        return true;
+    }
+    return false;
+}
+
+// Can this op-code be replaced by a single operand word? Literal integers are used as-is, and
+// plain `get`s become variable references, which the super-instruction will resolve.
+bool AsOperand(DataTag tag, DataTag* outOperand) {
+    if (tag.type == (int)DataType::Integer) {
+        *outOperand = tag;
+        return true;
+    }
+    if (IsOpcode(tag, 'm', 'g') && OpcodeParamCount(tag) == 0) {
+        *outOperand = EncodeVariableRef(tag.data);
+        return true;
+    }
+    return false;
+}
+
+// True if execution can only arrive at the `count` op-codes after `position` from the op-code before
+inline bool NoEntries(Vector* isEntry, int position, int count, int length) {
+    if (position + count > length) return false;
+    for (int i = position + 1; i < position + count; i++) {
+        if (*VecGet_char(isEntry, i)) return false;
+    }
+    return true;
+}
+
+inline void PushCode(Vector* output, DataTag code, int target) {
+    auto entry = PeepholeCode{};
+    entry.code = code;
+    entry.target = target;
+    VecPush_PeepholeCode(output, entry);
+}
+
+// Try to write a super-instruction for the op-codes starting at `position`.
+// Returns the number of original op-codes replaced, or zero if none.
+int FuseAt(Vector* codes, int position, Vector* isEntry, Vector* output, PeepholeStatistics* stats) {
+    int length = VecLength(codes);
+    auto a = CodeAt(codes, position);
+    auto b = CodeAt(codes, position + 1);
+    auto c = CodeAt(codes, position + 2);
+    auto d = CodeAt(codes, position + 3);
+    DataTag operand, secondOperand;
+    char operation;
+
+    // load-math-store: `set(x +(x y))` and similar
+    if (NoEntries(isEntry, position, 4, length)
+        && IsOpcode(a, 'm', 'g') && OpcodeParamCount(a) == 0
+        && AsOperand(b, &operand)
+        && IsMathCall(c, &operation)
+        && IsOpcode(d, 'm', 's') && OpcodeParamCount(d) <= 1 && d.data == a.data) {
+        PushCode(output, EncodeLongOpcode('A', operation, a.data), -1);
+        PushCode(output, operand, -1);
+        stats->LoadMathStore++;
+        return 4;
+    }
+
+    // compare-and-jump of two simple values, like `while(<(i 10) ...)`
+    if (NoEntries(isEntry, position, 3, length)
+        && AsOperand(a, &operand) && AsOperand(b, &secondOperand)) {
+        char codeClass, codeAction;
+        uint16_t argCount;
+        DecodeOpcode(c, &codeClass, &codeAction, &argCount, NULL, NULL);
+        if (c.type == (int)DataType::Opcode && codeClass == 'C' && argCount == 2) {
+            PushCode(output, EncodeLongOpcode('K', codeAction, 0), JumpTarget(c, position + 2));
+            PushCode(output, operand, -1);
+            PushCode(output, secondOperand, -1);
+            stats->CompareJump++;
+            return 3;
+        }
+    }
+
+    // get with a small literal index, like `get(str 5)`. The index is held in the param count byte
+    if (NoEntries(isEntry, position, 2, length)
+        && a.type == (int)DataType::Integer && DecodeInt32(a) >= 0 && DecodeInt32(a) <= 0xFF
+        && IsOpcode(b, 'm', 'g') && OpcodeParamCount(b) == 1) {
+        PushCode(output, EncodeWideLongOpcode('m', 'l', b.data, (uint8_t)DecodeInt32(a)), -1);
+        stats->IndexedGet++;
+        return 2;
+    }
+
+    // set, then read back the same value
+    if (NoEntries(isEntry, position, 2, length)
+        && IsOpcode(a, 'm', 's') && OpcodeParamCount(a) <= 1
+        && IsOpcode(b, 'm', 'g') && OpcodeParamCount(b) == 0 && a.data == b.data) {
+        PushCode(output, EncodeLongOpcode('m', 'k', a.data), -1);
+        stats->SetThenGet++;
+        return 2;
+    }
+
+    return 0;
+}
+
+// If a jump lands on an unconditional jump, go straight to where that one goes
+void ThreadJump(Vector* output, int position, PeepholeStatistics* stats) {
+    auto entry = VecGet_PeepholeCode(output, position);
+    int length = VecLength(output);
+    int target = entry->target;
+
+    for (int hop = 0; hop < MAX_JUMP_THREAD && target < length; hop++) {
+        auto next = VecGet_PeepholeCode(output, target);
+        if (!IsOpcode(next->code, 'c', 'j') && !IsOpcode(next->code, 'c', 's')) break;
+        if (next->target == target || !CanJumpTo(entry->code, position, next->target)) break;
+        target = next->target;
+    }
+
+    if (target == entry->target) return;
+    entry->target = target;
+    stats->ThreadedJumps++;
+}
+
+void TCW_Optimise(TagCodeCache* tcc) {
+    if (tcc == NULL || tcc->_errors != NULL) return;
+
+    auto codes = tcc->_opcodes;
+    int length = VecLength(codes);
+    auto stats = PeepholeStatistics{};
+    stats.OpCodesBefore = length;
+    stats.OpCodesAfter = length;
+
+    // 1) Find every position that can be reached other than from the op-code before it.
+    //    Super-instructions can start at these positions, but must not cover them.
+    tcc->_peephole = stats;
+
+    // These are vectors rather than arrays, as large programs won't fit in a single arena zone
+    auto isEntry = VecAllocate_char(); // used as Vector<bool>
+    auto newPosition = VecAllocate_int();
+    auto output = VecAllocate_PeepholeCode();
+    if (isEntry == NULL || newPosition == NULL || output == NULL
+        || !VecPrealloc(isEntry, length + 1) || !VecPrealloc(newPosition, length + 1)) {
+        VecDeallocate(isEntry);
+        VecDeallocate(newPosition);
+        VecDeallocate(output);
+        return;
+    }
+
+    for (int i = 0; i < length; i++) {
+        auto code = CodeAt(codes, i);
+        int target = JumpTarget(code, i);
+        if (target > length || target < -1) {
+            // Jumps out of this code. Must be a fragment, so leave it alone
+            VecDeallocate(isEntry);
+            VecDeallocate(newPosition);
+            VecDeallocate(output);
+            return;
+        }
+        if (target >= 0) VecSet_char(isEntry, target, true, NULL);
+
+        char operation;
+        if (IsOpcode(code, 'f', 'd')) VecSet_char(isEntry, i + 1, true, NULL); // function calls arrive at the start of the body
+        else if (IsOpcode(code, 'f', 'c') && !IsMathCall(code, &operation)) VecSet_char(isEntry, i + 1, true, NULL); // custom functions, `eval` and `call` return here
+    }
+
+    // 2) Write super-instructions, recording where each original op-code ends up
+    int i = 0;
+    while (i < length) {
+        int start = VecLength(output);
+        int used = FuseAt(codes, i, isEntry, output, &stats);
+        if (used == 0) {
+            auto code = CodeAt(codes, i);
+            PushCode(output, code, JumpTarget(code, i));
+            used = 1;
+        }
+        for (int j = 0; j < used; j++) { VecSet_int(newPosition, i + j, start, NULL); }
+        i += used;
+    }
+    VecSet_int(newPosition, length, VecLength(output), NULL);
+
+    // 3) Move jump targets to the new positions, then shorten jump chains.
+    int newLength = VecLength(output);
+    for (i = 0; i < newLength; i++) {
+        auto entry = VecGet_PeepholeCode(output, i);
+        if (entry->target >= 0) entry->target = *VecGet_int(newPosition, entry->target);
+    }
+    for (i = 0; i < newLength; i++) {
+        auto entry = VecGet_PeepholeCode(output, i);
+        if (entry->target >= 0 && !IsOpcode(entry->code, 'f', 'd')) ThreadJump(output, i, &stats);
+    }
+
+    // 4) Write out, with new jump distances
+    VecClear(codes);
+    for (i = 0; i < newLength; i++) {
+        auto entry = VecGet_PeepholeCode(output, i);
+        if (entry->target >= 0) VecPush_DataTag(codes, EncodeJump(entry->code, i, entry->target));
+        else VecPush_DataTag(codes, entry->code);
+    }
+
+    // 5) Move the line map. A super-instruction has the line of its first op-code.
+    auto lines = VecAllocate_int();
+    int lineCount = VecLength(tcc->_codeMap);
+    if (lines != NULL) {
+        for (i = 0; i < lineCount; i += 2) {
+            int oldPosition = *VecGet_int(tcc->_codeMap, i);
+            int position = *VecGet_int(newPosition, oldPosition);
+            if (oldPosition > 0 && oldPosition < length && *VecGet_int(newPosition, oldPosition - 1) == position) continue; // inside a super-instruction
+            SetLineAt(lines, position, *VecGet_int(tcc->_codeMap, i + 1));
+        }
+        VecDeallocate(tcc->_codeMap);
+        tcc->_codeMap = lines;
+    }
+
+    stats.OpCodesAfter = newLength;
+    tcc->_peephole = stats;
+
+    VecDeallocate(isEntry);
+    VecDeallocate(newPosition);
+    VecDeallocate(output);
+}
+
+PeepholeStatistics TCW_OptimiseStatistics(TagCodeCache* tcc) {
+    if (tcc == NULL) return PeepholeStatistics{};
+    return tcc->_peephole;
+}
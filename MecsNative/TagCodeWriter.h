@@ -45,19 +45,24 @@ int TCW_Position(TagCodeCache* tcc);
 int TCW_OpCodeCount(TagCodeCache* tcc);
 
 // Inject a compiled sub-unit into this writer. References to string constants will be recalculated
-// NOTE: The `srcFragment` parameter will be deallocted!
+// The fragment is not changed, and its strings, symbols and errors are copied, so it can be merged again (or its arena closed).
 void TCW_Merge(TagCodeCache* dest, TagCodeCache* srcFragment);
 
 // Write opcodes and data section to a BYTE vector. References to string constants will be recalculated
 Vector* TCW_WriteToStream(TagCodeCache* tcc);
 
-// Adds opcodes and data section to a BYTE vector. References to string constants will be recalculated. Returns start of code index.
+// Adds opcodes and data section to a BYTE vector. References to string constants will be recalculated.
+// Returns start of code index, or -1 if the code could not be written.
 int TCW_AppendToStream(TagCodeCache* tcc, Vector* existing);
 
 // Adds opcodes and data section to a `DataTag` vector. References to string constants will be recalculated
 // this is mainly for use with 'eval' runtime code generation. Returns start of code index.
 int TCW_AppendToVector(TagCodeCache* tcc, Vector* existing);
 
+// Adds opcodes and data section to a `DataTag` vector that will be addressed as if it started at `positionOffset`
+// (for code that runs after another, separate, vector). Returns start of code index, including the offset.
+int TCW_AppendToVectorAt(TagCodeCache* tcc, Vector* existing, int positionOffset);
+
 // Input a symbol set to the known symbols table
 bool TCW_AddSymbols(TagCodeCache* tcc, HashMap* sym);
 
@@ -69,8 +74,18 @@ HashMap* TCW_GetSymbols(TagCodeCache* tcc);
 void TCW_GetSymbolsTo(TagCodeCache* tcc, HashMap* sym, Arena* strMem);
 
 // Adds a symbol map to a BYTE vector.
+// The tag-code to source line map is included as the symbol `LINE_MAP_SYMBOL` (see `TCR_ReadLineMap`), as it is by `TCW_GetSymbolsTo`.
 bool TCW_WriteSymbolsToStream(TagCodeCache* tcc, Vector* existing);
 
+// Source lines:
+
+// Record that op-codes written from now on come from a line of the source file (counting from 1). Zero is ignored.
+void TCW_SourceLine(TagCodeCache* tcc, int line);
+// Mark the op-codes from `position` to the current end as not from this source file (e.g. merged from an import)
+void TCW_ForeignSourceLines(TagCodeCache* tcc, int position);
+// Source line of the op-code at a position, or zero if not known
+int TCW_LineAt(TagCodeCache* tcc, int position);
+
 
 // Generation methods:
 
@@ -88,7 +103,7 @@ void TCW_Increment(TagCodeCache* tcc, int8_t incr, String* targetName);
 void TCW_FunctionCall(TagCodeCache* tcc, String* functionName, int parameterCount);
 // Scheduler directive
 void TCW_Directive(TagCodeCache* tcc, String* functionName, int parameterCount);
-// Add a define-and-skip set of opcodes *before* merging in the compiled function opcodes.
+// Add a define-and-skip set of opcodes *before* writing the compiled function opcodes. `tokenCount` can be patched later.
 void TCW_FunctionDefine(TagCodeCache* tcc, String* functionName, int argCount, int tokenCount);
 // Add a single symbol reference
 bool TCW_AddSymbol(TagCodeCache* tcc, uint32_t crushed, String* name);
@@ -102,6 +117,15 @@ void TCW_CompoundCompareJump(TagCodeCache* tcc, CmpOp operation, uint16_t argCou
 void TCW_CompareJump(TagCodeCache* tcc, int opCodeCount);
 // Jump relative up, always
 void TCW_UnconditionalJump(TagCodeCache* tcc, int opCodeCount);
+
+// Backpatching, for blocks whose length isn't known until they are written:
+
+// Set the distance of the compare jump (`C` or `cc`) at `jumpPosition` so it lands `trailingOpCodes` after the current end.
+// A compound compare that can't encode the distance is split in two, which moves later opcodes down.
+// Returns the number of opcodes inserted (0 or 1).
+int TCW_PatchCompareJump(TagCodeCache* tcc, int jumpPosition, int trailingOpCodes);
+// Set the length of the function defined at `definePosition` (the `fd` opcode) to run to the current end.
+void TCW_PatchFunctionDefine(TagCodeCache* tcc, int definePosition);
 // Encode a numeric value
 void TCW_LiteralNumber(TagCodeCache* tcc, int32_t d);
 // Write a static string. Static strings aren't seen by the GC and exist in memory outside of the normal allocation space. Returns `true` iff the string is already present
@@ -110,4 +134,24 @@ bool TCW_LiteralString(TagCodeCache* tcc, String* s);
 void TCW_RawToken(TagCodeCache* tcc, DataTag value);
 
 
+// Optimisation methods:
+
+// Counts of the changes made by `TCW_Optimise`
+typedef struct PeepholeStatistics {
+    int OpCodesBefore;
+    int OpCodesAfter;
+    int LoadMathStore;  // `mg x; <value>; fc op; ms x` became `A op x; <value>`
+    int CompareJump;    // `<value>; <value>; C cmp` became `K cmp; <value>; <value>`
+    int IndexedGet;     // `<small integer>; mg x +1` became `ml x`
+    int SetThenGet;     // `ms x; mg x` became `mk x`
+    int ThreadedJumps;  // jumps that landed on an unconditional jump, and now go straight to its target
+} PeepholeStatistics;
+
+// Replace common sequences of op-codes with single 'super-instructions', and shorten chains of jumps.
+// All jump distances are recalculated. Only use on a complete program, as jumps out of a fragment can't be followed.
+void TCW_Optimise(TagCodeCache* tcc);
+// Read the counts from the last `TCW_Optimise` of this cache
+PeepholeStatistics TCW_OptimiseStatistics(TagCodeCache* tcc);
+
+
 #endif
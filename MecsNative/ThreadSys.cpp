@@ -0,0 +1,118 @@
+#include "ThreadSys.h"
+#include "MemoryManager.h"
+
+// Most threads we will start for one batch
+#define MAX_BATCH_THREADS 32
+
+// Shared state of a running batch
+typedef struct ThreadBatch {
+    ThreadWorkFunc work;
+    void* data;
+    int count;
+    volatile int next; // next index to be started. Only changed with an atomic add.
+} ThreadBatch;
+
+int NextBatchIndex(ThreadBatch* batch); // defined per platform
+
+// Take items from the batch until there are none left
+void RunBatchItems(ThreadBatch* batch) {
+    int index;
+    while ((index = NextBatchIndex(batch)) < batch->count) {
+        batch->work(batch->data, index);
+    }
+}
+
+#ifdef WIN32
+
+#include <SDL.h>
+#include <SDL_thread.h>
+#include <SDL_atomic.h>
+
+int NextBatchIndex(ThreadBatch* batch) {
+    return SDL_AtomicAdd((SDL_atomic_t*)&batch->next, 1);
+}
+
+int WorkerThreadMain(void* data) {
+    StartManagedMemory(); // new threads have an empty memory stack
+    RunBatchItems((ThreadBatch*)data);
+    ShutdownManagedMemory();
+    return 0;
+}
+
+int ThreadCoreCount() {
+    int count = SDL_GetCPUCount();
+    return (count < 1) ? 1 : count;
+}
+
+void ThreadRunBatch(ThreadWorkFunc work, void* data, int count, int threadLimit) {
+    if (work == NULL || count < 1) return;
+
+    auto batch = ThreadBatch{ work, data, count, 0 };
+
+    // The calling thread takes a share, so start one fewer
+    int extra = threadLimit - 1;
+    if (extra > count - 1) extra = count - 1;
+    if (extra > MAX_BATCH_THREADS) extra = MAX_BATCH_THREADS;
+
+    SDL_Thread* threads[MAX_BATCH_THREADS];
+    int started = 0;
+    for (int i = 0; i < extra; i++) {
+        threads[started] = SDL_CreateThread(WorkerThreadMain, "MECS worker", &batch);
+        if (threads[started] != NULL) started++; // if we can't start a thread, the others pick up the slack
+    }
+
+    RunBatchItems(&batch);
+
+    for (int i = 0; i < started; i++) {
+        SDL_WaitThread(threads[i], NULL);
+    }
+}
+
+#endif
+
+// The Raspberry Pi build runs on Linux too, so it shares the pthread version
+#if defined(HEADLESS) || defined(RASPI)
+
+#include <pthread.h>
+#include <unistd.h>
+
+int NextBatchIndex(ThreadBatch* batch) {
+    return __atomic_fetch_add(&batch->next, 1, __ATOMIC_SEQ_CST);
+}
+
+void* WorkerThreadMain(void* data) {
+    StartManagedMemory(); // new threads have an empty memory stack
+    RunBatchItems((ThreadBatch*)data);
+    ShutdownManagedMemory();
+    return NULL;
+}
+
+int ThreadCoreCount() {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return (count < 1) ? 1 : (int)count;
+}
+
+void ThreadRunBatch(ThreadWorkFunc work, void* data, int count, int threadLimit) {
+    if (work == NULL || count < 1) return;
+
+    auto batch = ThreadBatch{ work, data, count, 0 };
+
+    // The calling thread takes a share, so start one fewer
+    int extra = threadLimit - 1;
+    if (extra > count - 1) extra = count - 1;
+    if (extra > MAX_BATCH_THREADS) extra = MAX_BATCH_THREADS;
+
+    pthread_t threads[MAX_BATCH_THREADS];
+    int started = 0;
+    for (int i = 0; i < extra; i++) {
+        if (pthread_create(&threads[started], NULL, WorkerThreadMain, &batch) == 0) started++; // if we can't start a thread, the others pick up the slack
+    }
+
+    RunBatchItems(&batch);
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+#endif
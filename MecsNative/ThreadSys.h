@@ -0,0 +1,24 @@
+#pragma once
+
+#ifndef threadsys_h
+#define threadsys_h
+
+/*
+    Runs batches of independent work across processor cores.
+
+    Each worker thread has its own memory manager stack, which starts empty.
+    Work items must not share arenas, or any other writable data, with each other
+    or with the calling thread while the batch is running.
+*/
+
+// A single item of work. `index` is from 0 to the batch count - 1
+typedef void (*ThreadWorkFunc)(void* data, int index);
+
+// Number of processor cores available (at least 1)
+int ThreadCoreCount();
+
+// Run `work` once for each index from 0 to `count`-1, spread over at most `threadLimit` threads (including the caller's).
+// Returns when every item is finished. Items are started in index order, but can finish in any order.
+void ThreadRunBatch(ThreadWorkFunc work, void* data, int count, int threadLimit);
+
+#endif
@@ -0,0 +1,230 @@
+#include "TimerWheel.h"
+#include "MemoryManager.h"
+
+// Each level has 64 slots, so 4 levels cover 2^24 ticks (about 4.6 hours of milliseconds).
+// Timers further out wait in the top level slot that comes round last, and are placed again from there.
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 4
+#define WHEEL_RANGE (1ull << (WHEEL_BITS * WHEEL_LEVELS))
+
+#define NO_TIMER -1
+
+typedef struct TimerEntry {
+    uint64_t due;   // tick the timer fires on
+    int owner;      // caller's value, given back when the timer fires
+    int slot;       // index in `slots` of the list holding this timer, or NO_TIMER if the entry is free
+    int next;       // next entry in the same slot, or in the free list
+    int prev;       // previous entry in the same slot
+} TimerEntry;
+
+RegisterVectorStatics(Vec)
+RegisterVectorFor(TimerEntry, Vec)
+RegisterVectorFor(int, Vec)
+
+typedef struct TimerWheel {
+    // Vector<TimerEntry>. Entries are reused through `freeList`, and their index is the timer handle.
+    Vector* entries;
+    int freeList;
+
+    // First entry of the list in each slot, or NO_TIMER. Level `n` is slots `n*WHEEL_SLOTS` to `(n+1)*WHEEL_SLOTS - 1`.
+    int slots[WHEEL_LEVELS * WHEEL_SLOTS];
+    // Number of timers in each level
+    int levelCounts[WHEEL_LEVELS];
+    // Number of timers in all levels
+    int count;
+
+    // Current tick
+    uint64_t now;
+
+    Arena* memory;
+} TimerWheel;
+
+
+TimerWheel* TimerWheelAllocate(ArenaPtr arena, uint64_t now) {
+    if (arena == NULL) return NULL;
+
+    auto wheel = (TimerWheel*)ArenaAllocateAndClear(arena, sizeof(TimerWheel));
+    if (wheel == NULL) return NULL;
+
+    wheel->entries = VecAllocateArena_TimerEntry(arena);
+    if (wheel->entries == NULL) {
+        ArenaDereference(arena, wheel);
+        return NULL;
+    }
+
+    wheel->memory = arena;
+    wheel->now = now;
+    wheel->freeList = NO_TIMER;
+    for (int i = 0; i < WHEEL_LEVELS * WHEEL_SLOTS; i++) { wheel->slots[i] = NO_TIMER; }
+    return wheel;
+}
+
+void TimerWheelDeallocate(TimerWheel* wheel) {
+    if (wheel == NULL) return;
+    VecDeallocate(wheel->entries);
+    ArenaDereference(wheel->memory, wheel);
+}
+
+// Link a timer into the slot that covers its due time.
+// While moving timers down, the current tick's slot is about to fire, so timers due now go there. Otherwise they go in the next tick's.
+void PlaceTimer(TimerWheel* wheel, int index, bool movingDown) {
+    auto entry = VecGet_TimerEntry(wheel->entries, index);
+    uint64_t earliest = movingDown ? wheel->now : wheel->now + 1;
+    uint64_t due = (entry->due > earliest) ? entry->due : earliest;
+    uint64_t delta = due - wheel->now;
+
+    if (delta >= WHEEL_RANGE) {
+        due = wheel->now + WHEEL_RANGE - 1;
+        delta = WHEEL_RANGE - 1;
+    }
+
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= (1ull << (WHEEL_BITS * (level + 1)))) level++;
+
+    int slot = level * WHEEL_SLOTS + (int)((due >> (WHEEL_BITS * level)) & WHEEL_MASK);
+    entry->slot = slot;
+    entry->prev = NO_TIMER;
+    entry->next = wheel->slots[slot];
+    if (entry->next != NO_TIMER) VecGet_TimerEntry(wheel->entries, entry->next)->prev = index;
+    wheel->slots[slot] = index;
+    wheel->levelCounts[level]++;
+}
+
+// Put an unlinked entry on the free list
+void FreeTimer(TimerWheel* wheel, int index) {
+    auto entry = VecGet_TimerEntry(wheel->entries, index);
+    entry->slot = NO_TIMER;
+    entry->next = wheel->freeList;
+    wheel->freeList = index;
+    wheel->count--;
+}
+
+int TimerWheelAdd(TimerWheel* wheel, uint64_t due, int owner) {
+    if (wheel == NULL) return NO_TIMER;
+
+    int index = wheel->freeList;
+    if (index != NO_TIMER) {
+        wheel->freeList = VecGet_TimerEntry(wheel->entries, index)->next;
+    } else {
+        index = VecLength(wheel->entries);
+        if (!VecPush_TimerEntry(wheel->entries, TimerEntry{})) return NO_TIMER;
+    }
+
+    auto entry = VecGet_TimerEntry(wheel->entries, index);
+    entry->due = due;
+    entry->owner = owner;
+    PlaceTimer(wheel, index, false);
+    wheel->count++;
+    return index;
+}
+
+bool TimerWheelCancel(TimerWheel* wheel, int handle) {
+    if (wheel == NULL || handle < 0 || handle >= (int)VecLength(wheel->entries)) return false;
+
+    auto entry = VecGet_TimerEntry(wheel->entries, handle);
+    if (entry->slot == NO_TIMER) return false;
+
+    if (entry->prev != NO_TIMER) VecGet_TimerEntry(wheel->entries, entry->prev)->next = entry->next;
+    else wheel->slots[entry->slot] = entry->next;
+    if (entry->next != NO_TIMER) VecGet_TimerEntry(wheel->entries, entry->next)->prev = entry->prev;
+
+    wheel->levelCounts[entry->slot / WHEEL_SLOTS]--;
+    FreeTimer(wheel, handle);
+    return true;
+}
+
+// Take all the timers out of a higher level slot, and place them again in the levels below
+void MoveSlotDown(TimerWheel* wheel, int slot) {
+    int index = wheel->slots[slot];
+    wheel->slots[slot] = NO_TIMER;
+    while (index != NO_TIMER) {
+        int next = VecGet_TimerEntry(wheel->entries, index)->next;
+        wheel->levelCounts[slot / WHEEL_SLOTS]--;
+        PlaceTimer(wheel, index, true);
+        index = next;
+    }
+}
+
+// Fire all the timers in the current tick's slot
+int FireSlot(TimerWheel* wheel, int slot, Vector* firedOwners) {
+    int fired = 0;
+    int index = wheel->slots[slot];
+    wheel->slots[slot] = NO_TIMER;
+    while (index != NO_TIMER) {
+        auto entry = VecGet_TimerEntry(wheel->entries, index);
+        int next = entry->next;
+        wheel->levelCounts[0]--;
+
+        if (firedOwners != NULL) VecPush_int(firedOwners, entry->owner);
+        FreeTimer(wheel, index);
+        fired++;
+
+        index = next;
+    }
+    return fired;
+}
+
+int TimerWheelAdvance(TimerWheel* wheel, uint64_t now, Vector* firedOwners) {
+    if (wheel == NULL) return 0;
+
+    int fired = 0;
+    while (wheel->now < now) {
+        if (wheel->count == 0) {
+            wheel->now = now;
+            break;
+        }
+
+        // If the lowest levels are empty, nothing can happen until the next turn of the lowest level with timers
+        int level = 0;
+        while (wheel->levelCounts[level] == 0) level++;
+        if (level > 0) {
+            uint64_t lastBeforeTurn = wheel->now | ((1ull << (WHEEL_BITS * level)) - 1);
+            if (lastBeforeTurn >= now) {
+                wheel->now = now;
+                break;
+            }
+            wheel->now = lastBeforeTurn;
+        }
+
+        wheel->now++;
+        uint64_t tick = wheel->now;
+
+        // Each level starting a new turn moves the timers from its next slot down
+        for (int l = 1; l < WHEEL_LEVELS; l++) {
+            if ((tick & ((1ull << (WHEEL_BITS * l)) - 1)) != 0) break;
+            MoveSlotDown(wheel, l * WHEEL_SLOTS + (int)((tick >> (WHEEL_BITS * l)) & WHEEL_MASK));
+        }
+
+        fired += FireSlot(wheel, (int)(tick & WHEEL_MASK), firedOwners);
+    }
+    return fired;
+}
+
+int64_t TimerWheelNextDue(TimerWheel* wheel) {
+    if (wheel == NULL || wheel->count == 0) return -1;
+
+    // The next time a higher level moves timers down. Those might be due straight away.
+    int64_t result = -1;
+    for (int level = 1; level < WHEEL_LEVELS; level++) {
+        if (wheel->levelCounts[level] == 0) continue;
+        uint64_t span = 1ull << (WHEEL_BITS * level);
+        result = (int64_t)(span - (wheel->now & (span - 1)));
+        break;
+    }
+
+    // Timers in the lowest level fire on the tick of their slot
+    if (wheel->levelCounts[0] > 0) {
+        for (int i = 1; i <= WHEEL_SLOTS; i++) {
+            if (result >= 0 && i >= result) break;
+            if (wheel->slots[(wheel->now + i) & WHEEL_MASK] != NO_TIMER) return i;
+        }
+    }
+    return result;
+}
+
+int TimerWheelCount(TimerWheel* wheel) {
+    if (wheel == NULL) return 0;
+    return wheel->count;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#ifndef timerwheel_h
+#define timerwheel_h
+
+#include "ArenaAllocator.h"
+#include "Vector.h"
+
+#include <stdint.h>
+
+/*
+    Hierarchical timer wheel.
+
+    Timers are placed in rings of slots, one ring per level. Each slot of the lowest level is one tick,
+    and each slot of a higher level covers a whole turn of the level below. Adding and cancelling a timer
+    is O(1). As time moves on, timers in a higher level slot are moved down (at most once per level),
+    and timers in the current lowest level slot fire.
+
+    Ticks are whatever unit the caller advances by. The scheduler uses milliseconds.
+*/
+
+typedef struct TimerWheel TimerWheel;
+typedef TimerWheel* TimerWheelPtr;
+
+// Allocate a timer wheel in an arena, with its current time set to `now` ticks
+TimerWheel* TimerWheelAllocate(ArenaPtr arena, uint64_t now);
+// Deallocate a timer wheel and all its timers
+void TimerWheelDeallocate(TimerWheel* wheel);
+
+// Add a timer that fires at tick `due`. A time that has passed fires on the next tick.
+// `owner` is given back when the timer fires.
+// Returns a handle for cancelling, or -1 if out of memory. The handle is only valid until the timer fires or is cancelled.
+int TimerWheelAdd(TimerWheel* wheel, uint64_t due, int owner);
+// Remove a timer before it fires. Returns false if the handle was not a waiting timer.
+bool TimerWheelCancel(TimerWheel* wheel, int handle);
+
+// Move the current time forward to `now` ticks, pushing the owner of each timer that fires to `firedOwners` (Vector<int>).
+// Timers fire in order of tick, but timers due on the same tick fire in no particular order.
+// Returns the number of timers that fired.
+int TimerWheelAdvance(TimerWheel* wheel, uint64_t now, Vector* firedOwners);
+
+// Number of ticks until the wheel next needs to be advanced, or -1 if there are no timers.
+// This may be before any timer is due (when timers have to move down a level), but is never after.
+int64_t TimerWheelNextDue(TimerWheel* wheel);
+
+// Number of timers waiting
+int TimerWheelCount(TimerWheel* wheel);
+
+#endif
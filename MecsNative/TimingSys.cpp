@@ -4,6 +4,8 @@
 #ifdef WIN32
 
 #include <time.h>
+#include <windows.h>
+#include <SDL.h>
 
 uint64_t SystemTime() {
     time_t rawtime;
@@ -12,13 +14,67 @@ uint64_t SystemTime() {
     return rawtime;
 }
 
+uint64_t MonotonicNanoseconds() {
+    static uint64_t frequency = SDL_GetPerformanceFrequency();
+    uint64_t counter = SDL_GetPerformanceCounter();
+
+    // split the division so the multiply can't overflow
+    return (counter / frequency) * 1000000000ull + ((counter % frequency) * 1000000000ull) / frequency;
+}
+
+uint64_t ThreadCpuNanoseconds() {
+    FILETIME created, exited, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user)) return 0;
+
+    // file times are in 100ns units
+    uint64_t k = ((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime;
+    uint64_t u = ((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime;
+    return (k + u) * 100;
+}
+
+#endif
+
+#ifdef HEADLESS
+
+#include <time.h>
+
+uint64_t SystemTime() {
+    return (uint64_t)time(NULL);
+}
+
+uint64_t MonotonicNanoseconds() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+uint64_t ThreadCpuNanoseconds() {
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
 #endif
 
 #ifdef RASPI
 
+#include <time.h>
+
 uint64_t SystemTime() {
     // TODO !
     return uint64_t();
 }
 
+uint64_t MonotonicNanoseconds() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+uint64_t ThreadCpuNanoseconds() {
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
 #endif
\ No newline at end of file
@@ -5,6 +5,13 @@
 
 #include <stdint.h>
 
+// Wall-clock time, in seconds
 uint64_t SystemTime();
 
-#endif
\ No newline at end of file
+// Monotonic clock, in nanoseconds from an arbitrary start. Never goes backward, so use this to measure intervals.
+uint64_t MonotonicNanoseconds();
+
+// Processor time used by the calling thread, in nanoseconds. Only differences between readings are meaningful.
+uint64_t ThreadCpuNanoseconds();
+
+#endif
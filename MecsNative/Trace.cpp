@@ -0,0 +1,168 @@
+#include "Trace.h"
+#include "TimingSys.h"
+#include "FileSys.h"
+#include "MemoryManager.h"
+
+#include <stdlib.h>
+#include <atomic>
+
+// Most rings that can exist at once. Rings are reused when their thread ends, so this limits concurrent threads.
+#define TRACE_MAX_RINGS 64
+
+typedef struct TraceEvent {
+    uint64_t time;    // monotonic nanoseconds
+    const char* name; // static string
+    int32_t value;
+    uint32_t id;
+    uint8_t category; // bit index of the category
+    char phase;
+} TraceEvent;
+
+// Ring buffer written by one thread at a time, and read by `TraceWriteChromeJson`
+typedef struct TraceRing {
+    std::atomic<uint32_t> head; // count of events ever written. Only changed by the owning thread.
+    uint32_t tail;              // count of events already gathered. Only changed by the reader.
+    std::atomic<int> owned;     // non-zero while a thread is writing to this ring
+    int number;                 // shown as the thread id
+    TraceEvent events[TRACE_RING_SIZE];
+} TraceRing;
+
+volatile uint32_t TraceActive = 0;
+
+static TraceRing* Rings[TRACE_MAX_RINGS];
+static std::atomic<int> RingCount(0);
+static uint64_t TraceStartTime = 0;
+
+// Gives the ring up when the thread ends, so another thread can take it over
+typedef struct ThreadRingHandle {
+    TraceRing* ring;
+    ~ThreadRingHandle() { if (ring != NULL) ring->owned.store(0); }
+} ThreadRingHandle;
+
+static thread_local ThreadRingHandle ThreadRing = { NULL };
+
+// Find a ring no thread owns, or make a new one. Returns NULL if all rings are in use.
+TraceRing* ClaimRing() {
+    int count = RingCount.load();
+    for (int i = 0; i < count; i++) {
+        auto ring = Rings[i];
+        if (ring == NULL) continue;
+        int expected = 0;
+        if (ring->owned.compare_exchange_strong(expected, 1)) return ring;
+    }
+
+    // Rings are not held in an arena: they outlive the arena stack of their thread, and arena tracing writes into them
+    auto ring = (TraceRing*)calloc(1, sizeof(TraceRing));
+    if (ring == NULL) return NULL;
+    ring->owned.store(1);
+
+    int slot = RingCount.fetch_add(1);
+    if (slot >= TRACE_MAX_RINGS) {
+        RingCount.fetch_sub(1);
+        free(ring);
+        return NULL;
+    }
+    ring->number = slot;
+    Rings[slot] = ring;
+    return ring;
+}
+
+int CategoryIndex(uint32_t category) {
+    int index = 0;
+    while (category > 1) { category >>= 1; index++; }
+    return index;
+}
+
+const char* CategoryName(int index) {
+    switch (index) {
+    case 0: return "alloc";
+    case 1: return "free";
+    case 2: return "scope";
+    case 3: return "ipc";
+    case 4: return "slice";
+    case 5: return "gc";
+    default: return "other";
+    }
+}
+
+void TraceRecord(uint32_t category, char phase, const char* name, int32_t value, uint32_t id) {
+    auto ring = ThreadRing.ring;
+    if (ring == NULL) {
+        ring = ClaimRing();
+        if (ring == NULL) return;
+        ThreadRing.ring = ring;
+    }
+
+    uint32_t head = ring->head.load(std::memory_order_relaxed);
+    auto evt = &ring->events[head % TRACE_RING_SIZE];
+    evt->time = MonotonicNanoseconds();
+    evt->name = name;
+    evt->value = value;
+    evt->id = id;
+    evt->category = (uint8_t)CategoryIndex(category);
+    evt->phase = phase;
+    ring->head.store(head + 1, std::memory_order_release); // publish the event to the reader
+}
+
+void TraceEnable(uint32_t categories) {
+    if (TraceActive == 0 && categories != 0) TraceStartTime = MonotonicNanoseconds();
+    TraceActive = categories & TRACE_COMPILED;
+}
+
+// Microseconds since tracing started, as Chrome expects
+void AppendTraceTime(String* target, uint64_t time) {
+    uint64_t offset = (time > TraceStartTime) ? time - TraceStartTime : 0;
+    StringAppendInt32(target, (int32_t)(offset / 1000));
+    StringAppendChar(target, '.');
+    int fraction = (int)(offset % 1000);
+    if (fraction < 100) StringAppendChar(target, '0');
+    if (fraction < 10) StringAppendChar(target, '0');
+    StringAppendInt32(target, fraction);
+}
+
+bool TraceWriteChromeJson(String* target) {
+    if (target == NULL) return false;
+
+    StringAppend(target, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    bool first = true;
+
+    int count = RingCount.load();
+    for (int r = 0; r < count; r++) {
+        auto ring = Rings[r];
+        if (ring == NULL) continue;
+
+        uint32_t head = ring->head.load(std::memory_order_acquire);
+        uint32_t start = ring->tail;
+        if (head - start > TRACE_RING_SIZE) start = head - TRACE_RING_SIZE; // older events were overwritten
+
+        for (uint32_t i = start; i != head; i++) {
+            auto evt = &ring->events[i % TRACE_RING_SIZE];
+
+            if (!first) StringAppendChar(target, ',');
+            first = false;
+
+            StringAppendFormat(target, "\n{\"name\":\"\x05\",\"cat\":\"\x05\",\"ph\":\"", evt->name, CategoryName(evt->category));
+            StringAppendChar(target, evt->phase);
+            StringAppend(target, (evt->phase == 'i') ? "\",\"s\":\"t\",\"ts\":" : "\",\"ts\":");
+            AppendTraceTime(target, evt->time);
+            StringAppendFormat(target, ",\"pid\":1,\"tid\":\x02,\"args\":{\"value\":", ring->number);
+            StringAppendInt32(target, evt->value);
+            StringAppendFormat(target, ",\"id\":\x02}}", (int)evt->id);
+        }
+        ring->tail = head;
+    }
+
+    StringAppend(target, "\n]}\n");
+    return true;
+}
+
+bool TraceFlushToFile(String* path) {
+    if (path == NULL) return false;
+
+    MMPush(64 MEGABYTES); // every ring full is around 2MB of JSON per thread
+    auto json = StringEmpty();
+    bool ok = TraceWriteChromeJson(json) && FileWriteAll(path, StringGetByteVector(json));
+    MMPop();
+
+    return ok;
+}
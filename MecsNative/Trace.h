@@ -0,0 +1,69 @@
+#pragma once
+
+#ifndef trace_h
+#define trace_h
+
+#include <stdint.h>
+#include "String.h"
+
+/*
+    Low-overhead event tracing.
+
+    Each thread records binary events into its own ring buffer, without locks.
+    When a ring is full, its oldest events are overwritten.
+    `TraceWriteChromeJson` gathers the events of every thread into Chrome trace JSON,
+    for chrome://tracing or Perfetto.
+
+    Events are grouped into categories. A category is only built in if it is in `TRACE_COMPILED`.
+    Trace points for a category that is not built in compile to nothing.
+    Built-in categories are switched on and off at run time with `TraceEnable`.
+*/
+
+// Event categories
+#define TRACE_ALLOC  0x01 // arena allocations (only arenas marked with `TraceArena`)
+#define TRACE_FREE   0x02 // arena dereferences (only arenas marked with `TraceArena`)
+#define TRACE_SCOPE  0x04 // interpreter scopes pushed and dropped
+#define TRACE_IPC    0x08 // IPC messages sent, received and loaded
+#define TRACE_SLICE  0x10 // scheduler time slices
+#define TRACE_GC     0x20 // memory reclaimed in bulk (arenas dropped)
+
+#define TRACE_ALL    0x3F
+
+// Categories to build in. Allocation and free are left out by default, to keep branches out of the allocator.
+#ifndef TRACE_COMPILED
+#define TRACE_COMPILED (TRACE_SCOPE | TRACE_IPC | TRACE_SLICE | TRACE_GC)
+#endif
+
+// Number of events each thread's ring holds
+#define TRACE_RING_SIZE 16384
+
+// Categories switched on at run time. Change with `TraceEnable`.
+extern volatile uint32_t TraceActive;
+
+// Add an event to the calling thread's ring. Use the macros below rather than calling this directly.
+// `name` must be a static string. `phase` is a Chrome trace phase: 'i' instant, 'B' begin, 'E' end.
+void TraceRecord(uint32_t category, char phase, const char* name, int32_t value, uint32_t id);
+
+// Record an instant event. `value` and `id` are shown as the event's arguments.
+#define TRACE_EVENT(category, name, value, id) \
+    do { if ((TRACE_COMPILED & (category)) && (TraceActive & (category))) TraceRecord((category), 'i', (name), (value), (id)); } while (0)
+// Record the start of a span. Spans on one thread must nest.
+#define TRACE_BEGIN(category, name, id) \
+    do { if ((TRACE_COMPILED & (category)) && (TraceActive & (category))) TraceRecord((category), 'B', (name), 0, (id)); } while (0)
+// Record the end of the span most recently begun on this thread
+#define TRACE_END(category, name, id) \
+    do { if ((TRACE_COMPILED & (category)) && (TraceActive & (category))) TraceRecord((category), 'E', (name), 0, (id)); } while (0)
+
+// Switch on a set of categories, and switch off all others. Pass 0 to stop tracing.
+// Only categories in `TRACE_COMPILED` will record anything.
+void TraceEnable(uint32_t categories);
+
+// Append the buffered events of all threads to `target` as Chrome trace JSON, then empty the buffers.
+// Threads are shown by ring number rather than OS thread. Call while traced threads are quiet:
+// events written during the gather may be missed. Returns false if nothing could be written.
+bool TraceWriteChromeJson(String* target);
+
+// Write the buffered events of all threads to a file as Chrome trace JSON, then empty the buffers
+bool TraceFlushToFile(String* path);
+
+#endif
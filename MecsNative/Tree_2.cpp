@@ -16,6 +16,9 @@ typedef struct DRelation {
 	// Index of next sibling in chain, or negative if end
 	int NextSibling;
 
+	// Index of the last child, if known. Negative if leaf or not known. Saves walking the chain when appending.
+	int LastChild;
+
 	// Index into `Data` vector for the data at this node, or negative if empty.
 	int DataIndex;
 } DRelation;
@@ -57,6 +60,7 @@ DTreePtr DTreeAllocate(ArenaPtr arena, int dataElementSize) {
 	crel.ParentId = INVALID;
 	crel.NextSibling = INVALID;
 	crel.ChildId = INVALID;
+	crel.LastChild = INVALID;
 
 	VectorPush_DRelation(result->Relations, crel);
 	result->RootIndex = VectorLength(result->Relations) - 1;
@@ -77,6 +81,7 @@ void DTreeClear(DTreePtr tree) {
 	crel.ParentId = INVALID;
 	crel.NextSibling = INVALID;
 	crel.ChildId = INVALID;
+	crel.LastChild = INVALID;
 
 	VectorPush_DRelation(tree->Relations, crel);
 	tree->RootIndex = VectorLength(tree->Relations) - 1;
@@ -153,6 +158,7 @@ DRelation* InsertNode(DTreePtr tree, int parentId, void* element, int* childIdx)
 	crel.ParentId = parentId;
 	crel.NextSibling = INVALID;
 	crel.ChildId = INVALID;
+	crel.LastChild = INVALID;
 
 	VectorPush_DRelation(tree->Relations, crel);
 	*childIdx = VectorLength(tree->Relations) - 1;
@@ -205,13 +211,20 @@ int DTreeAddChild(DTreePtr tree, int parentId, void* element) {
 	auto prel = VectorGet_DRelation(tree->Relations, parentId);
 	if (prel->ChildId < 0) {
 		prel->ChildId = childIdx;
+		prel->LastChild = childIdx;
 		return childIdx;
 	}
 
-	// Case 2: need to walk sibling chain
-	int sibIdx = DTreeEndOfSiblingChain(tree, prel->ChildId);
-	auto srel = VectorGet_DRelation(tree->Relations, sibIdx);
+	// Case 2: add to end of sibling chain. Only walk it if we don't know where it ends
+	DRelation* srel = NULL;
+	if (prel->LastChild >= 0) {
+		srel = VectorGet_DRelation(tree->Relations, prel->LastChild);
+		if (srel->NextSibling >= 0) srel = NULL; // out of date
+	}
+	if (srel == NULL) srel = VectorGet_DRelation(tree->Relations, DTreeEndOfSiblingChain(tree, prel->ChildId));
+
 	srel->NextSibling = childIdx;
+	prel->LastChild = childIdx;
 	return childIdx;
 }
 
@@ -228,7 +241,7 @@ int DTreeAddSibling(DTreePtr tree, int nodeId, void* element) {
 	int childIdx = INVALID;
 	DRelation* rel =  InsertNode(tree, parentId, element, &childIdx);
 
-	// walk sibling chain and bind
+	// walk sibling chain and bind. The parent's `LastChild` is now out of date, which `DTreeAddChild` checks for.
 	int sibIdx = DTreeEndOfSiblingChain(tree, nodeId);
 	auto srel = VectorGet_DRelation(tree->Relations, sibIdx);
 	srel->NextSibling = childIdx;
@@ -325,6 +338,7 @@ int DTreeInsertChild(DTreePtr tree, int parentId, int targetIndex, void* element
 	auto prel = VectorGet_DRelation(tree->Relations, parentId);
 	if (prel->ChildId < 0) {
 		prel->ChildId = childIdx;
+		prel->LastChild = childIdx;
 		return childIdx;
 	}
 
@@ -353,6 +367,7 @@ int DTreeInsertChild(DTreePtr tree, int parentId, int targetIndex, void* element
 	// found link, insert child
 	nrel->NextSibling = srel->NextSibling;
 	srel->NextSibling = childIdx;
+	if (nrel->NextSibling < 0) prel->LastChild = childIdx;
 
 	return childIdx;
 }
@@ -365,6 +380,7 @@ void DTreeRemoveChild(DTreePtr tree, int parentId, int targetIndex) {
 
 	// Case 1: no existing child
 	if (prel->ChildId < 0) { return; }
+	prel->LastChild = INVALID; // might be the one we remove
 	
 	// Case 2: existing child and index is zero (remove 1st child)
 	if (targetIndex == 0) {
@@ -402,6 +418,7 @@ int DTreeRemoveChildById(DTreePtr tree, int parentId, int targetId) {
 
 	// Case 1: no existing child
 	if (prel->ChildId < 0) { return -1; }
+	prel->LastChild = INVALID; // might be the one we remove
 	
 	// Case 2: existing child and index is zero (remove 1st child)
 	if (prel->ChildId == targetId) {
@@ -448,6 +465,10 @@ int DTreePivot(DTreePtr tree, int nodeId) {
 	auto frel = VectorGet_DRelation(tree->Relations, pivotIndex);
 	if (frel->NextSibling < 0) return pivotIndex;
 
+	// The chains of both nodes change
+	prel->LastChild = pivotIndex;
+	frel->LastChild = INVALID;
+
 	// Case 3: Pivot with siblings but no children
 	if (frel->ChildId < 0) {
 		frel->ChildId = frel->NextSibling;
@@ -475,7 +496,9 @@ int DTreeInjectNode(DTreePtr tree, int parentId, void* element) {
 	auto prel = VectorGet_DRelation(tree->Relations, parentId);
 
 	newRel->ChildId = prel->ChildId;
+	newRel->LastChild = prel->LastChild;
 	prel->ChildId = childIdx;
+	prel->LastChild = childIdx;
 
 	return childIdx;
 }
@@ -526,6 +549,7 @@ static int NewBlankNode(DTreePtr tree, int parentId) {
 	crel.ParentId = parentId;
 	crel.NextSibling = INVALID;
 	crel.ChildId = INVALID;
+	crel.LastChild = INVALID;
 
 	VectorPush_DRelation(tree->Relations, crel);
 	return VectorLength(tree->Relations) - 1;
@@ -607,5 +631,5 @@ int DTreeAppendSubtree(DTreePtr dst, int dstParentId, DTreePtr src, int srcRootI
 	if (dstNode < 0) return INVALID;
 
 	auto ok = CopyRecursive(src, dst, srcRootId, dstNode, true);
-
+	return ok ? dstNode : INVALID;
 }
@@ -29,6 +29,11 @@ typedef struct Vector {
     bool _skipTableDirty;           // does the skip table need updating?
     bool _rebuilding;               // are we in the middle of rebuilding the skip table?
 
+    // Contiguous mode: all elements in `_flatData`, starting at `_baseOffset`
+    bool _contiguous;               // if true, the chunk chain is not used
+    unsigned int _flatCapacity;     // number of elements `_flatData` can hold
+    char* _flatData;                // single block of element data
+
     // Pointers to data
     // Start of the chunk chain
     char* _baseChunkTable;
@@ -69,6 +74,22 @@ const int TARGET_ELEMS_PER_CHUNK = 128;
 // This limits the memory growth of larger arrays. If it's bigger than an arena, everything will fail.
 const long SKIP_TABLE_SIZE_LIMIT = 2048;
 
+// Initial number of elements in a contiguous vector. This doubles each time the vector fills.
+// Once the block would be bigger than an arena allocation, the vector switches to chunked mode.
+const int CONTIGUOUS_INITIAL_ELEMS = 16;
+
+/*
+ * Contiguous mode:
+ *
+ * [Element 0]                   <- `_flatData`
+ * . . .
+ * [Element N]                   <- `_flatCapacity` - 1
+ *
+ * Live elements run from `_baseOffset` to `_baseOffset` + `_elementCount` - 1.
+ * The block doubles when full, and the vector is promoted to chunks if the block
+ * would exceed `ARENA_SIZE`. Pointers from `VectorGet` are invalidated by a resize.
+ */
+
 /*
  * Structure of the element chunk:
  *
@@ -170,21 +191,27 @@ bool FindNearestChunk(Vector *v, int targetIndex, void **chunkPtr, unsigned int
     uint startChunkIdx = 0;
     void* chunkHeadPtr = v->_baseChunkTable;
 
+    uint stride = 1;
     if (v->_skipEntries > 1)
     {
-        // guess search bounds
-        int guess = ((targetChunkIdx - 1) * v->_skipEntries) / endChunkIdx;
-        int lower = guess - 1;
-        if (lower < 0) lower = 0;
+        // binary search for the last entry at or before the target
+        int lower = 0;
+        int upper = v->_skipEntries - 1;
+        while (lower < upper) {
+            int mid = (lower + upper + 1) >> 1;
+            if (readUint(byteOffset(v->_skipTable, SKIP_ELEM_SIZE * mid), 0) <= targetChunkIdx) lower = mid;
+            else upper = mid - 1;
+        }
 
         var baseAddr = byteOffset(v->_skipTable, (SKIP_ELEM_SIZE * lower)); // pointer to skip table entry
         startChunkIdx = readUint(baseAddr, 0);
         chunkHeadPtr = readPtr(baseAddr, INDEX_SIZE);
+        stride = readUint(byteOffset(v->_skipTable, SKIP_ELEM_SIZE), 0);
     }
 
     var walk = targetChunkIdx - startChunkIdx;
-    if (walk > 4 && v->_skipEntries < SKIP_TABLE_SIZE_LIMIT) {
-        v->_skipTableDirty = true; // if we are walking too far, try builing a better table
+    if (walk > 4 && (v->_skipEntries < SKIP_TABLE_SIZE_LIMIT || walk > 2 * stride)) {
+        v->_skipTableDirty = true; // if we are walking too far (or the vector has grown past a full table), try builing a better table
     }
 
     // 4. Walk the chain until we find the chunk we want
@@ -207,7 +234,7 @@ inline void RebuildSkipTable(Vector *v)
 {
     v->_rebuilding = true;
     v->_skipTableDirty = false;
-    auto chunkTotal = v->_elementCount >> v->ElemChunkLog2;
+    auto chunkTotal = (v->_elementCount + v->_baseOffset) >> v->ElemChunkLog2;
     if (chunkTotal < 4) { // not worth having a skip table
         if (v->_skipTable != NULL) VecFree(v, v->_skipTable);
         v->_skipEntries = 0;
@@ -216,38 +243,33 @@ inline void RebuildSkipTable(Vector *v)
         return;
     }
 
-    // Guess a reasonable size for the skip table
-    auto entries = (chunkTotal < SKIP_TABLE_SIZE_LIMIT) ? chunkTotal : SKIP_TABLE_SIZE_LIMIT;
+    // General case: not every chunk will fit in the skip table, so take every `stride`th chunk.
+    // The table is filled with one walk down the chain.
+    uint stride = (chunkTotal + SKIP_TABLE_SIZE_LIMIT - 1) / SKIP_TABLE_SIZE_LIMIT;
+    if (stride < 1) stride = 1;
+    uint entries = (chunkTotal + stride - 1) / stride;
 
-    // General case: not every chunk will fit in the skip table
-    // Find representative chunks using the existing table.
-    // (finding will be a combination of search and scan)
     auto newTablePtr = VecAlloc(v, SKIP_ELEM_SIZE * entries);
     if (newTablePtr == NULL) { v->_rebuilding = false; return; } // live with the old one
 
-    auto stride = v->_elementCount / entries;
-    if (stride < 1) stride = 1;
-
-    long target = 0;
     auto newSkipEntries = 0;
-    bool found;
-    void *chunkPtr;
-    unsigned int chunkIndex;
+    void *chunkPtr = v->_baseChunkTable;
+    uint chunkIndex = 0;
 
     for (uint i = 0; i < entries; i++) {
-        found = FindNearestChunk(v, target, &chunkPtr, &chunkIndex);
-
-        if (!found || chunkPtr == NULL) { // total fail
-            VecFree(v,newTablePtr);
-            v->_rebuilding = false;
-            return;
+        for (; chunkIndex < i * stride; chunkIndex++) {
+            chunkPtr = readPtr(chunkPtr, 0);
+            if (chunkPtr == NULL) { // total fail
+                VecFree(v, newTablePtr);
+                v->_rebuilding = false;
+                return;
+            }
         }
 
-        var iptr = byteOffset(newTablePtr, (SKIP_ELEM_SIZE * i)); // 443
+        var iptr = byteOffset(newTablePtr, (SKIP_ELEM_SIZE * i));
         writeUint(iptr, 0, chunkIndex);
-        writePtr(iptr, INDEX_SIZE, chunkPtr); // TODO: !!! This fails at large sizes!
+        writePtr(iptr, INDEX_SIZE, chunkPtr);
         newSkipEntries++;
-        target += stride;
     }
 
     if (newSkipEntries < 1) {
@@ -276,6 +298,10 @@ inline void * PtrOfElem(Vector *v, int index) {
     while (index < 0) { index += v->_elementCount; } // allow negative index syntax
     if (index >= v->_elementCount) return NULL;
 
+    if (v->_contiguous) {
+        return v->_flatData + (v->ElementByteSize * (index + v->_baseOffset));
+    }
+
     var entryIdx = (index + v->_baseOffset) % v->ElemsPerChunk;
 
 	/* */
@@ -306,8 +332,72 @@ uint32_t Log2(uint32_t i) {
     return r - 1;
 }
 
-// Create a new dynamic vector with the given element size (must be fixed per vector) in a specific memory arena
-Vector *VectorAllocateArena(Arena* a, int elementSize) {
+// Move a contiguous vector's elements into a chunk chain.
+// This is done when the vector outgrows a single arena allocation.
+bool PromoteToChunks(Vector *v) {
+    auto oldData = v->_flatData;
+    auto oldOffset = v->_baseOffset;
+    auto count = v->_elementCount;
+
+    v->_contiguous = false;
+    v->_flatData = NULL;
+    v->_flatCapacity = 0;
+    v->_elementCount = 0;
+    v->_baseOffset = 0;
+    v->_endChunkPtr = NULL;
+
+    auto baseTable = NewChunk(v);
+    if (baseTable == NULL) {
+        v->IsValid = false;
+        return false;
+    }
+    v->_baseChunkTable = (char*)baseTable;
+
+    if (count > 0 && !VectorPushMany(v, oldData + (v->ElementByteSize * oldOffset), count)) return false;
+
+    if (oldData != NULL) VecFree(v, oldData);
+    return true;
+}
+
+// Make sure a contiguous vector has room for at least `required` elements after `_baseOffset` is removed.
+// If that won't fit in one allocation, the vector is promoted to chunks -- check `_contiguous` after calling.
+// Returns false if allocation failed.
+bool ContiguousEnsureCapacity(Vector *v, uint required) {
+    auto size = v->ElementByteSize;
+    uint maxCapacity = ARENA_SIZE / size;
+    if (required > maxCapacity) {
+        return PromoteToChunks(v);
+    }
+
+    // If there is enough dead space at the front, shuffle down rather than growing
+    if (required <= v->_flatCapacity) {
+        if (v->_baseOffset > 0) {
+            auto dst = v->_flatData;
+            auto src = v->_flatData + (size * v->_baseOffset);
+            auto bytes = size * v->_elementCount;
+            for (uint i = 0; i < bytes; i++) { dst[i] = src[i]; }
+            v->_baseOffset = 0;
+        }
+        return true;
+    }
+
+    uint newCapacity = v->_flatCapacity;
+    while (newCapacity < required) newCapacity *= 2;
+    if (newCapacity > maxCapacity) newCapacity = maxCapacity;
+
+    auto newData = (char*)VecAlloc(v, newCapacity * size);
+    if (newData == NULL) return false;
+
+    writeValue(newData, 0, v->_flatData + (size * v->_baseOffset), size * v->_elementCount);
+    VecFree(v, v->_flatData);
+
+    v->_flatData = newData;
+    v->_flatCapacity = newCapacity;
+    v->_baseOffset = 0;
+    return true;
+}
+
+Vector *VectorAllocateInternal(Arena* a, int elementSize, bool contiguous) {
     if (a == NULL) return NULL;
     auto result = (Vector*)ArenaAllocateAndClear(a, sizeof(Vector));
     if (result == NULL) return NULL;
@@ -335,10 +425,25 @@ Vector *VectorAllocateArena(Arena* a, int elementSize) {
 
     // Make a table, which can store a few chunks, and can have a next-chunk-table pointer
     // Each chunk can hold a few elements.
-    result->_skipEntries = NULL;
+    result->_skipEntries = 0;
     result->_skipTable = NULL;
     result->_endChunkPtr = NULL;
     result->_baseChunkTable = NULL;
+    result->_elementCount = 0;
+    result->_baseOffset = 0;
+
+    // Contiguous vectors start with a small block, unless the elements are too big to make that worthwhile
+    if (contiguous && (CONTIGUOUS_INITIAL_ELEMS * elementSize) <= ARENA_SIZE) {
+        result->_flatData = (char*)VecAlloc(result, CONTIGUOUS_INITIAL_ELEMS * elementSize);
+        if (result->_flatData == NULL) {
+            result->IsValid = false;
+            return result;
+        }
+        result->_flatCapacity = CONTIGUOUS_INITIAL_ELEMS;
+        result->_contiguous = true;
+        result->IsValid = true;
+        return result;
+    }
 
     auto baseTable = NewChunk(result);
 
@@ -347,8 +452,6 @@ Vector *VectorAllocateArena(Arena* a, int elementSize) {
         return result;
     }
     result->_baseChunkTable = (char*)baseTable;
-    result->_elementCount = 0;
-    result->_baseOffset = 0;
     RebuildSkipTable(result);
 
     // All done
@@ -356,10 +459,57 @@ Vector *VectorAllocateArena(Arena* a, int elementSize) {
     return result;
 }
 
+// Create a new dynamic vector with the given element size (must be fixed per vector) in a specific memory arena
+Vector *VectorAllocateArena(Arena* a, int elementSize) {
+    return VectorAllocateInternal(a, elementSize, false);
+}
+
 Vector *VectorAllocate(int elementSize) {
     return VectorAllocateArena(MMCurrent(), elementSize);
 }
 
+Vector *VectorAllocateArenaContiguous(Arena* a, int elementSize) {
+    return VectorAllocateInternal(a, elementSize, true);
+}
+
+Vector *VectorAllocateContiguous(int elementSize) {
+    return VectorAllocateArenaContiguous(MMCurrent(), elementSize);
+}
+
+bool VectorIsContiguous(Vector *v) {
+    if (v == NULL) return false;
+    return v->_contiguous;
+}
+
+void* VectorContiguousData(Vector *v) {
+    if (v == NULL || !v->_contiguous) return NULL;
+    return v->_flatData + (v->ElementByteSize * v->_baseOffset);
+}
+
+void* VectorBlockAt(Vector *v, int index, int* outFirst, int* outCount) {
+    if (v == NULL || index < 0 || index >= (int)v->_elementCount) return NULL;
+
+    if (v->_contiguous) {
+        *outFirst = 0;
+        *outCount = v->_elementCount;
+        return v->_flatData + (v->ElementByteSize * v->_baseOffset);
+    }
+
+    // Find the element's chunk, then step back to the first live element in it
+    auto elem = (char*)PtrOfElem(v, index);
+    if (elem == NULL) return NULL;
+    int entryIdx = (index + v->_baseOffset) % v->ElemsPerChunk;
+    int first = index - entryIdx;
+    if (first < 0) { entryIdx += first; first = 0; } // start of first chunk has been dequeued
+
+    int last = first + (v->ElemsPerChunk - ((first + v->_baseOffset) % v->ElemsPerChunk));
+    if (last > (int)v->_elementCount) last = v->_elementCount;
+
+    *outFirst = first;
+    *outCount = last - first;
+    return elem - (v->ElementByteSize * entryIdx);
+}
+
 bool VectorIsValid(Vector *v) {
     if (v == NULL) return false;
     return v->IsValid;
@@ -373,6 +523,8 @@ void VectorClear(Vector *v) {
     v->_baseOffset = 0;
     v->_skipEntries = 0;
 
+    if (v->_contiguous) return; // keep the block for re-use
+
     // empty out the skip table, if present
     if (v->_skipTable != NULL) {
         VecFree(v, v->_skipTable);
@@ -397,6 +549,9 @@ void VectorDeallocate(Vector *v) {
     v->IsValid = false;
     if (v->_skipTable != NULL) VecFree(v, v->_skipTable);
     v->_skipTable = NULL;
+    if (v->_flatData != NULL) VecFree(v, v->_flatData);
+    v->_flatData = NULL;
+    v->_flatCapacity = 0;
     // Walk through the chunk chain, removing until we hit an invalid pointer
     var current = v->_baseChunkTable;
     while (true) {
@@ -419,13 +574,23 @@ void VectorDeallocate(Vector *v) {
 	ArenaDereference(a, v);
 }
 
-inline int VectorLength(Vector *v) {
+int VectorLength(Vector *v) {
     if (v == NULL) return 0;
     return v->_elementCount;
 }
 
 bool VectorPush(Vector *v, void* value) {
     if (v == NULL) return false;
+    if (v->_contiguous) {
+        if (v->_baseOffset + v->_elementCount >= v->_flatCapacity) {
+            if (!ContiguousEnsureCapacity(v, v->_elementCount + 1)) return false;
+        }
+        if (v->_contiguous) { // might have been promoted to chunks
+            writeValue(v->_flatData, v->ElementByteSize * (v->_baseOffset + v->_elementCount), value, v->ElementByteSize);
+            v->_elementCount++;
+            return true;
+        }
+    }
     var entryIdx = (v->_elementCount + v->_baseOffset) % v->ElemsPerChunk;
 
     void *chunkPtr = NULL;
@@ -454,6 +619,47 @@ void* VectorGet(Vector *v, int index) {
     return PtrOfElem(v, index);
 }
 
+bool VectorReserve(Vector *v, unsigned int length) {
+    if (v == NULL) return false;
+    if (!v->_contiguous) return true;
+    if (v->_baseOffset + length <= v->_flatCapacity) return true;
+    return ContiguousEnsureCapacity(v, length);
+}
+
+bool VectorPushMany(Vector *v, void* values, unsigned int count) {
+    if (v == NULL) return false;
+    if (count < 1) return true;
+    if (v->_contiguous) {
+        if (v->_baseOffset + v->_elementCount + count > v->_flatCapacity) {
+            if (!ContiguousEnsureCapacity(v, v->_elementCount + count)) return false;
+        }
+        if (v->_contiguous) { // might have been promoted to chunks
+            writeValue(v->_flatData, v->ElementByteSize * (v->_baseOffset + v->_elementCount), values, v->ElementByteSize * count);
+            v->_elementCount += count;
+            return true;
+        }
+    }
+    // Chunked: push the first value of each run normally (which finds or adds the chunk), then copy the rest of the run in after it
+    auto size = v->ElementByteSize;
+    unsigned int i = 0;
+    while (i < count) {
+        if (!VectorPush(v, byteOffset(values, i * size))) return false;
+        i++;
+
+        unsigned int entryIdx = (v->_elementCount - 1 + v->_baseOffset) % v->ElemsPerChunk;
+        unsigned int run = v->ElemsPerChunk - 1 - entryIdx;
+        if (run > count - i) run = count - i;
+        if (run < 1) continue;
+
+        auto last = PtrOfElem(v, v->_elementCount - 1);
+        if (last == NULL) return false;
+        writeValue(last, size, byteOffset(values, i * size), size * run);
+        v->_elementCount += run;
+        i += run;
+    }
+    return true;
+}
+
 // Free cache memory
 void VectorFreeCache(Vector* v, void* cache) {
     VecFree(v, cache);
@@ -470,6 +676,13 @@ void* VectorCacheRange(Vector* v, int* lowIndex, int* highIndex) {
 
     auto requiredElems = ((*highIndex) - (*lowIndex)) + 1;
 
+    if (v->_contiguous) { // already in one block, so just copy
+        auto block = VecAlloc(v, v->ElementByteSize * requiredElems);
+        if (block == NULL) return NULL;
+        writeValue(block, 0, PtrOfElem(v, *lowIndex), v->ElementByteSize * requiredElems);
+        return block;
+    }
+
     // get offsets for optimisations
     auto maxIdx = v->ElemsPerChunk;
     uint32_t index = ((*lowIndex) + v->_baseOffset) % v->ElemsPerChunk;
@@ -518,6 +731,16 @@ bool VectorDequeue(Vector * v, void * outValue) {
     if (!v->IsValid) return false;
     if (v->_elementCount < 1) return false;
 
+    if (v->_contiguous) {
+        if (outValue != NULL) {
+            writeValue(outValue, 0, v->_flatData + (v->_baseOffset * v->ElementByteSize), v->ElementByteSize);
+        }
+        v->_baseOffset++;
+        v->_elementCount--;
+        if (v->_elementCount == 0) v->_baseOffset = 0; // emptied: reset to start of block
+        return true;
+    }
+
     // read the element at index `_baseOffset`, then increment `_baseOffset`.
     if (outValue != NULL) {
         auto ptr = byteOffset(v->_baseChunkTable, PTR_SIZE + (v->_baseOffset * v->ElementByteSize));
@@ -545,23 +768,11 @@ bool VectorDequeue(Vector * v, void * outValue) {
 
     if (v->_skipTable == NULL) return true; // don't need to fix the table
 
-    // Make a truncated version of the skip table
-    v->_skipEntries--;
-    if (v->_skipEntries < 4) { // no point having a table
-        VecFree(v, v->_skipTable);
-        v->_skipEntries = 0;
-        v->_skipTable = NULL;
-        return true;
-    }
-    // Copy of the skip table with first element gone
-    uint length = SKIP_ELEM_SIZE * v->_skipEntries;
-    auto newTablePtr = (char*)VecAlloc(v, length);
-    auto oldTablePtr = (char*)v->_skipTable;
-    for (uint i = 0; i < length; i++) {
-        newTablePtr[i] = oldTablePtr[i + SKIP_ELEM_SIZE];
-    }
-    v->_skipTable = newTablePtr;
-    VecFree(v, oldTablePtr);
+    // Every chunk index has moved down, and the first entry is gone. Drop the table, and build a new one when it's next needed.
+    VecFree(v, v->_skipTable);
+    v->_skipEntries = 0;
+    v->_skipTable = NULL;
+    v->_skipTableDirty = true;
 
     return true;
 }
@@ -570,6 +781,16 @@ bool VectorPop(Vector *v, void *target) {
     if (v == NULL || v->_elementCount == 0) return false;
 
     var index = v->_elementCount - 1;
+
+    if (v->_contiguous) {
+        if (target != NULL) {
+            writeValue(target, 0, v->_flatData + (v->ElementByteSize * (index + v->_baseOffset)), v->ElementByteSize);
+        }
+        v->_elementCount--;
+        if (v->_elementCount == 0) v->_baseOffset = 0;
+        return true;
+    }
+
     var entryIdx = (index + v->_baseOffset) % v->ElemsPerChunk;
 
     // Get the value
@@ -614,6 +835,13 @@ bool VectorPeek(Vector *v, void* target) {
     if (v->_elementCount == 0) return false;
 
     var index = v->_elementCount - 1;
+
+    if (v->_contiguous) {
+        if (target != NULL) {
+            writeValue(target, 0, v->_flatData + (v->ElementByteSize * (index + v->_baseOffset)), v->ElementByteSize);
+        }
+        return true;
+    }
     var entryIdx = (index + v->_baseOffset) % v->ElemsPerChunk;
 
     // Get the value
@@ -642,7 +870,21 @@ bool VectorPrealloc(Vector *v, unsigned int length) {
     var remain = length - v->_elementCount;
     if (remain < 1) return true;
 
-    var newChunkIdx = length / v->ElemsPerChunk;
+    if (v->_contiguous) {
+        if (!ContiguousEnsureCapacity(v, length)) return false;
+    }
+    if (v->_contiguous) { // zero out the new elements
+        auto size = v->ElementByteSize;
+        auto start = v->_flatData + (size * (v->_baseOffset + v->_elementCount));
+        auto bytes = size * (length - v->_elementCount);
+        for (uint i = 0; i < bytes; i++) { start[i] = 0; }
+        v->_elementCount = length;
+        return true;
+    }
+
+    // Index of the chunk holding the last element. An exact multiple of the chunk size must not get an extra, empty chunk,
+    // or the end chunk pointer would be past the last element, and the next push or pop would lose a chunk.
+    var newChunkIdx = (length + v->_baseOffset - 1) / v->ElemsPerChunk;
 
     // Walk through the chunk chain, adding where needed
     var chunkHeadPtr = v->_baseChunkTable;
@@ -826,6 +1068,99 @@ void VectorSort(Vector *v, int(*compareFunc)(void* A, void* B)) {
     VecFree(v, arr2);
 }
 
+// Largest scratch array used by `VectorSortRuns`. Two of these are needed at once.
+const int SORT_RUN_BYTES = 16384;
+
+// Merge two sorted vectors into a new one, emptying both. `headL` and `headR` are element-sized scratch space.
+Vector* MergeSortedRuns(Vector* left, Vector* right, void* headL, void* headR, int(*compareFunc)(void* A, void* B)) {
+    auto result = VectorAllocateArena(left->_arena, left->ElementByteSize);
+    if (!VectorIsValid(result)) return NULL;
+
+    bool hasL = VectorDequeue(left, headL);
+    bool hasR = VectorDequeue(right, headR);
+    while (hasL && hasR) {
+        if (compareFunc(headR, headL) < 0) { // take from the left on ties, to keep the sort stable
+            VectorPush(result, headR);
+            hasR = VectorDequeue(right, headR);
+        } else {
+            VectorPush(result, headL);
+            hasL = VectorDequeue(left, headL);
+        }
+    }
+    while (hasL) { VectorPush(result, headL); hasL = VectorDequeue(left, headL); }
+    while (hasR) { VectorPush(result, headR); hasR = VectorDequeue(right, headR); }
+    return result;
+}
+
+bool VectorSortRuns(Vector *v, void*(*arraySort)(void* arr1, void* arr2, int n), int(*compareFunc)(void* A, void* B)) {
+    if (v == NULL || arraySort == NULL || compareFunc == NULL) return false;
+    int n = v->_elementCount;
+    if (n < 2) return true;
+    auto size = v->ElementByteSize;
+
+    // Contiguous vectors are sorted in place if we can get a scratch block big enough
+    if (v->_contiguous && n * size <= ARENA_SIZE) {
+        void* base = v->_flatData + (size * v->_baseOffset);
+        void* tmp = VecAlloc(v, n * size);
+        if (tmp != NULL) {
+            auto result = arraySort(base, tmp, n);
+            if (result != base) writeValue(base, 0, result, n * size);
+            VecFree(v, tmp);
+            return true;
+        }
+    }
+
+    // Otherwise, empty the vector in runs, sorting each with the kernel...
+    int runElems = SORT_RUN_BYTES / size;
+    if (runElems < 2) runElems = 2;
+    void* arr1 = VecAlloc(v, runElems * size);
+    void* arr2 = VecAlloc(v, runElems * size);
+    auto runs = VectorAllocateArena(v->_arena, sizeof(Vector*));
+    if (arr1 == NULL || arr2 == NULL || !VectorIsValid(runs)) {
+        if (arr1 != NULL) VecFree(v, arr1);
+        if (arr2 != NULL) VecFree(v, arr2);
+        VectorDeallocate(runs);
+        return false;
+    }
+
+    while (v->_elementCount > 0) {
+        int count = 0;
+        while (count < runElems && VectorDequeue(v, byteOffset(arr1, count * size))) { count++; }
+
+        auto sorted = arraySort(arr1, arr2, count);
+        auto run = VectorAllocateArena(v->_arena, size);
+        for (int i = 0; i < count; i++) { VectorPush(run, byteOffset(sorted, i * size)); }
+        VectorPush(runs, &run);
+    }
+
+    // ...then merge pairs of runs until only one is left. Runs are kept in order for stability.
+    Vector *left = NULL, *right = NULL;
+    while (VectorLength(runs) > 1) {
+        auto merged = VectorAllocateArena(v->_arena, sizeof(Vector*));
+        while (VectorDequeue(runs, &left)) {
+            if (!VectorDequeue(runs, &right)) { VectorPush(merged, &left); break; } // odd one out
+            auto result = MergeSortedRuns(left, right, arr1, arr2, compareFunc);
+            VectorDeallocate(left);
+            VectorDeallocate(right);
+            VectorPush(merged, &result);
+        }
+        VectorDeallocate(runs);
+        runs = merged;
+    }
+
+    // Refill the original vector
+    bool ok = VectorDequeue(runs, &left) && left != NULL;
+    if (ok) {
+        while (VectorDequeue(left, arr1)) { VectorPush(v, arr1); }
+        VectorDeallocate(left);
+    }
+
+    VectorDeallocate(runs);
+    VecFree(v, arr1);
+    VecFree(v, arr2);
+    return ok;
+}
+
 Arena* VectorArena(Vector *v) {
     return v->_arena;
 }
@@ -838,7 +1173,7 @@ Vector* VectorClone(Vector* source, Arena* a) {
 
     auto len = VectorLength(source);
     auto elemSize = VectorElementSize(source);
-    auto result = VectorAllocateArena(a, elemSize);
+    auto result = VectorAllocateInternal(a, elemSize, source->_contiguous);
     VectorPrealloc(result, len);
     for (size_t i = 0; i < len; i++) {
         var src = PtrOfElem(source, i);
@@ -13,6 +13,20 @@ typedef Vector* VectorPtr;
 Vector *VectorAllocate(int elementSize);
 // Create a new dynamic vector with the given element size (must be fixed per vector) in a specific memory arena
 Vector *VectorAllocateArena(Arena* a, int elementSize);
+// Create a new dynamic vector that stores its elements in a single block, for fast indexed access.
+// The block grows by doubling, and the vector switches to chunked storage if it gets too big for one allocation.
+// Pointers returned by `VectorGet` are invalidated when a contiguous vector grows.
+Vector *VectorAllocateContiguous(int elementSize);
+// Create a new contiguous vector (see `VectorAllocateContiguous`) in a specific memory arena
+Vector *VectorAllocateArenaContiguous(Arena* a, int elementSize);
+// Returns true if the vector is currently using contiguous storage
+bool VectorIsContiguous(Vector *v);
+// Pointer to the first element of a contiguous vector, or NULL if the vector is chunked.
+// All elements follow on directly. This is an in-place pointer, and is invalidated by any push.
+void* VectorContiguousData(Vector *v);
+// Pointer to the run of elements that are stored next to `index`, contiguous or not. `outFirst` and `outCount` are set to the
+// range of indexes covered. Returns NULL if `index` is out of range. This is an in-place pointer, and is invalidated by any change.
+void* VectorBlockAt(Vector *v, int index, int* outFirst, int* outCount);
 // Clone a vector into a new arena
 Vector* VectorClone(Vector* source, Arena* a);
 // Check the vector is correctly allocated
@@ -25,6 +39,11 @@ void VectorDeallocate(Vector *v);
 int VectorLength(Vector *v);
 // Push a new value to the end of the vector
 bool VectorPush(Vector *v, void* value);
+// Push `count` values, stored contiguously at `values`, to the end of the vector
+bool VectorPushMany(Vector *v, void* values, unsigned int count);
+// Make room for at least `length` elements in a contiguous vector, without changing its contents.
+// Chunked vectors are not changed. Returns false if allocation failed.
+bool VectorReserve(Vector *v, unsigned int length);
 // Get a pointer to an element in the vector. This is an in-place pointer -- no copy is made
 void* VectorGet(Vector *v, int index);
 // Copy data from an element in the vector to a pointer
@@ -49,6 +68,10 @@ bool VectorReverse(Vector *v);
 // Sort the vector in-place using the given compare function.
 // Compare should return 0 if the two values are equal, negative if A should be before B, and positive if B should be before A.
 void VectorSort(Vector *v, int(*compareFunc)(void* A, void* B));
+// Sort the vector in-place using a typed array kernel from Sort.h.
+// The vector is sorted in runs that fit a single arena allocation, then the runs are merged with `compareFunc`,
+// which must give the same order as the kernel. Returns false if scratch memory could not be allocated.
+bool VectorSortRuns(Vector *v, void*(*arraySort)(void* arr1, void* arr2, int n), int(*compareFunc)(void* A, void* B));
 
 // Read a range of the vector into a contiguous array
 // this is for optimising multiple local accesses in algorithms.
@@ -83,11 +106,14 @@ void* IterativeMergeSort(void* arr1, void* arr2, int n, int elemSize, int(*compa
     inline bool nameSpace##Swap(Vector *v, unsigned int index1, unsigned int index2){ return VectorSwap(v, index1, index2); }\
     inline void nameSpace##FreeCache(Vector *v, void *c) { VectorFreeCache(v, c); }\
     inline void nameSpace##Clear(Vector *v) { VectorClear(v); }\
+    inline bool nameSpace##IsContiguous(Vector *v) { return VectorIsContiguous(v); }\
 
 // These must be registered for each type, as they are type variant
 #define RegisterVectorFor(typeName, nameSpace) \
     inline Vector* nameSpace##Allocate_##typeName(){ return VectorAllocate(sizeof(typeName)); } \
     inline Vector* nameSpace##AllocateArena_##typeName(Arena* a){ return VectorAllocateArena(a, sizeof(typeName)); } \
+    inline Vector* nameSpace##AllocateContiguous_##typeName(){ return VectorAllocateContiguous(sizeof(typeName)); } \
+    inline Vector* nameSpace##AllocateArenaContiguous_##typeName(Arena* a){ return VectorAllocateArenaContiguous(a, sizeof(typeName)); } \
     inline bool nameSpace##Push_##typeName(Vector *v, typeName value){ return VectorPush(v, (void*)&value); } \
     inline typeName * nameSpace##Get_##typeName(Vector *v, int index){ return (typeName*)VectorGet(v, index); } \
     inline bool nameSpace##Copy_##typeName(Vector *v, unsigned int idx, typeName *target){ return VectorCopy(v, idx, (void*) target); } \
@@ -96,6 +122,7 @@ void* IterativeMergeSort(void* arr1, void* arr2, int n, int elemSize, int(*compa
     inline bool nameSpace##Set_##typeName(Vector *v, int index, typeName element, typeName* prevValue){ return VectorSet(v, index, &element, (void*)prevValue); } \
     inline bool nameSpace##Dequeue_##typeName(Vector *v, typeName* outValue) { return VectorDequeue(v, (void*)outValue);}\
     inline void nameSpace##Sort_##typeName(Vector *v, int(*compareFunc)(typeName* A, typeName* B)) {VectorSort(v, (int(*)(void* A, void* B))compareFunc);}\
+    inline bool nameSpace##SortRuns_##typeName(Vector *v, typeName*(*arraySort)(typeName* arr1, typeName* arr2, int n), int(*compareFunc)(typeName* A, typeName* B)) {return VectorSortRuns(v, (void*(*)(void* arr1, void* arr2, int n))arraySort, (int(*)(void* A, void* B))compareFunc);}\
     inline typeName* nameSpace##CacheRange_##typeName(Vector* v, int* lowIndex, int* highIndex) {return (typeName*)VectorCacheRange(v, lowIndex, highIndex);}\
 
 